@@ -24,9 +24,17 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
 #include <dirent.h>
 #include <dlfcn.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <pthread.h>
 #include <string.h>
+#include <unistd.h>
 #include <openssl/crypto.h>
 #include <openssl/engine.h>
 #include <openssl/evp.h>
@@ -34,6 +42,13 @@
 #include <openssl/sha.h>
 #include <openssl/obj_mac.h>
 #include <openssl/aes.h>
+#include <openssl/tls1.h>
+#ifndef OPENSSL_NO_CMAC
+#include <openssl/cmac.h>
+#endif
+#ifndef OPENSSL_NO_HMAC
+#include <openssl/hmac.h>
+#endif
 
 #ifndef OPENSSL_NO_HW
 #ifndef OPENSSL_NO_HW_IBMCA
@@ -44,6 +59,9 @@
 
 #include <ica_api.h>
 #include "e_ibmca_err.h"
+#include "e_ibmca_caps.h"
+#include "e_ibmca_stats.h"
+#include "e_ibmca_tune.h"
 
 #define IBMCA_LIB_NAME "ibmca engine"
 #define LIBICA_SHARED_LIB "libica.so"
@@ -57,6 +75,14 @@
  #define EVP_CIPHER_CTX_iv_noconst(ctx)		((ctx)->iv)
  #define EVP_CIPHER_CTX_encrypting(ctx)		((ctx)->encrypt)
  #define EVP_CIPHER_CTX_buf_noconst(ctx)	((ctx)->buf)
+ #define EVP_CIPHER_CTX_num(ctx)		((ctx)->num)
+ #define EVP_CIPHER_CTX_set_num(ctx, n)		((ctx)->num = (n))
+ typedef pthread_once_t CRYPTO_ONCE;
+ #define CRYPTO_ONCE_STATIC_INIT		PTHREAD_ONCE_INIT
+ #define CRYPTO_THREAD_run_once(once, init)	(pthread_once(once, init) == 0)
+ #define EVP_MD_CTX_set_update_fn(ctx, fn)	((ctx)->update = (fn))
+ #define EVP_MD_CTX_pkey_ctx(ctx)		((ctx)->pctx)
+ #define OPENSSL_hexstr2buf(str, len)		string_to_hex((str), (len))
 #else
  #define EVP_CTRL_GCM_SET_IVLEN			EVP_CTRL_AEAD_SET_IVLEN
  #define EVP_CTRL_GCM_SET_TAG			EVP_CTRL_AEAD_SET_TAG
@@ -70,27 +96,134 @@
   #define OPENSSL_NO_AES_GCM
  #endif
 #endif
+#if !defined(NID_aes_128_ccm) || \
+    !defined(NID_aes_192_ccm) || \
+    !defined(NID_aes_256_ccm)
+ #ifndef OPENSSL_NO_AES_CCM
+  #define OPENSSL_NO_AES_CCM
+ #endif
+#endif
+#if !defined(NID_aes_128_cbc_hmac_sha1) || \
+    !defined(NID_aes_256_cbc_hmac_sha256) || \
+    !defined(EVP_CIPH_FLAG_TLS1_1_MULTIBLOCK)
+ #ifndef OPENSSL_NO_AES_CBC_HMAC
+  #define OPENSSL_NO_AES_CBC_HMAC
+ #endif
+#endif
 #ifndef EVP_AEAD_TLS1_AAD_LEN
  #define EVP_AEAD_TLS1_AAD_LEN			13
 #endif
+#ifndef EVP_CCM_TLS_FIXED_IV_LEN
+ #define EVP_CTRL_CCM_SET_IV_FIXED		EVP_CTRL_GCM_SET_IV_FIXED
+ #define EVP_CCM_TLS_FIXED_IV_LEN		4
+ #define EVP_CCM_TLS_EXPLICIT_IV_LEN		8
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+ #define IBMCA_PKEY_CTX_CONST			const
+#else
+ #define IBMCA_PKEY_CTX_CONST
+#endif
 #ifndef EVP_MD_FLAG_PKEY_METHOD_SIGNATURE
  #define EVP_MD_FLAG_PKEY_METHOD_SIGNATURE	0
 #endif
+#ifndef EVP_CIPH_FLAG_PIPELINE
+ #define EVP_CIPH_FLAG_PIPELINE			0
+ #define EVP_CTRL_SET_PIPELINE_OUTPUT_BUFS	0x22
+ #define EVP_CTRL_SET_PIPELINE_INPUT_BUFS	0x23
+ #define EVP_CTRL_SET_PIPELINE_INPUT_LENS	0x24
+#endif
+#define IBMCA_MAX_PIPELINES			32	/* SSL_MAX_PIPELINES */
+
+/*
+ * Requests of a cipher or digest below its crossover (SW_CROSSOVER ctrl,
+ * in bytes) are done by OpenSSL's own code, where the libica call costs
+ * more than it saves. Ciphers decide per request, digests once per
+ * context on their first update.
+ */
+#define IBMCA_ROUTE_UNSET	0
+#define IBMCA_ROUTE_HW		1
+#define IBMCA_ROUTE_SW		2
+
+/*
+ * libica takes the length of ECB, CBC and SHA requests as unsigned int.
+ * Longer ones are passed on in chunks of IBMCA_CHUNK bytes, a multiple of
+ * every block size, with IV and hash state carried from one to the next.
+ */
+#define IBMCA_CHUNK	((size_t)1 << 30)
+
+/* NIDs of all algorithms ibmca provides are below this bound */
+#define IBMCA_NID_MAX	1024
+
+static unsigned int ibmca_crossover[IBMCA_NID_MAX];
+
+/*
+ * CALIBRATE forces the route of its own threads only, see
+ * ibmca_route_force(). ibmca_route_forcing counts those threads, so that
+ * other requests do not look at the thread-local variable.
+ */
+static unsigned int ibmca_route_forcing;
+static __thread int ibmca_route_forced;
+static __thread int ibmca_rsa_me_forced;
+
+static inline int ibmca_route(int nid, size_t len)
+{
+	if (__atomic_load_n(&ibmca_route_forcing, __ATOMIC_RELAXED)
+	    && ibmca_route_forced != IBMCA_ROUTE_UNSET)
+		return ibmca_route_forced;
+	if (nid > 0 && nid < IBMCA_NID_MAX
+	    && len < __atomic_load_n(&ibmca_crossover[nid], __ATOMIC_RELAXED))
+		return IBMCA_ROUTE_SW;
+	return IBMCA_ROUTE_HW;
+}
+
+/*
+ * Handler of a DES, TDES or AES context for its key length, mode and
+ * direction. ibmca_init_key() stores the handlers of the key length first
+ * in the context; ibmca_cipher() picks mode and direction per call, since
+ * EVP_CipherInit_ex() may flip the direction without setting a key.
+ */
+typedef int (*ibmca_cipher_fn)(EVP_CIPHER_CTX *ctx, unsigned char *out,
+			       const unsigned char *in, size_t len);
+struct ibmca_cipher_fns;
+
+/*
+ * Records handed over with the EVP_CTRL_SET_PIPELINE_* controls. The next
+ * cipher call does all of them in turn and clears the pipeline again.
+ */
+struct ibmca_pipeline {
+	unsigned int n;
+	unsigned char **out;
+	unsigned char **in;
+	size_t *len;
+};
 
 typedef struct ibmca_des_context {
+	const struct ibmca_cipher_fns *fns;	/* NULL until a key is set */
 	unsigned char key[sizeof(ica_des_key_triple_t)];
 } ICA_DES_CTX;
 
 typedef struct ibmca_aes_128_context {
+	const struct ibmca_cipher_fns *fns;	/* NULL until a key is set */
 	unsigned char key[sizeof(ica_aes_key_len_128_t)];
+	AES_KEY sw_key;		/* for requests below the crossover */
+	int sw_key_dir;		/* AES_ENCRYPT/AES_DECRYPT + 1, 0 if unset */
+	struct ibmca_pipeline pipe;
 } ICA_AES_128_CTX;
 
 typedef struct ibmca_aes_192_context {
+	const struct ibmca_cipher_fns *fns;	/* NULL until a key is set */
 	unsigned char key[sizeof(ica_aes_key_len_192_t)];
+	AES_KEY sw_key;		/* for requests below the crossover */
+	int sw_key_dir;		/* AES_ENCRYPT/AES_DECRYPT + 1, 0 if unset */
+	struct ibmca_pipeline pipe;
 } ICA_AES_192_CTX;
 
 typedef struct ibmca_aes_256_context {
+	const struct ibmca_cipher_fns *fns;	/* NULL until a key is set */
 	unsigned char key[sizeof(ica_aes_key_len_256_t)];
+	AES_KEY sw_key;		/* for requests below the crossover */
+	int sw_key_dir;		/* AES_ENCRYPT/AES_DECRYPT + 1, 0 if unset */
+	struct ibmca_pipeline pipe;
 } ICA_AES_256_CTX;
 
 typedef struct ibmca_aes_gcm_context {
@@ -111,14 +244,135 @@ typedef struct ibmca_aes_gcm_context {
 	int iv_gen;
 	int tls_aadlen;
 
+	/* AAD of each record of a pipelined TLS call */
+	struct ibmca_pipeline pipe;
+	unsigned char tls_aad[IBMCA_MAX_PIPELINES][EVP_AEAD_TLS1_AAD_LEN];
+	unsigned int tls_aadcnt;
 } ICA_AES_GCM_CTX;
 
+/*
+ * libica does CCM in one call, so the AAD is collected here until the
+ * payload arrives. The nonce (15 - L bytes) is kept in the EVP IV.
+ */
+typedef struct ibmca_aes_ccm_context {
+	unsigned char key[32];
+	int key_set;
+	int iv_set;
+	int tag_set;
+	int len_set;
+	int L;			/* size of the length field */
+	int M;			/* tag length */
+	unsigned char tag[16];
+	size_t msglen;
+	unsigned char *aad;
+	size_t aadlen;
+	int tls_aadlen;
+} ICA_AES_CCM_CTX;
+
+typedef struct ibmca_aes_xts_context {
+	unsigned char key1[32];		/* data key */
+	unsigned char key2[32];		/* tweak key */
+	int key_set;
+} ICA_AES_XTS_CTX;
+
+#ifndef OPENSSL_NO_CMAC
+/*
+ * The key of a CMAC context is OpenSSL's CMAC_CTX. When its cipher is
+ * ibmca's AES-CBC or DES-EDE3-CBC, libica computes the MAC with the key
+ * taken from the cipher context, otherwise the CMAC_CTX does.
+ */
+typedef struct ibmca_cmac_ctx {
+	CMAC_CTX *sw;
+	int mech;		/* AES_CMAC, DES3_CMAC, or 0 for software */
+	unsigned int key_len;
+	unsigned int blk;
+	unsigned char key[32];
+	unsigned char iv[AES_BLOCK_SIZE];	/* chaining value */
+	unsigned char tail[AES_BLOCK_SIZE];	/* kept for the last call */
+	unsigned int tail_len;
+} IBMCA_CMAC_CTX;
+#endif
+
+#define IBMCA_HMAC_MAX_BLOCK	128
+
+typedef union ibmca_sha_state {
+	sha_context_t sha1;
+	sha256_context_t sha256;
+	sha512_context_t sha512;
+} ibmca_sha_state;
+
+/* HMAC with one of libica's SHA digests, see ibmca_hmac_pads() */
+struct ibmca_hmac_state {
+	int nid;
+	unsigned int blk;
+	unsigned int size;	/* of the digest */
+	ibmca_sha_state ipad;	/* after the key ^ ipad block */
+	ibmca_sha_state opad;	/* after the key ^ opad block */
+	ibmca_sha_state c;	/* inner hash of the message so far */
+	unsigned char tail[IBMCA_HMAC_MAX_BLOCK];
+	unsigned int tail_len;
+};
+
+#ifndef OPENSSL_NO_AES_CBC_HMAC
+/*
+ * AES-CBC-HMAC-SHA1/SHA256, the "stitched" ciphers of the TLS 1.0-1.2
+ * CBC suites. libssl sets the MAC key with EVP_CTRL_AEAD_SET_MAC_KEY and
+ * hands over the header of each record with EVP_CTRL_AEAD_TLS1_AAD; the
+ * cipher then adds, or checks and strips, MAC and padding itself.
+ */
+typedef struct ibmca_aes_hmac_context {
+	unsigned char key[32];
+	struct ibmca_hmac_state mac;
+	size_t payload_length;	/* IBMCA_NO_PAYLOAD_LENGTH outside of TLS */
+	unsigned char tls_aad[EVP_AEAD_TLS1_AAD_LEN];
+	unsigned int tls_ver;
+} ICA_AES_HMAC_CTX;
+#endif
+
+#ifndef OPENSSL_NO_HMAC
+/*
+ * The ipad and opad states of recently used keys. EVP_DigestSignInit()
+ * gives every MAC a new pkey context, so they are kept here rather than
+ * in the context. The slot follows the address of the key object and is
+ * only used if it holds the same digest and key bytes; keys longer than a
+ * block are not kept. If the lock is busy the states are computed again
+ * instead of waiting for it.
+ */
+#define IBMCA_HMAC_CACHE	64
+
+struct ibmca_hmac_key {
+	int keylen;
+	unsigned char key[IBMCA_HMAC_MAX_BLOCK];
+	struct ibmca_hmac_state st;	/* st.nid is 0 for an unused slot */
+};
+
+static struct ibmca_hmac_key ibmca_hmac_cache[IBMCA_HMAC_CACHE];
+static pthread_mutex_t ibmca_hmac_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * HMAC keys are an ASN1_OCTET_STRING, as for OpenSSL's own HMAC method.
+ * With SHA-1, SHA-256 and SHA-512 the libica states after the ipad and
+ * the opad block are taken from ibmca_hmac_cache when the digest is
+ * initialised with a key seen before, and are copied along with the
+ * context. Other digests are left to the HMAC_CTX.
+ */
+typedef struct ibmca_hmac_ctx {
+	const EVP_MD *md;
+	ASN1_OCTET_STRING ktmp;		/* key for EVP_PKEY_keygen() */
+	HMAC_CTX *sw;
+	int route;
+	struct ibmca_hmac_state hw;
+} IBMCA_HMAC_CTX;
+#endif
+
 #ifndef OPENSSL_NO_SHA1
 #define SHA_BLOCK_SIZE 64
 typedef struct ibmca_sha1_ctx {
 	sha_context_t c;
 	unsigned char tail[SHA_BLOCK_SIZE];
 	unsigned int tail_len;
+	int route;
+	SHA_CTX sw;
 } IBMCA_SHA_CTX;
 #endif
 
@@ -128,6 +382,8 @@ typedef struct ibmca_sha256_ctx {
 	sha256_context_t c;
 	unsigned char tail[SHA256_BLOCK_SIZE];
 	unsigned int tail_len;
+	int route;
+	SHA256_CTX sw;
 } IBMCA_SHA256_CTX;
 #endif
 
@@ -137,10 +393,25 @@ typedef struct ibmca_sha512_ctx {
 	sha512_context_t c;
 	unsigned char tail[SHA512_BLOCK_SIZE];
 	unsigned int tail_len;
+	int route;
+	SHA512_CTX sw;
 } IBMCA_SHA512_CTX;
 #endif
 
-static const char *LIBICA_NAME = "ica";
+static const char *LIBICA_NAME = LIBICA_SHARED_LIB;
+static char libica_path[PATH_MAX];
+static char stats_dump_path[PATH_MAX];
+static char caps_cache_path[PATH_MAX];
+static char ap_path[PATH_MAX] = AP_PATH;
+/* seconds between rescans of the crypto cards, 0 for no card watcher */
+static long card_watch_interval;
+/* patterns of the ciphers and digests to offer, and not to offer */
+static char algos_enabled[1024];
+static char algos_disabled[1024];
+/* adapter handles to open for RSA, DSA and DH */
+static long adapter_handles = 1;
+/* worker threads CALIBRATE measures with */
+static long calibrate_threads = 1;
 
 #if defined(NID_aes_128_cfb128) && ! defined (NID_aes_128_cfb)
 #define NID_aes_128_cfb NID_aes_128_cfb128
@@ -208,6 +479,11 @@ static int ibmca_crypto_algos[] = {
         AES_CBC,
         AES_OFB,
         AES_CFB,
+	AES_CTR,
+	AES_XTS,
+	AES_CCM,
+	AES_CMAC,
+	DES3_CMAC,
 	AES_GCM_KMA,
         0
 };
@@ -217,11 +493,19 @@ static int ibmca_crypto_algos[] = {
 /*
  * This struct maps one NID to one crypto algo.
  * So we can tell OpenSSL thsi NID maps to this function.
+ * by_nid is indexed by NID and holds the index into nids and
+ * crypto_meths plus one, 0 for NIDs that are not supported. It is
+ * built once the lists are complete and only read afterwards, so the
+ * ENGINE callbacks find the method without a search. NIDs created at
+ * run time (e.g. for DES-EDE3-CTR) are beyond by_nid and searched for
+ * in the first count entries.
  */
 struct crypto_pair
 {
         int nids[MAX_CIPHER_NIDS];
         const void *crypto_meths[MAX_CIPHER_NIDS];
+        unsigned char by_nid[IBMCA_NID_MAX];
+        size_t count;
 };
 
 /* We can not say how much crypto algos are
@@ -233,17 +517,29 @@ struct crypto_pair
  */
 static size_t size_cipher_list = 0;
 static size_t size_digest_list = 0;
+static size_t size_pkey_list = 0;
 
 static struct crypto_pair ibmca_cipher_lists;
 static struct crypto_pair ibmca_digest_lists;
+static struct crypto_pair ibmca_pkey_lists;
 
 
 static int ibmca_destroy(ENGINE * e);
 static int ibmca_init(ENGINE * e);
 static int ibmca_finish(ENGINE * e);
 static int ibmca_ctrl(ENGINE * e, int cmd, long i, void *p, void (*f) ());
+static void ibmca_atfork_child(void);
 
-static ica_adapter_handle_t ibmca_handle = 0;
+/*
+ * RSA, DSA and DH requests of different threads go through different
+ * adapter handles, so they do not queue up on a single file descriptor.
+ * Threads are given a handle round-robin on their first request.
+ */
+#define IBMCA_MAX_HANDLES	256
+static ica_adapter_handle_t ibmca_handles[IBMCA_MAX_HANDLES];
+static unsigned int ibmca_handle_count;
+static unsigned int ibmca_handle_next;
+static __thread unsigned int ibmca_handle_tls;	/* slot + 1, 0 if none yet */
 
 /* BIGNUM stuff */
 static int ibmca_mod_exp(BIGNUM * r, const BIGNUM * a, const BIGNUM * p,
@@ -302,30 +598,48 @@ static int ibmca_rand_bytes(unsigned char *buf, int num);
 static int ibmca_rand_status(void);
 
 /* DES, TDES, AES declarations */
-static int ibmca_usable_ciphers(const int **nids);
-
 static int ibmca_engine_ciphers(ENGINE * e, const EVP_CIPHER ** cipher,
 				const int **nids, int nid);
 
-static int ibmca_init_key(EVP_CIPHER_CTX * ctx, const unsigned char *key,
-			  const unsigned char *iv, int enc);
-
-static int ibmca_des_cipher(EVP_CIPHER_CTX * ctx, unsigned char *out,
-			    const unsigned char *in, size_t inlen);
-
-static int ibmca_tdes_cipher(EVP_CIPHER_CTX * ctx, unsigned char *out,
-			     const unsigned char *in, size_t inlen);
+static int ibmca_des_init_key(EVP_CIPHER_CTX *ctx, const unsigned char *key,
+			      const unsigned char *iv, int enc);
+static int ibmca_tdes_init_key(EVP_CIPHER_CTX *ctx, const unsigned char *key,
+			       const unsigned char *iv, int enc);
+static int ibmca_aes_128_init_key(EVP_CIPHER_CTX *ctx,
+				  const unsigned char *key,
+				  const unsigned char *iv, int enc);
+static int ibmca_aes_192_init_key(EVP_CIPHER_CTX *ctx,
+				  const unsigned char *key,
+				  const unsigned char *iv, int enc);
+static int ibmca_aes_256_init_key(EVP_CIPHER_CTX *ctx,
+				  const unsigned char *key,
+				  const unsigned char *iv, int enc);
+
+static int ibmca_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+			const unsigned char *in, size_t inlen);
 
-static int ibmca_aes_128_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
-				const unsigned char *in, size_t inlen);
+static int ibmca_cipher_cleanup(EVP_CIPHER_CTX * ctx);
 
-static int ibmca_aes_192_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
-				const unsigned char *in, size_t inlen);
+static int ibmca_aes_cbc_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+				const unsigned char *in, size_t len);
+static int ibmca_aes_cbc_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg,
+			      void *ptr);
 
-static int ibmca_aes_256_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
-				const unsigned char *in, size_t inlen);
+static int ibmca_aes_xts_init_key(EVP_CIPHER_CTX *ctx,
+				  const unsigned char *key,
+				  const unsigned char *iv, int enc);
+static int ibmca_aes_xts_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+				const unsigned char *in, size_t len);
 
-static int ibmca_cipher_cleanup(EVP_CIPHER_CTX * ctx);
+#ifndef OPENSSL_NO_AES_CBC_HMAC
+static int ibmca_aes_hmac_init_key(EVP_CIPHER_CTX *ctx,
+				   const unsigned char *key,
+				   const unsigned char *iv, int enc);
+static int ibmca_aes_hmac_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+				 const unsigned char *in, size_t len);
+static int ibmca_aes_hmac_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg,
+			       void *ptr);
+#endif
 
 #ifndef OPENSSL_NO_AES_GCM
 static int ibmca_aes_gcm_init_key(EVP_CIPHER_CTX *ctx,
@@ -346,9 +660,35 @@ static int ibmca_gcm_tag(EVP_CIPHER_CTX *ctx, unsigned char *out,
 			 const unsigned char *in, int taglen);
 #endif
 
-/* Sha1 stuff */
-static int ibmca_usable_digests(const int **nids);
+#ifndef OPENSSL_NO_AES_CCM
+static int ibmca_aes_ccm_init_key(EVP_CIPHER_CTX *ctx,
+				  const unsigned char *key,
+				  const unsigned char *iv, int enc);
+static int ibmca_aes_ccm_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+				const unsigned char *in, size_t len);
+static int ibmca_aes_ccm_cleanup(EVP_CIPHER_CTX *ctx);
+static int ibmca_aes_ccm_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg,
+			      void *ptr);
+#endif
+
+/* CMAC and HMAC */
+static int ibmca_engine_pkey_meths(ENGINE *e, EVP_PKEY_METHOD **pmeth,
+				   const int **nids, int nid);
+
+#ifndef OPENSSL_NO_CMAC
+static EVP_PKEY_METHOD *ibmca_cmac_pmeth;
+
+static EVP_PKEY_METHOD *ibmca_cmac_meth_new(void);
+#endif
+
+#ifndef OPENSSL_NO_HMAC
+static EVP_PKEY_METHOD *ibmca_hmac_pmeth;
 
+static EVP_PKEY_METHOD *ibmca_hmac_meth_new(void);
+static void ibmca_hmac_cache_clear(void);
+#endif
+
+/* Sha1 stuff */
 static int ibmca_engine_digests(ENGINE * e, const EVP_MD ** digest,
 				const int **nids, int nid);
 
@@ -389,11 +729,76 @@ static int ibmca_sha512_cleanup(EVP_MD_CTX * ctx);
 
 /* The definitions for control commands specific to this engine */
 #define IBMCA_CMD_SO_PATH		ENGINE_CMD_BASE
+#define IBMCA_CMD_GET_STATS		(ENGINE_CMD_BASE + 1)
+#define IBMCA_CMD_GET_LATENCY		(ENGINE_CMD_BASE + 2)
+#define IBMCA_CMD_STATS_DUMP		(ENGINE_CMD_BASE + 3)
+#define IBMCA_CMD_CAPS_CACHE		(ENGINE_CMD_BASE + 4)
+#define IBMCA_CMD_AP_PATH		(ENGINE_CMD_BASE + 5)
+#define IBMCA_CMD_CARD_WATCH		(ENGINE_CMD_BASE + 6)
+#define IBMCA_CMD_ENABLE_ALGORITHMS	(ENGINE_CMD_BASE + 7)
+#define IBMCA_CMD_DISABLE_ALGORITHMS	(ENGINE_CMD_BASE + 8)
+#define IBMCA_CMD_SW_CROSSOVER		(ENGINE_CMD_BASE + 9)
+#define IBMCA_CMD_TUNING_FILE		(ENGINE_CMD_BASE + 10)
+#define IBMCA_CMD_CALIBRATE_THREADS	(ENGINE_CMD_BASE + 11)
+#define IBMCA_CMD_CALIBRATE		(ENGINE_CMD_BASE + 12)
+#define IBMCA_CMD_ADAPTER_HANDLES	(ENGINE_CMD_BASE + 13)
 static const ENGINE_CMD_DEFN ibmca_cmd_defns[] = {
 	{IBMCA_CMD_SO_PATH,
 	 "SO_PATH",
-	 "Specifies the path to the 'atasi' shared library",
+	 "Specifies the path to the 'libica' shared library",
+	 ENGINE_CMD_FLAG_STRING},
+	{IBMCA_CMD_GET_STATS,
+	 "GET_STATS",
+	 "Reports calls, bytes, libica failures and software fallbacks per algorithm",
+	 ENGINE_CMD_FLAG_NO_INPUT},
+	{IBMCA_CMD_GET_LATENCY,
+	 "GET_LATENCY",
+	 "Reports latency histograms of the libica requests per algorithm",
+	 ENGINE_CMD_FLAG_NO_INPUT},
+	{IBMCA_CMD_STATS_DUMP,
+	 "STATS_DUMP",
+	 "Appends statistics and latency histograms to this file ('-' for stderr) at finish",
+	 ENGINE_CMD_FLAG_STRING},
+	{IBMCA_CMD_CAPS_CACHE,
+	 "CAPS_CACHE",
+	 "Keeps the libica capabilities in this file",
+	 ENGINE_CMD_FLAG_STRING},
+	{IBMCA_CMD_AP_PATH,
+	 "AP_PATH",
+	 "Specifies the sysfs directory of the AP bus devices",
+	 ENGINE_CMD_FLAG_STRING},
+	{IBMCA_CMD_CARD_WATCH,
+	 "CARD_WATCH",
+	 "Watches for crypto cards going on- or offline, rescanning at least every N seconds",
+	 ENGINE_CMD_FLAG_NUMERIC},
+	{IBMCA_CMD_ENABLE_ALGORITHMS,
+	 "ENABLE_ALGORITHMS",
+	 "Offers only the ciphers and digests matching this comma separated list of patterns",
+	 ENGINE_CMD_FLAG_STRING},
+	{IBMCA_CMD_DISABLE_ALGORITHMS,
+	 "DISABLE_ALGORITHMS",
+	 "Does not offer the ciphers and digests matching this comma separated list of patterns",
 	 ENGINE_CMD_FLAG_STRING},
+	{IBMCA_CMD_SW_CROSSOVER,
+	 "SW_CROSSOVER",
+	 "Leaves requests below pattern:bytes[,pattern:bytes...] to OpenSSL's software code",
+	 ENGINE_CMD_FLAG_STRING},
+	{IBMCA_CMD_TUNING_FILE,
+	 "TUNING_FILE",
+	 "Applies the crossovers and RSA CRT threshold CALIBRATE wrote to this file",
+	 ENGINE_CMD_FLAG_STRING},
+	{IBMCA_CMD_CALIBRATE_THREADS,
+	 "CALIBRATE_THREADS",
+	 "Specifies the largest number of concurrent requests CALIBRATE measures",
+	 ENGINE_CMD_FLAG_NUMERIC},
+	{IBMCA_CMD_CALIBRATE,
+	 "CALIBRATE",
+	 "Measures libica against OpenSSL's software code and writes a tuning file",
+	 ENGINE_CMD_FLAG_STRING},
+	{IBMCA_CMD_ADAPTER_HANDLES,
+	 "ADAPTER_HANDLES",
+	 "Specifies the number of adapter handles RSA, DSA and DH spread the threads over",
+	 ENGINE_CMD_FLAG_NUMERIC},
 	{0, NULL, NULL, 0}
 };
 
@@ -477,8 +882,8 @@ const EVP_CIPHER ibmca_des_ecb = {
 	sizeof(ica_des_key_single_t), /* key_len */
 	sizeof(ica_des_vector_t),     /* iv_len */
 	EVP_CIPH_ECB_MODE,            /* flags */
-	ibmca_init_key,               /* init */
-	ibmca_des_cipher,             /* do_cipher */
+	ibmca_des_init_key,           /* init */
+	ibmca_cipher,                 /* do_cipher */
 	ibmca_cipher_cleanup,         /* cleanup */
 	sizeof(struct ibmca_des_context), /* ctx_size */
 	EVP_CIPHER_set_asn1_iv,       /* set_asn1_parameters */
@@ -494,8 +899,8 @@ const EVP_CIPHER ibmca_des_cbc = {
 	sizeof(ica_des_key_single_t),
 	sizeof(ica_des_vector_t),
 	EVP_CIPH_CBC_MODE,
-	ibmca_init_key,
-	ibmca_des_cipher,
+	ibmca_des_init_key,
+	ibmca_cipher,
 	ibmca_cipher_cleanup,
 	sizeof(struct ibmca_des_context),
 	EVP_CIPHER_set_asn1_iv,
@@ -511,8 +916,8 @@ const EVP_CIPHER ibmca_des_ofb = {
 	sizeof(ica_des_key_single_t),
 	sizeof(ica_des_vector_t),
 	EVP_CIPH_OFB_MODE,
-	ibmca_init_key, /* XXX check me */
-	ibmca_des_cipher,
+	ibmca_des_init_key, /* XXX check me */
+	ibmca_cipher,
 	ibmca_cipher_cleanup,
 	sizeof(struct ibmca_des_context),
 	EVP_CIPHER_set_asn1_iv,
@@ -528,8 +933,8 @@ const EVP_CIPHER ibmca_des_cfb = {
 	sizeof(ica_des_key_single_t),
 	sizeof(ica_des_vector_t),
 	EVP_CIPH_CFB_MODE,
-	ibmca_init_key, /* XXX check me */
-	ibmca_des_cipher,
+	ibmca_des_init_key, /* XXX check me */
+	ibmca_cipher,
 	ibmca_cipher_cleanup,
 	sizeof(struct ibmca_des_context),
 	EVP_CIPHER_set_asn1_iv,
@@ -542,6 +947,7 @@ const EVP_CIPHER ibmca_des_cfb = {
 #define EVP_CIPHER_block_size_CBC       sizeof(ica_des_vector_t)
 #define EVP_CIPHER_block_size_OFB       1
 #define EVP_CIPHER_block_size_CFB	1
+#define EVP_CIPHER_block_size_CTR	1
 
 #define DECLARE_DES_EVP(lmode,umode)								\
 static EVP_CIPHER *des_##lmode = NULL;								\
@@ -554,8 +960,8 @@ static const EVP_CIPHER *ibmca_des_##lmode(void)						\
 						sizeof(ica_des_key_single_t))) == NULL  	\
 		   || !EVP_CIPHER_meth_set_iv_length(cipher, sizeof(ica_des_vector_t))		\
 		   || !EVP_CIPHER_meth_set_flags(cipher,EVP_CIPH_##umode##_MODE)		\
-		   || !EVP_CIPHER_meth_set_init(cipher, ibmca_init_key)				\
-		   || !EVP_CIPHER_meth_set_do_cipher(cipher, ibmca_des_cipher)			\
+		   || !EVP_CIPHER_meth_set_init(cipher, ibmca_des_init_key)			\
+		   || !EVP_CIPHER_meth_set_do_cipher(cipher, ibmca_cipher)			\
 		   || !EVP_CIPHER_meth_set_cleanup(cipher, ibmca_cipher_cleanup)		\
 		   || !EVP_CIPHER_meth_set_impl_ctx_size(cipher,				\
 							sizeof(struct ibmca_des_context))	\
@@ -581,6 +987,36 @@ DECLARE_DES_EVP(ofb, OFB)
 DECLARE_DES_EVP(cfb, CFB)
 #endif
 
+/*
+ * OpenSSL has no object for TDES in CTR mode. Share the one an
+ * application or another engine created under the same name, or add one
+ * without an OID.
+ */
+#ifndef NID_des_ede3_ctr
+# define SN_des_ede3_ctr	"DES-EDE3-CTR"
+# define LN_des_ede3_ctr	"des-ede3-ctr"
+# define NID_des_ede3_ctr	ibmca_tdes_ctr_nid()
+
+static int ibmca_tdes_ctr_nid(void)
+{
+	static int nid = NID_undef;
+	ASN1_OBJECT *obj;
+
+	if (nid != NID_undef)
+		return nid;
+	nid = OBJ_sn2nid(SN_des_ede3_ctr);
+	if (nid != NID_undef)
+		return nid;
+
+	obj = ASN1_OBJECT_create(OBJ_new_nid(1), NULL, 0, SN_des_ede3_ctr,
+				 LN_des_ede3_ctr);
+	if (obj != NULL)
+		nid = OBJ_add_object(obj);
+	ASN1_OBJECT_free(obj);
+	return nid;
+}
+#endif
+
 #ifdef OLDER_OPENSSL
 /* 3DES ECB EVP	*/
 const EVP_CIPHER ibmca_tdes_ecb = {
@@ -589,8 +1025,8 @@ const EVP_CIPHER ibmca_tdes_ecb = {
 	sizeof(ica_des_key_triple_t),
 	sizeof(ica_des_vector_t),
 	EVP_CIPH_ECB_MODE,
-	ibmca_init_key,
-	ibmca_tdes_cipher,
+	ibmca_tdes_init_key,
+	ibmca_cipher,
 	ibmca_cipher_cleanup,
 	sizeof(struct ibmca_des_context),
 	EVP_CIPHER_set_asn1_iv,
@@ -606,8 +1042,8 @@ const EVP_CIPHER ibmca_tdes_cbc = {
 	sizeof(ica_des_key_triple_t),
 	sizeof(ica_des_vector_t),
 	EVP_CIPH_CBC_MODE,
-	ibmca_init_key,
-	ibmca_tdes_cipher,
+	ibmca_tdes_init_key,
+	ibmca_cipher,
 	ibmca_cipher_cleanup,
 	sizeof(struct ibmca_des_context),
 	EVP_CIPHER_set_asn1_iv,
@@ -623,8 +1059,8 @@ const EVP_CIPHER ibmca_tdes_ofb = {
 	sizeof(ica_des_key_triple_t),
 	sizeof(ica_des_vector_t),
 	EVP_CIPH_OFB_MODE,
-	ibmca_init_key, /* XXX check me */
-	ibmca_tdes_cipher,
+	ibmca_tdes_init_key, /* XXX check me */
+	ibmca_cipher,
 	ibmca_cipher_cleanup,
 	sizeof(struct ibmca_des_context),
 	EVP_CIPHER_set_asn1_iv,
@@ -640,8 +1076,25 @@ const EVP_CIPHER ibmca_tdes_cfb = {
 	sizeof(ica_des_key_triple_t),
 	sizeof(ica_des_vector_t),
 	EVP_CIPH_CFB_MODE,
-	ibmca_init_key, /* XXX check me */
-	ibmca_tdes_cipher,
+	ibmca_tdes_init_key, /* XXX check me */
+	ibmca_cipher,
+	ibmca_cipher_cleanup,
+	sizeof(struct ibmca_des_context),
+	EVP_CIPHER_set_asn1_iv,
+	EVP_CIPHER_get_asn1_iv,
+	NULL,
+	NULL
+};
+
+/* 3DES CTR EVP, its NID is only known at run time */
+EVP_CIPHER ibmca_tdes_ctr = {
+	NID_undef,
+	1,
+	sizeof(ica_des_key_triple_t),
+	sizeof(ica_des_vector_t),
+	EVP_CIPH_CTR_MODE,
+	ibmca_tdes_init_key,
+	ibmca_cipher,
 	ibmca_cipher_cleanup,
 	sizeof(struct ibmca_des_context),
 	EVP_CIPHER_set_asn1_iv,
@@ -661,8 +1114,8 @@ static const EVP_CIPHER *ibmca_tdes_##lmode(void)						\
 						sizeof(ica_des_key_triple_t))) == NULL  	\
 		   || !EVP_CIPHER_meth_set_iv_length(cipher, sizeof(ica_des_vector_t))		\
 		   || !EVP_CIPHER_meth_set_flags(cipher,EVP_CIPH_##umode##_MODE)		\
-		   || !EVP_CIPHER_meth_set_init(cipher, ibmca_init_key)				\
-		   || !EVP_CIPHER_meth_set_do_cipher(cipher, ibmca_tdes_cipher)			\
+		   || !EVP_CIPHER_meth_set_init(cipher, ibmca_tdes_init_key)			\
+		   || !EVP_CIPHER_meth_set_do_cipher(cipher, ibmca_cipher)			\
 		   || !EVP_CIPHER_meth_set_cleanup(cipher, ibmca_cipher_cleanup)		\
 		   || !EVP_CIPHER_meth_set_impl_ctx_size(cipher,				\
 							   sizeof(struct ibmca_des_context))	\
@@ -686,6 +1139,7 @@ DECLARE_TDES_EVP(ecb, ECB)
 DECLARE_TDES_EVP(cbc, CBC)
 DECLARE_TDES_EVP(ofb, OFB)
 DECLARE_TDES_EVP(cfb, CFB)
+DECLARE_TDES_EVP(ctr, CTR)
 #endif
 
 #ifdef OLDER_OPENSSL
@@ -754,54 +1208,100 @@ static void ibmca_aes_##kbits##_##mode##_destroy(void)			\
 DECLARE_AES_EVP(128, ecb, sizeof(ica_aes_vector_t),
 		sizeof(ica_aes_key_len_128_t), sizeof(ica_aes_vector_t),
 		EVP_CIPH_ECB_MODE, sizeof(ICA_AES_128_CTX),
-		ibmca_init_key, ibmca_aes_128_cipher, ibmca_cipher_cleanup,
+		ibmca_aes_128_init_key, ibmca_cipher, ibmca_cipher_cleanup,
 		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv, NULL)
 DECLARE_AES_EVP(128, cbc, sizeof(ica_aes_vector_t),
 		sizeof(ica_aes_key_len_128_t), sizeof(ica_aes_vector_t),
-		EVP_CIPH_CBC_MODE, sizeof(ICA_AES_128_CTX),
-		ibmca_init_key, ibmca_aes_128_cipher, ibmca_cipher_cleanup,
-		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv, NULL)
+		EVP_CIPH_CBC_MODE | EVP_CIPH_FLAG_PIPELINE,
+		sizeof(ICA_AES_128_CTX), ibmca_aes_128_init_key,
+		ibmca_aes_cbc_cipher, ibmca_cipher_cleanup,
+		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv,
+		ibmca_aes_cbc_ctrl)
 DECLARE_AES_EVP(128, ofb, 1, sizeof(ica_aes_key_len_128_t),
 		sizeof(ica_aes_vector_t), EVP_CIPH_OFB_MODE,
-		sizeof(ICA_AES_128_CTX), ibmca_init_key,
-		ibmca_aes_128_cipher, ibmca_cipher_cleanup,
+		sizeof(ICA_AES_128_CTX), ibmca_aes_128_init_key,
+		ibmca_cipher, ibmca_cipher_cleanup,
 		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv, NULL)
 DECLARE_AES_EVP(128, cfb, 1, sizeof(ica_aes_key_len_128_t),
 		sizeof(ica_aes_vector_t), EVP_CIPH_CFB_MODE,
-		sizeof(ICA_AES_128_CTX), ibmca_init_key,
-		ibmca_aes_128_cipher, ibmca_cipher_cleanup,
+		sizeof(ICA_AES_128_CTX), ibmca_aes_128_init_key,
+		ibmca_cipher, ibmca_cipher_cleanup,
+		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv, NULL)
+DECLARE_AES_EVP(128, ctr, 1, sizeof(ica_aes_key_len_128_t),
+		sizeof(ica_aes_vector_t), EVP_CIPH_CTR_MODE,
+		sizeof(ICA_AES_128_CTX), ibmca_aes_128_init_key,
+		ibmca_cipher, ibmca_cipher_cleanup,
 		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv, NULL)
+DECLARE_AES_EVP(128, xts, 1, 2 * sizeof(ica_aes_key_len_128_t),
+		sizeof(ica_aes_vector_t),
+		EVP_CIPH_XTS_MODE | EVP_CIPH_FLAG_DEFAULT_ASN1
+		| EVP_CIPH_CUSTOM_IV | EVP_CIPH_ALWAYS_CALL_INIT,
+		sizeof(ICA_AES_XTS_CTX), ibmca_aes_xts_init_key,
+		ibmca_aes_xts_cipher, NULL, NULL, NULL, NULL)
 #ifndef OPENSSL_NO_AES_GCM
 DECLARE_AES_EVP(128, gcm, 1, sizeof(ica_aes_key_len_128_t),
 		sizeof(ica_aes_vector_t) - sizeof(uint32_t),
 		EVP_CIPH_GCM_MODE | EVP_CIPH_FLAG_DEFAULT_ASN1
 		| EVP_CIPH_CUSTOM_IV | EVP_CIPH_FLAG_CUSTOM_CIPHER
 		| EVP_CIPH_ALWAYS_CALL_INIT | EVP_CIPH_CTRL_INIT
-		| EVP_CIPH_CUSTOM_COPY | EVP_CIPH_FLAG_AEAD_CIPHER,
+		| EVP_CIPH_CUSTOM_COPY | EVP_CIPH_FLAG_AEAD_CIPHER
+		| EVP_CIPH_FLAG_PIPELINE,
 		sizeof(ICA_AES_GCM_CTX),
 		ibmca_aes_gcm_init_key, ibmca_aes_gcm_cipher, NULL, NULL,
 		NULL, ibmca_aes_gcm_ctrl)
 #endif
+#ifndef OPENSSL_NO_AES_CCM
+DECLARE_AES_EVP(128, ccm, 1, sizeof(ica_aes_key_len_128_t),
+		sizeof(ica_aes_vector_t) - sizeof(uint32_t),
+		EVP_CIPH_CCM_MODE | EVP_CIPH_FLAG_DEFAULT_ASN1
+		| EVP_CIPH_CUSTOM_IV | EVP_CIPH_FLAG_CUSTOM_CIPHER
+		| EVP_CIPH_ALWAYS_CALL_INIT | EVP_CIPH_CTRL_INIT
+		| EVP_CIPH_CUSTOM_COPY | EVP_CIPH_FLAG_AEAD_CIPHER,
+		sizeof(ICA_AES_CCM_CTX),
+		ibmca_aes_ccm_init_key, ibmca_aes_ccm_cipher,
+		ibmca_aes_ccm_cleanup, NULL, NULL, ibmca_aes_ccm_ctrl)
+#endif
+#ifndef OPENSSL_NO_AES_CBC_HMAC
+DECLARE_AES_EVP(128, cbc_hmac_sha1, AES_BLOCK_SIZE,
+		sizeof(ica_aes_key_len_128_t), sizeof(ica_aes_vector_t),
+		EVP_CIPH_CBC_MODE | EVP_CIPH_FLAG_DEFAULT_ASN1
+		| EVP_CIPH_FLAG_AEAD_CIPHER | EVP_CIPH_FLAG_TLS1_1_MULTIBLOCK,
+		sizeof(ICA_AES_HMAC_CTX), ibmca_aes_hmac_init_key,
+		ibmca_aes_hmac_cipher, NULL, NULL, NULL, ibmca_aes_hmac_ctrl)
+DECLARE_AES_EVP(128, cbc_hmac_sha256, AES_BLOCK_SIZE,
+		sizeof(ica_aes_key_len_128_t), sizeof(ica_aes_vector_t),
+		EVP_CIPH_CBC_MODE | EVP_CIPH_FLAG_DEFAULT_ASN1
+		| EVP_CIPH_FLAG_AEAD_CIPHER | EVP_CIPH_FLAG_TLS1_1_MULTIBLOCK,
+		sizeof(ICA_AES_HMAC_CTX), ibmca_aes_hmac_init_key,
+		ibmca_aes_hmac_cipher, NULL, NULL, NULL, ibmca_aes_hmac_ctrl)
+#endif
 
 DECLARE_AES_EVP(192, ecb, sizeof(ica_aes_vector_t),
 		sizeof(ica_aes_key_len_192_t), sizeof(ica_aes_vector_t),
 		EVP_CIPH_ECB_MODE, sizeof(ICA_AES_192_CTX),
-		ibmca_init_key, ibmca_aes_192_cipher, ibmca_cipher_cleanup,
+		ibmca_aes_192_init_key, ibmca_cipher, ibmca_cipher_cleanup,
 		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv, NULL)
 DECLARE_AES_EVP(192, cbc, sizeof(ica_aes_vector_t),
 		sizeof(ica_aes_key_len_192_t), sizeof(ica_aes_vector_t),
-		EVP_CIPH_CBC_MODE, sizeof(ICA_AES_192_CTX),
-		ibmca_init_key, ibmca_aes_192_cipher, ibmca_cipher_cleanup,
-		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv, NULL)
+		EVP_CIPH_CBC_MODE | EVP_CIPH_FLAG_PIPELINE,
+		sizeof(ICA_AES_192_CTX), ibmca_aes_192_init_key,
+		ibmca_aes_cbc_cipher, ibmca_cipher_cleanup,
+		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv,
+		ibmca_aes_cbc_ctrl)
 DECLARE_AES_EVP(192, ofb, 1, sizeof(ica_aes_key_len_192_t),
 		sizeof(ica_aes_vector_t), EVP_CIPH_OFB_MODE,
-		sizeof(ICA_AES_192_CTX), ibmca_init_key,
-		ibmca_aes_192_cipher, ibmca_cipher_cleanup,
+		sizeof(ICA_AES_192_CTX), ibmca_aes_192_init_key,
+		ibmca_cipher, ibmca_cipher_cleanup,
 		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv, NULL)
 DECLARE_AES_EVP(192, cfb, 1, sizeof(ica_aes_key_len_192_t),
 		sizeof(ica_aes_vector_t), EVP_CIPH_CFB_MODE,
-		sizeof(ICA_AES_192_CTX), ibmca_init_key,
-		ibmca_aes_192_cipher, ibmca_cipher_cleanup,
+		sizeof(ICA_AES_192_CTX), ibmca_aes_192_init_key,
+		ibmca_cipher, ibmca_cipher_cleanup,
+		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv, NULL)
+DECLARE_AES_EVP(192, ctr, 1, sizeof(ica_aes_key_len_192_t),
+		sizeof(ica_aes_vector_t), EVP_CIPH_CTR_MODE,
+		sizeof(ICA_AES_192_CTX), ibmca_aes_192_init_key,
+		ibmca_cipher, ibmca_cipher_cleanup,
 		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv, NULL)
 #ifndef OPENSSL_NO_AES_GCM
 DECLARE_AES_EVP(192, gcm, 1, sizeof(ica_aes_key_len_192_t),
@@ -809,43 +1309,94 @@ DECLARE_AES_EVP(192, gcm, 1, sizeof(ica_aes_key_len_192_t),
 		EVP_CIPH_GCM_MODE | EVP_CIPH_FLAG_DEFAULT_ASN1
 		| EVP_CIPH_CUSTOM_IV | EVP_CIPH_FLAG_CUSTOM_CIPHER
 		| EVP_CIPH_ALWAYS_CALL_INIT | EVP_CIPH_CTRL_INIT
-		| EVP_CIPH_CUSTOM_COPY | EVP_CIPH_FLAG_AEAD_CIPHER,
+		| EVP_CIPH_CUSTOM_COPY | EVP_CIPH_FLAG_AEAD_CIPHER
+		| EVP_CIPH_FLAG_PIPELINE,
 		sizeof(ICA_AES_GCM_CTX),
 		ibmca_aes_gcm_init_key, ibmca_aes_gcm_cipher, NULL, NULL,
 		NULL, ibmca_aes_gcm_ctrl)
 #endif
+#ifndef OPENSSL_NO_AES_CCM
+DECLARE_AES_EVP(192, ccm, 1, sizeof(ica_aes_key_len_192_t),
+		sizeof(ica_aes_vector_t) - sizeof(uint32_t),
+		EVP_CIPH_CCM_MODE | EVP_CIPH_FLAG_DEFAULT_ASN1
+		| EVP_CIPH_CUSTOM_IV | EVP_CIPH_FLAG_CUSTOM_CIPHER
+		| EVP_CIPH_ALWAYS_CALL_INIT | EVP_CIPH_CTRL_INIT
+		| EVP_CIPH_CUSTOM_COPY | EVP_CIPH_FLAG_AEAD_CIPHER,
+		sizeof(ICA_AES_CCM_CTX),
+		ibmca_aes_ccm_init_key, ibmca_aes_ccm_cipher,
+		ibmca_aes_ccm_cleanup, NULL, NULL, ibmca_aes_ccm_ctrl)
+#endif
 
 DECLARE_AES_EVP(256, ecb, sizeof(ica_aes_vector_t),
 		sizeof(ica_aes_key_len_256_t), sizeof(ica_aes_vector_t),
 		EVP_CIPH_ECB_MODE, sizeof(ICA_AES_256_CTX),
-		ibmca_init_key, ibmca_aes_256_cipher, ibmca_cipher_cleanup,
+		ibmca_aes_256_init_key, ibmca_cipher, ibmca_cipher_cleanup,
 		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv, NULL)
 DECLARE_AES_EVP(256, cbc, sizeof(ica_aes_vector_t),
 		sizeof(ica_aes_key_len_256_t), sizeof(ica_aes_vector_t),
-		EVP_CIPH_CBC_MODE, sizeof(ICA_AES_256_CTX),
-		ibmca_init_key, ibmca_aes_256_cipher, ibmca_cipher_cleanup,
-		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv, NULL)
+		EVP_CIPH_CBC_MODE | EVP_CIPH_FLAG_PIPELINE,
+		sizeof(ICA_AES_256_CTX), ibmca_aes_256_init_key,
+		ibmca_aes_cbc_cipher, ibmca_cipher_cleanup,
+		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv,
+		ibmca_aes_cbc_ctrl)
 DECLARE_AES_EVP(256, ofb, 1, sizeof(ica_aes_key_len_256_t),
 		sizeof(ica_aes_vector_t), EVP_CIPH_OFB_MODE,
-		sizeof(ICA_AES_256_CTX), ibmca_init_key,
-		ibmca_aes_256_cipher, ibmca_cipher_cleanup,
+		sizeof(ICA_AES_256_CTX), ibmca_aes_256_init_key,
+		ibmca_cipher, ibmca_cipher_cleanup,
 		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv, NULL)
 DECLARE_AES_EVP(256, cfb, 1, sizeof(ica_aes_key_len_256_t),
 		sizeof(ica_aes_vector_t), EVP_CIPH_CFB_MODE,
-		sizeof(ICA_AES_256_CTX), ibmca_init_key,
-		ibmca_aes_256_cipher, ibmca_cipher_cleanup,
+		sizeof(ICA_AES_256_CTX), ibmca_aes_256_init_key,
+		ibmca_cipher, ibmca_cipher_cleanup,
 		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv, NULL)
+DECLARE_AES_EVP(256, ctr, 1, sizeof(ica_aes_key_len_256_t),
+		sizeof(ica_aes_vector_t), EVP_CIPH_CTR_MODE,
+		sizeof(ICA_AES_256_CTX), ibmca_aes_256_init_key,
+		ibmca_cipher, ibmca_cipher_cleanup,
+		EVP_CIPHER_set_asn1_iv, EVP_CIPHER_get_asn1_iv, NULL)
+DECLARE_AES_EVP(256, xts, 1, 2 * sizeof(ica_aes_key_len_256_t),
+		sizeof(ica_aes_vector_t),
+		EVP_CIPH_XTS_MODE | EVP_CIPH_FLAG_DEFAULT_ASN1
+		| EVP_CIPH_CUSTOM_IV | EVP_CIPH_ALWAYS_CALL_INIT,
+		sizeof(ICA_AES_XTS_CTX), ibmca_aes_xts_init_key,
+		ibmca_aes_xts_cipher, NULL, NULL, NULL, NULL)
 #ifndef OPENSSL_NO_AES_GCM
 DECLARE_AES_EVP(256, gcm, 1, sizeof(ica_aes_key_len_256_t),
 		sizeof(ica_aes_vector_t) - sizeof(uint32_t),
 		EVP_CIPH_GCM_MODE | EVP_CIPH_FLAG_DEFAULT_ASN1
 		| EVP_CIPH_CUSTOM_IV | EVP_CIPH_FLAG_CUSTOM_CIPHER
 		| EVP_CIPH_ALWAYS_CALL_INIT | EVP_CIPH_CTRL_INIT
-		| EVP_CIPH_CUSTOM_COPY | EVP_CIPH_FLAG_AEAD_CIPHER,
+		| EVP_CIPH_CUSTOM_COPY | EVP_CIPH_FLAG_AEAD_CIPHER
+		| EVP_CIPH_FLAG_PIPELINE,
 		sizeof(ICA_AES_GCM_CTX),
 		ibmca_aes_gcm_init_key, ibmca_aes_gcm_cipher, NULL, NULL,
 		NULL, ibmca_aes_gcm_ctrl)
 #endif
+#ifndef OPENSSL_NO_AES_CCM
+DECLARE_AES_EVP(256, ccm, 1, sizeof(ica_aes_key_len_256_t),
+		sizeof(ica_aes_vector_t) - sizeof(uint32_t),
+		EVP_CIPH_CCM_MODE | EVP_CIPH_FLAG_DEFAULT_ASN1
+		| EVP_CIPH_CUSTOM_IV | EVP_CIPH_FLAG_CUSTOM_CIPHER
+		| EVP_CIPH_ALWAYS_CALL_INIT | EVP_CIPH_CTRL_INIT
+		| EVP_CIPH_CUSTOM_COPY | EVP_CIPH_FLAG_AEAD_CIPHER,
+		sizeof(ICA_AES_CCM_CTX),
+		ibmca_aes_ccm_init_key, ibmca_aes_ccm_cipher,
+		ibmca_aes_ccm_cleanup, NULL, NULL, ibmca_aes_ccm_ctrl)
+#endif
+#ifndef OPENSSL_NO_AES_CBC_HMAC
+DECLARE_AES_EVP(256, cbc_hmac_sha1, AES_BLOCK_SIZE,
+		sizeof(ica_aes_key_len_256_t), sizeof(ica_aes_vector_t),
+		EVP_CIPH_CBC_MODE | EVP_CIPH_FLAG_DEFAULT_ASN1
+		| EVP_CIPH_FLAG_AEAD_CIPHER | EVP_CIPH_FLAG_TLS1_1_MULTIBLOCK,
+		sizeof(ICA_AES_HMAC_CTX), ibmca_aes_hmac_init_key,
+		ibmca_aes_hmac_cipher, NULL, NULL, NULL, ibmca_aes_hmac_ctrl)
+DECLARE_AES_EVP(256, cbc_hmac_sha256, AES_BLOCK_SIZE,
+		sizeof(ica_aes_key_len_256_t), sizeof(ica_aes_vector_t),
+		EVP_CIPH_CBC_MODE | EVP_CIPH_FLAG_DEFAULT_ASN1
+		| EVP_CIPH_FLAG_AEAD_CIPHER | EVP_CIPH_FLAG_TLS1_1_MULTIBLOCK,
+		sizeof(ICA_AES_HMAC_CTX), ibmca_aes_hmac_init_key,
+		ibmca_aes_hmac_cipher, NULL, NULL, NULL, ibmca_aes_hmac_ctrl)
+#endif
 
 #ifdef OLDER_OPENSSL
 #ifndef OPENSSL_NO_SHA1
@@ -942,31 +1493,32 @@ static const char *engine_ibmca_id = "ibmca";
 static const char *engine_ibmca_name = "Ibmca hardware engine support";
 
 
-inline static int set_RSA_prop(ENGINE *e)
+/*
+ * The RSA, DSA and DH methods, and the CMAC and HMAC methods, are shared
+ * by all ENGINE structures and are filled in once.
+ */
+static CRYPTO_ONCE ibmca_pkey_meths_once = CRYPTO_ONCE_STATIC_INIT;
+static int pkey_meths_ok;
+
+static int ibmca_pkey_meths_fill(void);
+
+static void ibmca_pkey_meths_init(void)
 {
-	static int rsa_enabled = 0;
-#ifndef OPENSSL_NO_RSA
-	const RSA_METHOD *meth1;
-#ifndef OLDER_OPENSSL
-	ibmca_rsa = RSA_meth_new("Ibmca RSA method", 0);
-#endif
-#endif
-#ifndef OPENSSL_NO_DSA
-	const DSA_METHOD *meth2;
-#ifndef OLDER_OPENSSL
-	ibmca_dsa = DSA_meth_new("Ibmca DSA method", 0);
-#endif
-#endif
-#ifndef OPENSSL_NO_DH
-	const DH_METHOD *meth3;
-#ifndef OLDER_OPENSSL
-	ibmca_dh = DH_meth_new("Ibmca DH method", 0);
+	pkey_meths_ok = ibmca_pkey_meths_fill();
+#ifndef OPENSSL_NO_CMAC
+	ibmca_cmac_pmeth = ibmca_cmac_meth_new();
 #endif
+#ifndef OPENSSL_NO_HMAC
+	ibmca_hmac_pmeth = ibmca_hmac_meth_new();
 #endif
+}
 
-	if(rsa_enabled){
-		return 1;
-	}
+inline static int set_RSA_prop(ENGINE *e)
+{
+	if (!CRYPTO_THREAD_run_once(&ibmca_pkey_meths_once,
+				    ibmca_pkey_meths_init)
+	    || !pkey_meths_ok)
+		return 0;
         if(
 #ifndef OPENSSL_NO_RSA
 #ifdef OLDER_OPENSSL
@@ -991,6 +1543,33 @@ inline static int set_RSA_prop(ENGINE *e)
 	  )
 #endif
 		return 0;
+	return 1;
+}
+
+static int ibmca_pkey_meths_fill(void)
+{
+#ifndef OPENSSL_NO_RSA
+	const RSA_METHOD *meth1;
+#ifndef OLDER_OPENSSL
+	if ((ibmca_rsa = RSA_meth_new("Ibmca RSA method", 0)) == NULL)
+		return 0;
+#endif
+#endif
+#ifndef OPENSSL_NO_DSA
+	const DSA_METHOD *meth2;
+#ifndef OLDER_OPENSSL
+	if ((ibmca_dsa = DSA_meth_new("Ibmca DSA method", 0)) == NULL)
+		return 0;
+#endif
+#endif
+#ifndef OPENSSL_NO_DH
+	const DH_METHOD *meth3;
+#ifndef OLDER_OPENSSL
+	if ((ibmca_dh = DH_meth_new("Ibmca DH method", 0)) == NULL)
+		return 0;
+#endif
+#endif
+
 #ifndef OPENSSL_NO_RSA
         /* We know that the "PKCS1_SSLeay()" functions hook properly
          * to the ibmca-specific mod_exp and mod_exp_crt so we use
@@ -1044,7 +1623,6 @@ inline static int set_RSA_prop(ENGINE *e)
 		return 0;
 #endif
 #endif
-	rsa_enabled = 1;
 	return 1;
 }
 
@@ -1054,24 +1632,12 @@ inline static int set_RSA_prop(ENGINE *e)
  * dig_nid_cnt and ciph_nid_cnt needs to be pointer, because only set_engine_prop
  * knows about how much digest or cipher will be set per call. To count the number of
  * cipher and digest outside of the function is not feasible
+ * RAND and RSA are set by bind_helper() and look for libica support
+ * on their first use.
  */
-inline static int set_engine_prop(ENGINE *e, int algo_id, int *dig_nid_cnt, int *ciph_nid_cnt)
+inline static int set_engine_prop(int algo_id, int *dig_nid_cnt, int *ciph_nid_cnt)
 {
         switch(algo_id) {
-                case P_RNG:
-                        if(!ENGINE_set_RAND(e, &ibmca_rand))
-                                return 0;
-                        break;
-		/*
-		 * RSA will be enabled if one of this is set. OpenSSL does not distinguish
-		 * between RSA_ME and RSA_CRT. It is not the task of ibmca to route one ME
-		 * call to CRT or vice versa.
-		 */
-                case RSA_ME:
-                case RSA_CRT:
-                        if(!set_RSA_prop(e))
-                                return 0;
-			break;
 #ifndef OPENSSL_NO_SHA1
 		case SHA1:
 			ibmca_digest_lists.nids[*dig_nid_cnt] = NID_sha1;
@@ -1164,6 +1730,17 @@ inline static int set_engine_prop(ENGINE *e, int algo_id, int *dig_nid_cnt, int
 			ibmca_cipher_lists.crypto_meths[(*ciph_nid_cnt)++] = &ibmca_tdes_cfb;
 #else
 			ibmca_cipher_lists.crypto_meths[(*ciph_nid_cnt)++] = ibmca_tdes_cfb();
+#endif
+			break;
+		case DES3_CTR:
+			if (NID_des_ede3_ctr == NID_undef)
+				break;
+			ibmca_cipher_lists.nids[*ciph_nid_cnt] = NID_des_ede3_ctr;
+#ifdef OLDER_OPENSSL
+			ibmca_tdes_ctr.nid = NID_des_ede3_ctr;
+			ibmca_cipher_lists.crypto_meths[(*ciph_nid_cnt)++] = &ibmca_tdes_ctr;
+#else
+			ibmca_cipher_lists.crypto_meths[(*ciph_nid_cnt)++] = ibmca_tdes_ctr();
 #endif
 			break;
 		case AES_ECB:
@@ -1198,6 +1775,20 @@ inline static int set_engine_prop(ENGINE *e, int algo_id, int *dig_nid_cnt, int
 			ibmca_cipher_lists.nids[*ciph_nid_cnt] = NID_aes_256_cfb;
 			ibmca_cipher_lists.crypto_meths[(*ciph_nid_cnt)++] = ibmca_aes_256_cfb();
 			break;
+		case AES_CTR:
+			ibmca_cipher_lists.nids[*ciph_nid_cnt] = NID_aes_128_ctr;
+			ibmca_cipher_lists.crypto_meths[(*ciph_nid_cnt)++] = ibmca_aes_128_ctr();
+			ibmca_cipher_lists.nids[*ciph_nid_cnt] = NID_aes_192_ctr;
+			ibmca_cipher_lists.crypto_meths[(*ciph_nid_cnt)++] = ibmca_aes_192_ctr();
+			ibmca_cipher_lists.nids[*ciph_nid_cnt] = NID_aes_256_ctr;
+			ibmca_cipher_lists.crypto_meths[(*ciph_nid_cnt)++] = ibmca_aes_256_ctr();
+			break;
+		case AES_XTS:
+			ibmca_cipher_lists.nids[*ciph_nid_cnt] = NID_aes_128_xts;
+			ibmca_cipher_lists.crypto_meths[(*ciph_nid_cnt)++] = ibmca_aes_128_xts();
+			ibmca_cipher_lists.nids[*ciph_nid_cnt] = NID_aes_256_xts;
+			ibmca_cipher_lists.crypto_meths[(*ciph_nid_cnt)++] = ibmca_aes_256_xts();
+			break;
 #ifndef OPENSSL_NO_AES_GCM
 		case AES_GCM_KMA:
 			ibmca_cipher_lists.nids[*ciph_nid_cnt] = NID_aes_128_gcm;
@@ -1207,6 +1798,16 @@ inline static int set_engine_prop(ENGINE *e, int algo_id, int *dig_nid_cnt, int
 			ibmca_cipher_lists.nids[*ciph_nid_cnt] = NID_aes_256_gcm;
 			ibmca_cipher_lists.crypto_meths[(*ciph_nid_cnt)++] = ibmca_aes_256_gcm();
 			break;
+#endif
+#ifndef OPENSSL_NO_AES_CCM
+		case AES_CCM:
+			ibmca_cipher_lists.nids[*ciph_nid_cnt] = NID_aes_128_ccm;
+			ibmca_cipher_lists.crypto_meths[(*ciph_nid_cnt)++] = ibmca_aes_128_ccm();
+			ibmca_cipher_lists.nids[*ciph_nid_cnt] = NID_aes_192_ccm;
+			ibmca_cipher_lists.crypto_meths[(*ciph_nid_cnt)++] = ibmca_aes_192_ccm();
+			ibmca_cipher_lists.nids[*ciph_nid_cnt] = NID_aes_256_ccm;
+			ibmca_cipher_lists.crypto_meths[(*ciph_nid_cnt)++] = ibmca_aes_256_ccm();
+			break;
 #endif
 		default:
 			break;	/* do nothing */
@@ -1221,18 +1822,18 @@ int is_crypto_card_loaded()
 {
 	DIR* sysDir;
 	FILE *file;
-	char dev[PATH_MAX] = AP_PATH;
+	char dev[PATH_MAX + NAME_MAX + 8];
 	struct dirent *direntp;
 	char *type = NULL;
 	size_t size;
 	char c;
 
-	if ((sysDir = opendir(dev)) == NULL )
+	if ((sysDir = opendir(ap_path)) == NULL )
 		return 0;
 
 	while((direntp = readdir(sysDir)) != NULL){
 		if(strstr(direntp->d_name, "card") != 0){
-			snprintf(dev, PATH_MAX, "%s/%s/type", AP_PATH,
+			snprintf(dev, sizeof(dev), "%s/%s/type", ap_path,
 				direntp->d_name);
 
 			if ((file = fopen(dev, "r")) == NULL){
@@ -1260,7 +1861,7 @@ int is_crypto_card_loaded()
 			type = NULL;
 			fclose(file);
 
-			snprintf(dev, PATH_MAX, "%s/%s/online", AP_PATH,
+			snprintf(dev, sizeof(dev), "%s/%s/online", ap_path,
 				direntp->d_name);
 			if ((file = fopen(dev, "r")) == NULL){
 				closedir(sysDir);
@@ -1268,6 +1869,7 @@ int is_crypto_card_loaded()
 			}
 			if((c = fgetc(file)) == '1'){
 				fclose(file);
+				closedir(sysDir);
 				return 1;
 			}
 			fclose(file);
@@ -1278,80 +1880,451 @@ int is_crypto_card_loaded()
 }
 
 
-typedef unsigned int (*ica_get_functionlist_t)(libica_func_list_element *, unsigned int *);
-ica_get_functionlist_t          p_ica_get_functionlist;
+static void crypto_pair_index(struct crypto_pair *list, size_t size)
+{
+	size_t i;
+
+	memset(list->by_nid, 0, sizeof(list->by_nid));
+	list->count = size;
+	for (i = 0; i < size; i++) {
+		if (list->nids[i] > 0 && list->nids[i] < IBMCA_NID_MAX)
+			list->by_nid[list->nids[i]] = i + 1;
+	}
+}
 
-static int set_supported_meths(ENGINE *e)
+static const void *crypto_pair_lookup(const struct crypto_pair *list,
+				      int nid)
 {
-        int i, j;
-        unsigned int mech_len;
-        libica_func_list_element *pmech_list = NULL;
-	int rc = 0;
-        int dig_nid_cnt = 0;
-        int ciph_nid_cnt = 0;
-	int card_loaded;
+	size_t i;
 
-        if (p_ica_get_functionlist(NULL, &mech_len))
-		return 0;
+	if (nid >= IBMCA_NID_MAX) {
+		for (i = 0; i < list->count; i++) {
+			if (list->nids[i] == nid)
+				return list->crypto_meths[i];
+		}
+		return NULL;
+	}
+	if (nid <= 0 || !list->by_nid[nid])
+		return NULL;
+	return list->crypto_meths[list->by_nid[nid] - 1];
+}
 
-	pmech_list = malloc(sizeof(libica_func_list_element)*mech_len);
-	if (pmech_list == NULL)
-		return 0;
+static void str_lower(char *dst, const char *src, size_t len)
+{
+	size_t i;
 
-	if (p_ica_get_functionlist(pmech_list, &mech_len))
-		goto out;
+	for (i = 0; i + 1 < len && src[i]; i++)
+		dst[i] = tolower((unsigned char)src[i]);
+	dst[i] = '\0';
+}
 
-	card_loaded = is_crypto_card_loaded();
+/* Does the lower case fnmatch(3) pattern match a name of nid? */
+static int algo_match(const char *pattern, int nid)
+{
+	char sn[64], ln[64];
 
-	for (i = 0; i < mech_len; i++) {
-	        for (j = 0; ibmca_crypto_algos[j]; j++){
-			/* Disable crypto algorithm if it
-			 * is not supported in hardware
-			 */
-			if (!(pmech_list[i].flags &
-			      (ICA_FLAG_SHW | ICA_FLAG_DHW)))
-				break;
+	str_lower(sn, OBJ_nid2sn(nid) ? OBJ_nid2sn(nid) : "", sizeof(sn));
+	str_lower(ln, OBJ_nid2ln(nid) ? OBJ_nid2ln(nid) : "", sizeof(ln));
+	return !fnmatch(pattern, sn, 0) || !fnmatch(pattern, ln, 0);
+}
 
-			/* If no crypto card is available,
-			 * disable crypto algos that can
-			 * only operate on HW on card
-			 */
-			if ((pmech_list[i].flags & ICA_FLAG_DHW)
-			    && !card_loaded)
-				break;
+/*
+ * Does one of the comma separated fnmatch(3) patterns in list match the
+ * short or long name of nid? Case is ignored.
+ */
+static int algo_list_match(const char *list, int nid)
+{
+	char buf[sizeof(algos_enabled)];
+	char *tok, *save;
 
-	                if(ibmca_crypto_algos[j]
-			   == pmech_list[i].mech_mode_id){
-	                        /* Set NID, ibmca struct and the
-				 * info for the ENGINE struct
-				 */
-	                        if(!set_engine_prop(e, ibmca_crypto_algos[j],
-	                                            &dig_nid_cnt,
-	                                            &ciph_nid_cnt)){
-					goto out;
-				}
-	               }
-	       }
+	str_lower(buf, list, sizeof(buf));
+	for (tok = strtok_r(buf, ", ", &save); tok;
+	     tok = strtok_r(NULL, ", ", &save)) {
+		if (algo_match(tok, nid))
+			return 1;
 	}
+	return 0;
+}
 
-        if(dig_nid_cnt > 0) {
-                if(!ENGINE_set_digests(e, ibmca_engine_digests))
-			goto out;
-	}
-        if(ciph_nid_cnt > 0) {
-                if(!ENGINE_set_ciphers(e, ibmca_engine_ciphers))
-			goto out;
+/* Is there a software route for nid, i.e. does a crossover apply? */
+int ibmca_crossover_supported(int nid)
+{
+	int i;
+
+	for (i = 0; i < IBMCA_STAT_MAX; i++) {
+		if (((i >= IBMCA_STAT_AES_128_ECB && i <= IBMCA_STAT_AES_256_OFB)
+		     || (i >= IBMCA_STAT_SHA1 && i <= IBMCA_STAT_SHA512))
+		    && ibmca_stat_nids[i] == nid)
+			return 1;
 	}
-	rc = 1;
-out:
-        free(pmech_list);
-	return rc;
+	return 0;
 }
 
-
-/* This internal function is used by ENGINE_ibmca() and possibly by the
- * "dynamic" ENGINE support too */
-static int bind_helper(ENGINE * e)
+unsigned int ibmca_crossover_get(int nid)
+{
+	if (nid <= 0 || nid >= IBMCA_NID_MAX)
+		return 0;
+	return __atomic_load_n(&ibmca_crossover[nid], __ATOMIC_RELAXED);
+}
+
+void ibmca_crossover_set(int nid, unsigned int bytes)
+{
+	if (nid > 0 && nid < IBMCA_NID_MAX)
+		__atomic_store_n(&ibmca_crossover[nid], bytes,
+				 __ATOMIC_RELAXED);
+}
+
+void ibmca_route_force(int route)
+{
+	int forced;
+
+	switch (route) {
+	case IBMCA_TUNE_ROUTE_HW:
+	case IBMCA_TUNE_ROUTE_ME:
+		forced = IBMCA_ROUTE_HW;
+		break;
+	case IBMCA_TUNE_ROUTE_SW:
+		forced = IBMCA_ROUTE_SW;
+		break;
+	default:
+		forced = IBMCA_ROUTE_UNSET;
+		break;
+	}
+	if (forced != IBMCA_ROUTE_UNSET
+	    && ibmca_route_forced == IBMCA_ROUTE_UNSET)
+		__atomic_fetch_add(&ibmca_route_forcing, 1, __ATOMIC_RELAXED);
+	else if (forced == IBMCA_ROUTE_UNSET
+		 && ibmca_route_forced != IBMCA_ROUTE_UNSET)
+		__atomic_fetch_sub(&ibmca_route_forcing, 1, __ATOMIC_RELAXED);
+	ibmca_route_forced = forced;
+	ibmca_rsa_me_forced = route == IBMCA_TUNE_ROUTE_ME;
+}
+
+/*
+ * Parse "pattern:bytes[,pattern:bytes...]" and set the crossover of the
+ * AES ECB/CBC/CFB/OFB ciphers and SHA digests whose names match. A later
+ * pattern overrides an earlier one. Can be changed at any time.
+ */
+static int ibmca_set_crossover(const char *list, int apply)
+{
+	char buf[1024], *tok, *save, *colon, *end;
+	unsigned long bytes;
+	int i;
+
+	if (strlen(list) >= sizeof(buf))
+		return 0;
+	str_lower(buf, list, sizeof(buf));
+	for (tok = strtok_r(buf, ", ", &save); tok;
+	     tok = strtok_r(NULL, ", ", &save)) {
+		if ((colon = strchr(tok, ':')) == NULL || colon == tok)
+			return 0;
+		*colon = '\0';
+		bytes = strtoul(colon + 1, &end, 0);
+		if (end == colon + 1 || *end != '\0' || bytes > UINT_MAX)
+			return 0;
+		if (!apply)
+			continue;
+		for (i = 0; i < IBMCA_STAT_MAX; i++) {
+			if (ibmca_crossover_supported(ibmca_stat_nids[i])
+			    && algo_match(tok, ibmca_stat_nids[i]))
+				ibmca_crossover_set(ibmca_stat_nids[i], bytes);
+		}
+	}
+	return 1;
+}
+
+static int ibmca_nid_allowed(int nid)
+{
+	if (algos_enabled[0] && !algo_list_match(algos_enabled, nid))
+		return 0;
+	if (algos_disabled[0] && algo_list_match(algos_disabled, nid))
+		return 0;
+	return 1;
+}
+
+/*
+ * Drop the algorithms ENABLE_ALGORITHMS and DISABLE_ALGORITHMS rule out,
+ * returns the new size of the list.
+ */
+static size_t crypto_pair_filter(struct crypto_pair *list, size_t size)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < size; i++) {
+		if (!ibmca_nid_allowed(list->nids[i]))
+			continue;
+		list->nids[n] = list->nids[i];
+		list->crypto_meths[n++] = list->crypto_meths[i];
+	}
+	return n;
+}
+
+typedef unsigned int (*ica_get_functionlist_t)(libica_func_list_element *, unsigned int *);
+ica_get_functionlist_t          p_ica_get_functionlist;
+
+/* libica flags of each entry of ibmca_crypto_algos */
+static unsigned int ibmca_algo_flags[sizeof(ibmca_crypto_algos) /
+				     sizeof(ibmca_crypto_algos[0])];
+
+static CRYPTO_ONCE ibmca_card_once = CRYPTO_ONCE_STATIC_INIT;
+static int card_loaded;
+
+static void ibmca_card_probe(void)
+{
+	__atomic_store_n(&card_loaded, is_crypto_card_loaded(),
+			 __ATOMIC_RELAXED);
+}
+
+static unsigned int ibmca_algo_flags_get(int algo_id)
+{
+	int j;
+
+	for (j = 0; ibmca_crypto_algos[j]; j++) {
+		if (ibmca_crypto_algos[j] == algo_id)
+			return ibmca_algo_flags[j];
+	}
+	return 0;
+}
+
+/*
+ * An algorithm with these libica flags is used if libica supports it in
+ * hardware. Algorithms that can only operate on a crypto card trigger the
+ * card scan, once, the first time one of them is asked for. Afterwards
+ * the card watcher, if enabled, keeps card_loaded up to date.
+ */
+static int ibmca_flags_enabled(unsigned int flags)
+{
+	if (!(flags & (ICA_FLAG_SHW | ICA_FLAG_DHW)))
+		return 0;
+	if (flags & ICA_FLAG_DHW) {
+		if (!CRYPTO_THREAD_run_once(&ibmca_card_once,
+					    ibmca_card_probe))
+			return 0;
+		return __atomic_load_n(&card_loaded, __ATOMIC_RELAXED);
+	}
+	return 1;
+}
+
+static int ibmca_algo_enabled(int algo_id)
+{
+	return ibmca_flags_enabled(ibmca_algo_flags_get(algo_id));
+}
+
+/*
+ * Probe libica's function list and save it to the capability cache for
+ * the next process. The crypto cards are not part of it: a card can be
+ * varied online or offline without any trace in the AP bus directory, so
+ * they are scanned by every process, on first use of a card algorithm.
+ */
+static libica_func_list_element *ibmca_probe_caps(unsigned int *mech_len)
+{
+	libica_func_list_element *pmech_list;
+	struct ibmca_caps caps;
+
+	if (p_ica_get_functionlist(NULL, mech_len))
+		return NULL;
+
+	pmech_list = malloc(sizeof(libica_func_list_element) * *mech_len);
+	if (pmech_list == NULL)
+		return NULL;
+
+	if (p_ica_get_functionlist(pmech_list, mech_len)) {
+		free(pmech_list);
+		return NULL;
+	}
+
+	if (caps_cache_path[0] != '\0') {
+		caps.mechs = pmech_list;
+		caps.mech_len = *mech_len;
+		ibmca_caps_write(caps_cache_path, p_ica_get_functionlist,
+				 ap_path, &caps);
+	}
+	return pmech_list;
+}
+
+/*
+ * The MAC methods are offered when libica does the underlying cipher or
+ * digest for at least one of the keys they take. Returns the number of
+ * methods.
+ */
+static size_t set_pkey_prop(void)
+{
+	size_t n = 0;
+
+#ifndef OPENSSL_NO_CMAC
+	if (ibmca_cmac_pmeth != NULL
+	    && (ibmca_algo_enabled(AES_CMAC)
+		|| ibmca_algo_enabled(DES3_CMAC))) {
+		ibmca_pkey_lists.nids[n] = EVP_PKEY_CMAC;
+		ibmca_pkey_lists.crypto_meths[n++] = ibmca_cmac_pmeth;
+	}
+#endif
+#ifndef OPENSSL_NO_HMAC
+	if (ibmca_hmac_pmeth != NULL
+	    && (ibmca_algo_enabled(SHA1) || ibmca_algo_enabled(SHA256)
+		|| ibmca_algo_enabled(SHA512))) {
+		ibmca_pkey_lists.nids[n] = EVP_PKEY_HMAC;
+		ibmca_pkey_lists.crypto_meths[n++] = ibmca_hmac_pmeth;
+	}
+#endif
+	return n;
+}
+
+#ifndef OPENSSL_NO_AES_CBC_HMAC
+static const int ibmca_aes_hmac_nids[] = {
+	NID_aes_128_cbc_hmac_sha1,
+	NID_aes_256_cbc_hmac_sha1,
+	NID_aes_128_cbc_hmac_sha256,
+	NID_aes_256_cbc_hmac_sha256,
+};
+/* which of them ibmca_aes_hmac_names() gave names */
+static int ibmca_aes_hmac_named[sizeof(ibmca_aes_hmac_nids) /
+				sizeof(ibmca_aes_hmac_nids[0])];
+
+/*
+ * The stitched ciphers need libica for AES-CBC and for the digest,
+ * returns the new size of the cipher list.
+ */
+static size_t set_aes_hmac_prop(size_t n)
+{
+	if (!ibmca_algo_enabled(AES_CBC))
+		return n;
+	if (ibmca_algo_enabled(SHA1)) {
+		ibmca_cipher_lists.nids[n] = NID_aes_128_cbc_hmac_sha1;
+		ibmca_cipher_lists.crypto_meths[n++] = ibmca_aes_128_cbc_hmac_sha1();
+		ibmca_cipher_lists.nids[n] = NID_aes_256_cbc_hmac_sha1;
+		ibmca_cipher_lists.crypto_meths[n++] = ibmca_aes_256_cbc_hmac_sha1();
+	}
+	if (ibmca_algo_enabled(SHA256)) {
+		ibmca_cipher_lists.nids[n] = NID_aes_128_cbc_hmac_sha256;
+		ibmca_cipher_lists.crypto_meths[n++] = ibmca_aes_128_cbc_hmac_sha256();
+		ibmca_cipher_lists.nids[n] = NID_aes_256_cbc_hmac_sha256;
+		ibmca_cipher_lists.crypto_meths[n++] = ibmca_aes_256_cbc_hmac_sha256();
+	}
+	return n;
+}
+
+/* Is ibmca the default engine of cipher nid? */
+static int ibmca_cipher_default(int nid)
+{
+	ENGINE *e = ENGINE_get_cipher_engine(nid);
+	int rc;
+
+	if (e == NULL)
+		return 0;
+	rc = strcmp(ENGINE_get_id(e), engine_ibmca_id) == 0;
+	ENGINE_finish(e);
+	return rc;
+}
+
+/*
+ * libssl looks the stitched ciphers up by name, and OpenSSL only has
+ * them for x86 AES-NI. Elsewhere the names are added for the engine's
+ * ciphers, and removed again by ibmca_destroy(). The names are global,
+ * so they are only added where ibmca is the cipher default for the NID
+ * at the time libica is loaded; libica is never loaded with the engine
+ * lock held, see ibmca_init().
+ */
+static void ibmca_aes_hmac_names(void)
+{
+	const EVP_CIPHER *cipher;
+	size_t i;
+	int nid;
+
+	for (i = 0; i < sizeof(ibmca_aes_hmac_named) /
+			sizeof(ibmca_aes_hmac_named[0]); i++) {
+		nid = ibmca_aes_hmac_nids[i];
+		cipher = crypto_pair_lookup(&ibmca_cipher_lists, nid);
+		if (cipher != NULL && EVP_get_cipherbynid(nid) == NULL
+		    && ibmca_cipher_default(nid) && EVP_add_cipher(cipher))
+			ibmca_aes_hmac_named[i] = 1;
+	}
+}
+
+static void ibmca_aes_hmac_unname(void)
+{
+	size_t i;
+	int nid;
+
+	for (i = 0; i < sizeof(ibmca_aes_hmac_named) /
+			sizeof(ibmca_aes_hmac_named[0]); i++) {
+		if (!ibmca_aes_hmac_named[i])
+			continue;
+		nid = ibmca_aes_hmac_nids[i];
+		OBJ_NAME_remove(OBJ_nid2sn(nid), OBJ_NAME_TYPE_CIPHER_METH);
+		OBJ_NAME_remove(OBJ_nid2ln(nid), OBJ_NAME_TYPE_CIPHER_METH);
+		ibmca_aes_hmac_named[i] = 0;
+	}
+}
+#endif
+
+static int set_supported_meths(void)
+{
+        int i, j;
+        unsigned int mech_len;
+        libica_func_list_element *pmech_list = NULL;
+	struct ibmca_caps caps;
+	int rc = 0;
+        int dig_nid_cnt = 0;
+        int ciph_nid_cnt = 0;
+
+	if (caps_cache_path[0] != '\0'
+	    && ibmca_caps_read(caps_cache_path, p_ica_get_functionlist,
+			       ap_path, &caps)) {
+		pmech_list = caps.mechs;
+		mech_len = caps.mech_len;
+	} else if ((pmech_list = ibmca_probe_caps(&mech_len)) == NULL) {
+		return 0;
+	}
+
+	for (i = 0; i < mech_len; i++) {
+	        for (j = 0; ibmca_crypto_algos[j]; j++){
+	                if(ibmca_crypto_algos[j]
+			   == pmech_list[i].mech_mode_id)
+				ibmca_algo_flags[j] = pmech_list[i].flags;
+	       }
+	}
+
+	for (j = 0; ibmca_crypto_algos[j]; j++) {
+		switch (ibmca_crypto_algos[j]) {
+		case P_RNG:
+		case RSA_ME:
+		case RSA_CRT:
+			/* checked on first use, RSA may need the card scan */
+			continue;
+		}
+		if (!ibmca_algo_enabled(ibmca_crypto_algos[j]))
+			continue;
+		/* Set NID and ibmca struct */
+		if(!set_engine_prop(ibmca_crypto_algos[j], &dig_nid_cnt,
+				    &ciph_nid_cnt))
+			goto out;
+	}
+
+#ifndef OPENSSL_NO_AES_CBC_HMAC
+	size_cipher_list = set_aes_hmac_prop(size_cipher_list);
+#endif
+	size_digest_list = crypto_pair_filter(&ibmca_digest_lists,
+					      size_digest_list);
+	size_cipher_list = crypto_pair_filter(&ibmca_cipher_lists,
+					      size_cipher_list);
+	size_pkey_list = crypto_pair_filter(&ibmca_pkey_lists,
+					    set_pkey_prop());
+	crypto_pair_index(&ibmca_digest_lists, size_digest_list);
+	crypto_pair_index(&ibmca_cipher_lists, size_cipher_list);
+	crypto_pair_index(&ibmca_pkey_lists, size_pkey_list);
+#ifndef OPENSSL_NO_AES_CBC_HMAC
+	ibmca_aes_hmac_names();
+#endif
+	rc = 1;
+out:
+        free(pmech_list);
+	return rc;
+}
+
+/* This internal function is used by ENGINE_ibmca() and possibly by the
+ * "dynamic" ENGINE support too */
+static int bind_helper(ENGINE * e)
 {
 	if (!ENGINE_set_id(e, engine_ibmca_id) ||
 	    !ENGINE_set_name(e, engine_ibmca_name) ||
@@ -1362,10 +2335,21 @@ static int bind_helper(ENGINE * e)
 	    !ENGINE_set_cmd_defns(e, ibmca_cmd_defns))
 		return 0;
 
+	/*
+	 * libica is loaded on first use, see ibmca_load(). The cipher,
+	 * digest and pkey callbacks list all ibmca can offer and hand out
+	 * OpenSSL's own methods for what libica does not support; RAND, RSA,
+	 * DSA and DH fall back to software likewise.
+	 */
+	if (!ENGINE_set_ciphers(e, ibmca_engine_ciphers) ||
+	    !ENGINE_set_digests(e, ibmca_engine_digests) ||
+	    !ENGINE_set_RAND(e, &ibmca_rand) ||
+	    !ENGINE_set_pkey_meths(e, ibmca_engine_pkey_meths) ||
+	    !set_RSA_prop(e))
+		return 0;
+
 	/* Ensure the ibmca error handling is set up */
 	ERR_load_IBMCA_strings();
-	/* initialize the engine implizit */
-	ibmca_init(e);
 	return 1;
 }
 
@@ -1398,6 +2382,12 @@ static int ibmca_destroy(ENGINE * e)
 	/* Unload the ibmca error strings so any error state including our
 	 * functs or reasons won't lead to a segfault (they simply get displayed
 	 * without corresponding string data because none will be found). */
+#ifndef OPENSSL_NO_AES_CBC_HMAC
+	ibmca_aes_hmac_unname();
+#endif
+#ifndef OPENSSL_NO_HMAC
+	ibmca_hmac_cache_clear();
+#endif
 #ifndef OLDER_OPENSSL
 	ibmca_des_ecb_destroy();
 	ibmca_des_cbc_destroy();
@@ -1407,25 +2397,42 @@ static int ibmca_destroy(ENGINE * e)
 	ibmca_tdes_cbc_destroy();
 	ibmca_tdes_ofb_destroy();
 	ibmca_tdes_cfb_destroy();
+	ibmca_tdes_ctr_destroy();
 
 	ibmca_aes_128_ecb_destroy();
 	ibmca_aes_128_cbc_destroy();
 	ibmca_aes_128_ofb_destroy();
 	ibmca_aes_128_cfb_destroy();
+	ibmca_aes_128_ctr_destroy();
 	ibmca_aes_192_ecb_destroy();
 	ibmca_aes_192_cbc_destroy();
 	ibmca_aes_192_ofb_destroy();
 	ibmca_aes_192_cfb_destroy();
+	ibmca_aes_192_ctr_destroy();
 	ibmca_aes_256_ecb_destroy();
 	ibmca_aes_256_cbc_destroy();
 	ibmca_aes_256_ofb_destroy();
 	ibmca_aes_256_cfb_destroy();
+	ibmca_aes_256_ctr_destroy();
+	ibmca_aes_128_xts_destroy();
+	ibmca_aes_256_xts_destroy();
 
 # ifndef OPENSSL_NO_AES_GCM
 	ibmca_aes_128_gcm_destroy();
 	ibmca_aes_192_gcm_destroy();
 	ibmca_aes_256_gcm_destroy();
 # endif
+# ifndef OPENSSL_NO_AES_CCM
+	ibmca_aes_128_ccm_destroy();
+	ibmca_aes_192_ccm_destroy();
+	ibmca_aes_256_ccm_destroy();
+# endif
+# ifndef OPENSSL_NO_AES_CBC_HMAC
+	ibmca_aes_128_cbc_hmac_sha1_destroy();
+	ibmca_aes_256_cbc_hmac_sha1_destroy();
+	ibmca_aes_128_cbc_hmac_sha256_destroy();
+	ibmca_aes_256_cbc_hmac_sha256_destroy();
+# endif
 
 	ibmca_sha1_destroy();
 	ibmca_sha256_destroy();
@@ -1436,10 +2443,9 @@ static int ibmca_destroy(ENGINE * e)
 }
 
 /* This is a process-global DSO handle used for loading and unloading
- * the Ibmca library. NB: This is only set (or unset) during an
- * init() or finish() call (reference counts permitting) and they're
- * operating with global locks, so this should be thread-safe
- * implicitly. */
+ * the Ibmca library. NB: This is only set once, by ibmca_load() under
+ * CRYPTO_THREAD_run_once(), and unset when the process or the engine
+ * DSO is unloaded, so this is thread-safe. */
 
 void *ibmca_dso = NULL;
 
@@ -1482,6 +2488,10 @@ typedef unsigned int (*ica_des_cfb_t)(const unsigned char *in_data, unsigned cha
 typedef unsigned int (*ica_3des_cfb_t)(const unsigned char *, unsigned char *,
 			unsigned long, const unsigned char *, unsigned char *,
 			unsigned int, unsigned int);
+typedef unsigned int (*ica_3des_ctr_t)(const unsigned char *in_data, unsigned char *out_data,
+			  unsigned long data_length, const unsigned char *key,
+			  unsigned char *ctr, unsigned int ctr_width,
+			  unsigned int direction);
 typedef unsigned int (*ica_3des_ofb_t)(const unsigned char *in_data, unsigned char *out_data,
 			  unsigned long data_length, const unsigned char *key,
 			  unsigned char *iv, unsigned int direction);
@@ -1493,6 +2503,37 @@ typedef unsigned int (*ica_aes_cfb_t)(const unsigned char *in_data, unsigned cha
 			 unsigned long data_length, const unsigned char *key,
 			 unsigned int key_length, unsigned char *iv, unsigned int lcfb,
 			 unsigned int direction);
+typedef unsigned int (*ica_aes_ctr_t)(const unsigned char *in_data, unsigned char *out_data,
+			 unsigned long data_length, const unsigned char *key,
+			 unsigned int key_length, unsigned char *ctr,
+			 unsigned int ctr_width, unsigned int direction);
+typedef unsigned int (*ica_aes_xts_t)(const unsigned char *in_data, unsigned char *out_data,
+			 unsigned long data_length, unsigned char *key1,
+			 unsigned char *key2, unsigned int key_length,
+			 unsigned char *tweak, unsigned int direction);
+typedef unsigned int (*ica_aes_ccm_t)(unsigned char *payload,
+			 unsigned long payload_length,
+			 unsigned char *ciphertext_n_mac, unsigned int mac_length,
+			 const unsigned char *assoc_data,
+			 unsigned long assoc_data_length,
+			 const unsigned char *nonce, unsigned int nonce_length,
+			 const unsigned char *key, unsigned int key_length,
+			 unsigned int direction);
+typedef unsigned int (*ica_aes_cmac_intermediate_t)(const unsigned char *message,
+			 unsigned long message_length, const unsigned char *key,
+			 unsigned int key_length, unsigned char *iv);
+typedef unsigned int (*ica_aes_cmac_last_t)(const unsigned char *message,
+			 unsigned long message_length, unsigned char *mac,
+			 unsigned int mac_length, const unsigned char *key,
+			 unsigned int key_length, unsigned char *iv,
+			 unsigned int direction);
+typedef unsigned int (*ica_3des_cmac_intermediate_t)(const unsigned char *message,
+			  unsigned long message_length,
+			  const unsigned char *key, unsigned char *iv);
+typedef unsigned int (*ica_3des_cmac_last_t)(const unsigned char *message,
+			  unsigned long message_length, unsigned char *mac,
+			  unsigned int mac_length, const unsigned char *key,
+			  unsigned char *iv, unsigned int direction);
 
 typedef unsigned int (*ica_aes_gcm_initialize_t)(const unsigned char *iv,
 						 unsigned int iv_length,
@@ -1544,1252 +2585,3498 @@ ica_sha512_t			p_ica_sha512;
 ica_des_ofb_t			p_ica_des_ofb;
 ica_des_cfb_t			p_ica_des_cfb;
 ica_3des_cfb_t			p_ica_3des_cfb;
+ica_3des_ctr_t			p_ica_3des_ctr;
 ica_3des_ofb_t			p_ica_3des_ofb;
 ica_aes_ofb_t			p_ica_aes_ofb;
 ica_aes_cfb_t			p_ica_aes_cfb;
+ica_aes_ctr_t			p_ica_aes_ctr;
+ica_aes_xts_t			p_ica_aes_xts;
+ica_aes_ccm_t			p_ica_aes_ccm;
+ica_aes_cmac_intermediate_t	p_ica_aes_cmac_intermediate;
+ica_aes_cmac_last_t		p_ica_aes_cmac_last;
+ica_3des_cmac_intermediate_t	p_ica_3des_cmac_intermediate;
+ica_3des_cmac_last_t		p_ica_3des_cmac_last;
 #ifndef OPENSSL_NO_AES_GCM
 ica_aes_gcm_initialize_t	p_ica_aes_gcm_initialize;
 ica_aes_gcm_intermediate_t	p_ica_aes_gcm_intermediate;
 ica_aes_gcm_last_t		p_ica_aes_gcm_last;
 #endif
 
-/* utility function to obtain a context */
-static int get_context(ica_adapter_handle_t * p_handle)
+/*
+ * The data path calls libica through the ibmca_ica_* wrappers below,
+ * which account every request, its latency included, in the statistics
+ * of its algorithm and fire the ica_entry/ica_return probes.
+ */
+#define DES_STAT(base, mode) \
+	((base) + ((mode) == MODE_ECB ? 0 : 1))
+#define AES_STAT(mode_stat, key_length) \
+	((mode_stat) + ((key_length) / 8 - 2) * 4)
+#define GCM_STAT(key_length) \
+	(IBMCA_STAT_AES_128_GCM + (key_length) / 8 - 2)
+
+static inline unsigned int ibmca_ica_rsa_mod_expo(ica_adapter_handle_t h,
+		unsigned char *in, ica_rsa_key_mod_expo_t *key,
+		unsigned char *out)
 {
-	unsigned int status = 0;
+	enum ibmca_stat stat = IBMCA_STAT_RSA_ME;
+	uint64_t start = ibmca_stat_start(stat, key->key_length);
+	unsigned int rc = p_ica_rsa_mod_expo(h, in, key, out);
 
-	status = p_ica_open_adapter(p_handle);
-	if (status != 0)
-		return 0;
-	return 1;
+	ibmca_stat_ica(stat, key->key_length, rc, start);
+	return rc;
 }
 
-/* similarly to release one. */
-static void release_context(ica_adapter_handle_t i_handle)
+static inline unsigned int ibmca_ica_rsa_crt(ica_adapter_handle_t h,
+		unsigned char *in, ica_rsa_key_crt_t *key, unsigned char *out)
 {
-	p_ica_close_adapter(i_handle);
+	enum ibmca_stat stat = IBMCA_STAT_RSA_CRT;
+	uint64_t start = ibmca_stat_start(stat, key->key_length);
+	unsigned int rc = p_ica_rsa_crt(h, in, key, out);
+
+	ibmca_stat_ica(stat, key->key_length, rc, start);
+	return rc;
 }
 
-/* initialisation functions. */
-#define BIND(dso, sym)	(p_##sym = (sym##_t)dlsym(dso, #sym))
-static int ibmca_init(ENGINE * e)
+static inline unsigned int ibmca_ica_random_number_generate(unsigned int len,
+		unsigned char *out)
 {
-	static int init = 0;
+	enum ibmca_stat stat = IBMCA_STAT_RAND;
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_random_number_generate(len, out);
 
-	if (init)	/* Engine already loaded. */
-		return 1;
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
 
-	/* Attempt to load libica.so. Needs to be
-	 * changed unfortunately because the Ibmca drivers don't have
-	 * standard library names that can be platform-translated well. */
-	/* TODO: Work out how to actually map to the names the Ibmca
-	 * drivers really use - for now a symbollic link needs to be
-	 * created on the host system from libica.so to ica.so on
-	 * unix variants. */
+/*
+ * Only the first chunk of a SHA request can start the message and only
+ * the last one can end it, the others are middle parts.
+ */
+static inline unsigned int ibmca_sha_part(unsigned int part, int first,
+					  int last)
+{
+	int starts = first && (part == SHA_MSG_PART_ONLY
+			       || part == SHA_MSG_PART_FIRST);
+	int ends = last && (part == SHA_MSG_PART_ONLY
+			    || part == SHA_MSG_PART_FINAL);
+
+	if (starts)
+		return ends ? SHA_MSG_PART_ONLY : SHA_MSG_PART_FIRST;
+	return ends ? SHA_MSG_PART_FINAL : SHA_MSG_PART_MIDDLE;
+}
 
-	/* WJH XXX check name translation */
+static inline unsigned int ibmca_ica_sha1(unsigned int part,
+		unsigned long len, unsigned char *in, sha_context_t *c,
+		unsigned char *out)
+{
+	enum ibmca_stat stat = IBMCA_STAT_SHA1;
+	unsigned long n, done = 0;
+	unsigned int rc;
+	uint64_t start;
+
+	do {
+		n = len - done > IBMCA_CHUNK ? IBMCA_CHUNK : len - done;
+		start = ibmca_stat_start(stat, n);
+		rc = p_ica_sha1(ibmca_sha_part(part, done == 0, done + n == len),
+			      n, in + done, c, out);
+		ibmca_stat_ica(stat, n, rc, start);
+		done += n;
+	} while (rc == 0 && done < len);
+	return rc;
+}
 
-	ibmca_dso = dlopen(LIBICA_SHARED_LIB, RTLD_NOW);
-	if (ibmca_dso == NULL) {
-		IBMCAerr(IBMCA_F_IBMCA_INIT, IBMCA_R_DSO_FAILURE);
-		goto err;
-	}
+static inline unsigned int ibmca_ica_sha256(unsigned int part,
+		unsigned long len, unsigned char *in, sha256_context_t *c,
+		unsigned char *out)
+{
+	enum ibmca_stat stat = IBMCA_STAT_SHA256;
+	unsigned long n, done = 0;
+	unsigned int rc;
+	uint64_t start;
+
+	do {
+		n = len - done > IBMCA_CHUNK ? IBMCA_CHUNK : len - done;
+		start = ibmca_stat_start(stat, n);
+		rc = p_ica_sha256(ibmca_sha_part(part, done == 0, done + n == len),
+			      n, in + done, c, out);
+		ibmca_stat_ica(stat, n, rc, start);
+		done += n;
+	} while (rc == 0 && done < len);
+	return rc;
+}
 
-	if (!BIND(ibmca_dso, ica_open_adapter)
-	    || !BIND(ibmca_dso, ica_close_adapter)
-	    || !BIND(ibmca_dso, ica_rsa_mod_expo)
-	    || !BIND(ibmca_dso, ica_random_number_generate)
-	    || !BIND(ibmca_dso, ica_rsa_crt)
-	    || !BIND(ibmca_dso, ica_sha1)
-	    || !BIND(ibmca_dso, ica_des_encrypt)
-	    || !BIND(ibmca_dso, ica_des_decrypt)
-	    || !BIND(ibmca_dso, ica_3des_encrypt)
-	    || !BIND(ibmca_dso, ica_3des_decrypt)
-	    || !BIND(ibmca_dso, ica_aes_encrypt)
-	    || !BIND(ibmca_dso, ica_aes_decrypt)
-	    || !BIND(ibmca_dso, ica_sha256)
-	    || !BIND(ibmca_dso, ica_sha512)
-	    || !BIND(ibmca_dso, ica_aes_ofb)
-	    || !BIND(ibmca_dso, ica_des_ofb)
-	    || !BIND(ibmca_dso, ica_3des_ofb)
-	    || !BIND(ibmca_dso, ica_aes_cfb)
-	    || !BIND(ibmca_dso, ica_des_cfb)
-	    || !BIND(ibmca_dso, ica_get_functionlist)
-	    || !BIND(ibmca_dso, ica_3des_cfb)
-#ifndef OPENSSL_NO_AES_GCM
-	    || !BIND(ibmca_dso, ica_aes_gcm_initialize)
-	    || !BIND(ibmca_dso, ica_aes_gcm_intermediate)
-	    || !BIND(ibmca_dso, ica_aes_gcm_last)
-#endif
-	   ) {
-		IBMCAerr(IBMCA_F_IBMCA_INIT, IBMCA_R_DSO_FAILURE);
-		goto err;
-	}
+static inline unsigned int ibmca_ica_sha512(unsigned int part,
+		unsigned long len, unsigned char *in, sha512_context_t *c,
+		unsigned char *out)
+{
+	enum ibmca_stat stat = IBMCA_STAT_SHA512;
+	unsigned long n, done = 0;
+	unsigned int rc;
+	uint64_t start;
+
+	do {
+		n = len - done > IBMCA_CHUNK ? IBMCA_CHUNK : len - done;
+		start = ibmca_stat_start(stat, n);
+		rc = p_ica_sha512(ibmca_sha_part(part, done == 0, done + n == len),
+			      n, in + done, c, out);
+		ibmca_stat_ica(stat, n, rc, start);
+		done += n;
+	} while (rc == 0 && done < len);
+	return rc;
+}
 
-        if(!set_supported_meths(e))
-                goto err;
+static inline unsigned int ibmca_ica_des_encrypt(unsigned int mode,
+		unsigned int len, unsigned char *in, ica_des_vector_t *iv,
+		ica_des_key_single_t *key, unsigned char *out)
+{
+	enum ibmca_stat stat = DES_STAT(IBMCA_STAT_DES_ECB, mode);
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_des_encrypt(mode, len, in, iv, key, out);
 
-	if (!get_context(&ibmca_handle)) {
-		IBMCAerr(IBMCA_F_IBMCA_INIT, IBMCA_R_UNIT_FAILURE);
-		goto err;
-	}
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
 
-	init = 1;
-	return 1;
-err:
-	if (ibmca_dso) {
-		dlclose(ibmca_dso);
-		ibmca_dso = NULL;
-	}
-	p_ica_open_adapter = NULL;
-	p_ica_close_adapter = NULL;
-	p_ica_rsa_mod_expo = NULL;
-	p_ica_random_number_generate = NULL;
-	p_ica_rsa_crt = NULL;
-	p_ica_sha1 = NULL;
-	p_ica_des_encrypt = NULL;
-	p_ica_des_decrypt = NULL;
-	p_ica_3des_encrypt = NULL;
-	p_ica_3des_decrypt = NULL;
-	p_ica_aes_encrypt = NULL;
-	p_ica_aes_decrypt = NULL;
-	p_ica_sha256 = NULL;
-	p_ica_sha512 = NULL;
-	p_ica_aes_ofb = NULL;
-	p_ica_des_ofb = NULL;
-	p_ica_3des_ofb = NULL;
-	p_ica_aes_cfb = NULL;
-	p_ica_des_cfb = NULL;
-	p_ica_3des_cfb = NULL;
-#ifndef OPENSSL_NO_AES_GCM
-	p_ica_aes_gcm_initialize = NULL;
-	p_ica_aes_gcm_intermediate = NULL;
-	p_ica_aes_gcm_last = NULL;
-#endif
-	return 0;
+static inline unsigned int ibmca_ica_des_decrypt(unsigned int mode,
+		unsigned int len, unsigned char *in, ica_des_vector_t *iv,
+		ica_des_key_single_t *key, unsigned char *out)
+{
+	enum ibmca_stat stat = DES_STAT(IBMCA_STAT_DES_ECB, mode);
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_des_decrypt(mode, len, in, iv, key, out);
+
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
 }
 
-static int ibmca_finish(ENGINE * e)
+static inline unsigned int ibmca_ica_3des_encrypt(unsigned int mode,
+		unsigned int len, unsigned char *in, ica_des_vector_t *iv,
+		ica_des_key_triple_t *key, unsigned char *out)
 {
-	if (ibmca_dso == NULL) {
-		IBMCAerr(IBMCA_F_IBMCA_FINISH, IBMCA_R_NOT_LOADED);
-		return 0;
-	}
-	release_context(ibmca_handle);
-	if (!dlclose(ibmca_dso)) {
-		IBMCAerr(IBMCA_F_IBMCA_FINISH, IBMCA_R_DSO_FAILURE);
-		return 0;
-	}
-	ibmca_dso = NULL;
+	enum ibmca_stat stat = DES_STAT(IBMCA_STAT_TDES_ECB, mode);
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_3des_encrypt(mode, len, in, iv, key, out);
 
-	return 1;
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
 }
 
-static int ibmca_ctrl(ENGINE * e, int cmd, long i, void *p, void (*f) ())
+static inline unsigned int ibmca_ica_3des_decrypt(unsigned int mode,
+		unsigned int len, unsigned char *in, ica_des_vector_t *iv,
+		ica_des_key_triple_t *key, unsigned char *out)
 {
-	int initialised = ((ibmca_dso == NULL) ? 0 : 1);
-	switch (cmd) {
-	case IBMCA_CMD_SO_PATH:
-		if (p == NULL) {
-			IBMCAerr(IBMCA_F_IBMCA_CTRL,
-				 ERR_R_PASSED_NULL_PARAMETER);
-			return 0;
-		}
-		if (initialised) {
-			IBMCAerr(IBMCA_F_IBMCA_CTRL,
-				 IBMCA_R_ALREADY_LOADED);
-			return 0;
-		}
-		LIBICA_NAME = (const char *) p;
-		return 1;
-	default:
-		break;
-	}
-	IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_CTRL_COMMAND_NOT_IMPLEMENTED);
-	return 0;
+	enum ibmca_stat stat = DES_STAT(IBMCA_STAT_TDES_ECB, mode);
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_3des_decrypt(mode, len, in, iv, key, out);
+
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
 }
 
-/*
- * ENGINE calls this to find out how to deal with
- * a particular NID in the ENGINE.
- */
-static int ibmca_engine_ciphers(ENGINE * e, const EVP_CIPHER ** cipher,
-				const int **nids, int nid)
+static inline unsigned int ibmca_ica_des_ofb(const unsigned char *in,
+		unsigned char *out, unsigned long len, const unsigned char *key,
+		unsigned char *iv, unsigned int direction)
 {
-        int i;
-	if (!cipher)
-		return (ibmca_usable_ciphers(nids));
+	enum ibmca_stat stat = IBMCA_STAT_DES_OFB;
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_des_ofb(in, out, len, key, iv, direction);
 
-        *cipher = NULL;
-        for(i = 0; i < size_cipher_list;i++)
-                if(nid == ibmca_cipher_lists.nids[i]){
-                        *cipher = (EVP_CIPHER*) ibmca_cipher_lists.crypto_meths [i];
-                        break;
-		}
-        /* Check: how can *cipher be NULL? */
-	return (*cipher != NULL);
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
 }
 
-static int ibmca_usable_ciphers(const int **nids)
+static inline unsigned int ibmca_ica_des_cfb(const unsigned char *in,
+		unsigned char *out, unsigned long len, const unsigned char *key,
+		unsigned char *iv, unsigned int lcfb, unsigned int direction)
 {
+	enum ibmca_stat stat = IBMCA_STAT_DES_CFB;
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_des_cfb(in, out, len, key, iv, lcfb,
+					direction);
 
-        if(nids)
-	        *nids = ibmca_cipher_lists.nids;
-	return size_cipher_list;
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
 }
 
-static int ibmca_init_key(EVP_CIPHER_CTX * ctx, const unsigned char *key,
-			  const unsigned char *iv, int enc)
+static inline unsigned int ibmca_ica_3des_ofb(const unsigned char *in,
+		unsigned char *out, unsigned long len, const unsigned char *key,
+		unsigned char *iv, unsigned int direction)
 {
-#ifdef OLDER_OPENSSL
-	ICA_DES_CTX *pCtx = ctx->cipher_data;
+	enum ibmca_stat stat = IBMCA_STAT_TDES_OFB;
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_3des_ofb(in, out, len, key, iv, direction);
 
-	memcpy(pCtx->key, key, ctx->cipher->key_len);
-#else
-	ICA_DES_CTX *pCtx = (ICA_DES_CTX *) EVP_CIPHER_CTX_get_cipher_data(ctx);
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
 
-	memcpy(pCtx->key, key, EVP_CIPHER_CTX_key_length(ctx));
-#endif
+static inline unsigned int ibmca_ica_3des_cfb(const unsigned char *in,
+		unsigned char *out, unsigned long len, const unsigned char *key,
+		unsigned char *iv, unsigned int lcfb, unsigned int direction)
+{
+	enum ibmca_stat stat = IBMCA_STAT_TDES_CFB;
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_3des_cfb(in, out, len, key, iv, lcfb,
+					 direction);
 
-	return 1;
-}				// end ibmca_init_key
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
 
-static int ibmca_des_cipher(EVP_CIPHER_CTX * ctx, unsigned char *out,
-			    const unsigned char *in, size_t inlen)
+static inline unsigned int ibmca_ica_3des_ctr(const unsigned char *in,
+		unsigned char *out, unsigned long len, const unsigned char *key,
+		unsigned char *ctr, unsigned int ctr_width,
+		unsigned int direction)
 {
-	int mode = 0;
-	int rv;
-	unsigned int len;
-#ifdef OLDER_OPENSSL
-	ICA_DES_CTX *pCtx = ctx->cipher_data;
-#else
-	ICA_DES_CTX *pCtx = (ICA_DES_CTX *) EVP_CIPHER_CTX_get_cipher_data(ctx);
-#endif
+	enum ibmca_stat stat = IBMCA_STAT_TDES_CTR;
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_3des_ctr(in, out, len, key, ctr, ctr_width,
+					 direction);
 
-	ica_des_vector_t pre_iv;
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
 
-	if (inlen > UINT32_MAX) {
-		IBMCAerr(IBMCA_F_IBMCA_DES_CIPHER, IBMCA_R_OUTLEN_TO_LARGE);
-		return 0;
-	}
-	len = inlen;
+static inline unsigned int ibmca_ica_aes_encrypt(unsigned int mode,
+		unsigned int len, unsigned char *in, ica_aes_vector_t *iv,
+		unsigned int key_length, unsigned char *key, unsigned char *out)
+{
+	enum ibmca_stat stat = AES_STAT(DES_STAT(IBMCA_STAT_AES_128_ECB, mode),
+					key_length);
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_aes_encrypt(mode, len, in, iv, key_length,
+					    key, out);
 
-	if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_ECB_MODE) {
-		mode = MODE_ECB;
-	} else if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_CBC_MODE) {
-		mode = MODE_CBC;
-	} else if ((EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_CFB_MODE) &&
-		   (EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_OFB_MODE)) {
-		IBMCAerr(IBMCA_F_IBMCA_DES_CIPHER,
-				IBMCA_R_CIPHER_MODE_NOT_SUPPORTED);
-		return 0;
-	}
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
 
-#ifdef OLDER_OPENSSL
-	if (ctx->encrypt) {
-#else
-	if (EVP_CIPHER_CTX_encrypting(ctx)) {
-#endif
-		if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_CFB_MODE) {
-			rv = p_ica_des_cfb(in, out, len, pCtx->key,
-#ifdef OLDER_OPENSSL
-					   ctx->iv,
-#else
-					   EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					   8, ICA_ENCRYPT);
-		} else if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_OFB_MODE) {
-			rv = p_ica_des_ofb(in, out, len, pCtx->key,
-#ifdef OLDER_OPENSSL
-					   ctx->iv,
-#else
-					   EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					   ICA_ENCRYPT);
-		} else {
-			rv = p_ica_des_encrypt(mode, len, (unsigned char *)in,
-#ifdef OLDER_OPENSSL
-				(ica_des_vector_t *) ctx->iv,
-#else
-				(ica_des_vector_t *) EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-				(ica_des_key_single_t *) pCtx->key, out);
-		}
+static inline unsigned int ibmca_ica_aes_decrypt(unsigned int mode,
+		unsigned int len, unsigned char *in, ica_aes_vector_t *iv,
+		unsigned int key_length, unsigned char *key, unsigned char *out)
+{
+	enum ibmca_stat stat = AES_STAT(DES_STAT(IBMCA_STAT_AES_128_ECB, mode),
+					key_length);
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_aes_decrypt(mode, len, in, iv, key_length,
+					    key, out);
 
-		if (rv) {
-			IBMCAerr(IBMCA_F_IBMCA_DES_CIPHER,
-					IBMCA_R_REQUEST_FAILED);
-			return 0;
-		} else if (EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_OFB_MODE) {
-#ifdef OLDER_OPENSSL
-			memcpy(ctx->iv,
-#else
-			memcpy(EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-			       out + len - EVP_CIPHER_CTX_iv_length(ctx),
-			       EVP_CIPHER_CTX_iv_length(ctx));
-		}
-	} else {
-		if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_CFB_MODE) {
-			/* Protect against decrypt in place */
-			/* FIXME: Shouldn't we use EVP_CIPHER_CTX_iv_length() instead? */
-			memcpy(pre_iv, in + len - sizeof(pre_iv), sizeof(pre_iv));
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
 
-			rv = p_ica_des_cfb(in, out, len, pCtx->key,
-#ifdef OLDER_OPENSSL
-					   ctx->iv,
-#else
-					   EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					   8, ICA_DECRYPT);
-		} else if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_OFB_MODE) {
-			rv = p_ica_des_ofb(in, out, len, pCtx->key,
-#ifdef OLDER_OPENSSL
-					   ctx->iv,
-#else
-					   EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					   ICA_DECRYPT);
-		} else {
-			/* Protect against decrypt in place */
-			/* FIXME: Shouldn't we use EVP_CIPHER_CTX_iv_length() instead? */
-			memcpy(pre_iv, in + len - sizeof(pre_iv), sizeof(pre_iv));
+static inline unsigned int ibmca_ica_aes_ofb(const unsigned char *in,
+		unsigned char *out, unsigned long len, const unsigned char *key,
+		unsigned int key_length, unsigned char *iv,
+		unsigned int direction)
+{
+	enum ibmca_stat stat = AES_STAT(IBMCA_STAT_AES_128_OFB, key_length);
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_aes_ofb(in, out, len, key, key_length, iv,
+					direction);
 
-			rv = p_ica_des_decrypt(mode, len, (unsigned char *)in,
-#ifdef OLDER_OPENSSL
-				(ica_des_vector_t *) ctx->iv,
-#else
-				(ica_des_vector_t *) EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-				(ica_des_key_single_t *) pCtx->key, out);
-		}
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
 
-		if (rv) {
-			IBMCAerr(IBMCA_F_IBMCA_DES_CIPHER,
-					IBMCA_R_REQUEST_FAILED);
-			return 0;
-		} else if (EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_OFB_MODE) {
-#ifdef OLDER_OPENSSL
-			memcpy(ctx->iv,
-#else
-			memcpy(EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-				pre_iv, EVP_CIPHER_CTX_iv_length(ctx));
-		}
-	}
+static inline unsigned int ibmca_ica_aes_cfb(const unsigned char *in,
+		unsigned char *out, unsigned long len, const unsigned char *key,
+		unsigned int key_length, unsigned char *iv, unsigned int lcfb,
+		unsigned int direction)
+{
+	enum ibmca_stat stat = AES_STAT(IBMCA_STAT_AES_128_CFB, key_length);
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_aes_cfb(in, out, len, key, key_length, iv,
+					lcfb, direction);
 
-	return 1;
-}				// end ibmca_des_cipher
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
 
-static int ibmca_tdes_cipher(EVP_CIPHER_CTX * ctx, unsigned char *out,
-			     const unsigned char *in, size_t inlen)
+static inline unsigned int ibmca_ica_aes_ctr(const unsigned char *in,
+		unsigned char *out, unsigned long len, const unsigned char *key,
+		unsigned int key_length, unsigned char *ctr,
+		unsigned int ctr_width, unsigned int direction)
 {
-	int mode = 0;
-	int rv;
-	unsigned int len;
-#ifdef OLDER_OPENSSL
-	ICA_DES_CTX *pCtx = ctx->cipher_data;
-#else
-	ICA_DES_CTX *pCtx = (ICA_DES_CTX *) EVP_CIPHER_CTX_get_cipher_data(ctx);
-#endif
-	ica_des_vector_t pre_iv;
+	enum ibmca_stat stat = IBMCA_STAT_AES_128_CTR + key_length / 8 - 2;
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_aes_ctr(in, out, len, key, key_length, ctr,
+					ctr_width, direction);
 
-	if (inlen > UINT32_MAX) {
-		IBMCAerr(IBMCA_F_IBMCA_TDES_CIPHER, IBMCA_R_OUTLEN_TO_LARGE);
-		return 0;
-	}
-	len = inlen;
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
 
-	if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_ECB_MODE) {
-		mode = MODE_ECB;
-	} else if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_CBC_MODE) {
-		mode = MODE_CBC;
-	} else if ((EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_CFB_MODE) &&
-		   (EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_OFB_MODE)) {
-		IBMCAerr(IBMCA_F_IBMCA_TDES_CIPHER,
-				IBMCA_R_CIPHER_MODE_NOT_SUPPORTED);
-		return 0;
-	}
+static inline unsigned int ibmca_ica_aes_xts(const unsigned char *in,
+		unsigned char *out, unsigned long len, unsigned char *key1,
+		unsigned char *key2, unsigned int key_length,
+		unsigned char *tweak, unsigned int direction)
+{
+	enum ibmca_stat stat = key_length == AES_KEY_LEN128 ?
+			       IBMCA_STAT_AES_128_XTS : IBMCA_STAT_AES_256_XTS;
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_aes_xts(in, out, len, key1, key2, key_length,
+					tweak, direction);
 
-#ifdef OLDER_OPENSSL
-	if (ctx->encrypt) {
-#else
-	if (EVP_CIPHER_CTX_encrypting(ctx)) {
-#endif
-		if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_CFB_MODE) {
-			rv = p_ica_3des_cfb(in, out, len, pCtx->key,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					8, ICA_ENCRYPT);
-		} else if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_OFB_MODE) {
-			rv = p_ica_3des_ofb(in, out, len, pCtx->key,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					ICA_ENCRYPT);
-		} else {
-			rv = p_ica_3des_encrypt(mode, len, (unsigned char *)in,
-#ifdef OLDER_OPENSSL
-				(ica_des_vector_t *) ctx->iv,
-#else
-				(ica_des_vector_t *) EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-				(ica_des_key_triple_t *) pCtx->key, out);
-		}
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
 
-		if (rv) {
-			IBMCAerr(IBMCA_F_IBMCA_TDES_CIPHER,
-					IBMCA_R_REQUEST_FAILED);
-			return 0;
-		} else if (EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_OFB_MODE) {
-#ifdef OLDER_OPENSSL
-			memcpy(ctx->iv,
-#else
-			memcpy(EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-			       out + len - EVP_CIPHER_CTX_iv_length(ctx),
-			       EVP_CIPHER_CTX_iv_length(ctx));
-		}
-	} else {
-		if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_CFB_MODE) {
-			/* Protect against decrypt in place */
-			/* FIXME: Again, check if EVP_CIPHER_CTX_iv_length() should be used */
-			memcpy(pre_iv, in + len - sizeof(pre_iv), sizeof(pre_iv));
+static inline unsigned int ibmca_ica_aes_ccm(unsigned char *payload,
+		unsigned long len, unsigned char *ct_n_mac,
+		unsigned int mac_length, const unsigned char *aad,
+		unsigned long aad_length, const unsigned char *nonce,
+		unsigned int nonce_length, const unsigned char *key,
+		unsigned int key_length, unsigned int direction)
+{
+	enum ibmca_stat stat = IBMCA_STAT_AES_128_CCM + key_length / 8 - 2;
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_aes_ccm(payload, len, ct_n_mac, mac_length,
+					aad, aad_length, nonce, nonce_length,
+					key, key_length, direction);
 
-			rv = p_ica_3des_cfb(in, out, len, pCtx->key,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					8, ICA_DECRYPT);
-		} else if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_OFB_MODE) {
-			rv = p_ica_3des_ofb(in, out, len, pCtx->key,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					ICA_DECRYPT);
-		} else {
-			/* Protect against decrypt in place */
-			/* FIXME: Again, check if EVP_CIPHER_CTX_iv_length() should be used */
-			memcpy(pre_iv, in + len - sizeof(pre_iv), sizeof(pre_iv));
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
 
-			rv = p_ica_3des_decrypt(mode, len, (unsigned char *)in,
-#ifdef OLDER_OPENSSL
-				(ica_des_vector_t *) ctx->iv,
-#else
-				(ica_des_vector_t *) EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-				(ica_des_key_triple_t *) pCtx->key, out);
-		}
+static inline unsigned int ibmca_ica_aes_cmac_intermediate(
+		const unsigned char *msg, unsigned long len,
+		const unsigned char *key, unsigned int key_length,
+		unsigned char *iv)
+{
+	enum ibmca_stat stat = IBMCA_STAT_AES_128_CMAC + key_length / 8 - 2;
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_aes_cmac_intermediate(msg, len, key,
+						      key_length, iv);
 
-		if (rv) {
-			IBMCAerr(IBMCA_F_IBMCA_TDES_CIPHER,
-					IBMCA_R_REQUEST_FAILED);
-			return 0;
-		} else if (EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_OFB_MODE) {
-#ifdef OLDER_OPENSSL
-			memcpy(ctx->iv,
-#else
-			memcpy(EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-				pre_iv, EVP_CIPHER_CTX_iv_length(ctx));
-		}
-	}
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
 
-	return 1;
-}				// end ibmca_tdes_cipher
+static inline unsigned int ibmca_ica_aes_cmac_last(const unsigned char *msg,
+		unsigned long len, unsigned char *mac, unsigned int mac_length,
+		const unsigned char *key, unsigned int key_length,
+		unsigned char *iv, unsigned int direction)
+{
+	enum ibmca_stat stat = IBMCA_STAT_AES_128_CMAC + key_length / 8 - 2;
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_aes_cmac_last(msg, len, mac, mac_length, key,
+					      key_length, iv, direction);
 
-/* FIXME: a lot of common code between ica_aes_[128|192|256]_cipher() fncs */
-static int ibmca_aes_128_cipher(EVP_CIPHER_CTX * ctx, unsigned char *out,
-				const unsigned char *in, size_t inlen)
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
+
+static inline unsigned int ibmca_ica_3des_cmac_intermediate(
+		const unsigned char *msg, unsigned long len,
+		const unsigned char *key, unsigned char *iv)
 {
-	int mode = 0;
-	int rv;
-	unsigned int len;
-#ifdef OLDER_OPENSSL
-	ICA_AES_128_CTX *pCtx = ctx->cipher_data;
-#else
-	ICA_AES_128_CTX *pCtx = (ICA_AES_128_CTX *) EVP_CIPHER_CTX_get_cipher_data(ctx);
-#endif
-	ica_aes_vector_t pre_iv;
+	enum ibmca_stat stat = IBMCA_STAT_TDES_CMAC;
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_3des_cmac_intermediate(msg, len, key, iv);
 
-	if (inlen > UINT32_MAX) {
-		IBMCAerr(IBMCA_F_IBMCA_AES_128_CIPHER, IBMCA_R_OUTLEN_TO_LARGE);
-		return 0;
-	}
-	len = inlen;
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
 
-	if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_ECB_MODE) {
-		mode = MODE_ECB;
-	} else if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_CBC_MODE) {
-		mode = MODE_CBC;
-	} else if ((EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_CFB_MODE) &&
-		   (EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_OFB_MODE)) {
-		IBMCAerr(IBMCA_F_IBMCA_AES_128_CIPHER,
-			 IBMCA_R_CIPHER_MODE_NOT_SUPPORTED);
-		return 0;
-	}
+static inline unsigned int ibmca_ica_3des_cmac_last(const unsigned char *msg,
+		unsigned long len, unsigned char *mac, unsigned int mac_length,
+		const unsigned char *key, unsigned char *iv,
+		unsigned int direction)
+{
+	enum ibmca_stat stat = IBMCA_STAT_TDES_CMAC;
+	uint64_t start = ibmca_stat_start(stat, len);
+	unsigned int rc = p_ica_3des_cmac_last(msg, len, mac, mac_length, key,
+					       iv, direction);
 
-#ifdef OLDER_OPENSSL
-	if (ctx->encrypt) {
-#else
-	if (EVP_CIPHER_CTX_encrypting(ctx)) {
-#endif
-		if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_CFB_MODE) {
-			rv = p_ica_aes_cfb(in, out, len, pCtx->key,
-					AES_KEY_LEN128,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					AES_BLOCK_SIZE, ICA_ENCRYPT);
-		} else if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_OFB_MODE) {
-			rv = p_ica_aes_ofb(in, out, len, pCtx->key,
-					AES_KEY_LEN128,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					ICA_ENCRYPT);
-		} else {
-			rv = p_ica_aes_encrypt(mode, len, (unsigned char *)in,
-#ifdef OLDER_OPENSSL
-				(ica_aes_vector_t *)ctx->iv,
-#else
-				(ica_aes_vector_t *)EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-				AES_KEY_LEN128,
-				(unsigned char *)pCtx->key,
-				out);
-		}
+	ibmca_stat_ica(stat, len, rc, start);
+	return rc;
+}
 
-		if (rv) {
-			IBMCAerr(IBMCA_F_IBMCA_AES_128_CIPHER,
-				 IBMCA_R_REQUEST_FAILED);
-			return 0;
-		} else if (EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_OFB_MODE) {
-#ifdef OLDER_OPENSSL
-			memcpy(ctx->iv,
-#else
-			memcpy(EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-			       out + len - EVP_CIPHER_CTX_iv_length(ctx),
-			       EVP_CIPHER_CTX_iv_length(ctx));
-		}
-	} else {
-		if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_CFB_MODE) {
-			/* Protect against decrypt in place */
-			/* FIXME: Again, check if EVP_CIPHER_CTX_iv_length() should be used */
-			memcpy(pre_iv, in + len - sizeof(pre_iv), sizeof(pre_iv));
+#ifndef OPENSSL_NO_AES_GCM
+static inline unsigned int ibmca_ica_aes_gcm_initialize(const unsigned char *iv,
+		unsigned int iv_length, unsigned char *key,
+		unsigned int key_length, unsigned char *icb, unsigned char *ucb,
+		unsigned char *subkey, unsigned int direction)
+{
+	enum ibmca_stat stat = GCM_STAT(key_length);
+	uint64_t start = ibmca_stat_start(stat, 0);
+	unsigned int rc = p_ica_aes_gcm_initialize(iv, iv_length, key,
+						   key_length, icb, ucb,
+						   subkey, direction);
 
-			rv = p_ica_aes_cfb(in, out, len, pCtx->key,
-					AES_KEY_LEN128,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					AES_BLOCK_SIZE, ICA_DECRYPT);
-		} else if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_OFB_MODE) {
-			rv = p_ica_aes_ofb(in, out, len, pCtx->key,
-					AES_KEY_LEN128,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					ICA_DECRYPT);
-		} else {
-			/* Protect against decrypt in place */
-			/* FIXME: Again, check if EVP_CIPHER_CTX_iv_length() should be used */
-			memcpy(pre_iv, in + len - sizeof(pre_iv), sizeof(pre_iv));
+	ibmca_stat_ica(stat, 0, rc, start);
+	return rc;
+}
 
-			rv = p_ica_aes_decrypt(mode, len, (unsigned char *)in,
-#ifdef OLDER_OPENSSL
-				(ica_aes_vector_t *)ctx->iv,
+static inline unsigned int ibmca_ica_aes_gcm_intermediate(
+		unsigned char *plaintext, unsigned long plaintext_length,
+		unsigned char *ciphertext, unsigned char *ucb,
+		unsigned char *aad, unsigned long aad_length,
+		unsigned char *tag, unsigned int tag_length,
+		unsigned char *key, unsigned int key_length,
+		unsigned char *subkey, unsigned int direction)
+{
+	enum ibmca_stat stat = GCM_STAT(key_length);
+	uint64_t start = ibmca_stat_start(stat, plaintext_length + aad_length);
+	unsigned int rc = p_ica_aes_gcm_intermediate(plaintext,
+			plaintext_length, ciphertext, ucb, aad, aad_length,
+			tag, tag_length, key, key_length, subkey, direction);
+
+	ibmca_stat_ica(stat, plaintext_length + aad_length, rc, start);
+	return rc;
+}
+
+static inline unsigned int ibmca_ica_aes_gcm_last(unsigned char *icb,
+		unsigned long aad_length, unsigned long ciph_length,
+		unsigned char *tag, unsigned char *final_tag,
+		unsigned int final_tag_length, unsigned char *key,
+		unsigned int key_length, unsigned char *subkey,
+		unsigned int direction)
+{
+	enum ibmca_stat stat = GCM_STAT(key_length);
+	uint64_t start = ibmca_stat_start(stat, 0);
+	unsigned int rc = p_ica_aes_gcm_last(icb, aad_length, ciph_length,
+					     tag, final_tag, final_tag_length,
+					     key, key_length, subkey,
+					     direction);
+
+	ibmca_stat_ica(stat, 0, rc, start);
+	return rc;
+}
+#endif
+
+/* utility function to obtain a context */
+static int get_context(ica_adapter_handle_t * p_handle)
+{
+	unsigned int status = 0;
+
+	status = p_ica_open_adapter(p_handle);
+	if (status != 0)
+		return 0;
+	return 1;
+}
+
+/* similarly to release one. */
+static void release_context(ica_adapter_handle_t i_handle)
+{
+	p_ica_close_adapter(i_handle);
+}
+
+/* Open up to n handles of the pool, returns how many could be opened */
+static unsigned int get_contexts(unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		if (!get_context(&ibmca_handles[i]))
+			break;
+	}
+	return i;
+}
+
+static void release_contexts(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ibmca_handle_count; i++)
+		release_context(ibmca_handles[i]);
+	ibmca_handle_count = 0;
+}
+
+static ica_adapter_handle_t ibmca_pkey_handle(void)
+{
+	unsigned int slot = ibmca_handle_tls;
+
+	if (slot == 0) {
+		slot = __atomic_fetch_add(&ibmca_handle_next, 1,
+					  __ATOMIC_RELAXED) + 1;
+		ibmca_handle_tls = slot;
+	}
+	return ibmca_handles[(slot - 1) % ibmca_handle_count];
+}
+
+/* initialisation functions. */
+#define BIND(dso, sym)	(p_##sym = (sym##_t)dlsym(dso, #sym))
+static void ibmca_unbind(void)
+{
+	if (ibmca_dso) {
+		dlclose(ibmca_dso);
+		ibmca_dso = NULL;
+	}
+	p_ica_open_adapter = NULL;
+	p_ica_close_adapter = NULL;
+	p_ica_rsa_mod_expo = NULL;
+	p_ica_random_number_generate = NULL;
+	p_ica_rsa_crt = NULL;
+	p_ica_sha1 = NULL;
+	p_ica_des_encrypt = NULL;
+	p_ica_des_decrypt = NULL;
+	p_ica_3des_encrypt = NULL;
+	p_ica_3des_decrypt = NULL;
+	p_ica_aes_encrypt = NULL;
+	p_ica_aes_decrypt = NULL;
+	p_ica_sha256 = NULL;
+	p_ica_sha512 = NULL;
+	p_ica_aes_ofb = NULL;
+	p_ica_des_ofb = NULL;
+	p_ica_3des_ofb = NULL;
+	p_ica_aes_cfb = NULL;
+	p_ica_aes_ctr = NULL;
+	p_ica_aes_xts = NULL;
+	p_ica_aes_ccm = NULL;
+	p_ica_aes_cmac_intermediate = NULL;
+	p_ica_aes_cmac_last = NULL;
+	p_ica_3des_cmac_intermediate = NULL;
+	p_ica_3des_cmac_last = NULL;
+	p_ica_des_cfb = NULL;
+	p_ica_3des_cfb = NULL;
+	p_ica_3des_ctr = NULL;
+#ifndef OPENSSL_NO_AES_GCM
+	p_ica_aes_gcm_initialize = NULL;
+	p_ica_aes_gcm_intermediate = NULL;
+	p_ica_aes_gcm_last = NULL;
+#endif
+}
+
+static CRYPTO_ONCE ibmca_load_once = CRYPTO_ONCE_STATIC_INIT;
+static int ibmca_load_tried, ibmca_loaded;
+
+static void ibmca_load_libica(void)
+{
+	ibmca_load_tried = 1;
+
+	/* Attempt to load libica.so. Needs to be
+	 * changed unfortunately because the Ibmca drivers don't have
+	 * standard library names that can be platform-translated well. */
+	/* TODO: Work out how to actually map to the names the Ibmca
+	 * drivers really use - for now a symbollic link needs to be
+	 * created on the host system from libica.so to ica.so on
+	 * unix variants. */
+
+	/* WJH XXX check name translation */
+
+	ibmca_dso = dlopen(LIBICA_NAME, RTLD_NOW);
+	if (ibmca_dso == NULL) {
+		IBMCAerr(IBMCA_F_IBMCA_INIT, IBMCA_R_DSO_FAILURE);
+		return;
+	}
+
+	if (!BIND(ibmca_dso, ica_open_adapter)
+	    || !BIND(ibmca_dso, ica_close_adapter)
+	    || !BIND(ibmca_dso, ica_rsa_mod_expo)
+	    || !BIND(ibmca_dso, ica_random_number_generate)
+	    || !BIND(ibmca_dso, ica_rsa_crt)
+	    || !BIND(ibmca_dso, ica_sha1)
+	    || !BIND(ibmca_dso, ica_des_encrypt)
+	    || !BIND(ibmca_dso, ica_des_decrypt)
+	    || !BIND(ibmca_dso, ica_3des_encrypt)
+	    || !BIND(ibmca_dso, ica_3des_decrypt)
+	    || !BIND(ibmca_dso, ica_aes_encrypt)
+	    || !BIND(ibmca_dso, ica_aes_decrypt)
+	    || !BIND(ibmca_dso, ica_sha256)
+	    || !BIND(ibmca_dso, ica_sha512)
+	    || !BIND(ibmca_dso, ica_aes_ofb)
+	    || !BIND(ibmca_dso, ica_des_ofb)
+	    || !BIND(ibmca_dso, ica_3des_ofb)
+	    || !BIND(ibmca_dso, ica_aes_cfb)
+	    || !BIND(ibmca_dso, ica_aes_ctr)
+	    || !BIND(ibmca_dso, ica_aes_xts)
+	    || !BIND(ibmca_dso, ica_aes_ccm)
+	    || !BIND(ibmca_dso, ica_aes_cmac_intermediate)
+	    || !BIND(ibmca_dso, ica_aes_cmac_last)
+	    || !BIND(ibmca_dso, ica_3des_cmac_intermediate)
+	    || !BIND(ibmca_dso, ica_3des_cmac_last)
+	    || !BIND(ibmca_dso, ica_des_cfb)
+	    || !BIND(ibmca_dso, ica_get_functionlist)
+	    || !BIND(ibmca_dso, ica_3des_cfb)
+	    || !BIND(ibmca_dso, ica_3des_ctr)
+#ifndef OPENSSL_NO_AES_GCM
+	    || !BIND(ibmca_dso, ica_aes_gcm_initialize)
+	    || !BIND(ibmca_dso, ica_aes_gcm_intermediate)
+	    || !BIND(ibmca_dso, ica_aes_gcm_last)
+#endif
+	   ) {
+		IBMCAerr(IBMCA_F_IBMCA_INIT, IBMCA_R_DSO_FAILURE);
+		goto err;
+	}
+
+	if (!set_supported_meths())
+		goto err;
+
+	ibmca_loaded = 1;
+	pthread_atfork(NULL, NULL, ibmca_atfork_child);
+	return;
+err:
+	ibmca_unbind();
+}
+
+/*
+ * libica is loaded, and the supported ciphers and digests are looked up,
+ * once per process on the first use of the engine. Returns whether libica
+ * is usable.
+ */
+static int ibmca_load(void)
+{
+	if (!CRYPTO_THREAD_run_once(&ibmca_load_once, ibmca_load_libica))
+		return 0;
+	return ibmca_loaded;
+}
+
+/*
+ * The card watcher rescans the crypto cards when the kernel reports a
+ * change on the AP bus, and every card_watch_interval seconds in case the
+ * uevent is missed or cannot be received (e.g. for a test AP_PATH).
+ * ibmca_pkey_usable() picks up the new state on the next operation.
+ */
+#define IBMCA_CARD_WATCH_MAX	86400	/* seconds, keeps poll()'s ms an int */
+
+static pthread_t card_watcher;
+static int card_watcher_running;
+static int card_watch_pipe[2] = { -1, -1 };
+static int card_watch_sock = -1;	/* uevent socket, -1 if none */
+
+static int uevent_is_ap(const char *buf, ssize_t len)
+{
+	const char *p;
+
+	for (p = buf; p < buf + len; p += strlen(p) + 1) {
+		if (!strcmp(p, "SUBSYSTEM=ap"))
+			return 1;
+	}
+	return 0;
+}
+
+static void *ibmca_card_watch(void *arg)
+{
+	struct pollfd pfd[2];
+	char buf[4096];
+	ssize_t len;
+	int nfds, rescan, rc;
+
+	pfd[0].fd = card_watch_pipe[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd = card_watch_sock;
+	pfd[1].events = POLLIN;
+	nfds = card_watch_sock >= 0 ? 2 : 1;
+
+	for (;;) {
+		rc = poll(pfd, nfds, (int)card_watch_interval * 1000);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		/*
+		 * Anything else will not go away by polling again. Without
+		 * the uevent socket, the interval rescan is still done; if
+		 * even the pipe alone cannot be polled, give up watching.
+		 * The socket is closed by ibmca_card_watch_stop().
+		 */
+		if (rc < 0) {
+			if (nfds == 1)
+				break;
+			nfds = 1;
+			continue;
+		}
+		if (pfd[0].revents)
+			break;
+		rescan = (rc == 0);
+		if (nfds == 2 && (pfd[1].revents & POLLIN)) {
+			len = recv(pfd[1].fd, buf, sizeof(buf) - 1, 0);
+			if (len > 0) {
+				buf[len] = '\0';
+				rescan |= uevent_is_ap(buf, len);
+			}
+		}
+		if (rescan)
+			__atomic_store_n(&card_loaded, is_crypto_card_loaded(),
+					 __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void ibmca_card_watch_close(void)
+{
+	int *fds[] = { &card_watch_pipe[0], &card_watch_pipe[1],
+		       &card_watch_sock };
+	size_t i;
+
+	for (i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+		if (*fds[i] >= 0)
+			close(*fds[i]);
+		*fds[i] = -1;
+	}
+}
+
+/*
+ * The uevent socket is opened here rather than in the watcher, so that a
+ * child of fork() knows it and can close it.
+ */
+static void ibmca_card_watch_start(void)
+{
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK, .nl_groups = 1 };
+
+	if (card_watch_interval <= 0 || pipe(card_watch_pipe))
+		return;
+	card_watch_sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+				 NETLINK_KOBJECT_UEVENT);
+	if (card_watch_sock >= 0
+	    && bind(card_watch_sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(card_watch_sock);
+		card_watch_sock = -1;
+	}
+	if (pthread_create(&card_watcher, NULL, ibmca_card_watch, NULL)) {
+		ibmca_card_watch_close();
+		return;
+	}
+	card_watcher_running = 1;
+}
+
+static void ibmca_card_watch_stop(void)
+{
+	if (!card_watcher_running)
+		return;
+	close(card_watch_pipe[1]);
+	card_watch_pipe[1] = -1;
+	pthread_join(card_watcher, NULL);
+	ibmca_card_watch_close();
+	card_watcher_running = 0;
+}
+
+/*
+ * RSA, DSA and DH need an adapter handle, which is opened on their first
+ * use. Whenever libica cannot do mod-expo or CRT, because the algorithm
+ * needs a crypto card and none is online, they are done in software.
+ */
+static CRYPTO_ONCE ibmca_pkey_once = CRYPTO_ONCE_STATIC_INIT;
+static int pkey_open;
+static unsigned int pkey_me_flags, pkey_crt_flags;
+
+static void ibmca_pkey_open(void)
+{
+	unsigned int hw = ICA_FLAG_SHW | ICA_FLAG_DHW;
+	unsigned int me, crt;
+
+	if (!ibmca_load())
+		return;
+	me = ibmca_algo_flags_get(RSA_ME);
+	crt = ibmca_algo_flags_get(RSA_CRT);
+	if (!(me & hw) && !(crt & hw))
+		return;
+	/* a short pool still spreads the load; none at all is a failure */
+	ibmca_handle_count = get_contexts(adapter_handles);
+	if (ibmca_handle_count == 0) {
+		IBMCAerr(IBMCA_F_IBMCA_INIT, IBMCA_R_UNIT_FAILURE);
+		return;
+	}
+	pkey_me_flags = me;
+	pkey_crt_flags = crt;
+	pkey_open = 1;
+	if ((me | crt) & ICA_FLAG_DHW)
+		ibmca_card_watch_start();
+}
+
+/* set in a child of fork() whose parent ran the card watcher */
+static int card_watch_restart;
+
+static int ibmca_pkey_usable(int crt)
+{
+	if (!CRYPTO_THREAD_run_once(&ibmca_pkey_once, ibmca_pkey_open)
+	    || !pkey_open)
+		return 0;
+	if (__atomic_load_n(&card_watch_restart, __ATOMIC_RELAXED)
+	    && __atomic_exchange_n(&card_watch_restart, 0, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&card_loaded, is_crypto_card_loaded(),
+				 __ATOMIC_RELAXED);
+		ibmca_card_watch_start();
+	}
+	return ibmca_flags_enabled(crt ? pkey_crt_flags : pkey_me_flags);
+}
+
+static CRYPTO_ONCE ibmca_rand_once = CRYPTO_ONCE_STATIC_INIT;
+static int rand_ok;
+
+static void ibmca_rand_open(void)
+{
+	rand_ok = ibmca_load() && ibmca_algo_enabled(P_RNG);
+}
+
+static int ibmca_rand_usable(void)
+{
+	if (!CRYPTO_THREAD_run_once(&ibmca_rand_once, ibmca_rand_open))
+		return 0;
+	return rand_ok;
+}
+
+/*
+ * A child of fork() inherits the adapter handle, the card watcher's pipe
+ * without its thread, and the parent's statistics. Only the child runs
+ * this, so the parent never waits on it, and the child is still single
+ * threaded here: the handle is swapped for its own and the statistics
+ * start from zero. The card watcher is restarted on the first RSA, DSA
+ * or DH operation of the child.
+ */
+static void ibmca_atfork_child(void)
+{
+	ibmca_stats_reset();
+	if (pkey_open) {
+		release_contexts();
+		ibmca_handle_count = get_contexts(adapter_handles);
+		if (ibmca_handle_count == 0)
+			pkey_open = 0;
+	}
+	/* the watcher thread is gone, but not its pipe and socket */
+	if (card_watcher_running) {
+		ibmca_card_watch_close();
+		card_watcher_running = 0;
+		card_watch_restart = 1;
+	}
+}
+
+/* libica stays loaded until the process (or the engine DSO) goes away. */
+__attribute__((destructor)) static void ibmca_unload(void)
+{
+	if (!ibmca_loaded)
+		return;
+	ibmca_card_watch_stop();
+	if (pkey_open)
+		release_contexts();
+	ibmca_unbind();
+	ibmca_loaded = 0;
+}
+
+/*
+ * OpenSSL calls this with its global engine lock held, so libica is not
+ * loaded here but on first use.
+ */
+static int ibmca_init(ENGINE * e)
+{
+	return 1;
+}
+
+static void ibmca_stats_dump(void)
+{
+	FILE *fp = stderr;
+
+	if (stats_dump_path[0] == '\0')
+		return;
+	if (strcmp(stats_dump_path, "-") && !(fp = fopen(stats_dump_path, "a")))
+		return;
+	ibmca_stats_print(fp, NULL, 0);
+	ibmca_latency_print(fp, NULL, 0);
+	if (fp != stderr)
+		fclose(fp);
+}
+
+static int ibmca_finish(ENGINE * e)
+{
+	ibmca_stats_dump();
+	return 1;
+}
+
+static int ibmca_ctrl(ENGINE * e, int cmd, long i, void *p, void (*f) ())
+{
+	int len;
+
+	switch (cmd) {
+	case IBMCA_CMD_SO_PATH:
+		if (p == NULL) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL,
+				 ERR_R_PASSED_NULL_PARAMETER);
+			return 0;
+		}
+		/* libica is loaded on first use and stays loaded */
+		if (ibmca_load_tried) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_ALREADY_LOADED);
+			return 0;
+		}
+		strncpy(libica_path, (const char *) p, sizeof(libica_path) - 1);
+		LIBICA_NAME = libica_path;
+		return 1;
+	case IBMCA_CMD_GET_STATS:
+	case IBMCA_CMD_GET_LATENCY:
+		/* Without a buffer (e.g. "openssl engine -post GET_STATS")
+		 * the report goes to stdout. ENGINE_ctrl() callers pass a
+		 * buffer of i bytes and get the report length back. */
+		if (p == NULL) {
+			if (cmd == IBMCA_CMD_GET_STATS)
+				ibmca_stats_print(stdout, NULL, 0);
+			else
+				ibmca_latency_print(stdout, NULL, 0);
+			return 1;
+		}
+		if (i <= 0) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_OUTLEN_TO_LARGE);
+			return 0;
+		}
+		if (cmd == IBMCA_CMD_GET_STATS)
+			len = ibmca_stats_print(NULL, p, i);
+		else
+			len = ibmca_latency_print(NULL, p, i);
+		if (len >= i) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_OUTLEN_TO_LARGE);
+			return 0;
+		}
+		return len > 0 ? len : 1;
+	case IBMCA_CMD_STATS_DUMP:
+		if (p == NULL) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL,
+				 ERR_R_PASSED_NULL_PARAMETER);
+			return 0;
+		}
+		if (strlen((const char *) p) >= sizeof(stats_dump_path)) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_OPERANDS_TO_LARGE);
+			return 0;
+		}
+		strcpy(stats_dump_path, (const char *) p);
+		return 1;
+	case IBMCA_CMD_CAPS_CACHE:
+		if (p == NULL) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL,
+				 ERR_R_PASSED_NULL_PARAMETER);
+			return 0;
+		}
+		/* the cache is read when libica is loaded */
+		if (ibmca_load_tried) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_ALREADY_LOADED);
+			return 0;
+		}
+		if (strlen((const char *) p) >= sizeof(caps_cache_path)) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_OPERANDS_TO_LARGE);
+			return 0;
+		}
+		strcpy(caps_cache_path, (const char *) p);
+		return 1;
+	case IBMCA_CMD_AP_PATH:
+		if (p == NULL) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL,
+				 ERR_R_PASSED_NULL_PARAMETER);
+			return 0;
+		}
+		if (ibmca_load_tried) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_ALREADY_LOADED);
+			return 0;
+		}
+		if (strlen((const char *) p) >= sizeof(ap_path)) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_OPERANDS_TO_LARGE);
+			return 0;
+		}
+		strcpy(ap_path, (const char *) p);
+		return 1;
+	case IBMCA_CMD_CARD_WATCH:
+		/* the watcher is started with the adapter */
+		if (ibmca_load_tried) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_ALREADY_LOADED);
+			return 0;
+		}
+		if (i < 0 || i > IBMCA_CARD_WATCH_MAX) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_INVALID_ARGUMENT);
+			return 0;
+		}
+		card_watch_interval = i;
+		return 1;
+	case IBMCA_CMD_ADAPTER_HANDLES:
+		/* the handles are opened with the first RSA, DSA or DH */
+		if (ibmca_load_tried) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_ALREADY_LOADED);
+			return 0;
+		}
+		if (i < 1 || i > IBMCA_MAX_HANDLES) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_INVALID_ARGUMENT);
+			return 0;
+		}
+		adapter_handles = i;
+		return 1;
+	case IBMCA_CMD_ENABLE_ALGORITHMS:
+	case IBMCA_CMD_DISABLE_ALGORITHMS:
+		if (p == NULL) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL,
+				 ERR_R_PASSED_NULL_PARAMETER);
+			return 0;
+		}
+		/* the lists are built when libica is loaded */
+		if (ibmca_load_tried) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_ALREADY_LOADED);
+			return 0;
+		}
+		if (strlen((const char *) p) >= sizeof(algos_enabled)) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_OPERANDS_TO_LARGE);
+			return 0;
+		}
+		strcpy(cmd == IBMCA_CMD_ENABLE_ALGORITHMS ? algos_enabled :
+		       algos_disabled, (const char *) p);
+		return 1;
+	case IBMCA_CMD_SW_CROSSOVER:
+		if (p == NULL) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL,
+				 ERR_R_PASSED_NULL_PARAMETER);
+			return 0;
+		}
+		/* check all of it before anything is changed */
+		if (!ibmca_set_crossover((const char *) p, 0)) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_INVALID_ARGUMENT);
+			return 0;
+		}
+		ibmca_set_crossover((const char *) p, 1);
+		return 1;
+	case IBMCA_CMD_TUNING_FILE:
+		if (p == NULL) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL,
+				 ERR_R_PASSED_NULL_PARAMETER);
+			return 0;
+		}
+		if (!ibmca_tuning_read((const char *) p)) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_INVALID_ARGUMENT);
+			return 0;
+		}
+		return 1;
+	case IBMCA_CMD_CALIBRATE_THREADS:
+		if (i < 1 || i > 1024) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_INVALID_ARGUMENT);
+			return 0;
+		}
+		calibrate_threads = i;
+		return 1;
+	case IBMCA_CMD_CALIBRATE:
+		if (p == NULL) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL,
+				 ERR_R_PASSED_NULL_PARAMETER);
+			return 0;
+		}
+		if (!ibmca_load()) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_DSO_FAILURE);
+			return 0;
+		}
+		if (!ibmca_tuning_calibrate(e, (const char *) p,
+					    calibrate_threads,
+					    ibmca_pkey_usable(0)
+					    && ibmca_pkey_usable(1))) {
+			IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_REQUEST_FAILED);
+			return 0;
+		}
+		return 1;
+	default:
+		break;
+	}
+	IBMCAerr(IBMCA_F_IBMCA_CTRL, IBMCA_R_CTRL_COMMAND_NOT_IMPLEMENTED);
+	return 0;
+}
+
+/*
+ * Everything ibmca can offer. ENGINE_register_*() and
+ * ENGINE_set_default_*() ask for the NID lists when the configuration is
+ * loaded; they are answered from here so that libica is not loaded, and
+ * the crypto cards are not scanned, before the engine is used. A NID that
+ * libica then turns out not to do is served by OpenSSL's own
+ * implementation.
+ */
+static const int ibmca_all_cipher_nids[] = {
+	NID_des_ecb, NID_des_cbc, NID_des_ofb, NID_des_cfb,
+	NID_des_ede3_ecb, NID_des_ede3_cbc, NID_des_ede3_ofb,
+	NID_des_ede3_cfb,
+	NID_aes_128_ecb, NID_aes_192_ecb, NID_aes_256_ecb,
+	NID_aes_128_cbc, NID_aes_192_cbc, NID_aes_256_cbc,
+	NID_aes_128_ofb, NID_aes_192_ofb, NID_aes_256_ofb,
+	NID_aes_128_cfb, NID_aes_192_cfb, NID_aes_256_cfb,
+	NID_aes_128_ctr, NID_aes_192_ctr, NID_aes_256_ctr,
+	NID_aes_128_xts, NID_aes_256_xts,
+#ifndef OPENSSL_NO_AES_GCM
+	NID_aes_128_gcm, NID_aes_192_gcm, NID_aes_256_gcm,
+#endif
+#ifndef OPENSSL_NO_AES_CCM
+	NID_aes_128_ccm, NID_aes_192_ccm, NID_aes_256_ccm,
+#endif
+#ifndef OPENSSL_NO_AES_CBC_HMAC
+	NID_aes_128_cbc_hmac_sha1, NID_aes_256_cbc_hmac_sha1,
+	NID_aes_128_cbc_hmac_sha256, NID_aes_256_cbc_hmac_sha256,
+#endif
+	NID_undef
+};
+
+static const int ibmca_all_digest_nids[] = {
+#ifndef OPENSSL_NO_SHA1
+	NID_sha1,
+#endif
+#ifndef OPENSSL_NO_SHA256
+	NID_sha256,
+#endif
+#ifndef OPENSSL_NO_SHA512
+	NID_sha512,
+#endif
+	NID_undef
+};
+
+static const int ibmca_all_pkey_nids[] = {
+#ifndef OPENSSL_NO_CMAC
+	EVP_PKEY_CMAC,
+#endif
+#ifndef OPENSSL_NO_HMAC
+	EVP_PKEY_HMAC,
+#endif
+	NID_undef
+};
+
+/*
+ * The NIDs of all that ENABLE_ALGORITHMS and DISABLE_ALGORITHMS allow,
+ * plus extra unless it is NID_undef. OpenSSL asks under its engine lock.
+ */
+static int ibmca_all_nids(const int *all, int extra, int *list,
+			  const int **nids)
+{
+	int n = 0;
+
+	for (; *all != NID_undef; all++) {
+		if (ibmca_nid_allowed(*all))
+			list[n++] = *all;
+	}
+	if (extra != NID_undef && ibmca_nid_allowed(extra))
+		list[n++] = extra;
+	if (nids)
+		*nids = list;
+	return n;
+}
+
+/*
+ * ENGINE calls this to find out how to deal with
+ * a particular NID in the ENGINE.
+ */
+static int ibmca_engine_ciphers(ENGINE * e, const EVP_CIPHER ** cipher,
+				const int **nids, int nid)
+{
+	static int list[sizeof(ibmca_all_cipher_nids) /
+			sizeof(ibmca_all_cipher_nids[0])];
+
+	if (!cipher)
+		return ibmca_all_nids(ibmca_all_cipher_nids,
+				      NID_des_ede3_ctr, list, nids);
+
+	if (!ibmca_load()
+	    || (*cipher = crypto_pair_lookup(&ibmca_cipher_lists, nid))
+	       == NULL)
+		*cipher = EVP_get_cipherbynid(nid);
+	return (*cipher != NULL);
+}
+
+/*
+ * Do an AES ECB, CBC, CFB or OFB request below the crossover with
+ * OpenSSL's AES code. The key schedule is set up on the first such
+ * request of the context. Only whole blocks are handled, so the IV
+ * leaves in the same state as after the libica request.
+ */
+static int ibmca_aes_sw_cipher(EVP_CIPHER_CTX *ctx, AES_KEY *sw_key,
+			       int *sw_key_dir, const unsigned char *key,
+			       int bits, enum ibmca_stat ecb_stat,
+			       unsigned char *out, const unsigned char *in,
+			       size_t len)
+{
+	int mode = EVP_CIPHER_CTX_mode(ctx);
+	unsigned char *iv = EVP_CIPHER_CTX_iv_noconst(ctx);
+	int dir = AES_ENCRYPT, num = 0;
+	size_t i;
+
+	if ((mode == EVP_CIPH_ECB_MODE || mode == EVP_CIPH_CBC_MODE)
+	    && !EVP_CIPHER_CTX_encrypting(ctx))
+		dir = AES_DECRYPT;
+	if (*sw_key_dir != dir + 1) {
+		if ((dir == AES_ENCRYPT ? AES_set_encrypt_key(key, bits, sw_key)
+		     : AES_set_decrypt_key(key, bits, sw_key)) != 0)
+			return 0;
+		*sw_key_dir = dir + 1;
+	}
+
+	ibmca_stat_fallback(ecb_stat + mode - 1, len);
+	switch (mode) {
+	case EVP_CIPH_ECB_MODE:
+		for (i = 0; i < len; i += AES_BLOCK_SIZE)
+			AES_ecb_encrypt(in + i, out + i, sw_key, dir);
+		break;
+	case EVP_CIPH_CBC_MODE:
+		AES_cbc_encrypt(in, out, len, sw_key, iv, dir);
+		break;
+	case EVP_CIPH_CFB_MODE:
+		AES_cfb128_encrypt(in, out, len, sw_key, iv, &num,
+				   EVP_CIPHER_CTX_encrypting(ctx));
+		break;
+	case EVP_CIPH_OFB_MODE:
+		AES_ofb128_encrypt(in, out, len, sw_key, iv, &num);
+		break;
+	default:
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * How a handler carries the IV over to the next request. libica updates
+ * the IV itself for OFB; ECB has none.
+ */
+#define IBMCA_IV_NONE	0
+#define IBMCA_IV_OUT	1	/* the last ciphertext block written */
+#define IBMCA_IV_IN	2	/* the last ciphertext block read */
+
+/*
+ * Define handler name for contexts of type ctx_t. sw may return early
+ * with a software result; call is the libica request, which sees the
+ * context as pCtx, the IV as iv and the length as len. Requests longer
+ * than IBMCA_CHUNK are made in chunks, in and out advancing over them.
+ */
+#define IBMCA_CIPHER_FN(name, ctx_t, fcode, ivlen, chain, sw, call)	\
+static int name(EVP_CIPHER_CTX *ctx, unsigned char *out,		\
+		const unsigned char *in, size_t inlen)			\
+{									\
+	ctx_t *pCtx = EVP_CIPHER_CTX_get_cipher_data(ctx);		\
+	unsigned char *iv = EVP_CIPHER_CTX_iv_noconst(ctx);		\
+	unsigned char pre_iv[ivlen];					\
+	unsigned int len;						\
+									\
+	sw;								\
+	do {								\
+		len = inlen > IBMCA_CHUNK ? IBMCA_CHUNK : inlen;	\
+		/* Protect against decrypt in place */			\
+		if (chain == IBMCA_IV_IN && len >= ivlen)		\
+			memcpy(pre_iv, in + len - ivlen, ivlen);	\
+		if (call) {						\
+			IBMCAerr(fcode, IBMCA_R_REQUEST_FAILED);	\
+			return 0;					\
+		}							\
+		if (chain == IBMCA_IV_OUT && len >= ivlen)		\
+			memcpy(iv, out + len - ivlen, ivlen);		\
+		else if (chain == IBMCA_IV_IN && len >= ivlen)		\
+			memcpy(iv, pre_iv, ivlen);			\
+		in += len;						\
+		out += len;						\
+		inlen -= len;						\
+	} while (inlen);						\
+	return 1;							\
+}
+
+/*
+ * CTR keeps the unused rest of the last keystream block in the context
+ * buffer, and its offset in num, like OpenSSL's CRYPTO_ctr128_encrypt().
+ * A request uses up that rest first, hands all whole blocks to libica in
+ * a single call and takes a fresh keystream block for its tail. libica
+ * counts the counter (the IV) up in place. call encrypts n bytes from src
+ * to dst.
+ */
+#define IBMCA_CTR_FN(name, ctx_t, fcode, blk, call)			\
+static int name(EVP_CIPHER_CTX *ctx, unsigned char *out,		\
+		const unsigned char *in, size_t inlen)			\
+{									\
+	static const unsigned char zero[blk];				\
+	ctx_t *pCtx = EVP_CIPHER_CTX_get_cipher_data(ctx);		\
+	unsigned char *iv = EVP_CIPHER_CTX_iv_noconst(ctx);		\
+	unsigned char *ks = EVP_CIPHER_CTX_buf_noconst(ctx);		\
+	unsigned int num = EVP_CIPHER_CTX_num(ctx);			\
+	const unsigned char *src;					\
+	unsigned char *dst;						\
+	size_t n;							\
+									\
+	for (; num && inlen; inlen--) {					\
+		*out++ = *in++ ^ ks[num];				\
+		num = (num + 1) % (blk);				\
+	}								\
+	src = in;							\
+	dst = out;							\
+	n = inlen - inlen % (blk);					\
+	if (n && (call))						\
+		goto err;						\
+	if (inlen > n) {						\
+		src = zero;						\
+		dst = ks;						\
+		in += n;						\
+		out += n;						\
+		inlen -= n;						\
+		n = (blk);						\
+		if (call)						\
+			goto err;					\
+		for (n = 0; n < inlen; n++)				\
+			out[n] = in[n] ^ ks[n];				\
+		num = inlen;						\
+	}								\
+	EVP_CIPHER_CTX_set_num(ctx, num);				\
+	return 1;							\
+err:									\
+	IBMCAerr(fcode, IBMCA_R_REQUEST_FAILED);			\
+	return 0;							\
+}
+
+/*
+ * Handlers of a cipher, indexed by EVP mode - 1 (ECB, CBC, CFB, OFB,
+ * CTR). NULL where libica does not have the mode.
+ */
+struct ibmca_cipher_fns {
+	int fcode;
+	ibmca_cipher_fn enc[5];
+	ibmca_cipher_fn dec[5];
+};
+
+#define IBMCA_DES_FNS(alg, ica, key_t, fcode, ctr)			\
+IBMCA_CIPHER_FN(ibmca_##alg##_ecb_enc, ICA_DES_CTX, fcode,		\
+		sizeof(ica_des_vector_t), IBMCA_IV_NONE, (void)0,	\
+		ibmca_ica_##ica##_encrypt(MODE_ECB, len,		\
+				(unsigned char *)in,			\
+				(ica_des_vector_t *)iv,			\
+				(key_t *)pCtx->key, out))		\
+IBMCA_CIPHER_FN(ibmca_##alg##_ecb_dec, ICA_DES_CTX, fcode,		\
+		sizeof(ica_des_vector_t), IBMCA_IV_NONE, (void)0,	\
+		ibmca_ica_##ica##_decrypt(MODE_ECB, len,		\
+				(unsigned char *)in,			\
+				(ica_des_vector_t *)iv,			\
+				(key_t *)pCtx->key, out))		\
+IBMCA_CIPHER_FN(ibmca_##alg##_cbc_enc, ICA_DES_CTX, fcode,		\
+		sizeof(ica_des_vector_t), IBMCA_IV_OUT, (void)0,	\
+		ibmca_ica_##ica##_encrypt(MODE_CBC, len,		\
+				(unsigned char *)in,			\
+				(ica_des_vector_t *)iv,			\
+				(key_t *)pCtx->key, out))		\
+IBMCA_CIPHER_FN(ibmca_##alg##_cbc_dec, ICA_DES_CTX, fcode,		\
+		sizeof(ica_des_vector_t), IBMCA_IV_IN, (void)0,		\
+		ibmca_ica_##ica##_decrypt(MODE_CBC, len,		\
+				(unsigned char *)in,			\
+				(ica_des_vector_t *)iv,			\
+				(key_t *)pCtx->key, out))		\
+IBMCA_CIPHER_FN(ibmca_##alg##_cfb_enc, ICA_DES_CTX, fcode,		\
+		sizeof(ica_des_vector_t), IBMCA_IV_OUT, (void)0,	\
+		ibmca_ica_##ica##_cfb(in, out, len, pCtx->key, iv, 8,	\
+				      ICA_ENCRYPT))			\
+IBMCA_CIPHER_FN(ibmca_##alg##_cfb_dec, ICA_DES_CTX, fcode,		\
+		sizeof(ica_des_vector_t), IBMCA_IV_IN, (void)0,		\
+		ibmca_ica_##ica##_cfb(in, out, len, pCtx->key, iv, 8,	\
+				      ICA_DECRYPT))			\
+IBMCA_CIPHER_FN(ibmca_##alg##_ofb_enc, ICA_DES_CTX, fcode,		\
+		sizeof(ica_des_vector_t), IBMCA_IV_NONE, (void)0,	\
+		ibmca_ica_##ica##_ofb(in, out, len, pCtx->key, iv,	\
+				      ICA_ENCRYPT))			\
+IBMCA_CIPHER_FN(ibmca_##alg##_ofb_dec, ICA_DES_CTX, fcode,		\
+		sizeof(ica_des_vector_t), IBMCA_IV_NONE, (void)0,	\
+		ibmca_ica_##ica##_ofb(in, out, len, pCtx->key, iv,	\
+				      ICA_DECRYPT))			\
+static const struct ibmca_cipher_fns ibmca_##alg##_fns = {		\
+	fcode,								\
+	{ ibmca_##alg##_ecb_enc, ibmca_##alg##_cbc_enc,			\
+	  ibmca_##alg##_cfb_enc, ibmca_##alg##_ofb_enc, ctr },		\
+	{ ibmca_##alg##_ecb_dec, ibmca_##alg##_cbc_dec,			\
+	  ibmca_##alg##_cfb_dec, ibmca_##alg##_ofb_dec, ctr },		\
+};
+
+/* Whole blocks below the crossover are left to OpenSSL */
+#define IBMCA_AES_SW(kbits)						\
+	if (inlen % AES_BLOCK_SIZE == 0					\
+	    && ibmca_route(EVP_CIPHER_CTX_nid(ctx), inlen)		\
+	       == IBMCA_ROUTE_SW)					\
+		return ibmca_aes_sw_cipher(ctx, &pCtx->sw_key,		\
+					   &pCtx->sw_key_dir, pCtx->key,\
+					   kbits,			\
+					   IBMCA_STAT_AES_##kbits##_ECB,\
+					   out, in, inlen)
+
+#define IBMCA_AES_FNS(kbits)						\
+IBMCA_CIPHER_FN(ibmca_aes_##kbits##_ecb_enc, ICA_AES_##kbits##_CTX,	\
+		IBMCA_F_IBMCA_AES_##kbits##_CIPHER, AES_BLOCK_SIZE,	\
+		IBMCA_IV_NONE, IBMCA_AES_SW(kbits),			\
+		ibmca_ica_aes_encrypt(MODE_ECB, len,			\
+				(unsigned char *)in,			\
+				(ica_aes_vector_t *)iv,			\
+				AES_KEY_LEN##kbits, pCtx->key, out))	\
+IBMCA_CIPHER_FN(ibmca_aes_##kbits##_ecb_dec, ICA_AES_##kbits##_CTX,	\
+		IBMCA_F_IBMCA_AES_##kbits##_CIPHER, AES_BLOCK_SIZE,	\
+		IBMCA_IV_NONE, IBMCA_AES_SW(kbits),			\
+		ibmca_ica_aes_decrypt(MODE_ECB, len,			\
+				(unsigned char *)in,			\
+				(ica_aes_vector_t *)iv,			\
+				AES_KEY_LEN##kbits, pCtx->key, out))	\
+IBMCA_CIPHER_FN(ibmca_aes_##kbits##_cbc_enc, ICA_AES_##kbits##_CTX,	\
+		IBMCA_F_IBMCA_AES_##kbits##_CIPHER, AES_BLOCK_SIZE,	\
+		IBMCA_IV_OUT, IBMCA_AES_SW(kbits),			\
+		ibmca_ica_aes_encrypt(MODE_CBC, len,			\
+				(unsigned char *)in,			\
+				(ica_aes_vector_t *)iv,			\
+				AES_KEY_LEN##kbits, pCtx->key, out))	\
+IBMCA_CIPHER_FN(ibmca_aes_##kbits##_cbc_dec, ICA_AES_##kbits##_CTX,	\
+		IBMCA_F_IBMCA_AES_##kbits##_CIPHER, AES_BLOCK_SIZE,	\
+		IBMCA_IV_IN, IBMCA_AES_SW(kbits),			\
+		ibmca_ica_aes_decrypt(MODE_CBC, len,			\
+				(unsigned char *)in,			\
+				(ica_aes_vector_t *)iv,			\
+				AES_KEY_LEN##kbits, pCtx->key, out))	\
+IBMCA_CIPHER_FN(ibmca_aes_##kbits##_cfb_enc, ICA_AES_##kbits##_CTX,	\
+		IBMCA_F_IBMCA_AES_##kbits##_CIPHER, AES_BLOCK_SIZE,	\
+		IBMCA_IV_OUT, IBMCA_AES_SW(kbits),			\
+		ibmca_ica_aes_cfb(in, out, len, pCtx->key,		\
+				  AES_KEY_LEN##kbits, iv,		\
+				  AES_BLOCK_SIZE, ICA_ENCRYPT))		\
+IBMCA_CIPHER_FN(ibmca_aes_##kbits##_cfb_dec, ICA_AES_##kbits##_CTX,	\
+		IBMCA_F_IBMCA_AES_##kbits##_CIPHER, AES_BLOCK_SIZE,	\
+		IBMCA_IV_IN, IBMCA_AES_SW(kbits),			\
+		ibmca_ica_aes_cfb(in, out, len, pCtx->key,		\
+				  AES_KEY_LEN##kbits, iv,		\
+				  AES_BLOCK_SIZE, ICA_DECRYPT))		\
+IBMCA_CIPHER_FN(ibmca_aes_##kbits##_ofb_enc, ICA_AES_##kbits##_CTX,	\
+		IBMCA_F_IBMCA_AES_##kbits##_CIPHER, AES_BLOCK_SIZE,	\
+		IBMCA_IV_NONE, IBMCA_AES_SW(kbits),			\
+		ibmca_ica_aes_ofb(in, out, len, pCtx->key,		\
+				  AES_KEY_LEN##kbits, iv, ICA_ENCRYPT))	\
+IBMCA_CIPHER_FN(ibmca_aes_##kbits##_ofb_dec, ICA_AES_##kbits##_CTX,	\
+		IBMCA_F_IBMCA_AES_##kbits##_CIPHER, AES_BLOCK_SIZE,	\
+		IBMCA_IV_NONE, IBMCA_AES_SW(kbits),			\
+		ibmca_ica_aes_ofb(in, out, len, pCtx->key,		\
+				  AES_KEY_LEN##kbits, iv, ICA_DECRYPT))	\
+IBMCA_CTR_FN(ibmca_aes_##kbits##_ctr_crypt, ICA_AES_##kbits##_CTX,	\
+	     IBMCA_F_IBMCA_AES_##kbits##_CIPHER, AES_BLOCK_SIZE,	\
+	     ibmca_ica_aes_ctr(src, dst, n, pCtx->key,			\
+			       AES_KEY_LEN##kbits, iv,			\
+			       AES_BLOCK_SIZE * 8, ICA_ENCRYPT))	\
+static const struct ibmca_cipher_fns ibmca_aes_##kbits##_fns = {	\
+	IBMCA_F_IBMCA_AES_##kbits##_CIPHER,				\
+	{ ibmca_aes_##kbits##_ecb_enc, ibmca_aes_##kbits##_cbc_enc,	\
+	  ibmca_aes_##kbits##_cfb_enc, ibmca_aes_##kbits##_ofb_enc,	\
+	  ibmca_aes_##kbits##_ctr_crypt },				\
+	{ ibmca_aes_##kbits##_ecb_dec, ibmca_aes_##kbits##_cbc_dec,	\
+	  ibmca_aes_##kbits##_cfb_dec, ibmca_aes_##kbits##_ofb_dec,	\
+	  ibmca_aes_##kbits##_ctr_crypt },				\
+};
+
+IBMCA_CTR_FN(ibmca_tdes_ctr_crypt, ICA_DES_CTX, IBMCA_F_IBMCA_TDES_CIPHER,
+	     sizeof(ica_des_vector_t),
+	     ibmca_ica_3des_ctr(src, dst, n, pCtx->key, iv,
+				sizeof(ica_des_vector_t) * 8, ICA_ENCRYPT))
+
+IBMCA_DES_FNS(des, des, ica_des_key_single_t, IBMCA_F_IBMCA_DES_CIPHER,
+	      NULL)
+IBMCA_DES_FNS(tdes, 3des, ica_des_key_triple_t, IBMCA_F_IBMCA_TDES_CIPHER,
+	      ibmca_tdes_ctr_crypt)
+IBMCA_AES_FNS(128)
+IBMCA_AES_FNS(192)
+IBMCA_AES_FNS(256)
+
+static int ibmca_init_key(EVP_CIPHER_CTX *ctx, const unsigned char *key,
+			  int enc, const struct ibmca_cipher_fns *fns)
+{
+	ICA_DES_CTX *pCtx = (ICA_DES_CTX *) EVP_CIPHER_CTX_get_cipher_data(ctx);
+	int mode = EVP_CIPHER_CTX_mode(ctx);
+
+	if (mode < EVP_CIPH_ECB_MODE || mode > EVP_CIPH_CTR_MODE
+	    || fns->enc[mode - 1] == NULL) {
+		IBMCAerr(fns->fcode, IBMCA_R_CIPHER_MODE_NOT_SUPPORTED);
+		return 0;
+	}
+
+	/* also forgets a software key schedule of the previous key */
+#ifdef OLDER_OPENSSL
+	memset(pCtx, 0, ctx->cipher->ctx_size);
 #else
-				(ica_aes_vector_t *)EVP_CIPHER_CTX_iv_noconst(ctx),
+	memset(pCtx, 0, EVP_CIPHER_impl_ctx_size(EVP_CIPHER_CTX_cipher(ctx)));
+#endif
+	memcpy(pCtx->key, key, EVP_CIPHER_CTX_key_length(ctx));
+	pCtx->fns = fns;
+
+	return 1;
+}				// end ibmca_init_key
+
+#define IBMCA_INIT_KEY(alg)						\
+static int ibmca_##alg##_init_key(EVP_CIPHER_CTX *ctx,			\
+				  const unsigned char *key,		\
+				  const unsigned char *iv, int enc)	\
+{									\
+	return ibmca_init_key(ctx, key, enc, &ibmca_##alg##_fns);	\
+}
+
+IBMCA_INIT_KEY(des)
+IBMCA_INIT_KEY(tdes)
+IBMCA_INIT_KEY(aes_128)
+IBMCA_INIT_KEY(aes_192)
+IBMCA_INIT_KEY(aes_256)
+
+static int ibmca_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+			const unsigned char *in, size_t inlen)
+{
+	ICA_DES_CTX *pCtx = (ICA_DES_CTX *) EVP_CIPHER_CTX_get_cipher_data(ctx);
+	const struct ibmca_cipher_fns *fns = pCtx->fns;
+	ibmca_cipher_fn fn;
+	int rc;
+
+	if (fns == NULL) {
+		IBMCAerr(IBMCA_F_IBMCA_CIPHER, IBMCA_R_NOT_INITIALISED);
+		return 0;
+	}
+	fn = EVP_CIPHER_CTX_encrypting(ctx) ?
+	    fns->enc[EVP_CIPHER_CTX_mode(ctx) - 1] :
+	    fns->dec[EVP_CIPHER_CTX_mode(ctx) - 1];
+
+	IBMCA_PROBED(rc, EVP_CIPHER_CTX_nid(ctx), inlen,
+		     fn(ctx, out, in, inlen));
+	return rc;
+}
+
+static int ibmca_cipher_cleanup(EVP_CIPHER_CTX * ctx)
+{
+	return 1;
+}
+
+static int ibmca_pipeline_ctrl(struct ibmca_pipeline *pipe, int type,
+			       int arg, void *ptr)
+{
+	switch (type) {
+	case EVP_CTRL_SET_PIPELINE_OUTPUT_BUFS:
+	case EVP_CTRL_SET_PIPELINE_INPUT_BUFS:
+	case EVP_CTRL_SET_PIPELINE_INPUT_LENS:
+		break;
+	default:
+		return -1;
+	}
+	if (arg < 0 || arg > IBMCA_MAX_PIPELINES)
+		return 0;
+
+	pipe->n = arg;
+	if (type == EVP_CTRL_SET_PIPELINE_OUTPUT_BUFS)
+		pipe->out = ptr;
+	else if (type == EVP_CTRL_SET_PIPELINE_INPUT_BUFS)
+		pipe->in = ptr;
+	else
+		pipe->len = ptr;
+	return 1;
+}
+
+/* Hands the pending pipeline to the caller and clears it in the context */
+static struct ibmca_pipeline ibmca_pipeline_take(struct ibmca_pipeline *pipe)
+{
+	struct ibmca_pipeline taken = *pipe;
+
+	memset(pipe, 0, sizeof(*pipe));
+	return taken;
+}
+
+static struct ibmca_pipeline *ibmca_aes_pipeline(EVP_CIPHER_CTX *ctx)
+{
+	void *data = EVP_CIPHER_CTX_get_cipher_data(ctx);
+
+	switch (EVP_CIPHER_CTX_key_length(ctx)) {
+	case sizeof(ica_aes_key_len_128_t):
+		return &((ICA_AES_128_CTX *)data)->pipe;
+	case sizeof(ica_aes_key_len_192_t):
+		return &((ICA_AES_192_CTX *)data)->pipe;
+	default:
+		return &((ICA_AES_256_CTX *)data)->pipe;
+	}
+}
+
+static int ibmca_aes_cbc_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg,
+			      void *ptr)
+{
+	return ibmca_pipeline_ctrl(ibmca_aes_pipeline(ctx), type, arg, ptr);
+}
+
+/*
+ * The records of a pipeline are chained like separate calls would chain
+ * them, so the IV left behind is that of the last record.
+ */
+static int ibmca_aes_cbc_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+				const unsigned char *in, size_t len)
+{
+	struct ibmca_pipeline pipe;
+	unsigned int i;
+
+	if (ibmca_aes_pipeline(ctx)->n == 0)
+		return ibmca_cipher(ctx, out, in, len);
+
+	pipe = ibmca_pipeline_take(ibmca_aes_pipeline(ctx));
+	if (pipe.out == NULL || pipe.in == NULL || pipe.len == NULL)
+		return 0;
+	for (i = 0; i < pipe.n; i++) {
+		if (!ibmca_cipher(ctx, pipe.out[i], pipe.in[i], pipe.len[i]))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * The EVP key of XTS is the data key followed by the tweak key. The IV
+ * is the tweak of a data unit, and every update is a data unit of its
+ * own - the tweak libica leaves behind is not carried over.
+ */
+static int ibmca_aes_xts_init_key(EVP_CIPHER_CTX *ctx,
+				  const unsigned char *key,
+				  const unsigned char *iv, int enc)
+{
+	ICA_AES_XTS_CTX *xctx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+	const int keylen = EVP_CIPHER_CTX_key_length(ctx) / 2;
+
+	if (iv)
+		memcpy(EVP_CIPHER_CTX_iv_noconst(ctx), iv, AES_BLOCK_SIZE);
+	if (key == NULL)
+		return 1;
+
+	/* Equal halves turn XTS into plain XEX, see IEEE 1619 */
+	if (enc && CRYPTO_memcmp(key, key + keylen, keylen) == 0) {
+		IBMCAerr(IBMCA_F_IBMCA_AES_XTS_CIPHER,
+			 IBMCA_R_XTS_DUPLICATED_KEYS);
+		return 0;
+	}
+	memcpy(xctx->key1, key, keylen);
+	memcpy(xctx->key2, key + keylen, keylen);
+	xctx->key_set = 1;
+	return 1;
+}
+
+/* IEEE 1619 limits a data unit to 2^20 blocks */
+#define IBMCA_XTS_MAX_LEN	((size_t)AES_BLOCK_SIZE << 20)
+
+static int ibmca_aes_xts_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+				   const unsigned char *in, size_t len)
+{
+	ICA_AES_XTS_CTX *xctx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+	unsigned char tweak[AES_BLOCK_SIZE];
+
+	if (!xctx->key_set || len < AES_BLOCK_SIZE
+	    || len > IBMCA_XTS_MAX_LEN) {
+		IBMCAerr(IBMCA_F_IBMCA_AES_XTS_CIPHER,
+			 IBMCA_R_INVALID_ARGUMENT);
+		return 0;
+	}
+
+	memcpy(tweak, EVP_CIPHER_CTX_iv_noconst(ctx), sizeof(tweak));
+	if (ibmca_ica_aes_xts(in, out, len, xctx->key1, xctx->key2,
+			      EVP_CIPHER_CTX_key_length(ctx) / 2, tweak,
+			      EVP_CIPHER_CTX_encrypting(ctx) ?
+			      ICA_ENCRYPT : ICA_DECRYPT)) {
+		IBMCAerr(IBMCA_F_IBMCA_AES_XTS_CIPHER, IBMCA_R_REQUEST_FAILED);
+		return 0;
+	}
+	return 1;
+}
+
+static int ibmca_aes_xts_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+				const unsigned char *in, size_t len)
+{
+	int rc;
+
+	IBMCA_PROBED(rc, EVP_CIPHER_CTX_nid(ctx), len,
+		     ibmca_aes_xts_do_cipher(ctx, out, in, len));
+	return rc;
+}
+
+#ifndef OPENSSL_NO_AES_GCM
+static int ibmca_gcm_aad(ICA_AES_GCM_CTX *ctx, const unsigned char *aad,
+			 size_t len, int enc, int keylen)
+{
+	uint64_t alen = ctx->aadlen;
+
+	if (ctx->ptlen)
+		return -2;
+
+	alen += len;
+	if (alen > (1ULL << 61) || (sizeof(len) == 8 && alen < len))
+		return -1;
+
+	ctx->aadlen = alen;
+
+	/* ctx->taglen is not set at this time... and is not needed. The
+	 * function only checks, if it's a valid gcm tag length. So we chose
+	 * 16. */
+	return !(ibmca_ica_aes_gcm_intermediate(NULL, 0, NULL, ctx->ucb,
+					    (unsigned char *)aad, len,
+					    ctx->tag, 16, ctx->key, keylen,
+					    ctx->subkey, enc));
+}
+
+static int ibmca_aes_gcm(ICA_AES_GCM_CTX *ctx, const unsigned char *in,
+                         unsigned char *out, size_t len, int enc, int keylen)
+{
+	uint64_t mlen = ctx->ptlen;
+	unsigned char *pt, *ct;
+	int rv;
+
+	mlen += len;
+	if (mlen > ((1ULL << 36) - 32) || (sizeof(len) == 8 && mlen < len))
+		return -1;
+
+	ctx->ptlen = mlen;
+
+	if (enc) {
+		pt = (unsigned char *)in;
+		ct = out;
+	} else {
+		ct = (unsigned char *)in;
+		pt = out;
+	}
+
+	/* ctx->taglen is not set at this time... and is not needed. The
+	 * function only checks, if it's a valid gcm tag length. So we chose
+	 * 16. */
+	rv = !(ibmca_ica_aes_gcm_intermediate(pt, len, ct, ctx->ucb, NULL, 0,
+					  ctx->tag, 16, ctx->key, keylen,
+					  ctx->subkey, enc));
+	return rv;
+}
+
+static int ibmca_aes_gcm_init_key(EVP_CIPHER_CTX *ctx,
+                                  const unsigned char *key,
+                                  const unsigned char *iv, int enc)
+{
+	ICA_AES_GCM_CTX *gctx =
+	    (ICA_AES_GCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(ctx);
+	const int gkeylen = EVP_CIPHER_CTX_key_length(ctx);
+
+	if (!iv && !key)
+	    return 1;
+
+	if (key) {
+		memcpy(gctx->key, key, gkeylen);
+
+		if (iv == NULL && gctx->iv_set)
+			iv = gctx->iv;
+
+		if (iv) {
+			memset(gctx->icb, 0, sizeof(gctx->icb));
+			memset(gctx->tag, 0, sizeof(gctx->tag));
+			gctx->aadlen = 0;
+			gctx->ptlen = 0;
+			if (ibmca_ica_aes_gcm_initialize(iv, gctx->ivlen,
+						     gctx->key, gkeylen,
+						     gctx->icb, gctx->ucb,
+						     gctx->subkey, enc))
+				return 0;
+
+			gctx->iv_set = 1;
+		}
+		gctx->key_set = 1;
+	} else {
+		if (gctx->key_set) {
+			memset(gctx->icb, 0, sizeof(gctx->icb));
+			memset(gctx->tag, 0, sizeof(gctx->tag));
+			gctx->aadlen = 0;
+			gctx->ptlen = 0;
+			if (ibmca_ica_aes_gcm_initialize(iv, gctx->ivlen,
+						     gctx->key, gkeylen,
+						     gctx->icb, gctx->ucb,
+						     gctx->subkey, enc))
+				return 0;
+		} else {
+			memcpy(gctx->iv, iv, gctx->ivlen);
+		}
+		gctx->iv_set = 1;
+		gctx->iv_gen = 0;
+	}
+	return 1;
+}
+
+static int ibmca_aes_gcm_setiv(EVP_CIPHER_CTX *c)
+{
+	ICA_AES_GCM_CTX *gctx =
+	    (ICA_AES_GCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(c);
+	const int gkeylen = EVP_CIPHER_CTX_key_length(c);
+	int enc = EVP_CIPHER_CTX_encrypting(c);
+
+	if (gctx->key == NULL || !gctx->key_set)
+		return 0;
+
+	memset(gctx->icb, 0, sizeof(gctx->icb));
+	memset(gctx->tag, 0, sizeof(gctx->tag));
+	gctx->aadlen = 0;
+	gctx->ptlen = 0;
+	return !(ibmca_ica_aes_gcm_initialize(gctx->iv, gctx->ivlen, gctx->key,
+					  gkeylen, gctx->icb, gctx->ucb,
+					  gctx->subkey, enc));
+}
+
+static int ibmca_aes_gcm_ctrl(EVP_CIPHER_CTX *c, int type, int arg,
+			      void *ptr)
+{
+	ICA_AES_GCM_CTX *gctx =
+	    (ICA_AES_GCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(c);
+	unsigned char *iv_noconst = EVP_CIPHER_CTX_iv_noconst(c);
+	unsigned char *buf_noconst = EVP_CIPHER_CTX_buf_noconst(c);
+	int enc = EVP_CIPHER_CTX_encrypting(c);
+	EVP_CIPHER_CTX *out;
+	ICA_AES_GCM_CTX *gctx_out;
+	unsigned char *iv_noconst_out;
+	unsigned int len;
+
+	switch (type) {
+	case EVP_CTRL_INIT:
+		gctx->key_set = 0;
+		gctx->iv_set = 0;
+		gctx->ivlen = EVP_CIPHER_CTX_iv_length(c);
+		gctx->iv = iv_noconst;
+		gctx->taglen = -1;
+		gctx->iv_gen = 0;
+		gctx->tls_aadlen = -1;
+		gctx->tls_aadcnt = 0;
+		memset(&gctx->pipe, 0, sizeof(gctx->pipe));
+		return 1;
+
+	case EVP_CTRL_GCM_SET_IVLEN:
+		if (arg <= 0)
+			return 0;
+		if ((arg > EVP_MAX_IV_LENGTH) && (arg > gctx->ivlen)) {
+			if (gctx->iv != iv_noconst)
+				OPENSSL_free(gctx->iv);
+			gctx->iv = OPENSSL_malloc(arg);
+			if (gctx->iv == NULL)
+				return 0;
+		}
+		gctx->ivlen = arg;
+		return 1;
+
+	case EVP_CTRL_GCM_SET_TAG:
+		if (arg <= 0 || arg > 16 || enc)
+			return 0;
+		memcpy(buf_noconst, ptr, arg);
+		gctx->taglen = arg;
+		return 1;
+
+	case EVP_CTRL_GCM_GET_TAG:
+		if (arg <= 0 || arg > 16 || !enc || gctx->taglen < 0)
+			return 0;
+		memcpy(ptr, buf_noconst, arg);
+		return 1;
+
+	case EVP_CTRL_GCM_SET_IV_FIXED:
+		if (arg == -1) {
+			memcpy(gctx->iv, ptr, gctx->ivlen);
+			gctx->iv_gen = 1;
+			return 1;
+		}
+		if ((arg < 4) || (gctx->ivlen - arg) < 8)
+			return 0;
+		if (arg)
+			memcpy(gctx->iv, ptr, arg);
+		if (enc && RAND_bytes(gctx->iv + arg, gctx->ivlen - arg) <= 0)
+			return 0;
+		gctx->iv_gen = 1;
+		return 1;
+
+	case EVP_CTRL_GCM_IV_GEN:
+		if (gctx->iv_gen == 0 || gctx->key_set == 0)
+			return 0;
+		if (!ibmca_aes_gcm_setiv(c))
+			return 0;
+		if (arg <= 0 || arg > gctx->ivlen)
+			arg = gctx->ivlen;
+		memcpy(ptr, gctx->iv + gctx->ivlen - arg, arg);
+		++*(uint64_t *)(gctx->iv + gctx->ivlen - 8);
+		gctx->iv_set = 1;
+		return 1;
+
+	case EVP_CTRL_GCM_SET_IV_INV:
+		if (gctx->iv_gen == 0 || gctx->key_set == 0 || enc)
+			return 0;
+		memcpy(gctx->iv + gctx->ivlen - arg, ptr, arg);
+		if (!ibmca_aes_gcm_setiv(c))
+			return 0;
+		gctx->iv_set = 1;
+		return 1;
+
+	case EVP_CTRL_AEAD_TLS1_AAD:
+		if (arg != EVP_AEAD_TLS1_AAD_LEN)
+			return 0;
+		memcpy(buf_noconst, ptr, arg);
+		gctx->tls_aadlen = arg;
+		len = buf_noconst[arg - 2] << 8 | buf_noconst[arg - 1];
+		if (len < EVP_GCM_TLS_EXPLICIT_IV_LEN)
+			return 0;
+		len -= EVP_GCM_TLS_EXPLICIT_IV_LEN;
+		if (!enc) {
+			if (len < EVP_GCM_TLS_TAG_LEN)
+				return 0;
+			len -= EVP_GCM_TLS_TAG_LEN;
+		}
+		buf_noconst[arg - 2] = len >> 8;
+		buf_noconst[arg - 1] = len & 0xff;
+		if (gctx->tls_aadcnt >= IBMCA_MAX_PIPELINES)
+			return 0;
+		memcpy(gctx->tls_aad[gctx->tls_aadcnt++], buf_noconst, arg);
+		return EVP_GCM_TLS_TAG_LEN;
+
+	case EVP_CTRL_SET_PIPELINE_OUTPUT_BUFS:
+	case EVP_CTRL_SET_PIPELINE_INPUT_BUFS:
+	case EVP_CTRL_SET_PIPELINE_INPUT_LENS:
+		return ibmca_pipeline_ctrl(&gctx->pipe, type, arg, ptr);
+
+	case EVP_CTRL_COPY: {
+		out = ptr;
+		gctx_out = (ICA_AES_GCM_CTX *)
+			   EVP_CIPHER_CTX_get_cipher_data(out);
+		iv_noconst_out = EVP_CIPHER_CTX_iv_noconst(out);
+		if (gctx->iv == iv_noconst) {
+			gctx_out->iv = iv_noconst_out;
+		} else {
+			gctx_out->iv = OPENSSL_malloc(gctx->ivlen);
+			if (gctx_out->iv == NULL)
+				return 0;
+			memcpy(gctx_out->iv, gctx->iv, gctx->ivlen);
+		}
+		return 1;
+	}
+	default:
+		return -1;
+    }
+}
+
+static int ibmca_gcm_tag(EVP_CIPHER_CTX *ctx, unsigned char *out,
+			 const unsigned char *in, int taglen)
+{
+	ICA_AES_GCM_CTX *gctx =
+	    (ICA_AES_GCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(ctx);
+	int enc = EVP_CIPHER_CTX_encrypting(ctx);
+	const int gkeylen = EVP_CIPHER_CTX_key_length(ctx);
+
+	if (ibmca_ica_aes_gcm_last(gctx->icb, gctx->aadlen, gctx->ptlen,
+			       gctx->tag, (unsigned char *)in, taglen,
+			       gctx->key, gkeylen, gctx->subkey, enc))
+		return 0;
+
+	if (out)
+		memcpy(out, gctx->tag, taglen);
+
+	return 1;
+}
+
+static int ibmca_aes_gcm_tls_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+                                    const unsigned char *in, size_t len)
+{
+	ICA_AES_GCM_CTX *gctx =
+	    (ICA_AES_GCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(ctx);
+	unsigned char *buf = EVP_CIPHER_CTX_buf_noconst(ctx);
+	int enc = EVP_CIPHER_CTX_encrypting(ctx);
+	const int keylen = EVP_CIPHER_CTX_key_length(ctx);
+	int rv = -1;
+
+	if (out != in
+	    || len < (EVP_GCM_TLS_EXPLICIT_IV_LEN + EVP_GCM_TLS_TAG_LEN))
+		return -1;
+	if (EVP_CIPHER_CTX_ctrl(ctx, enc ? EVP_CTRL_GCM_IV_GEN :
+	    EVP_CTRL_GCM_SET_IV_INV, EVP_GCM_TLS_EXPLICIT_IV_LEN, out) <= 0)
+		goto err;
+
+	if (!ibmca_gcm_aad(gctx, buf, gctx->tls_aadlen, enc, keylen))
+		goto err;
+
+	in += EVP_GCM_TLS_EXPLICIT_IV_LEN;
+	out += EVP_GCM_TLS_EXPLICIT_IV_LEN;
+	len -= EVP_GCM_TLS_EXPLICIT_IV_LEN + EVP_GCM_TLS_TAG_LEN;
+
+	if (!ibmca_aes_gcm(gctx, in, out, len, enc, keylen))
+		goto err;
+
+	if (enc) {
+		out += len;
+		if (!ibmca_gcm_tag(ctx, out, NULL, EVP_GCM_TLS_TAG_LEN)) {
+			goto err;
+		}
+		rv = len + EVP_GCM_TLS_EXPLICIT_IV_LEN + EVP_GCM_TLS_TAG_LEN;
+	} else {
+		if (!ibmca_gcm_tag(ctx, buf, in + len, EVP_GCM_TLS_TAG_LEN)) {
+			OPENSSL_cleanse(out, len);
+			goto err;
+		}
+		rv = len;
+	}
+err:
+	gctx->iv_set = 0;
+	gctx->tls_aadlen = -1;
+	gctx->tls_aadcnt = 0;
+	return rv;
+}
+
+/*
+ * Each record of a pipelined TLS call brings its own AAD and explicit
+ * IV, so the records are sealed or opened one after the other.
+ */
+static int ibmca_aes_gcm_tls_pipeline(EVP_CIPHER_CTX *ctx)
+{
+	ICA_AES_GCM_CTX *gctx =
+	    (ICA_AES_GCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(ctx);
+	unsigned char *buf = EVP_CIPHER_CTX_buf_noconst(ctx);
+	struct ibmca_pipeline pipe = ibmca_pipeline_take(&gctx->pipe);
+	unsigned int i;
+	int rv, total = 0;
+
+	if (gctx->tls_aadcnt != pipe.n || pipe.out == NULL
+	    || pipe.in == NULL || pipe.len == NULL) {
+		gctx->tls_aadlen = -1;
+		gctx->tls_aadcnt = 0;
+		return -1;
+	}
+	for (i = 0; i < pipe.n; i++) {
+		memcpy(buf, gctx->tls_aad[i], EVP_AEAD_TLS1_AAD_LEN);
+		gctx->tls_aadlen = EVP_AEAD_TLS1_AAD_LEN;
+		rv = ibmca_aes_gcm_tls_cipher(ctx, pipe.out[i], pipe.in[i],
+					      pipe.len[i]);
+		if (rv < 0)
+			return -1;
+		total += rv;
+	}
+	return total;
+}
+
+static int ibmca_aes_gcm_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+				   const unsigned char *in, size_t len)
+{
+	ICA_AES_GCM_CTX *gctx =
+	    (ICA_AES_GCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(ctx);
+	unsigned char *buf = EVP_CIPHER_CTX_buf_noconst(ctx);
+	int enc = EVP_CIPHER_CTX_encrypting(ctx);
+	const int keylen = EVP_CIPHER_CTX_key_length(ctx);
+
+	if (!gctx->key_set)
+		return -1;
+
+	if (gctx->pipe.n)
+		return ibmca_aes_gcm_tls_pipeline(ctx);
+	if (gctx->tls_aadlen >= 0)
+		return ibmca_aes_gcm_tls_cipher(ctx, out, in, len);
+
+	if (!gctx->iv_set)
+		return -1;
+
+	if (in) {
+		if (out == NULL) {
+			if (!ibmca_gcm_aad(gctx, in, len, enc, keylen))
+				return -1;
+		} else {
+			if (!ibmca_aes_gcm(gctx, in, out, len, enc, keylen))
+				return -1;
+		}
+		return len;
+	} else {
+		if (enc) {
+			gctx->taglen = 16;
+			if (!ibmca_gcm_tag(ctx, buf, NULL, gctx->taglen))
+				return -1;
+		} else {
+			if (gctx->taglen < 0)
+				return -1;
+			if (!ibmca_gcm_tag(ctx, NULL, buf, gctx->taglen))
+				return -1;
+		}
+		gctx->iv_set = 0;
+		return 0;
+	}
+}
+
+static int ibmca_aes_gcm_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+				const unsigned char *in, size_t len)
+{
+	int rc;
+
+	IBMCA_PROBED(rc, EVP_CIPHER_CTX_nid(ctx), len,
+		     ibmca_aes_gcm_do_cipher(ctx, out, in, len));
+	return rc;
+}
 #endif
-				AES_KEY_LEN128,
-				(unsigned char *)pCtx->key,
-				out);
+
+#ifndef OPENSSL_NO_AES_CCM
+static int ibmca_aes_ccm_init_key(EVP_CIPHER_CTX *ctx,
+				  const unsigned char *key,
+				  const unsigned char *iv, int enc)
+{
+	ICA_AES_CCM_CTX *cctx =
+	    (ICA_AES_CCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(ctx);
+
+	if (key) {
+		memcpy(cctx->key, key, EVP_CIPHER_CTX_key_length(ctx));
+		cctx->key_set = 1;
+	}
+	if (iv) {
+		memcpy(EVP_CIPHER_CTX_iv_noconst(ctx), iv, 15 - cctx->L);
+		cctx->iv_set = 1;
+		cctx->len_set = 0;
+		cctx->aadlen = 0;
+	}
+	return 1;
+}
+
+static int ibmca_aes_ccm_cleanup(EVP_CIPHER_CTX *ctx)
+{
+	ICA_AES_CCM_CTX *cctx =
+	    (ICA_AES_CCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(ctx);
+
+	if (cctx != NULL) {
+		OPENSSL_free(cctx->aad);
+		cctx->aad = NULL;
+		cctx->aadlen = 0;
+	}
+	return 1;
+}
+
+static int ibmca_aes_ccm_ctrl(EVP_CIPHER_CTX *c, int type, int arg,
+			      void *ptr)
+{
+	ICA_AES_CCM_CTX *cctx =
+	    (ICA_AES_CCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(c);
+	unsigned char *buf_noconst = EVP_CIPHER_CTX_buf_noconst(c);
+	int enc = EVP_CIPHER_CTX_encrypting(c);
+	ICA_AES_CCM_CTX *cctx_out;
+	unsigned int len;
+
+	switch (type) {
+	case EVP_CTRL_INIT:
+		cctx->key_set = 0;
+		cctx->iv_set = 0;
+		cctx->tag_set = 0;
+		cctx->len_set = 0;
+		cctx->L = 8;
+		cctx->M = 12;
+		cctx->aad = NULL;
+		cctx->aadlen = 0;
+		cctx->tls_aadlen = -1;
+		return 1;
+
+	case EVP_CTRL_AEAD_TLS1_AAD:
+		if (arg != EVP_AEAD_TLS1_AAD_LEN)
+			return 0;
+		memcpy(buf_noconst, ptr, arg);
+		cctx->tls_aadlen = arg;
+		len = buf_noconst[arg - 2] << 8 | buf_noconst[arg - 1];
+		if (len < EVP_CCM_TLS_EXPLICIT_IV_LEN)
+			return 0;
+		len -= EVP_CCM_TLS_EXPLICIT_IV_LEN;
+		if (!enc) {
+			if (len < (unsigned int)cctx->M)
+				return 0;
+			len -= cctx->M;
+		}
+		buf_noconst[arg - 2] = len >> 8;
+		buf_noconst[arg - 1] = len & 0xff;
+		return cctx->M;
+
+	case EVP_CTRL_CCM_SET_IV_FIXED:
+		if (arg != EVP_CCM_TLS_FIXED_IV_LEN)
+			return 0;
+		memcpy(EVP_CIPHER_CTX_iv_noconst(c), ptr, arg);
+		return 1;
+
+	case EVP_CTRL_CCM_SET_IVLEN:
+		arg = 15 - arg;
+		/* fall through */
+	case EVP_CTRL_CCM_SET_L:
+		if (arg < 2 || arg > 8)
+			return 0;
+		cctx->L = arg;
+		return 1;
+
+	case EVP_CTRL_CCM_SET_TAG:
+		if ((arg & 1) || arg < 4 || arg > 16)
+			return 0;
+		if (enc && ptr)
+			return 0;
+		if (ptr) {
+			memcpy(cctx->tag, ptr, arg);
+			cctx->tag_set = 1;
+		}
+		cctx->M = arg;
+		return 1;
+
+	case EVP_CTRL_CCM_GET_TAG:
+		if (!enc || !cctx->tag_set || arg != cctx->M)
+			return 0;
+		memcpy(ptr, cctx->tag, arg);
+		cctx->tag_set = 0;
+		cctx->iv_set = 0;
+		cctx->len_set = 0;
+		return 1;
+
+	case EVP_CTRL_CCM_SET_MSGLEN:
+		if (arg < 0)
+			return 0;
+		cctx->msglen = arg;
+		cctx->len_set = 1;
+		return 1;
+
+	case EVP_CTRL_COPY:
+		cctx_out = (ICA_AES_CCM_CTX *)
+			   EVP_CIPHER_CTX_get_cipher_data((EVP_CIPHER_CTX *)ptr);
+		if (cctx->aad == NULL)
+			return 1;
+		cctx_out->aad = OPENSSL_malloc(cctx->aadlen);
+		if (cctx_out->aad == NULL)
+			return 0;
+		memcpy(cctx_out->aad, cctx->aad, cctx->aadlen);
+		return 1;
+
+	default:
+		return -1;
+	}
+}
+
+/*
+ * One TLS record, in place: explicit IV, payload, tag. The AAD is in the
+ * context buffer, the fixed part of the nonce in the IV.
+ */
+static int ibmca_aes_ccm_tls_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+				    const unsigned char *in, size_t len)
+{
+	ICA_AES_CCM_CTX *cctx =
+	    (ICA_AES_CCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(ctx);
+	unsigned char *buf = EVP_CIPHER_CTX_buf_noconst(ctx);
+	unsigned char *iv = EVP_CIPHER_CTX_iv_noconst(ctx);
+	int enc = EVP_CIPHER_CTX_encrypting(ctx);
+	int rv = -1;
+
+	if (out != in
+	    || len < EVP_CCM_TLS_EXPLICIT_IV_LEN + (size_t)cctx->M)
+		goto err;
+
+	/* the explicit IV is the sequence number at the start of the AAD */
+	if (enc)
+		memcpy(out, buf, EVP_CCM_TLS_EXPLICIT_IV_LEN);
+	memcpy(iv + EVP_CCM_TLS_FIXED_IV_LEN, in, EVP_CCM_TLS_EXPLICIT_IV_LEN);
+	len -= EVP_CCM_TLS_EXPLICIT_IV_LEN + cctx->M;
+	out += EVP_CCM_TLS_EXPLICIT_IV_LEN;
+
+	if (ibmca_ica_aes_ccm(out, len, out, cctx->M, buf, cctx->tls_aadlen,
+			      iv, 15 - cctx->L, cctx->key,
+			      EVP_CIPHER_CTX_key_length(ctx),
+			      enc ? ICA_ENCRYPT : ICA_DECRYPT)) {
+		if (!enc)
+			OPENSSL_cleanse(out, len);
+		goto err;
+	}
+	rv = enc ? len + EVP_CCM_TLS_EXPLICIT_IV_LEN + cctx->M : len;
+err:
+	cctx->tls_aadlen = -1;
+	return rv;
+}
+
+static int ibmca_aes_ccm(EVP_CIPHER_CTX *ctx, const unsigned char *in,
+			 unsigned char *out, size_t len)
+{
+	ICA_AES_CCM_CTX *cctx =
+	    (ICA_AES_CCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(ctx);
+	int enc = EVP_CIPHER_CTX_encrypting(ctx);
+	unsigned char *ct;
+	int rv = 0;
+
+	/* libica wants the tag right behind the ciphertext */
+	ct = OPENSSL_malloc(len + cctx->M);
+	if (ct == NULL)
+		return 0;
+	if (!enc) {
+		memcpy(ct, in, len);
+		memcpy(ct + len, cctx->tag, cctx->M);
+	}
+
+	if (ibmca_ica_aes_ccm(enc ? (unsigned char *)in : out, len, ct,
+			      cctx->M, cctx->aad, cctx->aadlen,
+			      EVP_CIPHER_CTX_iv_noconst(ctx), 15 - cctx->L,
+			      cctx->key, EVP_CIPHER_CTX_key_length(ctx),
+			      enc ? ICA_ENCRYPT : ICA_DECRYPT)) {
+		if (!enc)
+			OPENSSL_cleanse(out, len);
+		goto out;
+	}
+	if (enc) {
+		memcpy(out, ct, len);
+		memcpy(cctx->tag, ct + len, cctx->M);
+	}
+	rv = 1;
+out:
+	OPENSSL_cleanse(ct, len + cctx->M);
+	OPENSSL_free(ct);
+	return rv;
+}
+
+/*
+ * Like OpenSSL's CCM: an update with neither input nor output sets the
+ * message length, one without output passes the AAD and the one with
+ * both does the whole message. Decryption needs the tag before that.
+ */
+static int ibmca_aes_ccm_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+				   const unsigned char *in, size_t len)
+{
+	ICA_AES_CCM_CTX *cctx =
+	    (ICA_AES_CCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(ctx);
+	int enc = EVP_CIPHER_CTX_encrypting(ctx);
+	int rv;
+
+	if (!cctx->key_set)
+		return -1;
+
+	if (cctx->tls_aadlen >= 0)
+		return ibmca_aes_ccm_tls_cipher(ctx, out, in, len);
+
+	/* EVP_*Final() has nothing left to do */
+	if (in == NULL && out != NULL)
+		return 0;
+
+	if (!cctx->iv_set)
+		return -1;
+
+	if (out == NULL) {
+		if (in == NULL) {
+			cctx->msglen = len;
+			cctx->len_set = 1;
+			return len;
 		}
+		/* the AAD comes in one piece, after the message length */
+		if ((!cctx->len_set && len) || cctx->aadlen)
+			return -1;
+		OPENSSL_free(cctx->aad);
+		cctx->aad = OPENSSL_malloc(len ? len : 1);
+		if (cctx->aad == NULL)
+			return -1;
+		memcpy(cctx->aad, in, len);
+		cctx->aadlen = len;
+		return len;
+	}
 
-		if (rv) {
-			IBMCAerr(IBMCA_F_IBMCA_AES_128_CIPHER,
-				 IBMCA_R_REQUEST_FAILED);
-			return 0;
-		} else if (EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_OFB_MODE) {
-#ifdef OLDER_OPENSSL
-			memcpy(ctx->iv,
-#else
-			memcpy(EVP_CIPHER_CTX_iv_noconst(ctx),
+	if (!enc && !cctx->tag_set)
+		return -1;
+	if (cctx->len_set && cctx->msglen != len)
+		return -1;
+
+	rv = ibmca_aes_ccm(ctx, in, out, len) ? (int)len : -1;
+	cctx->aadlen = 0;
+	if (enc) {
+		cctx->tag_set = 1;
+	} else {
+		cctx->iv_set = 0;
+		cctx->tag_set = 0;
+		cctx->len_set = 0;
+	}
+	return rv;
+}
+
+static int ibmca_aes_ccm_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+				const unsigned char *in, size_t len)
+{
+	int rc;
+
+	IBMCA_PROBED(rc, EVP_CIPHER_CTX_nid(ctx), len,
+		     ibmca_aes_ccm_do_cipher(ctx, out, in, len));
+	return rc;
+}
 #endif
-				pre_iv, EVP_CIPHER_CTX_iv_length(ctx));
-		}
+
+#ifndef OPENSSL_NO_CMAC
+/*
+ * Take the libica key from the cipher context of the CMAC key, if the
+ * cipher is ibmca's and libica does CMAC with it. Also restarts the MAC.
+ */
+static void ibmca_cmac_setup(IBMCA_CMAC_CTX *ctx)
+{
+	EVP_CIPHER_CTX *cctx = CMAC_CTX_get0_cipher_ctx(ctx->sw);
+	const EVP_CIPHER *cipher = EVP_CIPHER_CTX_cipher(cctx);
+	ICA_DES_CTX *pCtx;
+
+	ctx->mech = 0;
+	ctx->tail_len = 0;
+	memset(ctx->iv, 0, sizeof(ctx->iv));
+	if (cipher == NULL
+	    || crypto_pair_lookup(&ibmca_cipher_lists,
+				  EVP_CIPHER_nid(cipher)) != cipher)
+		return;
+
+	switch (EVP_CIPHER_nid(cipher)) {
+	case NID_aes_128_cbc:
+	case NID_aes_192_cbc:
+	case NID_aes_256_cbc:
+		ctx->mech = AES_CMAC;
+		break;
+	case NID_des_ede3_cbc:
+		ctx->mech = DES3_CMAC;
+		break;
+	default:
+		return;
+	}
+	if (!ibmca_algo_enabled(ctx->mech)) {
+		ctx->mech = 0;
+		return;
+	}
+
+	/* all ibmca cipher contexts start with the handlers and the key */
+	pCtx = (ICA_DES_CTX *) EVP_CIPHER_CTX_get_cipher_data(cctx);
+	if (pCtx->fns == NULL) {
+		ctx->mech = 0;
+		return;
 	}
+	ctx->key_len = EVP_CIPHER_key_length(cipher);
+	ctx->blk = EVP_CIPHER_block_size(cipher);
+	memcpy(ctx->key, pCtx->key, ctx->key_len);
+}
+
+static int ibmca_cmac_init(EVP_PKEY_CTX *pctx)
+{
+	IBMCA_CMAC_CTX *ctx;
 
+	if ((ctx = OPENSSL_malloc(sizeof(*ctx))) == NULL)
+		return 0;
+	memset(ctx, 0, sizeof(*ctx));
+	if ((ctx->sw = CMAC_CTX_new()) == NULL) {
+		OPENSSL_free(ctx);
+		return 0;
+	}
+	EVP_PKEY_CTX_set_data(pctx, ctx);
 	return 1;
 }
 
-static int ibmca_aes_192_cipher(EVP_CIPHER_CTX * ctx, unsigned char *out,
-				const unsigned char *in, size_t inlen)
+static void ibmca_cmac_cleanup(EVP_PKEY_CTX *pctx)
 {
-	int mode = 0;
-	int rv;
+	IBMCA_CMAC_CTX *ctx = EVP_PKEY_CTX_get_data(pctx);
 
-	unsigned int len;
-#ifdef OLDER_OPENSSL
-	ICA_AES_192_CTX *pCtx = ctx->cipher_data;
-#else
-	ICA_AES_192_CTX *pCtx = (ICA_AES_192_CTX *) EVP_CIPHER_CTX_get_cipher_data(ctx);
-#endif
-	ica_aes_vector_t pre_iv;
+	if (ctx == NULL)
+		return;
+	CMAC_CTX_free(ctx->sw);
+	OPENSSL_cleanse(ctx, sizeof(*ctx));
+	OPENSSL_free(ctx);
+	EVP_PKEY_CTX_set_data(pctx, NULL);
+}
+
+static int ibmca_cmac_copy(EVP_PKEY_CTX *dst,
+			   IBMCA_PKEY_CTX_CONST EVP_PKEY_CTX *src)
+{
+	IBMCA_CMAC_CTX *sctx = EVP_PKEY_CTX_get_data(src), *dctx;
+	CMAC_CTX *sw;
 
-	if (inlen > UINT32_MAX) {
-		IBMCAerr(IBMCA_F_IBMCA_AES_192_CIPHER, IBMCA_R_OUTLEN_TO_LARGE);
+	if (!ibmca_cmac_init(dst))
+		return 0;
+	dctx = EVP_PKEY_CTX_get_data(dst);
+	sw = dctx->sw;
+	*dctx = *sctx;
+	dctx->sw = sw;
+	if (!CMAC_CTX_copy(dctx->sw, sctx->sw)) {
+		ibmca_cmac_cleanup(dst);
 		return 0;
 	}
-	len = inlen;
+	return 1;
+}
+
+static int ibmca_cmac_keygen(EVP_PKEY_CTX *pctx, EVP_PKEY *pkey)
+{
+	IBMCA_CMAC_CTX *ctx = EVP_PKEY_CTX_get_data(pctx);
+	CMAC_CTX *cmkey;
 
-	if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_ECB_MODE) {
-		mode = MODE_ECB;
-	} else if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_CBC_MODE) {
-		mode = MODE_CBC;
-	} else if ((EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_CFB_MODE) &&
-		   (EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_OFB_MODE)) {
-		IBMCAerr(IBMCA_F_IBMCA_AES_192_CIPHER,
-			 IBMCA_R_CIPHER_MODE_NOT_SUPPORTED);
+	if ((cmkey = CMAC_CTX_new()) == NULL)
+		return 0;
+	if (!CMAC_CTX_copy(cmkey, ctx->sw)
+	    || !EVP_PKEY_assign(pkey, EVP_PKEY_CMAC, cmkey)) {
+		CMAC_CTX_free(cmkey);
 		return 0;
 	}
+	return 1;
+}
 
-#ifdef OLDER_OPENSSL
-	if (ctx->encrypt) {
-#else
-	if (EVP_CIPHER_CTX_encrypting(ctx)) {
-#endif
-		if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_CFB_MODE) {
-			rv = p_ica_aes_cfb(in, out, len, pCtx->key,
-					AES_KEY_LEN192,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					AES_BLOCK_SIZE, ICA_ENCRYPT);
-		} else if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_OFB_MODE) {
-			rv = p_ica_aes_ofb(in, out, len, pCtx->key,
-					AES_KEY_LEN192,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					ICA_ENCRYPT);
-		} else {
-			rv = p_ica_aes_encrypt(mode, len, (unsigned char *)in,
-#ifdef OLDER_OPENSSL
-				(ica_aes_vector_t *)ctx->iv,
-#else
-				(ica_aes_vector_t *)EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-				AES_KEY_LEN192,
-				(unsigned char *)pCtx->key, out);
-		}
+static int ibmca_cmac_intermediate(IBMCA_CMAC_CTX *ctx,
+				   const unsigned char *in, size_t len)
+{
+	unsigned int rc;
 
-		if (rv) {
-			IBMCAerr(IBMCA_F_IBMCA_AES_192_CIPHER,
-				 IBMCA_R_REQUEST_FAILED);
-			return 0;
-		} else if (EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_OFB_MODE) {
-#ifdef OLDER_OPENSSL
-			memcpy(ctx->iv,
-#else
-			memcpy(EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-			       out + len - EVP_CIPHER_CTX_iv_length(ctx),
-			       EVP_CIPHER_CTX_iv_length(ctx));
-		}
-	} else {
-		if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_CFB_MODE) {
-			/* Protect against decrypt in place */
-			memcpy(pre_iv, in + len - sizeof(pre_iv), sizeof(pre_iv));
+	if (ctx->mech == AES_CMAC)
+		rc = ibmca_ica_aes_cmac_intermediate(in, len, ctx->key,
+						     ctx->key_len, ctx->iv);
+	else
+		rc = ibmca_ica_3des_cmac_intermediate(in, len, ctx->key,
+						      ctx->iv);
+	if (rc) {
+		IBMCAerr(IBMCA_F_IBMCA_CMAC_UPDATE, IBMCA_R_REQUEST_FAILED);
+		return 0;
+	}
+	return 1;
+}
 
-			rv = p_ica_aes_cfb(in, out, len, pCtx->key,
-					AES_KEY_LEN192,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					AES_BLOCK_SIZE, ICA_DECRYPT);
-		} else if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_OFB_MODE) {
-			rv = p_ica_aes_ofb(in, out, len, pCtx->key,
-					AES_KEY_LEN192,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					ICA_DECRYPT);
-		} else {
-			/* Protect against decrypt in place */
-			memcpy(pre_iv, in + len - sizeof(pre_iv), sizeof(pre_iv));
+/*
+ * Whole blocks go to libica as they come, in one call per update, but
+ * the last block of the data so far, partial or not, is kept: it is the
+ * one ica_*_cmac_last() has to see.
+ */
+static int ibmca_cmac_update(EVP_MD_CTX *mctx, const void *data,
+			     size_t count)
+{
+	IBMCA_CMAC_CTX *ctx = EVP_PKEY_CTX_get_data(EVP_MD_CTX_pkey_ctx(mctx));
+	const unsigned char *in = data;
+	size_t n;
 
-			rv = p_ica_aes_decrypt(mode, len, (unsigned char *)in,
-#ifdef OLDER_OPENSSL
-				(ica_aes_vector_t *)ctx->iv,
-#else
-				(ica_aes_vector_t *)EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-				AES_KEY_LEN192,
-				(unsigned char *)pCtx->key, out);
-		}
+	if (!ctx->mech)
+		return CMAC_Update(ctx->sw, data, count);
 
-		if (rv) {
-			IBMCAerr(IBMCA_F_IBMCA_AES_192_CIPHER,
-				 IBMCA_R_REQUEST_FAILED);
+	if (ctx->tail_len + count <= ctx->blk) {
+		memcpy(ctx->tail + ctx->tail_len, in, count);
+		ctx->tail_len += count;
+		return 1;
+	}
+	if (ctx->tail_len) {
+		n = ctx->blk - ctx->tail_len;
+		memcpy(ctx->tail + ctx->tail_len, in, n);
+		if (!ibmca_cmac_intermediate(ctx, ctx->tail, ctx->blk))
 			return 0;
-		} else if (EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_OFB_MODE) {
-#ifdef OLDER_OPENSSL
-			memcpy(ctx->iv,
-#else
-			memcpy(EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-			pre_iv, EVP_CIPHER_CTX_iv_length(ctx));
-		}
+		in += n;
+		count -= n;
 	}
+	n = (count - 1) / ctx->blk * ctx->blk;
+	if (n && !ibmca_cmac_intermediate(ctx, in, n))
+		return 0;
+	memcpy(ctx->tail, in + n, count - n);
+	ctx->tail_len = count - n;
+	return 1;
+}
 
+static int ibmca_cmac_signctx_init(EVP_PKEY_CTX *pctx, EVP_MD_CTX *mctx)
+{
+	EVP_MD_CTX_set_flags(mctx, EVP_MD_CTX_FLAG_NO_INIT);
+	EVP_MD_CTX_set_update_fn(mctx, ibmca_cmac_update);
 	return 1;
 }
 
-static int ibmca_aes_256_cipher(EVP_CIPHER_CTX * ctx, unsigned char *out,
-				const unsigned char *in, size_t inlen)
+static int ibmca_cmac_signctx(EVP_PKEY_CTX *pctx, unsigned char *sig,
+			      size_t *siglen, EVP_MD_CTX *mctx)
 {
-	int mode = 0;
-	int rv;
-	unsigned int len;
-#ifdef OLDER_OPENSSL
-	ICA_AES_256_CTX *pCtx = ctx->cipher_data;
-#else
-	ICA_AES_256_CTX *pCtx = (ICA_AES_256_CTX *) EVP_CIPHER_CTX_get_cipher_data(ctx);
-#endif
-	ica_aes_vector_t pre_iv;
+	IBMCA_CMAC_CTX *ctx = EVP_PKEY_CTX_get_data(pctx);
+	unsigned int rc;
 
-	if (inlen > UINT32_MAX) {
-		IBMCAerr(IBMCA_F_IBMCA_AES_256_CIPHER, IBMCA_R_OUTLEN_TO_LARGE);
+	if (!ctx->mech)
+		return CMAC_Final(ctx->sw, sig, siglen);
+
+	if (sig == NULL) {
+		*siglen = ctx->blk;
+		return 1;
+	}
+	if (ctx->mech == AES_CMAC)
+		rc = ibmca_ica_aes_cmac_last(ctx->tail, ctx->tail_len, sig,
+					     ctx->blk, ctx->key, ctx->key_len,
+					     ctx->iv, ICA_ENCRYPT);
+	else
+		rc = ibmca_ica_3des_cmac_last(ctx->tail, ctx->tail_len, sig,
+					      ctx->blk, ctx->key, ctx->iv,
+					      ICA_ENCRYPT);
+	if (rc) {
+		IBMCAerr(IBMCA_F_IBMCA_CMAC_FINAL, IBMCA_R_REQUEST_FAILED);
 		return 0;
 	}
-	len = inlen;
+	*siglen = ctx->blk;
+	return 1;
+}
+
+static int ibmca_cmac_ctrl(EVP_PKEY_CTX *pctx, int type, int p1, void *p2)
+{
+	IBMCA_CMAC_CTX *ctx = EVP_PKEY_CTX_get_data(pctx);
+	const EVP_CIPHER *cipher, *own;
+	EVP_PKEY *pkey;
+
+	switch (type) {
+	case EVP_PKEY_CTRL_CIPHER:
+		/* prefer ibmca's cipher, its key is what libica needs */
+		cipher = p2;
+		if (ibmca_load()
+		    && (own = crypto_pair_lookup(&ibmca_cipher_lists,
+						 EVP_CIPHER_nid(cipher))))
+			cipher = own;
+		if (!CMAC_Init(ctx->sw, NULL, 0, cipher, NULL))
+			return 0;
+		break;
+	case EVP_PKEY_CTRL_SET_MAC_KEY:
+		if (p2 == NULL || p1 < 0
+		    || !CMAC_Init(ctx->sw, p2, p1, NULL, NULL))
+			return 0;
+		break;
+	case EVP_PKEY_CTRL_MD:
+		pkey = EVP_PKEY_CTX_get0_pkey(pctx);
+		if (pkey == NULL
+		    || !CMAC_CTX_copy(ctx->sw, EVP_PKEY_get0(pkey))
+		    || !CMAC_Init(ctx->sw, NULL, 0, NULL, NULL))
+			return 0;
+		break;
+	default:
+		return -2;
+	}
+	ibmca_cmac_setup(ctx);
+	return 1;
+}
+
+static int ibmca_cmac_ctrl_str(EVP_PKEY_CTX *pctx, const char *type,
+			       const char *value)
+{
+	const EVP_CIPHER *cipher;
+	unsigned char *key;
+	long keylen;
+	int rc;
 
-	if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_ECB_MODE) {
-		mode = MODE_ECB;
-	} else if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_CBC_MODE) {
-		mode = MODE_CBC;
-	} else if ((EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_CFB_MODE) &&
-		   (EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_OFB_MODE)) {
-		IBMCAerr(IBMCA_F_IBMCA_AES_256_CIPHER,
-			 IBMCA_R_CIPHER_MODE_NOT_SUPPORTED);
+	if (value == NULL)
 		return 0;
+	if (strcmp(type, "cipher") == 0) {
+		if ((cipher = EVP_get_cipherbyname(value)) == NULL)
+			return 0;
+		return ibmca_cmac_ctrl(pctx, EVP_PKEY_CTRL_CIPHER, -1,
+				       (void *)cipher);
+	}
+	if (strcmp(type, "key") == 0)
+		return ibmca_cmac_ctrl(pctx, EVP_PKEY_CTRL_SET_MAC_KEY,
+				       strlen(value), (void *)value);
+	if (strcmp(type, "hexkey") == 0) {
+		if ((key = OPENSSL_hexstr2buf(value, &keylen)) == NULL)
+			return 0;
+		rc = ibmca_cmac_ctrl(pctx, EVP_PKEY_CTRL_SET_MAC_KEY, keylen,
+				     key);
+		OPENSSL_cleanse(key, keylen);
+		OPENSSL_free(key);
+		return rc;
 	}
+	return -2;
+}
 
-#ifdef OLDER_OPENSSL
-	if (ctx->encrypt) {
-#else
-	if (EVP_CIPHER_CTX_encrypting(ctx)) {
-#endif
-		if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_CFB_MODE) {
-			rv = p_ica_aes_cfb(in, out, len, pCtx->key,
-					AES_KEY_LEN256,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					AES_BLOCK_SIZE, ICA_ENCRYPT);
-		} else if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_OFB_MODE) {
-			rv = p_ica_aes_ofb(in, out, len, pCtx->key,
-					AES_KEY_LEN256,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					ICA_ENCRYPT);
-		} else {
-			rv = p_ica_aes_encrypt(mode, len, (unsigned char *)in,
-#ifdef OLDER_OPENSSL
-				(ica_aes_vector_t *)ctx->iv,
-#else
-				(ica_aes_vector_t *)EVP_CIPHER_CTX_iv_noconst(ctx),
+static EVP_PKEY_METHOD *ibmca_cmac_meth_new(void)
+{
+	EVP_PKEY_METHOD *meth;
+
+	meth = EVP_PKEY_meth_new(EVP_PKEY_CMAC, EVP_PKEY_FLAG_SIGCTX_CUSTOM);
+	if (meth == NULL)
+		return NULL;
+	EVP_PKEY_meth_set_init(meth, ibmca_cmac_init);
+	EVP_PKEY_meth_set_copy(meth, ibmca_cmac_copy);
+	EVP_PKEY_meth_set_cleanup(meth, ibmca_cmac_cleanup);
+	EVP_PKEY_meth_set_keygen(meth, NULL, ibmca_cmac_keygen);
+	EVP_PKEY_meth_set_signctx(meth, ibmca_cmac_signctx_init,
+				  ibmca_cmac_signctx);
+	EVP_PKEY_meth_set_ctrl(meth, ibmca_cmac_ctrl, ibmca_cmac_ctrl_str);
+	return meth;
+}
 #endif
-				AES_KEY_LEN256,
-				(unsigned char *)pCtx->key, out);
-		}
 
-		if (rv) {
-			IBMCAerr(IBMCA_F_IBMCA_AES_256_CIPHER,
-				 IBMCA_R_REQUEST_FAILED);
+#if !defined(OPENSSL_NO_HMAC) || !defined(OPENSSL_NO_AES_CBC_HMAC)
+static unsigned int ibmca_hmac_sha(int nid, unsigned int part,
+				   size_t len, const unsigned char *in,
+				   ibmca_sha_state *s, unsigned char *out)
+{
+	switch (nid) {
+	case NID_sha1:
+		return ibmca_ica_sha1(part, len, (unsigned char *)in, &s->sha1,
+				      out);
+	case NID_sha256:
+		return ibmca_ica_sha256(part, len, (unsigned char *)in,
+					&s->sha256, out);
+	default:
+		return ibmca_ica_sha512(part, len, (unsigned char *)in,
+					&s->sha512, out);
+	}
+}
+
+/*
+ * Run the key ^ ipad and the key ^ opad block through libica. Keys
+ * longer than a block are hashed first.
+ */
+static int ibmca_hmac_pads(struct ibmca_hmac_state *hw, int nid,
+			   const unsigned char *key, size_t keylen)
+{
+	unsigned char pad[IBMCA_HMAC_MAX_BLOCK], out[EVP_MAX_MD_SIZE];
+	ibmca_sha_state tmp;
+	unsigned int i;
+	int rc = 0;
+
+	hw->nid = nid;
+	hw->blk = nid == NID_sha512 ? SHA512_CBLOCK : SHA_CBLOCK;
+	hw->size = nid == NID_sha1 ? SHA_DIGEST_LENGTH :
+		   nid == NID_sha256 ? SHA256_DIGEST_LENGTH :
+		   SHA512_DIGEST_LENGTH;
+	if (keylen > hw->blk) {
+		if (ibmca_hmac_sha(nid, SHA_MSG_PART_ONLY, keylen, key, &tmp,
+				   out))
+			goto err;
+		key = out;
+		keylen = hw->size;
+	}
+	memset(pad, 0x36, hw->blk);
+	for (i = 0; i < keylen; i++)
+		pad[i] ^= key[i];
+	if (ibmca_hmac_sha(nid, SHA_MSG_PART_FIRST, hw->blk, pad, &hw->ipad,
+			   out))
+		goto err;
+	for (i = 0; i < hw->blk; i++)
+		pad[i] ^= 0x36 ^ 0x5c;
+	if (ibmca_hmac_sha(nid, SHA_MSG_PART_FIRST, hw->blk, pad, &hw->opad,
+			   out))
+		goto err;
+	hw->c = hw->ipad;
+	hw->tail_len = 0;
+	rc = 1;
+err:
+	OPENSSL_cleanse(pad, sizeof(pad));
+	OPENSSL_cleanse(out, sizeof(out));
+	return rc;
+}
+
+/*
+ * The inner hash continues from the ipad state with whole blocks; less
+ * than a block is kept for the final call.
+ */
+static int ibmca_hmac_hw_update(struct ibmca_hmac_state *hw,
+				const unsigned char *in, size_t count)
+{
+	unsigned char out[EVP_MAX_MD_SIZE];
+	size_t n;
+
+	if (hw->tail_len + count < hw->blk) {
+		memcpy(hw->tail + hw->tail_len, in, count);
+		hw->tail_len += count;
+		return 1;
+	}
+	if (hw->tail_len) {
+		n = hw->blk - hw->tail_len;
+		memcpy(hw->tail + hw->tail_len, in, n);
+		if (ibmca_hmac_sha(hw->nid, SHA_MSG_PART_MIDDLE, hw->blk,
+				   hw->tail, &hw->c, out))
 			return 0;
-		} else if (EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_OFB_MODE) {
-#ifdef OLDER_OPENSSL
-			memcpy(ctx->iv,
-#else
-			memcpy(EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-			       out + len - EVP_CIPHER_CTX_iv_length(ctx),
-			       EVP_CIPHER_CTX_iv_length(ctx));
-		}
-	} else {
-		if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_CFB_MODE) {
-			/* Protect against decrypt in place */
-			memcpy(pre_iv, in + len - sizeof(pre_iv), sizeof(pre_iv));
+		in += n;
+		count -= n;
+	}
+	n = count - count % hw->blk;
+	if (n && ibmca_hmac_sha(hw->nid, SHA_MSG_PART_MIDDLE, n, in, &hw->c,
+				out))
+		return 0;
+	memcpy(hw->tail, in + n, count - n);
+	hw->tail_len = count - n;
+	return 1;
+}
 
-			rv = p_ica_aes_cfb(in, out, len, pCtx->key,
-					AES_KEY_LEN256,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-					AES_BLOCK_SIZE, ICA_DECRYPT);
-		} else if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_OFB_MODE) {
-			rv = p_ica_aes_ofb(in, out, len, pCtx->key,
-					AES_KEY_LEN256,
-#ifdef OLDER_OPENSSL
-					ctx->iv,
-#else
-					EVP_CIPHER_CTX_iv_noconst(ctx),
+static int ibmca_hmac_hw_final(struct ibmca_hmac_state *hw,
+			       unsigned char *md)
+{
+	unsigned char inner[EVP_MAX_MD_SIZE];
+	ibmca_sha_state outer = hw->opad;
+	int rc;
+
+	rc = !ibmca_hmac_sha(hw->nid, SHA_MSG_PART_FINAL, hw->tail_len,
+			     hw->tail, &hw->c, inner)
+	     && !ibmca_hmac_sha(hw->nid, SHA_MSG_PART_FINAL, hw->size, inner,
+				&outer, md);
+	OPENSSL_cleanse(inner, sizeof(inner));
+	return rc;
+}
 #endif
-					ICA_DECRYPT);
+
+#ifndef OPENSSL_NO_AES_CBC_HMAC
+#define IBMCA_NO_PAYLOAD_LENGTH	((size_t)-1)
+
+/* Constant time comparisons, all ones for true and zero for false */
+static inline size_t ibmca_ct_msb(size_t a)
+{
+	return 0 - (a >> (sizeof(a) * 8 - 1));
+}
+
+static inline size_t ibmca_ct_lt(size_t a, size_t b)
+{
+	return ibmca_ct_msb(a ^ ((a ^ b) | ((a - b) ^ b)));
+}
+
+static inline size_t ibmca_ct_ge(size_t a, size_t b)
+{
+	return ~ibmca_ct_lt(a, b);
+}
+
+static inline size_t ibmca_ct_is_zero(size_t a)
+{
+	return ibmca_ct_msb(~a & (a - 1));
+}
+
+static inline size_t ibmca_ct_eq(size_t a, size_t b)
+{
+	return ibmca_ct_is_zero(a ^ b);
+}
+
+/* The chaining value libica keeps in the state, big-endian */
+static unsigned char *ibmca_sha_chain(int nid, ibmca_sha_state *s)
+{
+	switch (nid) {
+	case NID_sha1:
+		return s->sha1.shaHash;
+	case NID_sha256:
+		return s->sha256.sha256Hash;
+	default:
+		return s->sha512.sha512Hash;
+	}
+}
+
+/* libica leaves the CBC IV alone, it is chained here */
+static int ibmca_aes_hmac_cbc(EVP_CIPHER_CTX *ctx, unsigned char *iv,
+			      unsigned char *out, const unsigned char *in,
+			      size_t len, int enc)
+{
+	ICA_AES_HMAC_CTX *actx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+	unsigned int keylen = EVP_CIPHER_CTX_key_length(ctx);
+	unsigned char next[AES_BLOCK_SIZE];
+	unsigned int rc, n;
+
+	for (; len; in += n, out += n, len -= n) {
+		n = len > IBMCA_CHUNK ? IBMCA_CHUNK : len;
+		if (enc) {
+			rc = ibmca_ica_aes_encrypt(MODE_CBC, n,
+						   (unsigned char *)in,
+						   (ica_aes_vector_t *)iv,
+						   keylen, actx->key, out);
+			memcpy(next, out + n - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
 		} else {
 			/* Protect against decrypt in place */
-			memcpy(pre_iv, in + len - sizeof(pre_iv), sizeof(pre_iv));
-
-			rv = p_ica_aes_decrypt(mode, len, (unsigned char *)in,
-#ifdef OLDER_OPENSSL
-				(ica_aes_vector_t *)ctx->iv,
-#else
-				(ica_aes_vector_t *)EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-				AES_KEY_LEN256,
-				(unsigned char *)pCtx->key, out);
+			memcpy(next, in + n - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+			rc = ibmca_ica_aes_decrypt(MODE_CBC, n,
+						   (unsigned char *)in,
+						   (ica_aes_vector_t *)iv,
+						   keylen, actx->key, out);
 		}
-
-		if (rv) {
-			IBMCAerr(IBMCA_F_IBMCA_AES_256_CIPHER,
+		if (rc) {
+			IBMCAerr(IBMCA_F_IBMCA_AES_HMAC_CIPHER,
 				 IBMCA_R_REQUEST_FAILED);
 			return 0;
-		} else if (EVP_CIPHER_CTX_mode(ctx) != EVP_CIPH_OFB_MODE) {
-#ifdef OLDER_OPENSSL
-			memcpy(ctx->iv,
-#else
-			memcpy(EVP_CIPHER_CTX_iv_noconst(ctx),
-#endif
-				pre_iv, EVP_CIPHER_CTX_iv_length(ctx));
 		}
+		memcpy(iv, next, AES_BLOCK_SIZE);
 	}
-
 	return 1;
 }
 
-static int ibmca_cipher_cleanup(EVP_CIPHER_CTX * ctx)
+/*
+ * Seal a TLS record of len bytes: MAC the payload after the off bytes of
+ * explicit IV, on top of the header already in the MAC state, and
+ * encrypt payload, MAC and padding. The payload is hashed and encrypted
+ * from where it is; only its last partial block is copied, to go in
+ * front of the MAC.
+ */
+static int ibmca_aes_hmac_seal(EVP_CIPHER_CTX *ctx, unsigned char *iv,
+			       unsigned char *out, const unsigned char *in,
+			       size_t off, size_t plen, size_t len)
 {
-	return 1;
+	ICA_AES_HMAC_CTX *actx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+	unsigned char last[2 * AES_BLOCK_SIZE + SHA256_DIGEST_LENGTH];
+	size_t whole = plen & -AES_BLOCK_SIZE, i;
+	int rc = 0;
+
+	if (!ibmca_hmac_hw_update(&actx->mac, in + off, plen - off))
+		goto err;
+	memcpy(last, in + whole, plen - whole);
+	if (!ibmca_hmac_hw_final(&actx->mac, last + plen - whole))
+		goto err;
+	for (i = plen - whole + actx->mac.size; i < len - whole; i++)
+		last[i] = len - plen - actx->mac.size - 1;
+	rc = ibmca_aes_hmac_cbc(ctx, iv, out, in, whole, 1)
+	     && ibmca_aes_hmac_cbc(ctx, iv, out + whole, last, len - whole,
+				   1);
+	OPENSSL_cleanse(last, sizeof(last));
+	return rc;
+err:
+	IBMCAerr(IBMCA_F_IBMCA_AES_HMAC_CIPHER, IBMCA_R_REQUEST_FAILED);
+	return 0;
 }
 
-#ifndef OPENSSL_NO_AES_GCM
-static int ibmca_gcm_aad(ICA_AES_GCM_CTX *ctx, const unsigned char *aad,
-			 size_t len, int enc, int keylen)
+/*
+ * Check MAC and padding of a decrypted TLS record of len bytes without
+ * branching on, or indexing by, the padding length: like OpenSSL's
+ * ssl3_cbc_digest_record(), all blocks the inner hash can end in are
+ * hashed, and the state after the one that carries the SHA length is
+ * picked with masks. Returns 1 if MAC and padding are good, else 0.
+ */
+static int ibmca_aes_hmac_verify(ICA_AES_HMAC_CTX *actx,
+				 const unsigned char *rec, size_t len)
 {
-	uint64_t alen = ctx->aadlen;
+	const size_t aadlen = EVP_AEAD_TLS1_AAD_LEN;
+	struct ibmca_hmac_state *hw = &actx->mac;
+	unsigned char blk[SHA_CBLOCK], inner[EVP_MAX_MD_SIZE];
+	unsigned char mac[EVP_MAX_MD_SIZE], *chain;
+	ibmca_sha_state outer;
+	size_t dsz = hw->size, pad, maxpad, good, inp_len, hlen, hmin, hmax;
+	size_t k, final, bitlen, p, mask, in_mac, in_pad, res, i, j;
+	unsigned char b;
+	int rc = 0;
 
-	if (ctx->ptlen)
-		return -2;
+	pad = rec[len - 1];
+	maxpad = len - dsz - 1;
+	if (maxpad > 255)
+		maxpad = 255;
+	good = ibmca_ct_ge(maxpad, pad);
+	pad = (pad & good) | (maxpad & ~good);
+	inp_len = len - dsz - 1 - pad;
+	actx->tls_aad[aadlen - 2] = inp_len >> 8;
+	actx->tls_aad[aadlen - 1] = inp_len;
+
+	/* the inner hash is over hlen bytes of header and payload */
+	hlen = aadlen + inp_len;
+	hmax = aadlen + len - dsz - 1;
+	hmin = hmax - maxpad;
+	final = (hlen + 8) / SHA_CBLOCK;
+	bitlen = (SHA_CBLOCK + hlen) * 8;
+
+	hw->c = hw->ipad;
+	hw->tail_len = 0;
+	k = hmin / SHA_CBLOCK;
+	if (k && (!ibmca_hmac_hw_update(hw, actx->tls_aad, aadlen)
+		  || !ibmca_hmac_hw_update(hw, rec, k * SHA_CBLOCK - aadlen)))
+		goto err;
+	memset(inner, 0, sizeof(inner));
+	for (; k <= (hmax + 8) / SHA_CBLOCK; k++) {
+		for (j = 0; j < SHA_CBLOCK; j++) {
+			p = k * SHA_CBLOCK + j;
+			if (p < aadlen)
+				b = actx->tls_aad[p];
+			else if (p - aadlen < len)
+				b = rec[p - aadlen];
+			else
+				b = 0;
+			b &= ibmca_ct_lt(p, hlen);
+			b |= 0x80 & ibmca_ct_eq(p, hlen);
+			if (j >= SHA_CBLOCK - 8)
+				b |= (bitlen >> (8 * (SHA_CBLOCK - 1 - j)))
+				     & ibmca_ct_eq(k, final);
+			blk[j] = b;
+		}
+		if (ibmca_hmac_sha(hw->nid, SHA_MSG_PART_MIDDLE, SHA_CBLOCK,
+				   blk, &hw->c, mac))
+			goto err;
+		mask = ibmca_ct_eq(k, final);
+		chain = ibmca_sha_chain(hw->nid, &hw->c);
+		for (j = 0; j < dsz; j++)
+			inner[j] |= chain[j] & mask;
+	}
+	outer = hw->opad;
+	if (ibmca_hmac_sha(hw->nid, SHA_MSG_PART_FINAL, dsz, inner, &outer,
+			   mac))
+		goto err;
 
-	alen += len;
-	if (alen > (1ULL << 61) || (sizeof(len) == 8 && alen < len))
-		return -1;
+	/* MAC and padding are the last dsz + pad + 1 bytes */
+	res = 0;
+	for (i = 0, j = len - 1 - maxpad - dsz; j < len; j++) {
+		in_mac = ibmca_ct_ge(j, inp_len) & ibmca_ct_lt(j, inp_len + dsz);
+		in_pad = ibmca_ct_ge(j, inp_len + dsz);
+		res |= (rec[j] ^ mac[i]) & in_mac;
+		res |= (rec[j] ^ pad) & in_pad;
+		i += 1 & in_mac;
+	}
+	rc = good & ibmca_ct_is_zero(res) & 1;
+	OPENSSL_cleanse(blk, sizeof(blk));
+	OPENSSL_cleanse(inner, sizeof(inner));
+	OPENSSL_cleanse(mac, sizeof(mac));
+	return rc;
+err:
+	IBMCAerr(IBMCA_F_IBMCA_AES_HMAC_CIPHER, IBMCA_R_REQUEST_FAILED);
+	return 0;
+}
 
-	ctx->aadlen = alen;
+static int ibmca_aes_hmac_init_key(EVP_CIPHER_CTX *ctx,
+				   const unsigned char *key,
+				   const unsigned char *iv, int enc)
+{
+	ICA_AES_HMAC_CTX *actx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+	int nid;
 
-	/* ctx->taglen is not set at this time... and is not needed. The
-	 * function only checks, if it's a valid gcm tag length. So we chose
-	 * 16. */
-	return !(p_ica_aes_gcm_intermediate(NULL, 0, NULL, ctx->ucb,
-					    (unsigned char *)aad, len,
-					    ctx->tag, 16, ctx->key, keylen,
-					    ctx->subkey, enc));
+	switch (EVP_CIPHER_CTX_nid(ctx)) {
+	case NID_aes_128_cbc_hmac_sha1:
+	case NID_aes_256_cbc_hmac_sha1:
+		nid = NID_sha1;
+		break;
+	default:
+		nid = NID_sha256;
+		break;
+	}
+	if (key != NULL)
+		memcpy(actx->key, key, EVP_CIPHER_CTX_key_length(ctx));
+	actx->payload_length = IBMCA_NO_PAYLOAD_LENGTH;
+	if (!ibmca_hmac_pads(&actx->mac, nid, NULL, 0)) {
+		IBMCAerr(IBMCA_F_IBMCA_AES_HMAC_CIPHER,
+			 IBMCA_R_REQUEST_FAILED);
+		return 0;
+	}
+	return 1;
 }
 
-static int ibmca_aes_gcm(ICA_AES_GCM_CTX *ctx, const unsigned char *in,
-                         unsigned char *out, size_t len, int enc, int keylen)
+/* Length of a record with frag bytes of payload, header and IV included */
+static size_t ibmca_aes_hmac_mb_len(size_t frag, unsigned int dsz)
 {
-	uint64_t mlen = ctx->ptlen;
-	unsigned char *pt, *ct;
-	int rv;
+	return 5 + AES_BLOCK_SIZE
+	       + ((frag + dsz + AES_BLOCK_SIZE) & -AES_BLOCK_SIZE);
+}
 
-	mlen += len;
-	if (mlen > ((1ULL << 36) - 32) || (sizeof(len) == 8 && mlen < len))
-		return -1;
+/*
+ * A TLS 1.1+ multi-block write of len bytes goes out as interleave
+ * records, all but the last one of len / interleave bytes.
+ */
+static int ibmca_aes_hmac_mb_aad(EVP_CIPHER_CTX *ctx, int arg,
+				 EVP_CTRL_TLS1_1_MULTIBLOCK_PARAM *param)
+{
+	ICA_AES_HMAC_CTX *actx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+	size_t len, frag;
+	unsigned int n;
 
-	ctx->ptlen = mlen;
+	if (arg < (int)sizeof(*param) || !EVP_CIPHER_CTX_encrypting(ctx)
+	    || (param->inp[9] << 8 | param->inp[10]) < TLS1_1_VERSION)
+		return -1;
 
-	if (enc) {
-		pt = (unsigned char *)in;
-		ct = out;
+	len = param->inp[11] << 8 | param->inp[12];
+	if (len) {
+		if (len < 4096)
+			return 0;	/* too short */
+		n = len >= 8192 ? 8 : 4;
+	} else if (param->interleave == 4 || param->interleave == 8) {
+		n = param->interleave;
+		len = param->len;
 	} else {
-		ct = (unsigned char *)in;
-		pt = out;
+		return -1;
 	}
-
-	/* ctx->taglen is not set at this time... and is not needed. The
-	 * function only checks, if it's a valid gcm tag length. So we chose
-	 * 16. */
-	rv = !(p_ica_aes_gcm_intermediate(pt, len, ct, ctx->ucb, NULL, 0,
-					  ctx->tag, 16, ctx->key, keylen,
-					  ctx->subkey, enc));
-	return rv;
+	memcpy(actx->tls_aad, param->inp, EVP_AEAD_TLS1_AAD_LEN);
+	param->interleave = n;
+	frag = len / n;
+	return (n - 1) * ibmca_aes_hmac_mb_len(frag, actx->mac.size)
+	       + ibmca_aes_hmac_mb_len(len - frag * (n - 1), actx->mac.size);
 }
 
-static int ibmca_aes_gcm_init_key(EVP_CIPHER_CTX *ctx,
-                                  const unsigned char *key,
-                                  const unsigned char *iv, int enc)
+/*
+ * Each record gets a random explicit IV, sent in the clear and used as
+ * the CBC IV, and the sequence number of the previous one plus one.
+ */
+static int ibmca_aes_hmac_mb_encrypt(EVP_CIPHER_CTX *ctx, int arg,
+				     EVP_CTRL_TLS1_1_MULTIBLOCK_PARAM *param)
 {
-	ICA_AES_GCM_CTX *gctx =
-	    (ICA_AES_GCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(ctx);
-	const int gkeylen = EVP_CIPHER_CTX_key_length(ctx);
-
-	if (!iv && !key)
-	    return 1;
-
-	if (key) {
-		memcpy(gctx->key, key, gkeylen);
+	ICA_AES_HMAC_CTX *actx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+	unsigned char aad[EVP_AEAD_TLS1_AAD_LEN], iv[AES_BLOCK_SIZE];
+	const unsigned char *in = param->inp;
+	unsigned char *out = param->out;
+	unsigned int i, j, n = param->interleave;
+	size_t frag, plen, len;
+
+	if (arg < (int)sizeof(*param) || !EVP_CIPHER_CTX_encrypting(ctx)
+	    || (n != 4 && n != 8))
+		return -1;
 
-		if (iv == NULL && gctx->iv_set)
-			iv = gctx->iv;
+	memcpy(aad, actx->tls_aad, sizeof(aad));
+	frag = param->len / n;
+	for (i = 0; i < n; i++) {
+		plen = i < n - 1 ? frag : param->len - frag * (n - 1);
+		len = ibmca_aes_hmac_mb_len(plen, actx->mac.size) - 5;
+		out[0] = aad[8];
+		out[1] = aad[9];
+		out[2] = aad[10];
+		out[3] = len >> 8;
+		out[4] = len;
+		if (RAND_bytes(out + 5, AES_BLOCK_SIZE) <= 0)
+			return -1;
+		memcpy(iv, out + 5, AES_BLOCK_SIZE);
+
+		aad[11] = plen >> 8;
+		aad[12] = plen;
+		actx->mac.c = actx->mac.ipad;
+		actx->mac.tail_len = 0;
+		if (!ibmca_hmac_hw_update(&actx->mac, aad, sizeof(aad))
+		    || !ibmca_aes_hmac_seal(ctx, iv, out + 5 + AES_BLOCK_SIZE,
+					    in, 0, plen,
+					    len - AES_BLOCK_SIZE))
+			return -1;
+		out += 5 + len;
+		in += plen;
+		for (j = 8; j-- > 0 && ++aad[j] == 0;)
+			;
+	}
+	return out - param->out;
+}
 
-		if (iv) {
-			memset(gctx->icb, 0, sizeof(gctx->icb));
-			memset(gctx->tag, 0, sizeof(gctx->tag));
-			gctx->aadlen = 0;
-			gctx->ptlen = 0;
-			if (p_ica_aes_gcm_initialize(iv, gctx->ivlen,
-						     gctx->key, gkeylen,
-						     gctx->icb, gctx->ucb,
-						     gctx->subkey, enc))
-				return 0;
+/*
+ * The controls follow OpenSSL's own stitched ciphers: for encryption
+ * EVP_CTRL_AEAD_TLS1_AAD starts the MAC with the header and returns the
+ * length the record grows by, for decryption it keeps the header for the
+ * check and returns the MAC length.
+ */
+static int ibmca_aes_hmac_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg,
+			       void *ptr)
+{
+	ICA_AES_HMAC_CTX *actx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+	unsigned int dsz = actx->mac.size;
+	unsigned char *p = ptr;
+	size_t len;
 
-			gctx->iv_set = 1;
+	switch (type) {
+	case EVP_CTRL_AEAD_SET_MAC_KEY:
+		if (arg < 0)
+			return 0;
+		return ibmca_hmac_pads(&actx->mac, actx->mac.nid, ptr, arg);
+	case EVP_CTRL_AEAD_TLS1_AAD:
+		if (arg != EVP_AEAD_TLS1_AAD_LEN)
+			return -1;
+		len = p[arg - 2] << 8 | p[arg - 1];
+		actx->tls_ver = p[arg - 4] << 8 | p[arg - 3];
+		if (!EVP_CIPHER_CTX_encrypting(ctx)) {
+			memcpy(actx->tls_aad, p, arg);
+			actx->payload_length = arg;
+			return dsz;
 		}
-		gctx->key_set = 1;
-	} else {
-		if (gctx->key_set) {
-			memset(gctx->icb, 0, sizeof(gctx->icb));
-			memset(gctx->tag, 0, sizeof(gctx->tag));
-			gctx->aadlen = 0;
-			gctx->ptlen = 0;
-			if (p_ica_aes_gcm_initialize(iv, gctx->ivlen,
-						     gctx->key, gkeylen,
-						     gctx->icb, gctx->ucb,
-						     gctx->subkey, enc))
+		actx->payload_length = len;
+		if (actx->tls_ver >= TLS1_1_VERSION) {
+			if (len < AES_BLOCK_SIZE)
 				return 0;
-		} else {
-			memcpy(gctx->iv, iv, gctx->ivlen);
+			len -= AES_BLOCK_SIZE;
+			p[arg - 2] = len >> 8;
+			p[arg - 1] = len;
 		}
-		gctx->iv_set = 1;
-		gctx->iv_gen = 0;
+		actx->mac.c = actx->mac.ipad;
+		actx->mac.tail_len = 0;
+		if (!ibmca_hmac_hw_update(&actx->mac, p, arg))
+			return -1;
+		return ((len + dsz + AES_BLOCK_SIZE) & -AES_BLOCK_SIZE) - len;
+	case EVP_CTRL_TLS1_1_MULTIBLOCK_MAX_BUFSIZE:
+		return arg < 0 ? -1 : ibmca_aes_hmac_mb_len(arg, dsz);
+	case EVP_CTRL_TLS1_1_MULTIBLOCK_AAD:
+		return ibmca_aes_hmac_mb_aad(ctx, arg, ptr);
+	case EVP_CTRL_TLS1_1_MULTIBLOCK_ENCRYPT:
+		return ibmca_aes_hmac_mb_encrypt(ctx, arg, ptr);
+	default:
+		return -1;
 	}
-	return 1;
 }
 
-static int ibmca_aes_gcm_setiv(EVP_CIPHER_CTX *c)
+static int ibmca_aes_hmac_open(EVP_CIPHER_CTX *ctx, unsigned char *out,
+			       const unsigned char *in, size_t len)
 {
-	ICA_AES_GCM_CTX *gctx =
-	    (ICA_AES_GCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(c);
-	const int gkeylen = EVP_CIPHER_CTX_key_length(c);
-	int enc = EVP_CIPHER_CTX_encrypting(c);
+	ICA_AES_HMAC_CTX *actx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+	unsigned char *iv = EVP_CIPHER_CTX_iv_noconst(ctx);
 
-	if (gctx->key == NULL || !gctx->key_set)
+	if (actx->tls_ver >= TLS1_1_VERSION) {
+		if (len < AES_BLOCK_SIZE + actx->mac.size + 1)
+			return 0;
+		/* the explicit IV is left out of the output */
+		memcpy(iv, in, AES_BLOCK_SIZE);
+		in += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+		len -= AES_BLOCK_SIZE;
+	} else if (len < actx->mac.size + 1) {
 		return 0;
+	}
+	return ibmca_aes_hmac_cbc(ctx, iv, out, in, len, 0)
+	       && ibmca_aes_hmac_verify(actx, out, len);
+}
 
-	memset(gctx->icb, 0, sizeof(gctx->icb));
-	memset(gctx->tag, 0, sizeof(gctx->tag));
-	gctx->aadlen = 0;
-	gctx->ptlen = 0;
-	return !(p_ica_aes_gcm_initialize(gctx->iv, gctx->ivlen, gctx->key,
-					  gkeylen, gctx->icb, gctx->ucb,
-					  gctx->subkey, enc));
+/*
+ * Outside of TLS, i.e. without EVP_CTRL_AEAD_TLS1_AAD first, this is
+ * plain AES-CBC; OpenSSL keeps hashing the data there, but nothing ever
+ * reads that hash, so it is not done here.
+ */
+static int ibmca_aes_hmac_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+				    const unsigned char *in, size_t len)
+{
+	ICA_AES_HMAC_CTX *actx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+	unsigned char *iv = EVP_CIPHER_CTX_iv_noconst(ctx);
+	size_t plen = actx->payload_length;
+	int enc = EVP_CIPHER_CTX_encrypting(ctx);
+
+	actx->payload_length = IBMCA_NO_PAYLOAD_LENGTH;
+	if (len % AES_BLOCK_SIZE)
+		return 0;
+	if (plen == IBMCA_NO_PAYLOAD_LENGTH)
+		return ibmca_aes_hmac_cbc(ctx, iv, out, in, len, enc);
+	if (!enc)
+		return plen == EVP_AEAD_TLS1_AAD_LEN
+		       && ibmca_aes_hmac_open(ctx, out, in, len);
+	if (len != ((plen + actx->mac.size + AES_BLOCK_SIZE)
+		    & -AES_BLOCK_SIZE))
+		return 0;
+	return ibmca_aes_hmac_seal(ctx, iv, out, in,
+				   actx->tls_ver >= TLS1_1_VERSION ?
+				   AES_BLOCK_SIZE : 0, plen, len);
 }
 
-static int ibmca_aes_gcm_ctrl(EVP_CIPHER_CTX *c, int type, int arg,
-			      void *ptr)
+static int ibmca_aes_hmac_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+				 const unsigned char *in, size_t len)
 {
-	ICA_AES_GCM_CTX *gctx =
-	    (ICA_AES_GCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(c);
-	unsigned char *iv_noconst = EVP_CIPHER_CTX_iv_noconst(c);
-	unsigned char *buf_noconst = EVP_CIPHER_CTX_buf_noconst(c);
-	int enc = EVP_CIPHER_CTX_encrypting(c);
-	EVP_CIPHER_CTX *out;
-	ICA_AES_GCM_CTX *gctx_out;
-	unsigned char *iv_noconst_out;
-	unsigned int len;
+	int rc;
 
-	switch (type) {
-	case EVP_CTRL_INIT:
-		gctx->key_set = 0;
-		gctx->iv_set = 0;
-		gctx->ivlen = EVP_CIPHER_CTX_iv_length(c);
-		gctx->iv = iv_noconst;
-		gctx->taglen = -1;
-		gctx->iv_gen = 0;
-		gctx->tls_aadlen = -1;
-		return 1;
+	IBMCA_PROBED(rc, EVP_CIPHER_CTX_nid(ctx), len,
+		     ibmca_aes_hmac_do_cipher(ctx, out, in, len));
+	return rc;
+}
+#endif
 
-	case EVP_CTRL_GCM_SET_IVLEN:
-		if (arg <= 0)
-			return 0;
-		if ((arg > EVP_MAX_IV_LENGTH) && (arg > gctx->ivlen)) {
-			if (gctx->iv != iv_noconst)
-				OPENSSL_free(gctx->iv);
-			gctx->iv = OPENSSL_malloc(arg);
-			if (gctx->iv == NULL)
-				return 0;
-		}
-		gctx->ivlen = arg;
-		return 1;
+#ifndef OPENSSL_NO_HMAC
+#ifdef OLDER_OPENSSL
+static HMAC_CTX *HMAC_CTX_new(void)
+{
+	HMAC_CTX *ctx = OPENSSL_malloc(sizeof(*ctx));
 
-	case EVP_CTRL_GCM_SET_TAG:
-		if (arg <= 0 || arg > 16 || enc)
-			return 0;
-		memcpy(buf_noconst, ptr, arg);
-		gctx->taglen = arg;
-		return 1;
+	if (ctx != NULL)
+		HMAC_CTX_init(ctx);
+	return ctx;
+}
 
-	case EVP_CTRL_GCM_GET_TAG:
-		if (arg <= 0 || arg > 16 || !enc || gctx->taglen < 0)
-			return 0;
-		memcpy(ptr, buf_noconst, arg);
-		return 1;
+static void HMAC_CTX_free(HMAC_CTX *ctx)
+{
+	if (ctx == NULL)
+		return;
+	HMAC_CTX_cleanup(ctx);
+	OPENSSL_free(ctx);
+}
+#endif
 
-	case EVP_CTRL_GCM_SET_IV_FIXED:
-		if (arg == -1) {
-			memcpy(gctx->iv, ptr, gctx->ivlen);
-			gctx->iv_gen = 1;
-			return 1;
-		}
-		if ((arg < 4) || (gctx->ivlen - arg) < 8)
-			return 0;
-		if (arg)
-			memcpy(gctx->iv, ptr, arg);
-		if (enc && RAND_bytes(gctx->iv + arg, gctx->ivlen - arg) <= 0)
-			return 0;
-		gctx->iv_gen = 1;
-		return 1;
+static int ibmca_hmac_cached_pads(struct ibmca_hmac_state *hw, int nid,
+				  const ASN1_OCTET_STRING *key)
+{
+	struct ibmca_hmac_key *k;
+	int rc;
 
-	case EVP_CTRL_GCM_IV_GEN:
-		if (gctx->iv_gen == 0 || gctx->key_set == 0)
-			return 0;
-		if (!ibmca_aes_gcm_setiv(c))
-			return 0;
-		if (arg <= 0 || arg > gctx->ivlen)
-			arg = gctx->ivlen;
-		memcpy(ptr, gctx->iv + gctx->ivlen - arg, arg);
-		++*(uint64_t *)(gctx->iv + gctx->ivlen - 8);
-		gctx->iv_set = 1;
-		return 1;
+	k = &ibmca_hmac_cache[(uintptr_t)key / sizeof(*key) % IBMCA_HMAC_CACHE];
+	if (key->length > IBMCA_HMAC_MAX_BLOCK
+	    || pthread_mutex_trylock(&ibmca_hmac_cache_lock))
+		return ibmca_hmac_pads(hw, nid, key->data, key->length);
+
+	if (k->st.nid == nid && k->keylen == key->length
+	    && CRYPTO_memcmp(k->key, key->data, key->length) == 0) {
+		*hw = k->st;
+		rc = 1;
+	} else if ((rc = ibmca_hmac_pads(hw, nid, key->data, key->length))) {
+		k->keylen = key->length;
+		memcpy(k->key, key->data, key->length);
+		k->st = *hw;
+	}
+	pthread_mutex_unlock(&ibmca_hmac_cache_lock);
+	return rc;
+}
+
+static void ibmca_hmac_cache_clear(void)
+{
+	pthread_mutex_lock(&ibmca_hmac_cache_lock);
+	OPENSSL_cleanse(ibmca_hmac_cache, sizeof(ibmca_hmac_cache));
+	pthread_mutex_unlock(&ibmca_hmac_cache_lock);
+}
+
+/*
+ * Get the ipad and opad states of the key from libica, or set up the
+ * HMAC_CTX if libica does not do the digest.
+ */
+static int ibmca_hmac_key(IBMCA_HMAC_CTX *ctx, const EVP_MD *md,
+			  const ASN1_OCTET_STRING *key)
+{
+	int algo, nid = md != NULL ? EVP_MD_type(md) : NID_undef;
+
+	switch (nid) {
+	case NID_sha1:
+		algo = SHA1;
+		break;
+	case NID_sha256:
+		algo = SHA256;
+		break;
+	case NID_sha512:
+		algo = SHA512;
+		break;
+	default:
+		algo = 0;
+		break;
+	}
+	if (!algo || !ibmca_algo_enabled(algo)) {
+		ctx->route = IBMCA_ROUTE_SW;
+		return HMAC_Init_ex(ctx->sw, key->data, key->length, md, NULL);
+	}
+
+	ctx->route = IBMCA_ROUTE_HW;
+	if (!ibmca_hmac_cached_pads(&ctx->hw, nid, key)) {
+		IBMCAerr(IBMCA_F_IBMCA_HMAC_INIT, IBMCA_R_REQUEST_FAILED);
+		return 0;
+	}
+	return 1;
+}
 
-	case EVP_CTRL_GCM_SET_IV_INV:
-		if (gctx->iv_gen == 0 || gctx->key_set == 0 || enc)
-			return 0;
-		memcpy(gctx->iv + gctx->ivlen - arg, ptr, arg);
-		if (!ibmca_aes_gcm_setiv(c))
-			return 0;
-		gctx->iv_set = 1;
-		return 1;
+static int ibmca_hmac_init(EVP_PKEY_CTX *pctx)
+{
+	IBMCA_HMAC_CTX *ctx;
 
-	case EVP_CTRL_AEAD_TLS1_AAD:
-		if (arg != EVP_AEAD_TLS1_AAD_LEN)
-			return 0;
-		memcpy(buf_noconst, ptr, arg);
-		gctx->tls_aadlen = arg;
-		len = buf_noconst[arg - 2] << 8 | buf_noconst[arg - 1];
-		if (len < EVP_GCM_TLS_EXPLICIT_IV_LEN)
-			return 0;
-		len -= EVP_GCM_TLS_EXPLICIT_IV_LEN;
-		if (!enc) {
-			if (len < EVP_GCM_TLS_TAG_LEN)
-				return 0;
-			len -= EVP_GCM_TLS_TAG_LEN;
-		}
-		buf_noconst[arg - 2] = len >> 8;
-		buf_noconst[arg - 1] = len & 0xff;
-		return EVP_GCM_TLS_TAG_LEN;
+	if ((ctx = OPENSSL_malloc(sizeof(*ctx))) == NULL)
+		return 0;
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->ktmp.type = V_ASN1_OCTET_STRING;
+	if ((ctx->sw = HMAC_CTX_new()) == NULL) {
+		OPENSSL_free(ctx);
+		return 0;
+	}
+	EVP_PKEY_CTX_set_data(pctx, ctx);
+	return 1;
+}
 
-	case EVP_CTRL_COPY: {
-		out = ptr;
-		gctx_out = (ICA_AES_GCM_CTX *)
-			   EVP_CIPHER_CTX_get_cipher_data(out);
-		iv_noconst_out = EVP_CIPHER_CTX_iv_noconst(out);
-		if (gctx->iv == iv_noconst) {
-			gctx_out->iv = iv_noconst_out;
-		} else {
-			gctx_out->iv = OPENSSL_malloc(gctx->ivlen);
-			if (gctx_out->iv == NULL)
-				return 0;
-			memcpy(gctx_out->iv, gctx->iv, gctx->ivlen);
-		}
-		return 1;
+static void ibmca_hmac_cleanup(EVP_PKEY_CTX *pctx)
+{
+	IBMCA_HMAC_CTX *ctx = EVP_PKEY_CTX_get_data(pctx);
+
+	if (ctx == NULL)
+		return;
+	HMAC_CTX_free(ctx->sw);
+	if (ctx->ktmp.data != NULL) {
+		OPENSSL_cleanse(ctx->ktmp.data, ctx->ktmp.length);
+		OPENSSL_free(ctx->ktmp.data);
 	}
-	default:
-		return -1;
-    }
+	OPENSSL_cleanse(ctx, sizeof(*ctx));
+	OPENSSL_free(ctx);
+	EVP_PKEY_CTX_set_data(pctx, NULL);
 }
 
-static int ibmca_gcm_tag(EVP_CIPHER_CTX *ctx, unsigned char *out,
-			 const unsigned char *in, int taglen)
+static int ibmca_hmac_copy(EVP_PKEY_CTX *dst,
+			   IBMCA_PKEY_CTX_CONST EVP_PKEY_CTX *src)
 {
-	ICA_AES_GCM_CTX *gctx =
-	    (ICA_AES_GCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(ctx);
-	int enc = EVP_CIPHER_CTX_encrypting(ctx);
-	const int gkeylen = EVP_CIPHER_CTX_key_length(ctx);
+	IBMCA_HMAC_CTX *sctx = EVP_PKEY_CTX_get_data(src), *dctx;
 
-	if (p_ica_aes_gcm_last(gctx->icb, gctx->aadlen, gctx->ptlen,
-			       gctx->tag, (unsigned char *)in, taglen,
-			       gctx->key, gkeylen, gctx->subkey, enc))
+	if (!ibmca_hmac_init(dst))
+		return 0;
+	dctx = EVP_PKEY_CTX_get_data(dst);
+	dctx->md = sctx->md;
+	dctx->route = sctx->route;
+	dctx->hw = sctx->hw;
+	if ((sctx->ktmp.data != NULL
+	     && !ASN1_OCTET_STRING_set(&dctx->ktmp, sctx->ktmp.data,
+				       sctx->ktmp.length))
+	    || (sctx->route == IBMCA_ROUTE_SW
+		&& !HMAC_CTX_copy(dctx->sw, sctx->sw))) {
+		ibmca_hmac_cleanup(dst);
 		return 0;
+	}
+	return 1;
+}
 
-	if (out)
-		memcpy(out, gctx->tag, taglen);
+static int ibmca_hmac_keygen(EVP_PKEY_CTX *pctx, EVP_PKEY *pkey)
+{
+	IBMCA_HMAC_CTX *ctx = EVP_PKEY_CTX_get_data(pctx);
+	ASN1_OCTET_STRING *hkey;
 
+	if (ctx->ktmp.data == NULL
+	    || (hkey = ASN1_OCTET_STRING_dup(&ctx->ktmp)) == NULL)
+		return 0;
+	if (!EVP_PKEY_assign(pkey, EVP_PKEY_HMAC, hkey)) {
+		ASN1_OCTET_STRING_free(hkey);
+		return 0;
+	}
 	return 1;
 }
 
-static int ibmca_aes_gcm_tls_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
-                                    const unsigned char *in, size_t len)
+static int ibmca_hmac_update(EVP_MD_CTX *mctx, const void *data,
+			     size_t count)
 {
-	ICA_AES_GCM_CTX *gctx =
-	    (ICA_AES_GCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(ctx);
-	unsigned char *buf = EVP_CIPHER_CTX_buf_noconst(ctx);
-	int enc = EVP_CIPHER_CTX_encrypting(ctx);
-	const int keylen = EVP_CIPHER_CTX_key_length(ctx);
-	int rv = -1;
+	IBMCA_HMAC_CTX *ctx = EVP_PKEY_CTX_get_data(EVP_MD_CTX_pkey_ctx(mctx));
 
-	if (out != in
-	    || len < (EVP_GCM_TLS_EXPLICIT_IV_LEN + EVP_GCM_TLS_TAG_LEN))
-		return -1;
-	if (EVP_CIPHER_CTX_ctrl(ctx, enc ? EVP_CTRL_GCM_IV_GEN :
-	    EVP_CTRL_GCM_SET_IV_INV, EVP_GCM_TLS_EXPLICIT_IV_LEN, out) <= 0)
-		goto err;
+	if (ctx->route != IBMCA_ROUTE_HW)
+		return HMAC_Update(ctx->sw, data, count);
+	if (!ibmca_hmac_hw_update(&ctx->hw, data, count)) {
+		IBMCAerr(IBMCA_F_IBMCA_HMAC_UPDATE, IBMCA_R_REQUEST_FAILED);
+		return 0;
+	}
+	return 1;
+}
 
-	if (!ibmca_gcm_aad(gctx, buf, gctx->tls_aadlen, enc, keylen))
-		goto err;
+static int ibmca_hmac_signctx_init(EVP_PKEY_CTX *pctx, EVP_MD_CTX *mctx)
+{
+	EVP_MD_CTX_set_flags(mctx, EVP_MD_CTX_FLAG_NO_INIT);
+	EVP_MD_CTX_set_update_fn(mctx, ibmca_hmac_update);
+	return 1;
+}
 
-	in += EVP_GCM_TLS_EXPLICIT_IV_LEN;
-	out += EVP_GCM_TLS_EXPLICIT_IV_LEN;
-	len -= EVP_GCM_TLS_EXPLICIT_IV_LEN + EVP_GCM_TLS_TAG_LEN;
+static int ibmca_hmac_signctx(EVP_PKEY_CTX *pctx, unsigned char *sig,
+			      size_t *siglen, EVP_MD_CTX *mctx)
+{
+	IBMCA_HMAC_CTX *ctx = EVP_PKEY_CTX_get_data(pctx);
+	unsigned int hlen;
+	int l = EVP_MD_CTX_size(mctx);
 
-	if (!ibmca_aes_gcm(gctx, in, out, len, enc, keylen))
-		goto err;
+	if (l < 0)
+		return 0;
+	*siglen = l;
+	if (sig == NULL)
+		return 1;
 
-	if (enc) {
-		out += len;
-		if (!ibmca_gcm_tag(ctx, out, NULL, EVP_GCM_TLS_TAG_LEN)) {
-			goto err;
-		}
-		rv = len + EVP_GCM_TLS_EXPLICIT_IV_LEN + EVP_GCM_TLS_TAG_LEN;
-	} else {
-		if (!ibmca_gcm_tag(ctx, buf, in + len, EVP_GCM_TLS_TAG_LEN)) {
-			OPENSSL_cleanse(out, len);
-			goto err;
-		}
-		rv = len;
+	if (ctx->route != IBMCA_ROUTE_HW) {
+		if (!HMAC_Final(ctx->sw, sig, &hlen))
+			return 0;
+		*siglen = hlen;
+		return 1;
 	}
-err:
-	gctx->iv_set = 0;
-	gctx->tls_aadlen = -1;
-	return rv;
+	if (!ibmca_hmac_hw_final(&ctx->hw, sig)) {
+		IBMCAerr(IBMCA_F_IBMCA_HMAC_FINAL, IBMCA_R_REQUEST_FAILED);
+		return 0;
+	}
+	return 1;
 }
 
-static int ibmca_aes_gcm_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
-                                const unsigned char *in, size_t len)
+static int ibmca_hmac_ctrl(EVP_PKEY_CTX *pctx, int type, int p1, void *p2)
 {
-	ICA_AES_GCM_CTX *gctx =
-	    (ICA_AES_GCM_CTX *)EVP_CIPHER_CTX_get_cipher_data(ctx);
-	unsigned char *buf = EVP_CIPHER_CTX_buf_noconst(ctx);
-	int enc = EVP_CIPHER_CTX_encrypting(ctx);
-	const int keylen = EVP_CIPHER_CTX_key_length(ctx);
-
-	if (!gctx->key_set)
-		return -1;
+	IBMCA_HMAC_CTX *ctx = EVP_PKEY_CTX_get_data(pctx);
+	ASN1_OCTET_STRING *key;
+	EVP_PKEY *pkey;
 
-	if (gctx->tls_aadlen >= 0)
-		return ibmca_aes_gcm_tls_cipher(ctx, out, in, len);
+	switch (type) {
+	case EVP_PKEY_CTRL_SET_MAC_KEY:
+		if ((p2 == NULL && p1 > 0) || p1 < -1)
+			return 0;
+		return ASN1_OCTET_STRING_set(&ctx->ktmp, p2, p1);
+	case EVP_PKEY_CTRL_MD:
+		ctx->md = p2;
+		return 1;
+	case EVP_PKEY_CTRL_DIGESTINIT:
+		if ((pkey = EVP_PKEY_CTX_get0_pkey(pctx)) == NULL
+		    || (key = EVP_PKEY_get0(pkey)) == NULL)
+			return 0;
+		return ibmca_hmac_key(ctx, EVP_MD_CTX_md((EVP_MD_CTX *)p2),
+				      key);
+	default:
+		return -2;
+	}
+}
 
-	if (!gctx->iv_set)
-		return -1;
+static int ibmca_hmac_ctrl_str(EVP_PKEY_CTX *pctx, const char *type,
+			       const char *value)
+{
+	unsigned char *key;
+	long keylen;
+	int rc;
 
-	if (in) {
-		if (out == NULL) {
-			if (!ibmca_gcm_aad(gctx, in, len, enc, keylen))
-				return -1;
-		} else {
-			if (!ibmca_aes_gcm(gctx, in, out, len, enc, keylen))
-				return -1;
-		}
-		return len;
-	} else {
-		if (enc) {
-			gctx->taglen = 16;
-			if (!ibmca_gcm_tag(ctx, buf, NULL, gctx->taglen))
-				return -1;
-		} else {
-			if (gctx->taglen < 0)
-				return -1;
-			if (!ibmca_gcm_tag(ctx, NULL, buf, gctx->taglen))
-				return -1;
-		}
-		gctx->iv_set = 0;
+	if (value == NULL)
 		return 0;
+	if (strcmp(type, "key") == 0)
+		return ibmca_hmac_ctrl(pctx, EVP_PKEY_CTRL_SET_MAC_KEY,
+				       strlen(value), (void *)value);
+	if (strcmp(type, "hexkey") == 0) {
+		if ((key = OPENSSL_hexstr2buf(value, &keylen)) == NULL)
+			return 0;
+		rc = ibmca_hmac_ctrl(pctx, EVP_PKEY_CTRL_SET_MAC_KEY, keylen,
+				     key);
+		OPENSSL_cleanse(key, keylen);
+		OPENSSL_free(key);
+		return rc;
 	}
+	return -2;
+}
+
+static EVP_PKEY_METHOD *ibmca_hmac_meth_new(void)
+{
+	EVP_PKEY_METHOD *meth;
+
+	if ((meth = EVP_PKEY_meth_new(EVP_PKEY_HMAC, 0)) == NULL)
+		return NULL;
+	EVP_PKEY_meth_set_init(meth, ibmca_hmac_init);
+	EVP_PKEY_meth_set_copy(meth, ibmca_hmac_copy);
+	EVP_PKEY_meth_set_cleanup(meth, ibmca_hmac_cleanup);
+	EVP_PKEY_meth_set_keygen(meth, NULL, ibmca_hmac_keygen);
+	EVP_PKEY_meth_set_signctx(meth, ibmca_hmac_signctx_init,
+				  ibmca_hmac_signctx);
+	EVP_PKEY_meth_set_ctrl(meth, ibmca_hmac_ctrl, ibmca_hmac_ctrl_str);
+	return meth;
 }
 #endif
 
+static int ibmca_engine_pkey_meths(ENGINE *e, EVP_PKEY_METHOD **pmeth,
+				   const int **nids, int nid)
+{
+	static int list[sizeof(ibmca_all_pkey_nids) /
+			sizeof(ibmca_all_pkey_nids[0])];
+
+	if (!pmeth)
+		return ibmca_all_nids(ibmca_all_pkey_nids, NID_undef, list,
+				      nids);
+
+	if (!ibmca_load()
+	    || (*pmeth = (EVP_PKEY_METHOD *)
+			 crypto_pair_lookup(&ibmca_pkey_lists, nid)) == NULL)
+		*pmeth = (EVP_PKEY_METHOD *)EVP_PKEY_meth_find(nid);
+	return (*pmeth != NULL);
+}
+
 static int ibmca_engine_digests(ENGINE * e, const EVP_MD ** digest,
 				const int **nids, int nid)
 {
-	int i;
-	if (!digest)
-		return (ibmca_usable_digests(nids));
-
-        *digest = NULL;
-        for(i = 0; i < size_digest_list;i++)
-                if(nid == ibmca_digest_lists.nids[i]){
-                        *digest = (EVP_MD*) ibmca_digest_lists.crypto_meths[i];
-                        break;
-		}
+	static int list[sizeof(ibmca_all_digest_nids) /
+			sizeof(ibmca_all_digest_nids[0])];
 
+	if (!digest)
+		return ibmca_all_nids(ibmca_all_digest_nids, NID_undef, list,
+				      nids);
 
+	if (!ibmca_load()
+	    || (*digest = crypto_pair_lookup(&ibmca_digest_lists, nid))
+	       == NULL)
+		*digest = EVP_get_digestbynid(nid);
 	return (*digest != NULL);
 }
 
-static int ibmca_usable_digests(const int **nids)
-{
-        if(nids)
-		*nids = ibmca_digest_lists.nids;
-	return size_digest_list;
-}
-
 #ifndef OPENSSL_NO_SHA1
 static int ibmca_sha1_init(EVP_MD_CTX * ctx)
 {
@@ -2802,8 +6089,8 @@ static int ibmca_sha1_init(EVP_MD_CTX * ctx)
 	return 1;
 }
 
-static int ibmca_sha1_update(EVP_MD_CTX * ctx, const void *in_data,
-			     unsigned long inlen)
+static int ibmca_sha1_do_update(EVP_MD_CTX * ctx, const void *in_data,
+				unsigned long inlen)
 {
 #ifdef OLDER_OPENSSL
 	IBMCA_SHA_CTX *ibmca_sha_ctx = ctx->md_data;
@@ -2818,6 +6105,15 @@ static int ibmca_sha1_update(EVP_MD_CTX * ctx, const void *in_data,
 	if (in_data_len == 0)
 		return 1;
 
+	if (ibmca_sha_ctx->route == IBMCA_ROUTE_UNSET
+	    && (ibmca_sha_ctx->route = ibmca_route(NID_sha1, inlen))
+	       == IBMCA_ROUTE_SW)
+		SHA1_Init(&ibmca_sha_ctx->sw);
+	if (ibmca_sha_ctx->route == IBMCA_ROUTE_SW) {
+		ibmca_stat_fallback(IBMCA_STAT_SHA1, inlen);
+		return SHA1_Update(&ibmca_sha_ctx->sw, in_data, inlen);
+	}
+
 	if( ibmca_sha_ctx->c.runningLength == 0 && ibmca_sha_ctx->tail_len == 0) {
 		message_part = SHA_MSG_PART_FIRST;
 
@@ -2841,7 +6137,7 @@ static int ibmca_sha1_update(EVP_MD_CTX * ctx, const void *in_data,
 			memcpy(ibmca_sha_ctx->tail + ibmca_sha_ctx->tail_len, in_data, fill_size);
 
 			/* Submit the filled out tail buffer */
-			if( p_ica_sha1( (unsigned int)SHA_MSG_PART_FIRST,
+			if( ibmca_ica_sha1( (unsigned int)SHA_MSG_PART_FIRST,
 					(unsigned int)SHA_BLOCK_SIZE, ibmca_sha_ctx->tail,
 					&ibmca_sha_ctx->c,
 					tmp_hash)) {
@@ -2880,7 +6176,7 @@ static int ibmca_sha1_update(EVP_MD_CTX * ctx, const void *in_data,
 						in_data, fill_size);
 
 				/* Submit the filled out save buffer */
-				if( p_ica_sha1( message_part,
+				if( ibmca_ica_sha1( message_part,
 						(unsigned int)SHA_BLOCK_SIZE, ibmca_sha_ctx->tail,
 						&ibmca_sha_ctx->c,
 						tmp_hash)) {
@@ -2927,8 +6223,8 @@ static int ibmca_sha1_update(EVP_MD_CTX * ctx, const void *in_data,
 
 	/* If the data passed in was <64 bytes, in_data_len will be 0 */
         if( in_data_len &&
-		p_ica_sha1(message_part,
-			(unsigned int)in_data_len, (unsigned char *)(in_data + fill_size),
+		ibmca_ica_sha1(message_part,
+			in_data_len, (unsigned char *)(in_data + fill_size),
 			&ibmca_sha_ctx->c,
 			tmp_hash)) {
 
@@ -2939,6 +6235,16 @@ static int ibmca_sha1_update(EVP_MD_CTX * ctx, const void *in_data,
 	return 1;
 }
 
+static int ibmca_sha1_update(EVP_MD_CTX *ctx, const void *in_data,
+			     unsigned long inlen)
+{
+	int rc;
+
+	IBMCA_PROBED(rc, NID_sha1, inlen,
+		     ibmca_sha1_do_update(ctx, in_data, inlen));
+	return rc;
+}
+
 static int ibmca_sha1_final(EVP_MD_CTX * ctx, unsigned char *md)
 {
 #ifdef OLDER_OPENSSL
@@ -2948,12 +6254,20 @@ static int ibmca_sha1_final(EVP_MD_CTX * ctx, unsigned char *md)
 #endif
 	unsigned int message_part = 0;
 
+	/* empty message */
+	if (ibmca_sha_ctx->route == IBMCA_ROUTE_UNSET
+	    && (ibmca_sha_ctx->route = ibmca_route(NID_sha1, 0))
+	       == IBMCA_ROUTE_SW)
+		SHA1_Init(&ibmca_sha_ctx->sw);
+	if (ibmca_sha_ctx->route == IBMCA_ROUTE_SW)
+		return SHA1_Final(md, &ibmca_sha_ctx->sw);
+
 	if (ibmca_sha_ctx->c.runningLength)
 		message_part = SHA_MSG_PART_FINAL;
 	else
 		message_part = SHA_MSG_PART_ONLY;
 
-	if( p_ica_sha1(message_part,
+	if( ibmca_ica_sha1(message_part,
 		       ibmca_sha_ctx->tail_len,
 		       (unsigned char *)ibmca_sha_ctx->tail,
 		       &ibmca_sha_ctx->c, md)) {
@@ -2985,7 +6299,8 @@ static int ibmca_sha256_init(EVP_MD_CTX *ctx)
 }				// end ibmca_sha256_init
 
 static int
-ibmca_sha256_update(EVP_MD_CTX *ctx, const void *in_data, unsigned long inlen)
+ibmca_sha256_do_update(EVP_MD_CTX *ctx, const void *in_data,
+		       unsigned long inlen)
 {
 #ifdef OLDER_OPENSSL
 	IBMCA_SHA256_CTX *ibmca_sha256_ctx = ctx->md_data;
@@ -2999,6 +6314,15 @@ ibmca_sha256_update(EVP_MD_CTX *ctx, const void *in_data, unsigned long inlen)
 	if (in_data_len == 0)
 		return 1;
 
+	if (ibmca_sha256_ctx->route == IBMCA_ROUTE_UNSET
+	    && (ibmca_sha256_ctx->route = ibmca_route(NID_sha256, inlen))
+	       == IBMCA_ROUTE_SW)
+		SHA256_Init(&ibmca_sha256_ctx->sw);
+	if (ibmca_sha256_ctx->route == IBMCA_ROUTE_SW) {
+		ibmca_stat_fallback(IBMCA_STAT_SHA256, inlen);
+		return SHA256_Update(&ibmca_sha256_ctx->sw, in_data, inlen);
+	}
+
 	if (ibmca_sha256_ctx->c.runningLength == 0
 	    && ibmca_sha256_ctx->tail_len == 0) {
 		message_part = SHA_MSG_PART_FIRST;
@@ -3024,7 +6348,7 @@ ibmca_sha256_update(EVP_MD_CTX *ctx, const void *in_data, unsigned long inlen)
 			       fill_size);
 
 			/* Submit the filled out tail buffer */
-			if (p_ica_sha256((unsigned int)SHA_MSG_PART_FIRST,
+			if (ibmca_ica_sha256((unsigned int)SHA_MSG_PART_FIRST,
 					(unsigned int)SHA256_BLOCK_SIZE,
 					ibmca_sha256_ctx->tail,
 					&ibmca_sha256_ctx->c,
@@ -3062,7 +6386,7 @@ ibmca_sha256_update(EVP_MD_CTX *ctx, const void *in_data, unsigned long inlen)
 				       fill_size);
 
 				/* Submit the filled out save buffer */
-				if (p_ica_sha256(message_part,
+				if (ibmca_ica_sha256(message_part,
 						(unsigned int)SHA256_BLOCK_SIZE,
 						ibmca_sha256_ctx->tail,
 						&ibmca_sha256_ctx->c,
@@ -3110,8 +6434,8 @@ ibmca_sha256_update(EVP_MD_CTX *ctx, const void *in_data, unsigned long inlen)
 
 	/* If the data passed in was <64 bytes, in_data_len will be 0 */
         if (in_data_len &&
-	    p_ica_sha256(message_part,
-			(unsigned int)in_data_len, (unsigned char *)(in_data + fill_size),
+	    ibmca_ica_sha256(message_part,
+			in_data_len, (unsigned char *)(in_data + fill_size),
 			&ibmca_sha256_ctx->c,
 			tmp_hash)) {
 		IBMCAerr(IBMCA_F_IBMCA_SHA256_UPDATE, IBMCA_R_REQUEST_FAILED);
@@ -3119,7 +6443,17 @@ ibmca_sha256_update(EVP_MD_CTX *ctx, const void *in_data, unsigned long inlen)
 	}
 
 	return 1;
-}				// end ibmca_sha256_update
+}				// end ibmca_sha256_do_update
+
+static int ibmca_sha256_update(EVP_MD_CTX *ctx, const void *in_data,
+			       unsigned long inlen)
+{
+	int rc;
+
+	IBMCA_PROBED(rc, NID_sha256, inlen,
+		     ibmca_sha256_do_update(ctx, in_data, inlen));
+	return rc;
+}
 
 static int ibmca_sha256_final(EVP_MD_CTX *ctx, unsigned char *md)
 {
@@ -3130,12 +6464,20 @@ static int ibmca_sha256_final(EVP_MD_CTX *ctx, unsigned char *md)
 #endif
 	unsigned int message_part = 0;
 
+	/* empty message */
+	if (ibmca_sha256_ctx->route == IBMCA_ROUTE_UNSET
+	    && (ibmca_sha256_ctx->route = ibmca_route(NID_sha256, 0))
+	       == IBMCA_ROUTE_SW)
+		SHA256_Init(&ibmca_sha256_ctx->sw);
+	if (ibmca_sha256_ctx->route == IBMCA_ROUTE_SW)
+		return SHA256_Final(md, &ibmca_sha256_ctx->sw);
+
 	if (ibmca_sha256_ctx->c.runningLength)
 		message_part = SHA_MSG_PART_FINAL;
 	else
 		message_part = SHA_MSG_PART_ONLY;
 
-	if (p_ica_sha256(message_part,
+	if (ibmca_ica_sha256(message_part,
 			ibmca_sha256_ctx->tail_len,
 			(unsigned char *)ibmca_sha256_ctx->tail,
 			&ibmca_sha256_ctx->c,
@@ -3166,7 +6508,8 @@ static int ibmca_sha512_init(EVP_MD_CTX *ctx)
 }
 
 static int
-ibmca_sha512_update(EVP_MD_CTX *ctx, const void *in_data, unsigned long inlen)
+ibmca_sha512_do_update(EVP_MD_CTX *ctx, const void *in_data,
+		       unsigned long inlen)
 {
 #ifdef OLDER_OPENSSL
 	IBMCA_SHA512_CTX *ibmca_sha512_ctx = ctx->md_data;
@@ -3180,6 +6523,15 @@ ibmca_sha512_update(EVP_MD_CTX *ctx, const void *in_data, unsigned long inlen)
 	if (in_data_len == 0)
 		return 1;
 
+	if (ibmca_sha512_ctx->route == IBMCA_ROUTE_UNSET
+	    && (ibmca_sha512_ctx->route = ibmca_route(NID_sha512, inlen))
+	       == IBMCA_ROUTE_SW)
+		SHA512_Init(&ibmca_sha512_ctx->sw);
+	if (ibmca_sha512_ctx->route == IBMCA_ROUTE_SW) {
+		ibmca_stat_fallback(IBMCA_STAT_SHA512, inlen);
+		return SHA512_Update(&ibmca_sha512_ctx->sw, in_data, inlen);
+	}
+
 	if (ibmca_sha512_ctx->c.runningLengthLow == 0
 	    && ibmca_sha512_ctx->tail_len == 0) {
 		message_part = SHA_MSG_PART_FIRST;
@@ -3206,7 +6558,7 @@ ibmca_sha512_update(EVP_MD_CTX *ctx, const void *in_data, unsigned long inlen)
 			       fill_size);
 
 			/* Submit the filled out tail buffer */
-			if (p_ica_sha512((unsigned int)SHA_MSG_PART_FIRST,
+			if (ibmca_ica_sha512((unsigned int)SHA_MSG_PART_FIRST,
 					 (unsigned int)SHA512_BLOCK_SIZE,
 					 ibmca_sha512_ctx->tail,
 					 &ibmca_sha512_ctx->c, tmp_hash)) {
@@ -3244,7 +6596,7 @@ ibmca_sha512_update(EVP_MD_CTX *ctx, const void *in_data, unsigned long inlen)
 					fill_size);
 
 				/* Submit the filled out save buffer */
-				if (p_ica_sha512(message_part,
+				if (ibmca_ica_sha512(message_part,
 						(unsigned int)SHA512_BLOCK_SIZE,
 						ibmca_sha512_ctx->tail,
 						&ibmca_sha512_ctx->c,
@@ -3293,7 +6645,7 @@ ibmca_sha512_update(EVP_MD_CTX *ctx, const void *in_data, unsigned long inlen)
 
 	/* If the data passed in was <128 bytes, in_data_len will be 0 */
 	if (in_data_len &&
-	    p_ica_sha512(message_part, (unsigned int)in_data_len,
+	    ibmca_ica_sha512(message_part, in_data_len,
 			 (unsigned char *)(in_data + fill_size),
 			 &ibmca_sha512_ctx->c, tmp_hash)) {
 		IBMCAerr(IBMCA_F_IBMCA_SHA512_UPDATE, IBMCA_R_REQUEST_FAILED);
@@ -3303,6 +6655,16 @@ ibmca_sha512_update(EVP_MD_CTX *ctx, const void *in_data, unsigned long inlen)
 	return 1;
 }
 
+static int ibmca_sha512_update(EVP_MD_CTX *ctx, const void *in_data,
+			       unsigned long inlen)
+{
+	int rc;
+
+	IBMCA_PROBED(rc, NID_sha512, inlen,
+		     ibmca_sha512_do_update(ctx, in_data, inlen));
+	return rc;
+}
+
 static int ibmca_sha512_final(EVP_MD_CTX *ctx, unsigned char *md)
 {
 #ifdef OLDER_OPENSSL
@@ -3312,12 +6674,20 @@ static int ibmca_sha512_final(EVP_MD_CTX *ctx, unsigned char *md)
 #endif
 	unsigned int message_part = 0;
 
+	/* empty message */
+	if (ibmca_sha512_ctx->route == IBMCA_ROUTE_UNSET
+	    && (ibmca_sha512_ctx->route = ibmca_route(NID_sha512, 0))
+	       == IBMCA_ROUTE_SW)
+		SHA512_Init(&ibmca_sha512_ctx->sw);
+	if (ibmca_sha512_ctx->route == IBMCA_ROUTE_SW)
+		return SHA512_Final(md, &ibmca_sha512_ctx->sw);
+
 	if (ibmca_sha512_ctx->c.runningLengthLow)
 		message_part = SHA_MSG_PART_FINAL;
 	else
 		message_part = SHA_MSG_PART_ONLY;
 
-	if (p_ica_sha512(message_part, ibmca_sha512_ctx->tail_len,
+	if (ibmca_ica_sha512(message_part, ibmca_sha512_ctx->tail_len,
 			 (unsigned char *)ibmca_sha512_ctx->tail,
 			 &ibmca_sha512_ctx->c, md)) {
 		IBMCAerr(IBMCA_F_IBMCA_SHA512_FINAL, IBMCA_R_REQUEST_FAILED);
@@ -3333,8 +6703,8 @@ static int ibmca_sha512_cleanup(EVP_MD_CTX *ctx)
 }
 #endif // OPENSSL_NO_SHA512
 
-static int ibmca_mod_exp(BIGNUM *r, const BIGNUM *a, const BIGNUM *p,
-			 const BIGNUM *m, BN_CTX *ctx)
+static int ibmca_do_mod_exp(BIGNUM *r, const BIGNUM *a, const BIGNUM *p,
+			    const BIGNUM *m, BN_CTX *ctx)
 {
 	/* r = (a^p) mod m
 	                        r = output
@@ -3348,9 +6718,9 @@ static int ibmca_mod_exp(BIGNUM *r, const BIGNUM *a, const BIGNUM *p,
 	unsigned int rc;
 	int plen, mlen, inputlen;
 
-	if (!ibmca_dso) {
-		IBMCAerr(IBMCA_F_IBMCA_MOD_EXP, IBMCA_R_NOT_LOADED);
-		goto err;
+	if (!ibmca_pkey_usable(0)) {
+		ibmca_stat_fallback(IBMCA_STAT_RSA_ME, BN_num_bytes(m));
+		return BN_mod_exp(r, a, p, m, ctx);
 	}
 
 	/*
@@ -3406,7 +6776,7 @@ static int ibmca_mod_exp(BIGNUM *r, const BIGNUM *a, const BIGNUM *p,
 	BN_bn2bin(a, input + key->key_length - inputlen);
 
 	/* execute the ica mod_exp call */
-	rc = p_ica_rsa_mod_expo(ibmca_handle, input, key, output);
+	rc = ibmca_ica_rsa_mod_expo(ibmca_pkey_handle(), input, key, output);
 	if (rc != 0) {
 		goto err;
 	}
@@ -3435,7 +6805,37 @@ end:
 	return rc;
 }
 
+static int ibmca_mod_exp(BIGNUM *r, const BIGNUM *a, const BIGNUM *p,
+			 const BIGNUM *m, BN_CTX *ctx)
+{
+	int rc;
+
+	IBMCA_PROBED(rc, NID_rsaEncryption, BN_num_bytes(m),
+		     ibmca_do_mod_exp(r, a, p, m, ctx));
+	return rc;
+}
+
+/*
+ * Keys below rsa_crt_min_bits (set by a tuning file) are used without
+ * their CRT parameters, where mod-expo was measured to be faster.
+ */
+static int rsa_crt_min_bits;
+
+void ibmca_rsa_crt_min_bits_set(int bits)
+{
+	__atomic_store_n(&rsa_crt_min_bits, bits, __ATOMIC_RELAXED);
+}
+
 #ifndef OPENSSL_NO_RSA
+static int ibmca_rsa_use_me(int bits)
+{
+	/* CALIBRATE decides itself, see IBMCA_TUNE_ROUTE_ME */
+	if (__atomic_load_n(&ibmca_route_forcing, __ATOMIC_RELAXED)
+	    && ibmca_route_forced != IBMCA_ROUTE_UNSET)
+		return ibmca_rsa_me_forced;
+	return bits < __atomic_load_n(&rsa_crt_min_bits, __ATOMIC_RELAXED);
+}
+
 static int ibmca_rsa_init(RSA *rsa)
 {
 	RSA_blinding_off(rsa);
@@ -3449,13 +6849,18 @@ static int ibmca_rsa_mod_exp(BIGNUM * r0, const BIGNUM * I, RSA * rsa,
 {
 	int to_return = 0;
 
-	if (!rsa->p || !rsa->q || !rsa->dmp1 || !rsa->dmq1 || !rsa->iqmp) {
+	if (!rsa->p || !rsa->q || !rsa->dmp1 || !rsa->dmq1 || !rsa->iqmp
+	    || (rsa->d && rsa->n && ibmca_rsa_use_me(BN_num_bits(rsa->n)))) {
 		if (!rsa->d || !rsa->n) {
 			IBMCAerr(IBMCA_F_IBMCA_RSA_MOD_EXP,
 				 IBMCA_R_MISSING_KEY_COMPONENTS);
 			goto err;
 		}
 		to_return = ibmca_mod_exp(r0, I, rsa->d, rsa->n, ctx);
+	} else if (!ibmca_pkey_usable(1)) {
+		ibmca_stat_fallback(IBMCA_STAT_RSA_CRT,
+				    2 * BN_num_bytes(rsa->p));
+		to_return = RSA_PKCS1_SSLeay()->rsa_mod_exp(r0, I, rsa, ctx);
 	} else {
 		to_return =
 		    ibmca_mod_exp_crt(r0, I, rsa->p, rsa->q, rsa->dmp1,
@@ -3474,13 +6879,18 @@ static int ibmca_rsa_mod_exp(BIGNUM * r0, const BIGNUM * I, RSA * rsa,
 	RSA_get0_key(rsa, &n, NULL, &d);
 	RSA_get0_factors(rsa, &p, &q);
 	RSA_get0_crt_params(rsa, &dmp1, &dmq1, &iqmp);
-	if (!p || !q || !dmp1 || !dmq1 || iqmp) {
+	if (!p || !q || !dmp1 || !dmq1 || !iqmp
+	    || (d && n && ibmca_rsa_use_me(BN_num_bits(n)))) {
 		if (!d || !n) {
 			IBMCAerr(IBMCA_F_IBMCA_RSA_MOD_EXP,
 				 IBMCA_R_MISSING_KEY_COMPONENTS);
 			goto err;
 		}
 		to_return = ibmca_mod_exp(r0, I, d, n, ctx);
+	} else if (!ibmca_pkey_usable(1)) {
+		ibmca_stat_fallback(IBMCA_STAT_RSA_CRT, 2 * BN_num_bytes(p));
+		to_return = RSA_meth_get_mod_exp(RSA_PKCS1_OpenSSL())(r0, I, rsa,
+								     ctx);
 	} else {
 		to_return = ibmca_mod_exp_crt(r0, I, p, q, dmp1, dmq1, iqmp, ctx);
 	}
@@ -3491,10 +6901,10 @@ err:
 #endif
 
 /* Ein kleines chinesisches "Restessen"  */
-static int ibmca_mod_exp_crt(BIGNUM * r, const BIGNUM * a,
-			     const BIGNUM * p, const BIGNUM * q,
-			     const BIGNUM * dmp1, const BIGNUM * dmq1,
-			     const BIGNUM * iqmp, BN_CTX * ctx)
+static int ibmca_do_mod_exp_crt(BIGNUM * r, const BIGNUM * a,
+				const BIGNUM * p, const BIGNUM * q,
+				const BIGNUM * dmp1, const BIGNUM * dmq1,
+				const BIGNUM * iqmp, BN_CTX * ctx)
 {
 	/*
 	r = output
@@ -3601,7 +7011,7 @@ static int ibmca_mod_exp_crt(BIGNUM * r, const BIGNUM * a,
 
 	/* execute the ica crt call */
 
-	rc = p_ica_rsa_crt(ibmca_handle, input, key, output);
+	rc = ibmca_ica_rsa_crt(ibmca_pkey_handle(), input, key, output);
 	if (rc != 0) {
 		IBMCAerr(IBMCA_F_IBMCA_MOD_EXP, IBMCA_R_REQUEST_FAILED);
 		goto err;
@@ -3633,6 +7043,18 @@ end:
 	return rc;
 }
 
+static int ibmca_mod_exp_crt(BIGNUM *r, const BIGNUM *a,
+			     const BIGNUM *p, const BIGNUM *q,
+			     const BIGNUM *dmp1, const BIGNUM *dmq1,
+			     const BIGNUM *iqmp, BN_CTX *ctx)
+{
+	int rc;
+
+	IBMCA_PROBED(rc, NID_rsaEncryption, 2 * BN_num_bytes(p),
+		     ibmca_do_mod_exp_crt(r, a, p, q, dmp1, dmq1, iqmp, ctx));
+	return rc;
+}
+
 #ifndef OPENSSL_NO_DSA
 /* This code was liberated and adapted from the commented-out code in
  * dsa_ossl.c. Because of the unoptimised form of the Ibmca acceleration
@@ -3706,18 +7128,35 @@ static int ibmca_mod_exp_dh(DH const *dh, BIGNUM * r,
 #endif
 
 /* Random bytes are good */
-static int ibmca_rand_bytes(unsigned char *buf, int num)
+static int ibmca_do_rand_bytes(unsigned char *buf, int num)
 {
 	unsigned int rc;
 
-	rc = p_ica_random_number_generate(num, buf);
-	if (rc < 0) {
+	if (!ibmca_rand_usable()) {
+		ibmca_stat_fallback(IBMCA_STAT_RAND, num);
+#ifdef OLDER_OPENSSL
+		return RAND_SSLeay()->bytes(buf, num);
+#else
+		return RAND_OpenSSL()->bytes(buf, num);
+#endif
+	}
+
+	rc = ibmca_ica_random_number_generate(num, buf);
+	if (rc != 0) {
 		IBMCAerr(IBMCA_F_IBMCA_RAND_BYTES, IBMCA_R_REQUEST_FAILED);
 		return 0;
 	}
 	return 1;
 }
 
+static int ibmca_rand_bytes(unsigned char *buf, int num)
+{
+	int rc;
+
+	IBMCA_PROBED(rc, NID_undef, num, ibmca_do_rand_bytes(buf, num));
+	return rc;
+}
+
 static int ibmca_rand_status(void)
 {
 	return 1;
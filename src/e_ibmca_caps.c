@@ -0,0 +1,193 @@
+/*
+ * Copyright [2026] International Business Machines Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "e_ibmca_caps.h"
+
+#define IBMCA_CAPS_MAGIC	"IBMCACAP"
+#define IBMCA_CAPS_VERSION	2
+
+/*
+ * The file is a header followed by mech_len libica_func_list_elements.
+ * It is only valid on the machine, and for the libica, it was written for.
+ */
+struct ibmca_caps_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t mech_len;
+	/* identity of the libica file */
+	uint64_t libica_dev;
+	uint64_t libica_ino;
+	uint64_t libica_size;
+	int64_t libica_mtime;
+	int64_t libica_mtime_nsec;
+	/* hash of the card devices on the AP bus */
+	uint64_t ap_gen;
+};
+
+/*
+ * A card that is added or removed changes the entries of the AP bus
+ * directory. Reading them is a single readdir, unlike the scan of the
+ * type and online attributes of every card.
+ */
+static uint64_t ap_generation(const char *ap_path)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;	/* FNV-1a */
+	struct dirent *de;
+	const char *c;
+	DIR *dir;
+
+	if ((dir = opendir(ap_path)) == NULL)
+		return 0;
+	while ((de = readdir(dir)) != NULL) {
+		if (strncmp(de->d_name, "card", 4))
+			continue;
+		for (c = de->d_name; ; c++) {
+			h = (h ^ (unsigned char)*c) * 0x100000001b3ULL;
+			if (*c == '\0')
+				break;
+		}
+	}
+	closedir(dir);
+	return h;
+}
+
+static int fingerprint(struct ibmca_caps_hdr *hdr, const void *libica_sym,
+		       const char *ap_path)
+{
+	struct stat st;
+	Dl_info info;
+
+	if (!dladdr(libica_sym, &info) || info.dli_fname == NULL
+	    || stat(info.dli_fname, &st))
+		return 0;
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, IBMCA_CAPS_MAGIC, sizeof(hdr->magic));
+	hdr->version = IBMCA_CAPS_VERSION;
+	hdr->libica_dev = st.st_dev;
+	hdr->libica_ino = st.st_ino;
+	hdr->libica_size = st.st_size;
+	hdr->libica_mtime = st.st_mtim.tv_sec;
+	hdr->libica_mtime_nsec = st.st_mtim.tv_nsec;
+	hdr->ap_gen = ap_generation(ap_path);
+	return 1;
+}
+
+/*
+ * Returns 1 and a malloced copy of the function list in caps if path holds
+ * a snapshot that is valid for the loaded libica and the current cards.
+ */
+int ibmca_caps_read(const char *path, const void *libica_sym,
+		    const char *ap_path, struct ibmca_caps *caps)
+{
+	struct ibmca_caps_hdr now;
+	const struct ibmca_caps_hdr *hdr;
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd, rc = 0;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return 0;
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return 0;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 0;
+
+	hdr = map;
+	size = sizeof(*hdr) + (size_t)hdr->mech_len
+				* sizeof(libica_func_list_element);
+	if (!fingerprint(&now, libica_sym, ap_path)
+	    || memcmp(hdr->magic, now.magic, sizeof(now.magic))
+	    || hdr->version != now.version || size != st.st_size
+	    || hdr->libica_dev != now.libica_dev
+	    || hdr->libica_ino != now.libica_ino
+	    || hdr->libica_size != now.libica_size
+	    || hdr->libica_mtime != now.libica_mtime
+	    || hdr->libica_mtime_nsec != now.libica_mtime_nsec
+	    || hdr->ap_gen != now.ap_gen)
+		goto out;
+
+	caps->mechs = malloc(hdr->mech_len * sizeof(libica_func_list_element)
+			     + 1);
+	if (caps->mechs == NULL)
+		goto out;
+	memcpy(caps->mechs, hdr + 1,
+	       hdr->mech_len * sizeof(libica_func_list_element));
+	caps->mech_len = hdr->mech_len;
+	rc = 1;
+out:
+	munmap(map, st.st_size);
+	return rc;
+}
+
+/*
+ * The snapshot is written to a fresh temporary file that is renamed over
+ * path, so concurrent readers see either the old or the new one, and a
+ * temporary file left behind by a crashed writer is never in the way.
+ */
+int ibmca_caps_write(const char *path, const void *libica_sym,
+		     const char *ap_path, const struct ibmca_caps *caps)
+{
+	struct ibmca_caps_hdr hdr;
+	char tmp[PATH_MAX];
+	size_t len;
+	FILE *fp;
+	int fd;
+
+	if (!fingerprint(&hdr, libica_sym, ap_path))
+		return 0;
+	hdr.mech_len = caps->mech_len;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp))
+		return 0;
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	/* mkostemp() creates it 0600, other users may share the cache */
+	if (fchmod(fd, 0644) || (fp = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		goto err;
+	}
+	len = caps->mech_len * sizeof(libica_func_list_element);
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1
+	    || (len && fwrite(caps->mechs, len, 1, fp) != 1)) {
+		fclose(fp);
+		goto err;
+	}
+	if (fclose(fp) || rename(tmp, path))
+		goto err;
+	return 1;
+err:
+	unlink(tmp);
+	return 0;
+}
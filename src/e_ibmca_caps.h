@@ -0,0 +1,43 @@
+/*
+ * Copyright [2026] International Business Machines Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef HEADER_IBMCA_CAPS_H
+#define HEADER_IBMCA_CAPS_H
+
+#include <ica_api.h>
+
+/*
+ * Snapshot of libica's function list. It is saved to a file so later
+ * processes can skip ica_get_functionlist().
+ */
+struct ibmca_caps {
+	libica_func_list_element *mechs;
+	unsigned int mech_len;
+};
+
+/*
+ * libica_sym is any symbol of the loaded libica and identifies its file.
+ * ap_path is the AP bus directory in sysfs; libica only lists some
+ * functions while a card of the right type is there. The snapshot is
+ * only used while both are unchanged.
+ */
+int ibmca_caps_read(const char *path, const void *libica_sym,
+		    const char *ap_path, struct ibmca_caps *caps);
+int ibmca_caps_write(const char *path, const void *libica_sym,
+		     const char *ap_path, const struct ibmca_caps *caps);
+
+#endif
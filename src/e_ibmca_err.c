@@ -45,6 +45,14 @@ static ERR_STRING_DATA IBMCA_str_functs[] = {
 	{ERR_PACK(0, IBMCA_F_IBMCA_SHA256_FINAL, 0), "IBMCA_SHA256_FINAL"},
 	{ERR_PACK(0, IBMCA_F_IBMCA_SHA512_UPDATE, 0), "IBMCA_SHA512_UPDATE"},
 	{ERR_PACK(0, IBMCA_F_IBMCA_SHA512_FINAL, 0), "IBMCA_SHA512_FINAL"},
+	{ERR_PACK(0, IBMCA_F_IBMCA_AES_XTS_CIPHER, 0), "IBMCA_AES_XTS_CIPHER"},
+	{ERR_PACK(0, IBMCA_F_IBMCA_CMAC_UPDATE, 0), "IBMCA_CMAC_UPDATE"},
+	{ERR_PACK(0, IBMCA_F_IBMCA_CMAC_FINAL, 0), "IBMCA_CMAC_FINAL"},
+	{ERR_PACK(0, IBMCA_F_IBMCA_HMAC_INIT, 0), "IBMCA_HMAC_INIT"},
+	{ERR_PACK(0, IBMCA_F_IBMCA_HMAC_UPDATE, 0), "IBMCA_HMAC_UPDATE"},
+	{ERR_PACK(0, IBMCA_F_IBMCA_HMAC_FINAL, 0), "IBMCA_HMAC_FINAL"},
+	{ERR_PACK(0, IBMCA_F_IBMCA_AES_HMAC_CIPHER, 0), "IBMCA_AES_HMAC_CIPHER"},
+	{ERR_PACK(0, IBMCA_F_IBMCA_CIPHER, 0), "IBMCA_CIPHER"},
 	{0, NULL}
 };
 
@@ -66,6 +74,8 @@ static ERR_STRING_DATA IBMCA_str_reasons[] = {
 	{IBMCA_R_UNDERFLOW_KEYRECORD, "underflow keyrecord"},
 	{IBMCA_R_UNIT_FAILURE, "unit failure"},
 	{IBMCA_R_CIPHER_MODE_NOT_SUPPORTED, "cipher mode not supported"},
+	{IBMCA_R_INVALID_ARGUMENT, "invalid argument"},
+	{IBMCA_R_XTS_DUPLICATED_KEYS, "xts duplicated keys"},
 	{0, NULL}
 };
 
@@ -48,6 +48,14 @@ void ERR_IBMCA_error(int function, int reason, char *file, int line);
 #define IBMCA_F_IBMCA_SHA256_FINAL			 115
 #define IBMCA_F_IBMCA_SHA512_UPDATE			 116
 #define IBMCA_F_IBMCA_SHA512_FINAL			 117
+#define IBMCA_F_IBMCA_AES_XTS_CIPHER			 118
+#define IBMCA_F_IBMCA_CMAC_UPDATE			 119
+#define IBMCA_F_IBMCA_CMAC_FINAL			 120
+#define IBMCA_F_IBMCA_HMAC_INIT				 121
+#define IBMCA_F_IBMCA_HMAC_UPDATE			 122
+#define IBMCA_F_IBMCA_HMAC_FINAL			 123
+#define IBMCA_F_IBMCA_AES_HMAC_CIPHER			 124
+#define IBMCA_F_IBMCA_CIPHER				 125
 
 /* Reason codes. */
 #define IBMCA_R_ALREADY_LOADED				 100
@@ -66,5 +74,7 @@ void ERR_IBMCA_error(int function, int reason, char *file, int line);
 #define IBMCA_R_UNDERFLOW_KEYRECORD			 114
 #define IBMCA_R_UNIT_FAILURE				 109
 #define IBMCA_R_CIPHER_MODE_NOT_SUPPORTED		 115
+#define IBMCA_R_INVALID_ARGUMENT			 116
+#define IBMCA_R_XTS_DUPLICATED_KEYS			 117
 
 #endif
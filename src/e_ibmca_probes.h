@@ -0,0 +1,85 @@
+/*
+ * Copyright [2026] International Business Machines Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef HEADER_IBMCA_PROBES_H
+#define HEADER_IBMCA_PROBES_H
+
+/*
+ * USDT probes of provider "ibmca", usable with perf, bpftrace or
+ * systemtap on a running process:
+ *
+ *   evp_entry(nid, len)           an engine EVP/RSA/RAND entry point
+ *   evp_return(nid, len, rc)      ... and its return value
+ *   ica_entry(nid, len, stat)     a request is passed to libica
+ *   ica_return(nid, len, rc)      ... and libica's return code
+ *
+ * stat is the enum ibmca_stat slot of the request. Each probe has a
+ * semaphore that the tracer raises while it is attached, and the
+ * arguments are only evaluated then; a probe that is not enabled costs a
+ * load and a branch. Without <sys/sdt.h> the probes compile to nothing.
+ */
+#ifdef HAVE_SYS_SDT_H
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+/* defined in e_ibmca_stats.c */
+extern volatile unsigned short ibmca_evp_entry_semaphore;
+extern volatile unsigned short ibmca_evp_return_semaphore;
+extern volatile unsigned short ibmca_ica_entry_semaphore;
+extern volatile unsigned short ibmca_ica_return_semaphore;
+
+#define IBMCA_PROBE_ENABLED(name) \
+	__builtin_expect(ibmca_##name##_semaphore != 0, 0)
+#define IBMCA_PROBE2(name, a1, a2)					\
+	do {								\
+		if (IBMCA_PROBE_ENABLED(name))				\
+			STAP_PROBE2(ibmca, name, a1, a2);		\
+	} while (0)
+#define IBMCA_PROBE3(name, a1, a2, a3)					\
+	do {								\
+		if (IBMCA_PROBE_ENABLED(name))				\
+			STAP_PROBE3(ibmca, name, a1, a2, a3);		\
+	} while (0)
+
+/*
+ * rc = call, between the evp_entry and evp_return probes. nid and len are
+ * evaluated once, before the call, and only if one of them is enabled.
+ */
+#define IBMCA_PROBED(rc, nid, len, call)				\
+	do {								\
+		if (IBMCA_PROBE_ENABLED(evp_entry)			\
+		    || IBMCA_PROBE_ENABLED(evp_return)) {		\
+			long ibmca_probe_nid = (nid);			\
+			size_t ibmca_probe_len = (len);			\
+									\
+			IBMCA_PROBE2(evp_entry, ibmca_probe_nid,	\
+				     ibmca_probe_len);			\
+			(rc) = (call);					\
+			IBMCA_PROBE3(evp_return, ibmca_probe_nid,	\
+				     ibmca_probe_len, (rc));		\
+		} else {						\
+			(rc) = (call);					\
+		}							\
+	} while (0)
+#else
+#define IBMCA_PROBE_ENABLED(name)		0
+#define IBMCA_PROBE2(name, a1, a2)		do { } while (0)
+#define IBMCA_PROBE3(name, a1, a2, a3)		do { } while (0)
+#define IBMCA_PROBED(rc, nid, len, call)	do { (rc) = (call); } while (0)
+#endif
+
+#endif
@@ -0,0 +1,285 @@
+/*
+ * Copyright [2026] International Business Machines Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <openssl/obj_mac.h>
+#include "e_ibmca_stats.h"
+
+struct ibmca_stat_shard ibmca_stat_shards[IBMCA_STAT_SHARDS];
+__thread struct ibmca_stat_shard *ibmca_stat_tls;
+
+static unsigned int next_shard;
+
+#ifdef HAVE_SYS_SDT_H
+/* raised by the tracer while the probe of the same name is attached */
+volatile unsigned short ibmca_evp_entry_semaphore
+	__attribute__((section(".probes")));
+volatile unsigned short ibmca_evp_return_semaphore
+	__attribute__((section(".probes")));
+volatile unsigned short ibmca_ica_entry_semaphore
+	__attribute__((section(".probes")));
+volatile unsigned short ibmca_ica_return_semaphore
+	__attribute__((section(".probes")));
+#endif
+
+static const char *ibmca_stat_names[IBMCA_STAT_MAX] = {
+	[IBMCA_STAT_DES_ECB] = "des-ecb",
+	[IBMCA_STAT_DES_CBC] = "des-cbc",
+	[IBMCA_STAT_DES_CFB] = "des-cfb",
+	[IBMCA_STAT_DES_OFB] = "des-ofb",
+	[IBMCA_STAT_TDES_ECB] = "des-ede3-ecb",
+	[IBMCA_STAT_TDES_CBC] = "des-ede3-cbc",
+	[IBMCA_STAT_TDES_CFB] = "des-ede3-cfb",
+	[IBMCA_STAT_TDES_OFB] = "des-ede3-ofb",
+	[IBMCA_STAT_AES_128_ECB] = "aes-128-ecb",
+	[IBMCA_STAT_AES_128_CBC] = "aes-128-cbc",
+	[IBMCA_STAT_AES_128_CFB] = "aes-128-cfb",
+	[IBMCA_STAT_AES_128_OFB] = "aes-128-ofb",
+	[IBMCA_STAT_AES_192_ECB] = "aes-192-ecb",
+	[IBMCA_STAT_AES_192_CBC] = "aes-192-cbc",
+	[IBMCA_STAT_AES_192_CFB] = "aes-192-cfb",
+	[IBMCA_STAT_AES_192_OFB] = "aes-192-ofb",
+	[IBMCA_STAT_AES_256_ECB] = "aes-256-ecb",
+	[IBMCA_STAT_AES_256_CBC] = "aes-256-cbc",
+	[IBMCA_STAT_AES_256_CFB] = "aes-256-cfb",
+	[IBMCA_STAT_AES_256_OFB] = "aes-256-ofb",
+	[IBMCA_STAT_AES_128_GCM] = "aes-128-gcm",
+	[IBMCA_STAT_AES_192_GCM] = "aes-192-gcm",
+	[IBMCA_STAT_AES_256_GCM] = "aes-256-gcm",
+	[IBMCA_STAT_AES_128_CTR] = "aes-128-ctr",
+	[IBMCA_STAT_AES_192_CTR] = "aes-192-ctr",
+	[IBMCA_STAT_AES_256_CTR] = "aes-256-ctr",
+	[IBMCA_STAT_TDES_CTR] = "des-ede3-ctr",
+	[IBMCA_STAT_AES_128_XTS] = "aes-128-xts",
+	[IBMCA_STAT_AES_256_XTS] = "aes-256-xts",
+	[IBMCA_STAT_AES_128_CCM] = "aes-128-ccm",
+	[IBMCA_STAT_AES_192_CCM] = "aes-192-ccm",
+	[IBMCA_STAT_AES_256_CCM] = "aes-256-ccm",
+	[IBMCA_STAT_AES_128_CMAC] = "aes-128-cmac",
+	[IBMCA_STAT_AES_192_CMAC] = "aes-192-cmac",
+	[IBMCA_STAT_AES_256_CMAC] = "aes-256-cmac",
+	[IBMCA_STAT_TDES_CMAC] = "des-ede3-cmac",
+	[IBMCA_STAT_SHA1] = "sha1",
+	[IBMCA_STAT_SHA256] = "sha256",
+	[IBMCA_STAT_SHA512] = "sha512",
+	[IBMCA_STAT_RSA_ME] = "rsa-me",
+	[IBMCA_STAT_RSA_CRT] = "rsa-crt",
+	[IBMCA_STAT_RAND] = "rand",
+};
+
+/* NID of each slot, as passed to the ica_entry/ica_return probes */
+const int ibmca_stat_nids[IBMCA_STAT_MAX] = {
+	[IBMCA_STAT_DES_ECB] = NID_des_ecb,
+	[IBMCA_STAT_DES_CBC] = NID_des_cbc,
+	[IBMCA_STAT_DES_CFB] = NID_des_cfb64,
+	[IBMCA_STAT_DES_OFB] = NID_des_ofb64,
+	[IBMCA_STAT_TDES_ECB] = NID_des_ede3_ecb,
+	[IBMCA_STAT_TDES_CBC] = NID_des_ede3_cbc,
+	[IBMCA_STAT_TDES_CFB] = NID_des_ede3_cfb64,
+	[IBMCA_STAT_TDES_OFB] = NID_des_ede3_ofb64,
+	[IBMCA_STAT_AES_128_ECB] = NID_aes_128_ecb,
+	[IBMCA_STAT_AES_128_CBC] = NID_aes_128_cbc,
+	[IBMCA_STAT_AES_128_CFB] = NID_aes_128_cfb128,
+	[IBMCA_STAT_AES_128_OFB] = NID_aes_128_ofb128,
+	[IBMCA_STAT_AES_192_ECB] = NID_aes_192_ecb,
+	[IBMCA_STAT_AES_192_CBC] = NID_aes_192_cbc,
+	[IBMCA_STAT_AES_192_CFB] = NID_aes_192_cfb128,
+	[IBMCA_STAT_AES_192_OFB] = NID_aes_192_ofb128,
+	[IBMCA_STAT_AES_256_ECB] = NID_aes_256_ecb,
+	[IBMCA_STAT_AES_256_CBC] = NID_aes_256_cbc,
+	[IBMCA_STAT_AES_256_CFB] = NID_aes_256_cfb128,
+	[IBMCA_STAT_AES_256_OFB] = NID_aes_256_ofb128,
+	[IBMCA_STAT_AES_128_GCM] = NID_aes_128_gcm,
+	[IBMCA_STAT_AES_192_GCM] = NID_aes_192_gcm,
+	[IBMCA_STAT_AES_256_GCM] = NID_aes_256_gcm,
+	[IBMCA_STAT_AES_128_CTR] = NID_aes_128_ctr,
+	[IBMCA_STAT_AES_192_CTR] = NID_aes_192_ctr,
+	[IBMCA_STAT_AES_256_CTR] = NID_aes_256_ctr,
+	[IBMCA_STAT_TDES_CTR] = NID_undef,	/* created at run time */
+	[IBMCA_STAT_AES_128_XTS] = NID_aes_128_xts,
+	[IBMCA_STAT_AES_256_XTS] = NID_aes_256_xts,
+	[IBMCA_STAT_AES_128_CCM] = NID_aes_128_ccm,
+	[IBMCA_STAT_AES_192_CCM] = NID_aes_192_ccm,
+	[IBMCA_STAT_AES_256_CCM] = NID_aes_256_ccm,
+	[IBMCA_STAT_AES_128_CMAC] = NID_cmac,
+	[IBMCA_STAT_AES_192_CMAC] = NID_cmac,
+	[IBMCA_STAT_AES_256_CMAC] = NID_cmac,
+	[IBMCA_STAT_TDES_CMAC] = NID_cmac,
+	[IBMCA_STAT_SHA1] = NID_sha1,
+	[IBMCA_STAT_SHA256] = NID_sha256,
+	[IBMCA_STAT_SHA512] = NID_sha512,
+	[IBMCA_STAT_RSA_ME] = NID_rsaEncryption,
+	[IBMCA_STAT_RSA_CRT] = NID_rsaEncryption,
+	[IBMCA_STAT_RAND] = NID_undef,
+};
+
+/* Called once per thread, on its first counted request. */
+struct ibmca_stat_shard *ibmca_stat_shard_get(void)
+{
+	unsigned int n;
+
+	n = __atomic_fetch_add(&next_shard, 1, __ATOMIC_RELAXED);
+	ibmca_stat_tls = &ibmca_stat_shards[n % IBMCA_STAT_SHARDS];
+	return ibmca_stat_tls;
+}
+
+/* Start counting from zero, e.g. in the child of fork(). */
+void ibmca_stats_reset(void)
+{
+	memset(ibmca_stat_shards, 0, sizeof(ibmca_stat_shards));
+}
+
+const char *ibmca_stat_name(enum ibmca_stat stat)
+{
+	return ibmca_stat_names[stat];
+}
+
+void ibmca_stats_sum(enum ibmca_stat stat, struct ibmca_stat_counters *sum)
+{
+	const struct ibmca_stat_counters *c;
+	int i, b;
+
+	memset(sum, 0, sizeof(*sum));
+	for (i = 0; i < IBMCA_STAT_SHARDS; i++) {
+		c = &ibmca_stat_shards[i].c[stat];
+		sum->calls += __atomic_load_n(&c->calls, __ATOMIC_RELAXED);
+		sum->bytes += __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+		sum->failures += __atomic_load_n(&c->failures,
+						 __ATOMIC_RELAXED);
+		sum->fallbacks += __atomic_load_n(&c->fallbacks,
+						  __ATOMIC_RELAXED);
+		sum->fallback_bytes += __atomic_load_n(&c->fallback_bytes,
+						       __ATOMIC_RELAXED);
+		for (b = 0; b < IBMCA_LAT_BUCKETS; b++)
+			sum->lat[b] += __atomic_load_n(&c->lat[b],
+						       __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * Reports go either to fp or, if buf is not NULL, into buf. off counts
+ * the length of the complete report even if buf is too small for it.
+ */
+struct report {
+	FILE *fp;
+	char *buf;
+	size_t len;
+	size_t off;
+};
+
+static void report_add(struct report *r, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	if (r->buf == NULL)
+		n = vfprintf(r->fp, fmt, ap);
+	else
+		n = vsnprintf(r->buf + (r->off < r->len ? r->off : r->len),
+			      r->off < r->len ? r->len - r->off : 0, fmt, ap);
+	va_end(ap);
+	if (n > 0)
+		r->off += n;
+}
+
+static int report_end(struct report *r)
+{
+	if (r->buf != NULL && r->len > 0 && r->off == 0)
+		r->buf[0] = '\0';
+	return r->off;
+}
+
+/*
+ * Write one line of counters per algorithm that has been used. Returns
+ * the length of the complete report, so a result of len or more means
+ * buf was too small and the report is truncated.
+ */
+int ibmca_stats_print(FILE *fp, char *buf, size_t len)
+{
+	struct report r = { fp, buf, len, 0 };
+	struct ibmca_stat_counters sum;
+	int i;
+
+	for (i = 0; i < IBMCA_STAT_MAX; i++) {
+		ibmca_stats_sum(i, &sum);
+		if (!sum.calls && !sum.fallbacks)
+			continue;
+		report_add(&r, "%s calls=%llu bytes=%llu ica_failures=%llu "
+			   "sw_fallbacks=%llu sw_bytes=%llu\n",
+			   ibmca_stat_name(i),
+			   (unsigned long long)sum.calls,
+			   (unsigned long long)sum.bytes,
+			   (unsigned long long)sum.failures,
+			   (unsigned long long)sum.fallbacks,
+			   (unsigned long long)sum.fallback_bytes);
+	}
+	return report_end(&r);
+}
+
+/* Upper bound in ns of the bucket that holds the q quantile */
+static uint64_t lat_quantile(const struct ibmca_stat_counters *sum, double q)
+{
+	uint64_t rank, seen = 0;
+	int b;
+
+	rank = (uint64_t)(q * sum->calls);
+	if (rank >= sum->calls)
+		rank = sum->calls - 1;
+	for (b = 0; b < IBMCA_LAT_BUCKETS - 1; b++) {
+		seen += sum->lat[b];
+		if (seen > rank)
+			break;
+	}
+	return 1ULL << (b + IBMCA_LAT_MIN_SHIFT);
+}
+
+/*
+ * Write the libica latency histogram of every algorithm that has been
+ * used: the bucket bounds of p50, p99, p99.9 and max, then the count of
+ * each non-empty bucket keyed by its upper bound in ns. Returns the
+ * length like ibmca_stats_print().
+ */
+int ibmca_latency_print(FILE *fp, char *buf, size_t len)
+{
+	struct report r = { fp, buf, len, 0 };
+	struct ibmca_stat_counters sum;
+	int i, b;
+
+	for (i = 0; i < IBMCA_STAT_MAX; i++) {
+		ibmca_stats_sum(i, &sum);
+		if (!sum.calls)
+			continue;
+		report_add(&r, "%s n=%llu p50_ns=%llu p99_ns=%llu "
+			   "p999_ns=%llu max_ns=%llu", ibmca_stat_name(i),
+			   (unsigned long long)sum.calls,
+			   (unsigned long long)lat_quantile(&sum, 0.5),
+			   (unsigned long long)lat_quantile(&sum, 0.99),
+			   (unsigned long long)lat_quantile(&sum, 0.999),
+			   (unsigned long long)lat_quantile(&sum, 1.0));
+		for (b = 0; b < IBMCA_LAT_BUCKETS; b++) {
+			if (sum.lat[b])
+				report_add(&r, " le_%llu=%llu",
+					   1ULL << (b + IBMCA_LAT_MIN_SHIFT),
+					   (unsigned long long)sum.lat[b]);
+		}
+		report_add(&r, "\n");
+	}
+	return report_end(&r);
+}
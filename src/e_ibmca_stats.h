@@ -0,0 +1,180 @@
+/*
+ * Copyright [2026] International Business Machines Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef HEADER_IBMCA_STATS_H
+#define HEADER_IBMCA_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "e_ibmca_probes.h"
+
+/*
+ * One counter slot per algorithm and mode. The cipher modes of a family
+ * are ordered like the EVP_CIPH_*_MODE values (ECB, CBC, CFB, OFB), so
+ * IBMCA_STAT_<family>_ECB + EVP_CIPHER_CTX_mode(ctx) - 1 selects the
+ * slot of a context.
+ */
+enum ibmca_stat {
+	IBMCA_STAT_DES_ECB,
+	IBMCA_STAT_DES_CBC,
+	IBMCA_STAT_DES_CFB,
+	IBMCA_STAT_DES_OFB,
+	IBMCA_STAT_TDES_ECB,
+	IBMCA_STAT_TDES_CBC,
+	IBMCA_STAT_TDES_CFB,
+	IBMCA_STAT_TDES_OFB,
+	IBMCA_STAT_AES_128_ECB,
+	IBMCA_STAT_AES_128_CBC,
+	IBMCA_STAT_AES_128_CFB,
+	IBMCA_STAT_AES_128_OFB,
+	IBMCA_STAT_AES_192_ECB,
+	IBMCA_STAT_AES_192_CBC,
+	IBMCA_STAT_AES_192_CFB,
+	IBMCA_STAT_AES_192_OFB,
+	IBMCA_STAT_AES_256_ECB,
+	IBMCA_STAT_AES_256_CBC,
+	IBMCA_STAT_AES_256_CFB,
+	IBMCA_STAT_AES_256_OFB,
+	IBMCA_STAT_AES_128_GCM,
+	IBMCA_STAT_AES_192_GCM,
+	IBMCA_STAT_AES_256_GCM,
+	IBMCA_STAT_AES_128_CTR,
+	IBMCA_STAT_AES_192_CTR,
+	IBMCA_STAT_AES_256_CTR,
+	IBMCA_STAT_TDES_CTR,
+	IBMCA_STAT_AES_128_XTS,
+	IBMCA_STAT_AES_256_XTS,
+	IBMCA_STAT_AES_128_CCM,
+	IBMCA_STAT_AES_192_CCM,
+	IBMCA_STAT_AES_256_CCM,
+	IBMCA_STAT_AES_128_CMAC,
+	IBMCA_STAT_AES_192_CMAC,
+	IBMCA_STAT_AES_256_CMAC,
+	IBMCA_STAT_TDES_CMAC,
+	IBMCA_STAT_SHA1,
+	IBMCA_STAT_SHA256,
+	IBMCA_STAT_SHA512,
+	IBMCA_STAT_RSA_ME,
+	IBMCA_STAT_RSA_CRT,
+	IBMCA_STAT_RAND,
+	IBMCA_STAT_MAX
+};
+
+/*
+ * libica latencies are kept in log2 buckets: bucket 0 counts requests
+ * below 256 ns, bucket b those from 2^(b+7) up to 2^(b+8) ns. The last
+ * bucket also takes everything slower (about 34 s and up).
+ */
+#define IBMCA_LAT_BUCKETS	28
+#define IBMCA_LAT_MIN_SHIFT	8
+
+struct ibmca_stat_counters {
+	uint64_t calls;		/* requests passed to libica */
+	uint64_t bytes;		/* payload of those requests */
+	uint64_t failures;	/* requests libica returned an error for */
+	uint64_t fallbacks;	/* requests done in OpenSSL software */
+	uint64_t fallback_bytes;	/* payload of those requests */
+	uint64_t lat[IBMCA_LAT_BUCKETS];	/* libica latency histogram */
+};
+
+/*
+ * Threads are spread over IBMCA_STAT_SHARDS shards, each on its own
+ * cache line (256 bytes on s390x), so concurrent updates neither take a
+ * lock nor bounce lines between CPUs. Readers sum up all shards.
+ */
+#define IBMCA_STAT_SHARDS	64
+
+struct ibmca_stat_shard {
+	struct ibmca_stat_counters c[IBMCA_STAT_MAX];
+} __attribute__((aligned(256)));
+
+extern struct ibmca_stat_shard ibmca_stat_shards[IBMCA_STAT_SHARDS];
+extern __thread struct ibmca_stat_shard *ibmca_stat_tls;
+extern const int ibmca_stat_nids[IBMCA_STAT_MAX];
+
+struct ibmca_stat_shard *ibmca_stat_shard_get(void);
+void ibmca_stats_sum(enum ibmca_stat stat, struct ibmca_stat_counters *sum);
+void ibmca_stats_reset(void);
+const char *ibmca_stat_name(enum ibmca_stat stat);
+int ibmca_stats_print(FILE *fp, char *buf, size_t len);
+int ibmca_latency_print(FILE *fp, char *buf, size_t len);
+
+static inline uint64_t ibmca_stat_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline unsigned int ibmca_lat_bucket(uint64_t ns)
+{
+	unsigned int b;
+
+	if (ns < (1ULL << IBMCA_LAT_MIN_SHIFT))
+		return 0;
+	b = 64 - __builtin_clzll(ns) - IBMCA_LAT_MIN_SHIFT;
+	return b < IBMCA_LAT_BUCKETS ? b : IBMCA_LAT_BUCKETS - 1;
+}
+
+static inline struct ibmca_stat_counters *ibmca_stat_slot(enum ibmca_stat stat)
+{
+	struct ibmca_stat_shard *shard = ibmca_stat_tls;
+
+	if (shard == NULL)
+		shard = ibmca_stat_shard_get();
+	return &shard->c[stat];
+}
+
+/* Start a libica request of len bytes, returns its start time. */
+static inline uint64_t ibmca_stat_start(enum ibmca_stat stat, uint64_t len)
+{
+	IBMCA_PROBE3(ica_entry, ibmca_stat_nids[stat], len, stat);
+	return ibmca_stat_now();
+}
+
+/*
+ * Count one libica request of len bytes that started at time start
+ * (from ibmca_stat_start()), and whether it failed.
+ */
+static inline void ibmca_stat_ica(enum ibmca_stat stat, uint64_t len,
+				  unsigned int rc, uint64_t start)
+{
+	struct ibmca_stat_counters *slot;
+	unsigned int b = ibmca_lat_bucket(ibmca_stat_now() - start);
+
+	IBMCA_PROBE3(ica_return, ibmca_stat_nids[stat], len, rc);
+	slot = ibmca_stat_slot(stat);
+	__atomic_fetch_add(&slot->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&slot->bytes, len, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&slot->lat[b], 1, __ATOMIC_RELAXED);
+	if (rc)
+		__atomic_fetch_add(&slot->failures, 1, __ATOMIC_RELAXED);
+}
+
+/* Count one request that was handed to OpenSSL's software code. */
+static inline void ibmca_stat_fallback(enum ibmca_stat stat, uint64_t len)
+{
+	struct ibmca_stat_counters *slot = ibmca_stat_slot(stat);
+
+	__atomic_fetch_add(&slot->fallbacks, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&slot->fallback_bytes, len, __ATOMIC_RELAXED);
+}
+
+#endif
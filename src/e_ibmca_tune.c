@@ -0,0 +1,403 @@
+/*
+ * Copyright [2026] International Business Machines Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Calibration of the hardware/software routing: every cipher and digest
+ * that has a software route is run through the engine once with all
+ * requests forced to libica and once forced to OpenSSL, over a ladder of
+ * request sizes and with 1 up to n threads. RSA keys are run with and
+ * without their CRT parameters likewise. Only the measuring threads are
+ * forced, other requests keep the current settings. The results go to a
+ * tuning file that ibmca_tuning_read() applies.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/objects.h>
+#include <openssl/rsa.h>
+#include "e_ibmca_stats.h"
+#include "e_ibmca_tune.h"
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+ #define EVP_MD_CTX_new()	EVP_MD_CTX_create()
+ #define EVP_MD_CTX_free(ctx)	EVP_MD_CTX_destroy(ctx)
+#endif
+
+#define TUNE_MIN_LEN		16
+#define TUNE_MAX_LEN		16384
+#define TUNE_POINT_NS		10000000ULL	/* per size, path and threads */
+#define TUNE_REPEAT		3		/* best of, per point */
+#define TUNE_MARGIN		0.05		/* to beat the default route */
+#define TUNE_SIZES		11		/* 16 to 16384 bytes */
+#define TUNE_MAX_STEPS		40		/* see tune_next() */
+
+static const int tune_rsa_bits[] = { 1024, 2048, 4096 };
+#define TUNE_RSA_SIZES	(sizeof(tune_rsa_bits) / sizeof(tune_rsa_bits[0]))
+
+int ibmca_tuning_read(const char *path)
+{
+	char line[256], key[64], name[64];
+	unsigned int val;
+	FILE *fp;
+	int nid, rc = 1;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%63s", key) != 1)
+			continue;
+		if (!strcmp(key, "crossover")) {
+			if (sscanf(line, "%*s %63s %u", name, &val) != 2
+			    || (nid = OBJ_txt2nid(name)) == NID_undef
+			    || !ibmca_crossover_supported(nid)) {
+				rc = 0;
+				continue;
+			}
+			ibmca_crossover_set(nid, val);
+		} else if (!strcmp(key, "rsa_crt_min_bits")) {
+			if (sscanf(line, "%*s %u", &val) != 1) {
+				rc = 0;
+				continue;
+			}
+			ibmca_rsa_crt_min_bits_set(val);
+		}
+		/* unknown settings are left to newer engines */
+	}
+	fclose(fp);
+	return rc;
+}
+
+struct tune_point {
+	ENGINE *e;
+	int nid;
+	const EVP_CIPHER *cipher;
+	const EVP_MD *md;
+	RSA *rsa;
+	size_t len;
+	int route;		/* IBMCA_TUNE_ROUTE_HW or _SW */
+	/*
+	 * The threads of a run wait until all of them are set up. Unlike a
+	 * barrier, this gate can also be opened when not every thread could
+	 * be created; the threads then give up.
+	 */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int ready;
+	int state;		/* 0 closed, 1 open, -1 aborted */
+};
+
+struct tune_thread {
+	struct tune_point *pt;
+	pthread_t tid;
+	uint64_t ops;
+	int failed;
+};
+
+static void *tune_thread(void *arg)
+{
+	struct tune_thread *t = arg;
+	struct tune_point *pt = t->pt;
+	unsigned char key[32] = { 0 }, iv[16] = { 0 }, md[EVP_MAX_MD_SIZE];
+	unsigned char *in, *out;
+	EVP_CIPHER_CTX *cctx = NULL;
+	EVP_MD_CTX *mctx = NULL;
+	unsigned int mdlen;
+	uint64_t end;
+	int outl, ok = 1;
+
+	in = calloc(1, pt->len + 32);
+	out = calloc(1, pt->len + 32);
+	if (in == NULL || out == NULL) {
+		ok = 0;
+	} else if (pt->cipher) {
+		cctx = EVP_CIPHER_CTX_new();
+		ok = cctx && EVP_CipherInit_ex(cctx, pt->cipher, pt->e, key,
+					       iv, 1);
+	} else if (pt->md) {
+		ok = (mctx = EVP_MD_CTX_new()) != NULL;
+	} else {
+		/* below the modulus, so RSA_NO_PADDING accepts it */
+		in[1] = 1;
+	}
+	ibmca_route_force(pt->route);
+
+	pthread_mutex_lock(&pt->lock);
+	pt->ready++;
+	pthread_cond_broadcast(&pt->cond);
+	while (pt->state == 0)
+		pthread_cond_wait(&pt->cond, &pt->lock);
+	if (pt->state < 0)
+		ok = 0;
+	pthread_mutex_unlock(&pt->lock);
+	end = ibmca_stat_now() + TUNE_POINT_NS;
+	while (ok && ibmca_stat_now() < end) {
+		if (pt->cipher)
+			ok = EVP_CipherUpdate(cctx, out, &outl, in, pt->len);
+		else if (pt->md)
+			ok = EVP_DigestInit_ex(mctx, pt->md, pt->e)
+			     && EVP_DigestUpdate(mctx, in, pt->len)
+			     && EVP_DigestFinal_ex(mctx, md, &mdlen);
+		else
+			ok = RSA_private_encrypt(pt->len, in, out, pt->rsa,
+						 RSA_NO_PADDING) == pt->len;
+		t->ops++;
+	}
+	t->failed = !ok;
+	ibmca_route_force(IBMCA_TUNE_ROUTE_NONE);
+
+	EVP_CIPHER_CTX_free(cctx);
+	EVP_MD_CTX_free(mctx);
+	free(in);
+	free(out);
+	return NULL;
+}
+
+/* Operations per second of the point with n threads, -1 on failure */
+static double tune_run(struct tune_point *pt, int n)
+{
+	struct tune_thread *t;
+	uint64_t ops = 0, start;
+	int i, started = 0, failed = 0;
+
+	if ((t = calloc(n, sizeof(*t))) == NULL)
+		return -1;
+	pthread_mutex_init(&pt->lock, NULL);
+	pthread_cond_init(&pt->cond, NULL);
+	pt->ready = 0;
+	pt->state = 0;
+	for (i = 0; i < n; i++) {
+		t[i].pt = pt;
+		if (pthread_create(&t[i].tid, NULL, tune_thread, &t[i]))
+			break;
+		started++;
+	}
+	/* with threads missing, the started ones are let go without work */
+	pthread_mutex_lock(&pt->lock);
+	while (started == n && pt->ready < started)
+		pthread_cond_wait(&pt->cond, &pt->lock);
+	pt->state = started == n ? 1 : -1;
+	pthread_cond_broadcast(&pt->cond);
+	pthread_mutex_unlock(&pt->lock);
+	start = ibmca_stat_now();
+	for (i = 0; i < started; i++) {
+		pthread_join(t[i].tid, NULL);
+		ops += t[i].ops;
+		failed |= t[i].failed;
+	}
+	start = ibmca_stat_now() - start;
+	pthread_cond_destroy(&pt->cond);
+	pthread_mutex_destroy(&pt->lock);
+	free(t);
+	if (failed || started < n || start == 0)
+		return -1;
+	return ops * 1e9 / start;
+}
+
+/* Best of TUNE_REPEAT runs on the route, -1 if one failed */
+static double tune_best(struct tune_point *pt, int route, int n)
+{
+	double ops, best = 0;
+	int i;
+
+	pt->route = route;
+	for (i = 0; i < TUNE_REPEAT; i++) {
+		if ((ops = tune_run(pt, n)) < 0)
+			return -1;
+		if (ops > best)
+			best = ops;
+	}
+	return best;
+}
+
+/* 1, 2, 4, ... and threads */
+static int tune_next(int n, int threads)
+{
+	if (n == threads)
+		return n + 1;
+	return n * 2 > threads ? threads : n * 2;
+}
+
+/*
+ * The first of the n points from which on the alternative route is
+ * nowhere faster than the default one by more than TUNE_MARGIN, so that
+ * the result is a single cut. Points that failed do not count.
+ */
+static int tune_cut(const double *def, const double *alt, int n)
+{
+	while (n > 0 && !(def[n - 1] >= 0
+			  && alt[n - 1] > def[n - 1] * (1 + TUNE_MARGIN)))
+		n--;
+	return n;
+}
+
+static int tune_cmp_int(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/* The lower median of the cuts found with the different thread counts */
+static int tune_median(int *cut, int steps)
+{
+	if (steps == 0)
+		return 0;
+	qsort(cut, steps, sizeof(*cut), tune_cmp_int);
+	return cut[(steps - 1) / 2];
+}
+
+/*
+ * Crossover of one cipher or digest: requests below the size from which
+ * on libica wins go to software. 0 if libica always won.
+ */
+static unsigned int tune_crossover(FILE *fp, struct tune_point *pt,
+				   int threads)
+{
+	double hw[TUNE_SIZES], sw[TUNE_SIZES];
+	int cut[TUNE_MAX_STEPS], steps = 0, n, i, c;
+
+	for (n = 1; n <= threads && steps < TUNE_MAX_STEPS;
+	     n = tune_next(n, threads)) {
+		for (i = 0; i < TUNE_SIZES; i++) {
+			pt->len = TUNE_MIN_LEN << i;
+			hw[i] = tune_best(pt, IBMCA_TUNE_ROUTE_HW, n);
+			sw[i] = tune_best(pt, IBMCA_TUNE_ROUTE_SW, n);
+			if (hw[i] < 0 || sw[i] < 0)
+				continue;
+			fprintf(fp, "# %s len=%zu threads=%d hw_MBps=%.1f "
+				"sw_MBps=%.1f\n", OBJ_nid2sn(pt->nid), pt->len,
+				n, hw[i] * pt->len / 1e6,
+				sw[i] * pt->len / 1e6);
+		}
+		cut[steps++] = tune_cut(hw, sw, TUNE_SIZES);
+	}
+	c = tune_median(cut, steps);
+	return c ? TUNE_MIN_LEN << c : 0;
+}
+
+/*
+ * Smallest key size from which on CRT is used: one bit above the last
+ * size at which mod-expo without CRT was faster, 0 if CRT always won.
+ * Each key is run both ways, see IBMCA_TUNE_ROUTE_ME.
+ */
+static int tune_rsa(FILE *fp, ENGINE *e, int threads)
+{
+	struct tune_point pt = { .e = e, .nid = NID_rsaEncryption };
+	BIGNUM *f4 = BN_new();
+	RSA *key[TUNE_RSA_SIZES] = { NULL };
+	double me_ops[TUNE_RSA_SIZES], crt_ops[TUNE_RSA_SIZES];
+	int cut[TUNE_MAX_STEPS], steps = 0, n, i, c;
+
+	for (i = 0; f4 && BN_set_word(f4, RSA_F4) && i < TUNE_RSA_SIZES; i++) {
+		if ((key[i] = RSA_new_method(e)) != NULL
+		    && !RSA_generate_key_ex(key[i], tune_rsa_bits[i], f4,
+					    NULL)) {
+			RSA_free(key[i]);
+			key[i] = NULL;
+		}
+	}
+
+	for (n = 1; n <= threads && steps < TUNE_MAX_STEPS;
+	     n = tune_next(n, threads)) {
+		for (i = 0; i < TUNE_RSA_SIZES; i++) {
+			me_ops[i] = crt_ops[i] = -1;
+			if (key[i] == NULL)
+				continue;
+			pt.len = tune_rsa_bits[i] / 8;
+			pt.rsa = key[i];
+			me_ops[i] = tune_best(&pt, IBMCA_TUNE_ROUTE_ME, n);
+			crt_ops[i] = tune_best(&pt, IBMCA_TUNE_ROUTE_HW, n);
+			fprintf(fp, "# rsa bits=%d threads=%d me_ops=%.1f "
+				"crt_ops=%.1f\n", tune_rsa_bits[i], n,
+				me_ops[i], crt_ops[i]);
+		}
+		cut[steps++] = tune_cut(crt_ops, me_ops, TUNE_RSA_SIZES);
+	}
+
+	for (i = 0; i < TUNE_RSA_SIZES; i++)
+		RSA_free(key[i]);
+	BN_free(f4);
+	c = tune_median(cut, steps);
+	return c ? tune_rsa_bits[c - 1] + 1 : 0;
+}
+
+/*
+ * Measure, apply the results, and write them to path. threads is the
+ * largest number of concurrent requests to tune for; the settings are the
+ * median of those found with 1 up to threads. rsa says whether libica
+ * does RSA.
+ */
+int ibmca_tuning_calibrate(ENGINE *e, const char *path, int threads, int rsa)
+{
+	ENGINE_CIPHERS_PTR ciphers = ENGINE_get_ciphers(e);
+	ENGINE_DIGESTS_PTR digests = ENGINE_get_digests(e);
+	struct tune_point pt;
+	const int *nids;
+	unsigned int xo;
+	int i, n, min_bits;
+	FILE *fp;
+
+	if (threads < 1)
+		threads = 1;
+	if ((fp = fopen(path, "w")) == NULL)
+		return 0;
+	fprintf(fp, "# ibmca tuning file, written by the CALIBRATE control "
+		"command\n");
+
+	n = ciphers ? ciphers(e, NULL, &nids, 0) : 0;
+	for (i = 0; i < n; i++) {
+		if (!ibmca_crossover_supported(nids[i]))
+			continue;
+		memset(&pt, 0, sizeof(pt));
+		pt.e = e;
+		pt.nid = nids[i];
+		pt.cipher = ENGINE_get_cipher(e, nids[i]);
+		/* OpenSSL's own, libica does not do it */
+		if (pt.cipher == NULL
+		    || pt.cipher == EVP_get_cipherbynid(nids[i]))
+			continue;
+		xo = tune_crossover(fp, &pt, threads);
+		ibmca_crossover_set(nids[i], xo);
+		fprintf(fp, "crossover %s %u\n", OBJ_nid2sn(nids[i]), xo);
+	}
+
+	n = digests ? digests(e, NULL, &nids, 0) : 0;
+	for (i = 0; i < n; i++) {
+		if (!ibmca_crossover_supported(nids[i]))
+			continue;
+		memset(&pt, 0, sizeof(pt));
+		pt.e = e;
+		pt.nid = nids[i];
+		pt.md = ENGINE_get_digest(e, nids[i]);
+		if (pt.md == NULL || pt.md == EVP_get_digestbynid(nids[i]))
+			continue;
+		xo = tune_crossover(fp, &pt, threads);
+		ibmca_crossover_set(nids[i], xo);
+		fprintf(fp, "crossover %s %u\n", OBJ_nid2sn(nids[i]), xo);
+	}
+
+	if (rsa) {
+		min_bits = tune_rsa(fp, e, threads);
+		ibmca_rsa_crt_min_bits_set(min_bits);
+		fprintf(fp, "rsa_crt_min_bits %d\n", min_bits);
+	}
+	return fclose(fp) == 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright [2026] International Business Machines Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef HEADER_IBMCA_TUNE_H
+#define HEADER_IBMCA_TUNE_H
+
+#include <openssl/engine.h>
+
+/* Routing knobs of e_ibmca.c, see SW_CROSSOVER */
+int ibmca_crossover_supported(int nid);
+unsigned int ibmca_crossover_get(int nid);
+void ibmca_crossover_set(int nid, unsigned int bytes);
+void ibmca_rsa_crt_min_bits_set(int bits);
+
+/*
+ * Route of the calling thread's requests while CALIBRATE measures them,
+ * regardless of the crossovers. Keys with CRT parameters use CRT while a
+ * route is forced, except with IBMCA_TUNE_ROUTE_ME, which is the HW route
+ * with RSA done by mod-expo.
+ */
+#define IBMCA_TUNE_ROUTE_NONE	0
+#define IBMCA_TUNE_ROUTE_HW	1
+#define IBMCA_TUNE_ROUTE_SW	2
+#define IBMCA_TUNE_ROUTE_ME	3
+void ibmca_route_force(int route);
+
+/*
+ * A tuning file holds one setting per line:
+ *
+ *   crossover <cipher or digest name> <bytes>
+ *   rsa_crt_min_bits <bits>
+ *
+ * Empty lines and lines starting with '#' are ignored.
+ */
+int ibmca_tuning_read(const char *path);
+int ibmca_tuning_calibrate(ENGINE *e, const char *path, int threads,
+			   int rsa);
+
+#endif
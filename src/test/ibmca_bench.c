@@ -0,0 +1,359 @@
+/*
+ * Copyright [2026] International Business Machines Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * ibmca_bench measures throughput and latency percentiles of every cipher
+ * and digest the ibmca engine implements itself. The engine registers all
+ * NIDs it knows and hands out OpenSSL's own implementation for those that
+ * libica does not do; those are skipped. Results are written as JSON.
+ */
+
+#include <openssl/engine.h>
+#include <openssl/evp.h>
+#include <openssl/err.h>
+#include <openssl/objects.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include "ibmca_test_common.h"
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+ #define EVP_MD_CTX_new()	EVP_MD_CTX_create()
+ #define EVP_MD_CTX_free(ctx)	EVP_MD_CTX_destroy((ctx))
+#endif
+
+#define MIN_SIZE	16UL
+#define MAX_SIZE	(64UL << 20)
+#define MAX_SAMPLES	(1 << 18)
+
+#define CIPH 1
+#define DIG  2
+
+struct bench_point {
+	int nid;
+	int type;
+	size_t size;
+	int threads;
+	unsigned int duration_ms;
+	int software;
+};
+
+/*
+ * GCM and CCM are measured per record: init, update, final and tag, as
+ * TLS uses them. CCM has to be told the tag and the message length up
+ * front. All other modes, the stitched AES-CBC-HMAC ciphers included,
+ * stream through a context that is initialised once.
+ */
+static int cipher_op(EVP_CIPHER_CTX *ctx, const EVP_CIPHER *cipher,
+		     ENGINE *e, const unsigned char *key,
+		     const unsigned char *iv, const unsigned char *in,
+		     unsigned char *out, size_t size)
+{
+	unsigned char tag[16];
+	int outl;
+
+	switch (EVP_CIPHER_mode(cipher)) {
+	case EVP_CIPH_GCM_MODE:
+		return EVP_EncryptInit_ex(ctx, cipher, e, key, iv)
+		       && EVP_EncryptUpdate(ctx, out, &outl, in, size)
+		       && EVP_EncryptFinal_ex(ctx, out + outl, &outl)
+		       && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG,
+					      sizeof(tag), tag) > 0;
+	case EVP_CIPH_CCM_MODE:
+		return EVP_EncryptInit_ex(ctx, cipher, e, NULL, NULL)
+		       && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_SET_TAG,
+					      sizeof(tag), NULL) > 0
+		       && EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv)
+		       && EVP_EncryptUpdate(ctx, NULL, &outl, NULL, size)
+		       && EVP_EncryptUpdate(ctx, out, &outl, in, size)
+		       && EVP_EncryptFinal_ex(ctx, out + outl, &outl)
+		       && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_GET_TAG,
+					      sizeof(tag), tag) > 0;
+	default:
+		return EVP_EncryptUpdate(ctx, out, &outl, in, size);
+	}
+}
+
+static void *bench_thread(void *p)
+{
+	struct thread_arg *arg = p;
+	const struct bench_point *pt = arg->pt;
+	struct thread_result *res = arg->res;
+	ENGINE *e = pt->software ? NULL : eng;
+	const EVP_CIPHER *cipher = NULL;
+	const EVP_MD *md = NULL;
+	EVP_CIPHER_CTX *cctx = NULL;
+	EVP_MD_CTX *mctx = NULL;
+	unsigned char key[64], iv[16], digest[EVP_MAX_MD_SIZE];
+	unsigned char *in, *out = NULL;
+	uint64_t start, t0, t1, end;
+	unsigned int dlen, i;
+	int ok;
+
+	in = calloc(1, pt->size);
+	if (pt->type == CIPH)
+		out = malloc(pt->size + EVP_MAX_BLOCK_LENGTH);
+	if (in == NULL || (pt->type == CIPH && out == NULL))
+		goto fail;
+	/* no two blocks alike, XTS refuses equal halves of the key */
+	for (i = 0; i < sizeof(key); i++)
+		key[i] = 0x5a + i;
+	memset(iv, 0xa5, sizeof(iv));
+
+	if (pt->type == CIPH) {
+		cipher = pt->software ? EVP_get_cipherbynid(pt->nid)
+				      : ENGINE_get_cipher(eng, pt->nid);
+		cctx = EVP_CIPHER_CTX_new();
+		if (cipher == NULL || cctx == NULL
+		    || !EVP_EncryptInit_ex(cctx, cipher, e, key, iv))
+			goto fail;
+		EVP_CIPHER_CTX_set_padding(cctx, 0);
+	} else {
+		md = pt->software ? EVP_get_digestbynid(pt->nid)
+				  : ENGINE_get_digest(eng, pt->nid);
+		mctx = EVP_MD_CTX_new();
+		if (md == NULL || mctx == NULL)
+			goto fail;
+	}
+
+	if (!gate_wait(arg->gate))
+		goto out;
+	start = now_ns();
+	end = start + (uint64_t)pt->duration_ms * 1000000ULL;
+	do {
+		t0 = now_ns();
+		if (pt->type == CIPH)
+			ok = cipher_op(cctx, cipher, e, key, iv, in, out,
+				       pt->size);
+		else
+			ok = EVP_DigestInit_ex(mctx, md, e)
+			     && EVP_DigestUpdate(mctx, in, pt->size)
+			     && EVP_DigestFinal_ex(mctx, digest, &dlen);
+		t1 = now_ns();
+		if (!ok)
+			goto fail_started;
+		record(arg, t1 - t0);
+		/* at least three operations per thread for percentiles */
+	} while (t1 < end || res->ops < 3);
+
+	goto out;
+
+fail:
+	if (!gate_wait(arg->gate))
+		goto out;
+fail_started:
+	res->failed = 1;
+out:
+	EVP_CIPHER_CTX_free(cctx);
+	if (mctx)
+		EVP_MD_CTX_free(mctx);
+	free(in);
+	free(out);
+	return NULL;
+}
+
+/* The engine does nid itself rather than handing out OpenSSL's code */
+static int engine_offers(int type, int nid)
+{
+	const EVP_CIPHER *cipher;
+	const EVP_MD *md;
+
+	if (type == CIPH) {
+		cipher = ENGINE_get_cipher(eng, nid);
+		return cipher != NULL && cipher != EVP_get_cipherbynid(nid);
+	}
+	md = ENGINE_get_digest(eng, nid);
+	return md != NULL && md != EVP_get_digestbynid(nid);
+}
+
+static int run_point(FILE *json, const struct bench_point *pt, int *first)
+{
+	struct bench_result r;
+	double mbps;
+
+	if (!bench_run(bench_thread, pt, pt->threads, MAX_SAMPLES, &r))
+		return 0;
+	mbps = r.secs > 0 ? r.ops * (double)pt->size / r.secs / 1e6 : 0;
+
+	fprintf(json, "%s\n    {\"algorithm\": \"%s\", \"nid\": %d, "
+		"\"type\": \"%s\", \"implementation\": \"%s\", "
+		"\"size\": %zu, \"threads\": %d, \"ops\": %llu, "
+		"\"seconds\": %.6f, \"mb_per_s\": %.3f, "
+		"\"ops_per_s\": %.1f, \"p50_ns\": %llu, \"p99_ns\": %llu, "
+		"\"p999_ns\": %llu, \"max_ns\": %llu, \"failed\": %s}",
+		*first ? "" : ",", OBJ_nid2sn(pt->nid), pt->nid,
+		pt->type == CIPH ? "cipher" : "digest",
+		pt->software ? "openssl" : "ibmca", pt->size, pt->threads,
+		(unsigned long long)r.ops, r.secs, mbps,
+		r.secs > 0 ? r.ops / r.secs : 0,
+		(unsigned long long)r.p50, (unsigned long long)r.p99,
+		(unsigned long long)r.p999, (unsigned long long)r.max,
+		r.failed ? "true" : "false");
+	*first = 0;
+
+	fprintf(stderr, "%-16s %9zu B %3d thr %10.2f MB/s p50 %8llu ns "
+		"p99 %9llu ns%s\n", OBJ_nid2sn(pt->nid), pt->size, pt->threads,
+		mbps, (unsigned long long)r.p50, (unsigned long long)r.p99,
+		r.failed ? " FAILED" : "");
+	return !r.failed;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	       "  -f, --file PATH       ibmca engine (default %s)\n"
+	       "  -l, --libica PATH     libica to load via SO_PATH\n"
+	       "  -a, --algorithm NAME  only benchmark this algorithm\n"
+	       "  -s, --min-size N      smallest message size (default %lu)\n"
+	       "  -S, --max-size N      largest message size (default %lu)\n"
+	       "  -t, --threads N       largest thread count (default 1)\n"
+	       "  -d, --duration MS     time per measurement (default 200)\n"
+	       "  -o, --output FILE     JSON output (default stdout)\n"
+	       "  -w, --software        also measure OpenSSL's own code\n"
+	       "  -h, --help            this text\n",
+	       prog, IBMCA_PATH, MIN_SIZE, MAX_SIZE);
+}
+
+int main(int argc, char *argv[])
+{
+	char *engine_id = IBMCA_PATH, *libica = NULL, *algo = NULL;
+	char *output = NULL;
+	unsigned long min_size = MIN_SIZE, max_size = MAX_SIZE;
+	unsigned int duration = 200;
+	int max_threads = 1, software = 0, first = 1, failure = 0;
+	const int *nids;
+	int nnids, type, i, impl, opt, option_index = 0;
+	ENGINE_CIPHERS_PTR get_ciphers;
+	ENGINE_DIGESTS_PTR get_digests;
+	struct bench_point pt;
+	FILE *json = stdout;
+	size_t size;
+	struct option long_options[] = {
+		{"file", required_argument, 0, 'f'},
+		{"libica", required_argument, 0, 'l'},
+		{"algorithm", required_argument, 0, 'a'},
+		{"min-size", required_argument, 0, 's'},
+		{"max-size", required_argument, 0, 'S'},
+		{"threads", required_argument, 0, 't'},
+		{"duration", required_argument, 0, 'd'},
+		{"output", required_argument, 0, 'o'},
+		{"software", no_argument, 0, 'w'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while ((opt = getopt_long(argc, argv, "f:l:a:s:S:t:d:o:wh",
+				  long_options, &option_index)) != -1) {
+		switch (opt) {
+		case 'f':
+			engine_id = optarg;
+			break;
+		case 'l':
+			libica = optarg;
+			break;
+		case 'a':
+			algo = optarg;
+			break;
+		case 's':
+			min_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			max_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'd':
+			duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'w':
+			software = 1;
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (min_size == 0 || min_size > max_size || max_threads < 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (init_engine(engine_id, libica)) {
+		fprintf(stderr, "Could not initialize Ibmca engine\n");
+		ERR_print_errors_fp(stderr);
+		return EXIT_FAILURE;
+	}
+	if (output && (json = fopen(output, "w")) == NULL) {
+		perror(output);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(json, "{\n  \"engine\": \"%s\",\n  \"libica\": \"%s\",\n"
+		"  \"duration_ms\": %u,\n  \"results\": [", engine_id,
+		libica ? libica : "default", duration);
+
+	get_ciphers = ENGINE_get_ciphers(eng);
+	get_digests = ENGINE_get_digests(eng);
+	for (type = CIPH; type <= DIG; type++) {
+		if (type == CIPH)
+			nnids = get_ciphers ? get_ciphers(eng, NULL, &nids, 0) : 0;
+		else
+			nnids = get_digests ? get_digests(eng, NULL, &nids, 0) : 0;
+
+		for (i = 0; i < nnids; i++) {
+			if (algo && strcasecmp(algo, OBJ_nid2sn(nids[i]))
+			    && strcasecmp(algo, OBJ_nid2ln(nids[i])))
+				continue;
+			if (!engine_offers(type, nids[i])) {
+				ERR_clear_error();
+				continue;
+			}
+			for (size = min_size; size <= max_size;
+			     size = next_step(size, max_size, 4)) {
+				for (pt.threads = 1; pt.threads <= max_threads;
+				     pt.threads = next_step(pt.threads,
+							    max_threads, 2)) {
+					for (impl = 0; impl <= software; impl++) {
+						pt.nid = nids[i];
+						pt.type = type;
+						pt.size = size;
+						pt.duration_ms = duration;
+						pt.software = impl;
+						if (!run_point(json, &pt, &first))
+							failure++;
+					}
+				}
+			}
+		}
+	}
+	fprintf(json, "\n  ],\n  \"failures\": %d\n}\n", failure);
+	if (json != stdout)
+		fclose(json);
+
+	ENGINE_finish(eng);
+	ENGINE_free(eng);
+	return failure ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,470 @@
+/*
+ * Copyright [2026] International Business Machines Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * ibmca_pkey_bench measures the public key operations of the ibmca engine
+ * (RSA mod-expo and CRT, DSA and DH) over key sizes and thread counts.
+ * For every operation and key size it reports ops/s, latency percentiles
+ * and the thread count at which throughput saturates. Results are written
+ * as JSON.
+ */
+
+#include <openssl/engine.h>
+#include <openssl/rsa.h>
+#include <openssl/dsa.h>
+#include <openssl/dh.h>
+#include <openssl/bn.h>
+#include <openssl/err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include "ibmca_test_common.h"
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+ #error "ibmca_pkey_bench needs OpenSSL 1.1.0 or later"
+#endif
+
+#define MAX_SAMPLES	(1 << 16)
+#define MAX_POINTS	16
+/* throughput within this fraction of the peak counts as saturated */
+#define SATURATION	0.95
+
+enum {
+	RSA_ME,		/* private key without CRT parameters */
+	RSA_CRT,	/* private key with CRT parameters */
+	RSA_PUB,	/* public key operation */
+	DSA_SIGN,
+	DSA_VERIFY,
+	DH_DERIVE,
+	NUM_OPS
+};
+
+static const char *op_names[NUM_OPS] = {
+	"rsa-me", "rsa-crt", "rsa-pub", "dsa-sign", "dsa-verify", "dh"
+};
+
+struct pkey_set {
+	int bits;
+	RSA *rsa_me;
+	RSA *rsa_crt;
+	DSA *dsa;
+	DH *dh;
+	BIGNUM *dh_peer;
+};
+
+struct bench_point {
+	int op;
+	const struct pkey_set *keys;
+	int threads;
+	unsigned int duration_ms;
+};
+
+/*
+ * Private keys without CRT parameters reach ibmca_mod_exp() through the
+ * RSA method's bn_mod_exp, keys with CRT parameters go through
+ * ibmca_rsa_mod_exp() and ibmca_mod_exp_crt().
+ */
+static RSA *rsa_on_engine(const RSA *src, int crt)
+{
+	const BIGNUM *n, *e, *d, *p, *q, *dmp1, *dmq1, *iqmp;
+	RSA *rsa;
+
+	rsa = RSA_new_method(eng);
+	if (rsa == NULL)
+		return NULL;
+	RSA_get0_key(src, &n, &e, &d);
+	RSA_get0_factors(src, &p, &q);
+	RSA_get0_crt_params(src, &dmp1, &dmq1, &iqmp);
+	if (!RSA_set0_key(rsa, BN_dup(n), BN_dup(e), BN_dup(d)))
+		goto err;
+	if (crt && (!RSA_set0_factors(rsa, BN_dup(p), BN_dup(q))
+		    || !RSA_set0_crt_params(rsa, BN_dup(dmp1), BN_dup(dmq1),
+					    BN_dup(iqmp))))
+		goto err;
+	return rsa;
+err:
+	RSA_free(rsa);
+	return NULL;
+}
+
+static int make_keys(struct pkey_set *ks, int bits, const int *ops)
+{
+	RSA *rsa = NULL;
+	DSA *params = NULL;
+	DH *dh = NULL;
+	BIGNUM *e = NULL;
+	const BIGNUM *peer;
+	int ok = 0;
+
+	ks->bits = bits;
+	if (ops[RSA_ME] || ops[RSA_CRT] || ops[RSA_PUB]) {
+		rsa = RSA_new();
+		e = BN_new();
+		if (rsa == NULL || e == NULL || !BN_set_word(e, RSA_F4)
+		    || !RSA_generate_key_ex(rsa, bits, e, NULL))
+			goto end;
+		ks->rsa_me = rsa_on_engine(rsa, 0);
+		ks->rsa_crt = rsa_on_engine(rsa, 1);
+		if (ks->rsa_me == NULL || ks->rsa_crt == NULL)
+			goto end;
+	}
+	if (ops[DSA_SIGN] || ops[DSA_VERIFY] || ops[DH_DERIVE]) {
+		params = DSA_new();
+		if (params == NULL
+		    || !DSA_generate_parameters_ex(params, bits, NULL, 0,
+						   NULL, NULL, NULL))
+			goto end;
+	}
+	if (ops[DSA_SIGN] || ops[DSA_VERIFY]) {
+		ks->dsa = DSA_new_method(eng);
+		if (ks->dsa == NULL
+		    || !DSA_set0_pqg(ks->dsa,
+				     BN_dup(DSA_get0_p(params)),
+				     BN_dup(DSA_get0_q(params)),
+				     BN_dup(DSA_get0_g(params)))
+		    || !DSA_generate_key(ks->dsa))
+			goto end;
+	}
+	if (ops[DH_DERIVE]) {
+		/* DSA style parameters, as openssl dhparam -dsaparam does */
+		dh = DSA_dup_DH(params);
+		ks->dh = DH_new_method(eng);
+		if (dh == NULL || ks->dh == NULL
+		    || !DH_set0_pqg(ks->dh, BN_dup(DH_get0_p(dh)),
+				    BN_dup(DH_get0_q(dh)),
+				    BN_dup(DH_get0_g(dh)))
+		    || !DH_generate_key(dh) || !DH_generate_key(ks->dh))
+			goto end;
+		DH_get0_key(dh, &peer, NULL);
+		ks->dh_peer = BN_dup(peer);
+		if (ks->dh_peer == NULL)
+			goto end;
+	}
+	ok = 1;
+end:
+	RSA_free(rsa);
+	DSA_free(params);
+	DH_free(dh);
+	BN_free(e);
+	return ok;
+}
+
+static void free_keys(struct pkey_set *ks)
+{
+	RSA_free(ks->rsa_me);
+	RSA_free(ks->rsa_crt);
+	DSA_free(ks->dsa);
+	DH_free(ks->dh);
+	BN_free(ks->dh_peer);
+	memset(ks, 0, sizeof(*ks));
+}
+
+static int pkey_op(const struct bench_point *pt, unsigned char *in,
+		   unsigned char *out, unsigned char *sig, unsigned int *siglen)
+{
+	const struct pkey_set *ks = pt->keys;
+	int len = ks->bits / 8;
+
+	switch (pt->op) {
+	case RSA_ME:
+		return RSA_private_encrypt(len, in, out, ks->rsa_me,
+					   RSA_NO_PADDING) == len;
+	case RSA_CRT:
+		return RSA_private_encrypt(len, in, out, ks->rsa_crt,
+					   RSA_NO_PADDING) == len;
+	case RSA_PUB:
+		return RSA_public_encrypt(len, in, out, ks->rsa_crt,
+					  RSA_NO_PADDING) == len;
+	case DSA_SIGN:
+		return DSA_sign(0, in, 32, sig, siglen, ks->dsa);
+	case DSA_VERIFY:
+		return DSA_verify(0, in, 32, sig, *siglen, ks->dsa) == 1;
+	case DH_DERIVE:
+		return DH_compute_key(out, ks->dh_peer, ks->dh) > 0;
+	}
+	return 0;
+}
+
+static void *bench_thread(void *p)
+{
+	struct thread_arg *arg = p;
+	const struct bench_point *pt = arg->pt;
+	struct thread_result *res = arg->res;
+	int len = pt->keys->bits / 8;
+	unsigned char *in, *out, *sig;
+	unsigned int siglen = 0;
+	uint64_t start, t0, t1, end;
+
+	in = malloc(len);
+	out = malloc(len);
+	sig = malloc(pt->keys->dsa ? DSA_size(pt->keys->dsa) : 1);
+	if (in == NULL || out == NULL || sig == NULL)
+		goto fail;
+	/* below the modulus, so RSA_NO_PADDING accepts it */
+	memset(in, 0x5a, len);
+	in[0] = 0;
+
+	/* the verify input is signed once, outside the measurement */
+	if (pt->op == DSA_VERIFY
+	    && !DSA_sign(0, in, 32, sig, &siglen, pt->keys->dsa))
+		goto fail;
+
+	if (!gate_wait(arg->gate))
+		goto out;
+	start = now_ns();
+	end = start + (uint64_t)pt->duration_ms * 1000000ULL;
+	do {
+		t0 = now_ns();
+		if (!pkey_op(pt, in, out, sig, &siglen))
+			goto fail_started;
+		t1 = now_ns();
+		record(arg, t1 - t0);
+		/* at least three operations per thread for percentiles */
+	} while (t1 < end || res->ops < 3);
+
+	goto out;
+
+fail:
+	if (!gate_wait(arg->gate))
+		goto out;
+fail_started:
+	res->failed = 1;
+out:
+	free(in);
+	free(out);
+	free(sig);
+	return NULL;
+}
+
+/* Returns ops/s of the point, or a negative value on failure */
+static double run_point(FILE *json, const struct bench_point *pt, int *first)
+{
+	struct bench_result r;
+	double opsps;
+
+	if (!bench_run(bench_thread, pt, pt->threads, MAX_SAMPLES, &r))
+		return -1;
+	opsps = r.secs > 0 ? r.ops / r.secs : 0;
+
+	fprintf(json, "%s\n    {\"operation\": \"%s\", \"bits\": %d, "
+		"\"threads\": %d, \"ops\": %llu, \"seconds\": %.6f, "
+		"\"ops_per_s\": %.1f, \"p50_ns\": %llu, \"p99_ns\": %llu, "
+		"\"p999_ns\": %llu, \"max_ns\": %llu, \"failed\": %s}",
+		*first ? "" : ",", op_names[pt->op], pt->keys->bits,
+		pt->threads, (unsigned long long)r.ops, r.secs, opsps,
+		(unsigned long long)r.p50, (unsigned long long)r.p99,
+		(unsigned long long)r.p999, (unsigned long long)r.max,
+		r.failed ? "true" : "false");
+	*first = 0;
+
+	fprintf(stderr, "%-10s %4d bit %3d thr %10.1f ops/s p50 %9llu ns "
+		"p99 %10llu ns%s\n", op_names[pt->op], pt->keys->bits,
+		pt->threads, opsps, (unsigned long long)r.p50,
+		(unsigned long long)r.p99, r.failed ? " FAILED" : "");
+	return r.failed ? -1 : opsps;
+}
+
+static int parse_ops(char *list, int *ops)
+{
+	char *tok;
+	int i;
+
+	memset(ops, 0, NUM_OPS * sizeof(int));
+	for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+		for (i = 0; i < NUM_OPS; i++)
+			if (!strcasecmp(tok, op_names[i]))
+				break;
+		if (i == NUM_OPS)
+			return 0;
+		ops[i] = 1;
+	}
+	return 1;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	       "  -f, --file PATH       ibmca engine (default %s)\n"
+	       "  -l, --libica PATH     libica to load via SO_PATH\n"
+	       "  -a, --operations LIST comma separated subset of\n"
+	       "                        rsa-me,rsa-crt,rsa-pub,dsa-sign,"
+	       "dsa-verify,dh\n"
+	       "  -b, --bits LIST       comma separated key sizes "
+	       "(default 1024,2048,3072,4096)\n"
+	       "  -t, --threads N       largest thread count (default 256)\n"
+	       "  -d, --duration MS     time per measurement (default 500)\n"
+	       "  -o, --output FILE     JSON output (default stdout)\n"
+	       "  -h, --help            this text\n",
+	       prog, IBMCA_PATH);
+}
+
+int main(int argc, char *argv[])
+{
+	char *engine_id = IBMCA_PATH, *libica = NULL, *output = NULL;
+	char bits_list[128] = "1024,2048,3072,4096", *tok;
+	unsigned int duration = 500;
+	int max_threads = 256, first = 1, sum_first = 1, failure = 0;
+	int ops[NUM_OPS], op, bits, npts, sat, i, opt, option_index = 0;
+	int threads[MAX_POINTS];
+	double rate[MAX_POINTS], peak;
+	struct pkey_set keys;
+	struct bench_point pt;
+	FILE *json = stdout;
+	char *summary = NULL;
+	size_t summary_len = 0;
+	FILE *sum;
+	struct option long_options[] = {
+		{"file", required_argument, 0, 'f'},
+		{"libica", required_argument, 0, 'l'},
+		{"operations", required_argument, 0, 'a'},
+		{"bits", required_argument, 0, 'b'},
+		{"threads", required_argument, 0, 't'},
+		{"duration", required_argument, 0, 'd'},
+		{"output", required_argument, 0, 'o'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	for (i = 0; i < NUM_OPS; i++)
+		ops[i] = 1;
+
+	while ((opt = getopt_long(argc, argv, "f:l:a:b:t:d:o:h",
+				  long_options, &option_index)) != -1) {
+		switch (opt) {
+		case 'f':
+			engine_id = optarg;
+			break;
+		case 'l':
+			libica = optarg;
+			break;
+		case 'a':
+			if (!parse_ops(optarg, ops)) {
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'b':
+			strncpy(bits_list, optarg, sizeof(bits_list) - 1);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'd':
+			duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (max_threads < 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (init_engine(engine_id, libica)) {
+		fprintf(stderr, "Could not initialize Ibmca engine\n");
+		ERR_print_errors_fp(stderr);
+		return EXIT_FAILURE;
+	}
+	if (output && (json = fopen(output, "w")) == NULL) {
+		perror(output);
+		return EXIT_FAILURE;
+	}
+	sum = open_memstream(&summary, &summary_len);
+	if (sum == NULL) {
+		perror("open_memstream");
+		return EXIT_FAILURE;
+	}
+
+	fprintf(json, "{\n  \"engine\": \"%s\",\n  \"libica\": \"%s\",\n"
+		"  \"duration_ms\": %u,\n  \"results\": [", engine_id,
+		libica ? libica : "default", duration);
+
+	for (tok = strtok(bits_list, ","); tok; tok = strtok(NULL, ",")) {
+		bits = atoi(tok);
+		memset(&keys, 0, sizeof(keys));
+		fprintf(stderr, "generating %d bit keys\n", bits);
+		if (bits < 512 || !make_keys(&keys, bits, ops)) {
+			fprintf(stderr, "could not create %s bit keys\n", tok);
+			ERR_print_errors_fp(stderr);
+			free_keys(&keys);
+			failure++;
+			continue;
+		}
+		for (op = 0; op < NUM_OPS; op++) {
+			if (!ops[op])
+				continue;
+			npts = 0;
+			for (pt.threads = 1;
+			     pt.threads <= max_threads && npts < MAX_POINTS;
+			     pt.threads = next_step(pt.threads, max_threads, 2)) {
+				pt.op = op;
+				pt.keys = &keys;
+				pt.duration_ms = duration;
+				threads[npts] = pt.threads;
+				rate[npts] = run_point(json, &pt, &first);
+				if (rate[npts] < 0) {
+					failure++;
+					rate[npts] = 0;
+				}
+				npts++;
+			}
+
+			/*
+			 * The saturation point is the smallest thread count
+			 * that reaches SATURATION of the peak throughput;
+			 * more threads only add latency from there on.
+			 */
+			for (peak = 0, i = 0; i < npts; i++)
+				if (rate[i] > peak)
+					peak = rate[i];
+			for (sat = 0; sat < npts - 1; sat++)
+				if (rate[sat] >= SATURATION * peak)
+					break;
+			fprintf(sum, "%s\n    {\"operation\": \"%s\", "
+				"\"bits\": %d, \"threads\": %d, "
+				"\"ops_per_s\": %.1f, \"peak_ops_per_s\": %.1f}",
+				sum_first ? "" : ",",
+				op_names[op], bits, threads[sat], rate[sat],
+				peak);
+			sum_first = 0;
+			fprintf(stderr, "%-10s %4d bit saturates at %d threads "
+				"(%.1f ops/s, peak %.1f)\n", op_names[op], bits,
+				threads[sat], rate[sat], peak);
+		}
+		free_keys(&keys);
+	}
+	fclose(sum);
+	fprintf(json, "\n  ],\n  \"saturation\": [%s\n  ],\n"
+		"  \"failures\": %d\n}\n", summary ? summary : "", failure);
+	if (json != stdout)
+		fclose(json);
+	free(summary);
+
+	ENGINE_finish(eng);
+	ENGINE_free(eng);
+	return failure ? EXIT_FAILURE : EXIT_SUCCESS;
+}
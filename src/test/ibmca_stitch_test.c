@@ -0,0 +1,410 @@
+/*
+ * Copyright [2026] International Business Machines Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * TLS record test of the stitched AES-CBC-HMAC ciphers. Records are built
+ * from fixed keys, IVs and sequence numbers with OpenSSL's own AES-CBC and
+ * HMAC, and checked against what the engine seals, opens and produces in
+ * multi-block mode. Records with a broken pad or MAC must not open.
+ *
+ * On hosts without crypto hardware, run it against the libica stand-in:
+ *   ./ibmca_stitch_test -f /path/to/libibmca.so -l ./libica_sw.so
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <openssl/engine.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/err.h>
+#include "ibmca_test_common.h"
+
+#define AAD_LEN		13	/* EVP_AEAD_TLS1_AAD_LEN */
+#define REC_TYPE	23	/* application data */
+#define MAX_PAYLOAD	16384
+#define MAX_RECORD	(AES_BLOCK + MAX_PAYLOAD + 64 + 256)
+#define AES_BLOCK	16
+#define MB_FRAG		4000	/* payload of a multi-block record */
+
+enum bad { GOOD, BAD_PAD, BAD_PAD_LEN, BAD_MAC, BAD_DATA, BAD_MAX };
+
+static const char *bad_names[BAD_MAX] = {
+	"good", "bad pad", "bad pad length", "bad mac", "bad data",
+};
+
+static const struct stitched {
+	int nid;
+	const char *name;
+	const char *aes;
+	const char *md;
+} stitched[] = {
+	{ NID_aes_128_cbc_hmac_sha1, "AES-128-CBC-HMAC-SHA1",
+	  "AES-128-CBC", "SHA1" },
+	{ NID_aes_256_cbc_hmac_sha1, "AES-256-CBC-HMAC-SHA1",
+	  "AES-256-CBC", "SHA1" },
+	{ NID_aes_128_cbc_hmac_sha256, "AES-128-CBC-HMAC-SHA256",
+	  "AES-128-CBC", "SHA256" },
+	{ NID_aes_256_cbc_hmac_sha256, "AES-256-CBC-HMAC-SHA256",
+	  "AES-256-CBC", "SHA256" },
+};
+
+static const int versions[] = { 0x0301, 0x0303 };	/* TLS 1.0, 1.2 */
+static const size_t payloads[] = { 0, 1, 15, 16, 63, 64, 300, 1024,
+				   MAX_PAYLOAD };
+
+static int failure;
+
+static unsigned char key[32], mac_key[32], iv[AES_BLOCK], seq[8];
+static unsigned char payload[8 * MB_FRAG];
+
+static void fill(unsigned char *buf, size_t len, unsigned char seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (unsigned char)(seed + i * 31);
+}
+
+static void set_header(unsigned char *hdr, const unsigned char *sq,
+		       int ver, size_t len)
+{
+	memcpy(hdr, sq, 8);
+	hdr[8] = REC_TYPE;
+	hdr[9] = ver >> 8;
+	hdr[10] = ver & 0xff;
+	hdr[11] = len >> 8;
+	hdr[12] = len & 0xff;
+}
+
+static int sw_cbc(const char *aes, int enc, const unsigned char *cbc_iv,
+		  const unsigned char *in, size_t len, unsigned char *out)
+{
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+	int outl, ok;
+
+	ok = ctx != NULL
+	     && EVP_CipherInit_ex(ctx, EVP_get_cipherbyname(aes), NULL, key,
+				  cbc_iv, enc)
+	     && EVP_CIPHER_CTX_set_padding(ctx, 0)
+	     && EVP_CipherUpdate(ctx, out, &outl, in, len)
+	     && (size_t)outl == len;
+	EVP_CIPHER_CTX_free(ctx);
+	return ok;
+}
+
+/*
+ * The record of ver with sequence number sq that carries len bytes of
+ * payload, as libssl would seal it, spoilt as bad says. Returns its
+ * length.
+ */
+static size_t sw_seal(const struct stitched *st, int ver,
+		      const unsigned char *sq, size_t len,
+		      enum bad bad, unsigned char *rec)
+{
+	const EVP_MD *md = EVP_get_digestbyname(st->md);
+	unsigned char buf[MAX_RECORD], hdr[AAD_LEN];
+	size_t off = ver >= 0x0302 ? AES_BLOCK : 0, n, i;
+	unsigned int mdlen;
+	HMAC_CTX *hmac = HMAC_CTX_new();
+	unsigned char pad;
+
+	fill(buf, off, 0xe0);			/* explicit IV */
+	memcpy(buf + off, payload, len);
+	set_header(hdr, sq, ver, len);
+	if (hmac == NULL
+	    || !HMAC_Init_ex(hmac, mac_key, EVP_MD_size(md), md, NULL)
+	    || !HMAC_Update(hmac, hdr, sizeof(hdr))
+	    || !HMAC_Update(hmac, payload, len)
+	    || !HMAC_Final(hmac, buf + off + len, &mdlen)) {
+		HMAC_CTX_free(hmac);
+		return 0;
+	}
+	HMAC_CTX_free(hmac);
+	n = off + len + mdlen;
+
+	pad = AES_BLOCK - 1 - n % AES_BLOCK;
+	for (i = 0; i <= pad; i++)
+		buf[n + i] = pad;
+	n += pad + 1;
+
+	switch (bad) {
+	case BAD_PAD:
+		if (pad == 0)
+			return 0;
+		buf[n - 2] ^= 1;
+		break;
+	case BAD_PAD_LEN:
+		/* more padding than there is room for */
+		buf[n - 1] = 255;
+		for (i = n - 1 - pad; i < n - 1; i++)
+			buf[i] = 255;
+		break;
+	case BAD_MAC:
+		buf[off + len] ^= 0x80;
+		break;
+	case BAD_DATA:
+		if (len == 0)
+			return 0;
+		buf[off] ^= 1;
+		break;
+	default:
+		break;
+	}
+
+	return sw_cbc(st->aes, 1, iv, buf, n, rec) ? n : 0;
+}
+
+static EVP_CIPHER_CTX *engine_ctx(const struct stitched *st, int enc,
+				  const unsigned char *cbc_iv)
+{
+	const EVP_CIPHER *cipher = ENGINE_get_cipher(eng, st->nid);
+	EVP_CIPHER_CTX *ctx;
+
+	if (cipher == NULL || (ctx = EVP_CIPHER_CTX_new()) == NULL)
+		return NULL;
+	if (!EVP_CipherInit_ex(ctx, cipher, eng, key, cbc_iv, enc)
+	    || EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_MAC_KEY,
+				   EVP_MD_size(EVP_get_digestbyname(st->md)),
+				   mac_key) <= 0) {
+		EVP_CIPHER_CTX_free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+static void fail(const struct stitched *st, const char *what, int ver,
+		 size_t len)
+{
+	fprintf(stderr, "FAIL %s: %s, version %04x, %zu bytes\n", st->name,
+		what, ver, len);
+	ERR_print_errors_fp(stderr);
+	failure++;
+}
+
+/* The engine seals the same record as sw_seal() */
+static void test_seal(const struct stitched *st, int ver, size_t len)
+{
+	unsigned char ref[MAX_RECORD], rec[MAX_RECORD], aad[AAD_LEN];
+	size_t off = ver >= 0x0302 ? AES_BLOCK : 0, n;
+	EVP_CIPHER_CTX *ctx = engine_ctx(st, 1, iv);
+	int pad;
+
+	n = sw_seal(st, ver, seq, len, GOOD, ref);
+	fill(rec, off, 0xe0);
+	memcpy(rec + off, payload, len);
+	set_header(aad, seq, ver, off + len);
+	if (ctx == NULL || n == 0
+	    || (pad = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_TLS1_AAD,
+					  sizeof(aad), aad)) <= 0
+	    || off + len + pad != n
+	    || EVP_Cipher(ctx, rec, rec, n) <= 0
+	    || memcmp(rec, ref, n) != 0)
+		fail(st, "seal", ver, len);
+	EVP_CIPHER_CTX_free(ctx);
+}
+
+/* The engine opens a record of sw_seal(), but only if it is intact */
+static void test_open(const struct stitched *st, int ver, size_t len,
+		      enum bad bad)
+{
+	unsigned char rec[MAX_RECORD], aad[AAD_LEN];
+	size_t off = ver >= 0x0302 ? AES_BLOCK : 0, n;
+	EVP_CIPHER_CTX *ctx;
+	int rc;
+
+	n = sw_seal(st, ver, seq, len, bad, rec);
+	if (n == 0) {
+		if (bad == GOOD)
+			fail(st, "reference record", ver, len);
+		return;
+	}
+	if ((ctx = engine_ctx(st, 0, iv)) == NULL) {
+		fail(st, "open init", ver, len);
+		return;
+	}
+	set_header(aad, seq, ver, n);
+	rc = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_TLS1_AAD, sizeof(aad),
+				 aad) == EVP_MD_size(EVP_get_digestbyname(st->md))
+	     && EVP_Cipher(ctx, rec, rec, n) == 1;
+	if (bad == GOOD
+	    ? !rc || memcmp(rec + off, payload, len) != 0 : rc)
+		fail(st, bad_names[bad], ver, len);
+	EVP_CIPHER_CTX_free(ctx);
+	ERR_clear_error();
+}
+
+/*
+ * interleave records of MB_FRAG bytes in one multi-block write. Every
+ * record is opened with OpenSSL's AES-CBC, its first block being the
+ * explicit IV, and its MAC and padding are checked.
+ */
+static void test_multiblock(const struct stitched *st, unsigned int interleave)
+{
+	static unsigned char out[8 * (5 + MAX_RECORD)];
+	const EVP_MD *md = EVP_get_digestbyname(st->md);
+	EVP_CTRL_TLS1_1_MULTIBLOCK_PARAM param;
+	unsigned char aad[AAD_LEN], sq[8], hdr[AAD_LEN];
+	unsigned char plain[MAX_RECORD], mac[EVP_MAX_MD_SIZE];
+	size_t pos = 0, rlen, n, i;
+	unsigned int mdlen, r;
+	EVP_CIPHER_CTX *ctx = engine_ctx(st, 1, iv);
+	int len, ok;
+
+	set_header(aad, seq, 0x0303, 0);
+	memset(&param, 0, sizeof(param));
+	param.inp = aad;
+	param.len = interleave * MB_FRAG;
+	param.interleave = interleave;
+	len = ctx == NULL ? 0 :
+	      EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_TLS1_1_MULTIBLOCK_AAD,
+				  sizeof(param), &param);
+	ok = len > 0 && param.interleave == interleave
+	     && (size_t)len <= sizeof(out);
+	if (ok) {
+		param.out = out;
+		param.inp = payload;
+		param.len = interleave * MB_FRAG;
+		ok = EVP_CIPHER_CTX_ctrl(ctx,
+					 EVP_CTRL_TLS1_1_MULTIBLOCK_ENCRYPT,
+					 sizeof(param), &param) == len;
+	}
+
+	memcpy(sq, seq, sizeof(sq));
+	for (r = 0; ok && r < interleave; r++) {
+		rlen = out[pos + 3] << 8 | out[pos + 4];
+		ok = out[pos] == REC_TYPE && out[pos + 1] == 3
+		     && out[pos + 2] == 3 && rlen > AES_BLOCK
+		     && rlen % AES_BLOCK == 0 && pos + 5 + rlen <= (size_t)len
+		     && sw_cbc(st->aes, 0, out + pos + 5,
+			       out + pos + 5 + AES_BLOCK, rlen - AES_BLOCK,
+			       plain);
+		if (!ok)
+			break;
+		n = rlen - AES_BLOCK - plain[rlen - AES_BLOCK - 1] - 1;
+		set_header(hdr, sq, 0x0303, MB_FRAG);
+		ok = n == MB_FRAG + (size_t)EVP_MD_size(md)
+		     && memcmp(plain, payload + r * MB_FRAG, MB_FRAG) == 0;
+		if (ok) {
+			HMAC_CTX *hmac = HMAC_CTX_new();
+
+			ok = hmac != NULL
+			     && HMAC_Init_ex(hmac, mac_key, EVP_MD_size(md),
+					     md, NULL)
+			     && HMAC_Update(hmac, hdr, sizeof(hdr))
+			     && HMAC_Update(hmac, plain, MB_FRAG)
+			     && HMAC_Final(hmac, mac, &mdlen)
+			     && memcmp(plain + MB_FRAG, mac, mdlen) == 0;
+			HMAC_CTX_free(hmac);
+		}
+		for (i = n; ok && i < rlen - AES_BLOCK; i++)
+			ok = plain[i] == plain[rlen - AES_BLOCK - 1];
+		pos += 5 + rlen;
+		for (i = sizeof(sq); i > 0 && ++sq[i - 1] == 0; i--)
+			;
+	}
+	if (!ok || pos != (size_t)len)
+		fail(st, interleave == 4 ? "multi-block x4" : "multi-block x8",
+		     0x0303, interleave * MB_FRAG);
+	EVP_CIPHER_CTX_free(ctx);
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	       "  -f, --file PATH       ibmca engine (default %s)\n"
+	       "  -l, --libica PATH     libica to load via SO_PATH\n"
+	       "  -h, --help            this text\n", prog, IBMCA_PATH);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option opts[] = {
+		{ "file", required_argument, NULL, 'f' },
+		{ "libica", required_argument, NULL, 'l' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	char *engine_id = IBMCA_PATH, *libica = NULL;
+	size_t s, p, v, b, tested = 0;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "f:l:h", opts, NULL)) != -1) {
+		switch (c) {
+		case 'f':
+			engine_id = optarg;
+			break;
+		case 'l':
+			libica = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (init_engine(engine_id, libica)) {
+		fprintf(stderr, "Could not initialize Ibmca engine\n");
+		ERR_print_errors_fp(stderr);
+		return EXIT_FAILURE;
+	}
+
+	fill(key, sizeof(key), 0x10);
+	fill(mac_key, sizeof(mac_key), 0x40);
+	fill(iv, sizeof(iv), 0x70);
+	fill(seq, sizeof(seq), 0xf8);		/* carries into byte 6 */
+	fill(payload, sizeof(payload), 0x01);
+
+	for (s = 0; s < sizeof(stitched) / sizeof(stitched[0]); s++) {
+		const EVP_CIPHER *cipher = ENGINE_get_cipher(eng,
+							     stitched[s].nid);
+
+		if (cipher == NULL || EVP_CIPHER_nid(cipher) != stitched[s].nid
+		    || !(EVP_CIPHER_flags(cipher) & EVP_CIPH_FLAG_AEAD_CIPHER)) {
+			printf("%s: not offered, skipped\n", stitched[s].name);
+			ERR_clear_error();
+			continue;
+		}
+		for (v = 0; v < sizeof(versions) / sizeof(versions[0]); v++) {
+			for (p = 0; p < sizeof(payloads) / sizeof(payloads[0]);
+			     p++) {
+				test_seal(&stitched[s], versions[v],
+					  payloads[p]);
+				for (b = GOOD; b < BAD_MAX; b++)
+					test_open(&stitched[s], versions[v],
+						  payloads[p], b);
+			}
+		}
+		test_multiblock(&stitched[s], 4);
+		test_multiblock(&stitched[s], 8);
+		tested++;
+	}
+
+	ENGINE_finish(eng);
+	ENGINE_free(eng);
+
+	if (failure) {
+		printf("%d stitched cipher test(s) failed\n", failure);
+		return EXIT_FAILURE;
+	}
+	printf("%zu stitched cipher(s) passed\n", tested);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright [2026] International Business Machines Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/err.h>
+#include "ibmca_test_common.h"
+
+ENGINE *eng;
+
+int init_engine(const char *id, const char *libica)
+{
+	ENGINE_load_builtin_engines();
+	eng = ENGINE_by_id("dynamic");
+	if (!eng)
+		return 1;
+	if (!ENGINE_ctrl_cmd_string(eng, "SO_PATH", id, 0)
+	    || !ENGINE_ctrl_cmd_string(eng, "LOAD", NULL, 0))
+		return 1;
+	if (libica && !ENGINE_ctrl_cmd_string(eng, "SO_PATH", libica, 0))
+		return 1;
+	if (!ENGINE_init(eng))
+		return 1;
+	ERR_clear_error();
+	return 0;
+}
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t xorshift(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+unsigned long next_step(unsigned long cur, unsigned long max,
+			unsigned int factor)
+{
+	if (cur < max && cur * factor > max)
+		return max;
+	return cur * factor;
+}
+
+static void gate_init(struct start_gate *gate)
+{
+	pthread_mutex_init(&gate->lock, NULL);
+	pthread_cond_init(&gate->cond, NULL);
+	gate->ready = 0;
+	gate->state = 0;
+}
+
+static void gate_destroy(struct start_gate *gate)
+{
+	pthread_cond_destroy(&gate->cond);
+	pthread_mutex_destroy(&gate->lock);
+}
+
+int gate_wait(struct start_gate *gate)
+{
+	int state;
+
+	pthread_mutex_lock(&gate->lock);
+	gate->ready++;
+	pthread_cond_broadcast(&gate->cond);
+	while (gate->state == 0)
+		pthread_cond_wait(&gate->cond, &gate->lock);
+	state = gate->state;
+	pthread_mutex_unlock(&gate->lock);
+	return state > 0;
+}
+
+/* Lets the threads run once n of them are waiting, or aborts them */
+static void gate_open(struct start_gate *gate, int n, int run)
+{
+	pthread_mutex_lock(&gate->lock);
+	while (run && gate->ready < n)
+		pthread_cond_wait(&gate->cond, &gate->lock);
+	gate->state = run ? 1 : -1;
+	pthread_cond_broadcast(&gate->cond);
+	pthread_mutex_unlock(&gate->lock);
+}
+
+void record(struct thread_arg *arg, uint64_t lat)
+{
+	struct thread_result *res = arg->res;
+	uint64_t slot;
+
+	res->ops++;
+	if (res->nsamples < res->max_samples) {
+		res->samples[res->nsamples++] = lat;
+		return;
+	}
+	slot = xorshift(&arg->seed) % res->ops;
+	if (slot < res->max_samples)
+		res->samples[slot] = lat;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const uint64_t *v, size_t n, double q)
+{
+	size_t idx;
+
+	if (n == 0)
+		return 0;
+	idx = (size_t)(q * (n - 1) + 0.5);
+	return v[idx];
+}
+
+int bench_run(void *(*fn)(void *), const void *pt, int threads,
+	      size_t max_samples, struct bench_result *out)
+{
+	struct thread_result *res;
+	struct thread_arg *args;
+	pthread_t *tids;
+	struct start_gate gate;
+	uint64_t *all = NULL, t0, t1;
+	size_t nall = 0;
+	int i, n, rc, ok = 0;
+
+	memset(out, 0, sizeof(*out));
+	res = calloc(threads, sizeof(*res));
+	args = calloc(threads, sizeof(*args));
+	tids = calloc(threads, sizeof(*tids));
+	if (res == NULL || args == NULL || tids == NULL)
+		goto end;
+	for (i = 0; i < threads; i++) {
+		res[i].samples = malloc(max_samples * sizeof(uint64_t));
+		res[i].max_samples = max_samples;
+		if (res[i].samples == NULL)
+			goto end;
+	}
+
+	gate_init(&gate);
+	for (n = 0; n < threads; n++) {
+		args[n].pt = pt;
+		args[n].res = &res[n];
+		args[n].gate = &gate;
+		args[n].seed = 0x9e3779b97f4a7c15ULL * (n + 1);
+		rc = pthread_create(&tids[n], NULL, fn, &args[n]);
+		if (rc) {
+			fprintf(stderr, "thread %d of %d: %s\n", n + 1,
+				threads, strerror(rc));
+			out->failed = 1;
+			break;
+		}
+	}
+	gate_open(&gate, n, !out->failed);
+	t0 = now_ns();
+	for (i = 0; i < n; i++)
+		pthread_join(tids[i], NULL);
+	t1 = now_ns();
+	gate_destroy(&gate);
+
+	for (i = 0; i < threads; i++) {
+		out->ops += res[i].ops;
+		nall += res[i].nsamples;
+		out->failed |= res[i].failed;
+	}
+	all = malloc((nall ? nall : 1) * sizeof(uint64_t));
+	if (all == NULL)
+		goto end;
+	for (nall = 0, i = 0; i < threads; i++) {
+		memcpy(all + nall, res[i].samples,
+		       res[i].nsamples * sizeof(uint64_t));
+		nall += res[i].nsamples;
+	}
+	qsort(all, nall, sizeof(uint64_t), cmp_u64);
+
+	out->secs = (t1 - t0) / 1e9;
+	out->p50 = percentile(all, nall, 0.50);
+	out->p99 = percentile(all, nall, 0.99);
+	out->p999 = percentile(all, nall, 0.999);
+	out->max = nall ? all[nall - 1] : 0;
+	ok = 1;
+end:
+	for (i = 0; res != NULL && i < threads; i++)
+		free(res[i].samples);
+	free(all);
+	free(res);
+	free(args);
+	free(tids);
+	return ok;
+}
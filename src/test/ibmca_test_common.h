@@ -0,0 +1,102 @@
+/*
+ * Copyright [2026] International Business Machines Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Helpers shared by the test and benchmark programs: loading the engine
+ * and running one measurement over a number of threads.
+ */
+
+#ifndef IBMCA_TEST_COMMON_H
+#define IBMCA_TEST_COMMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <openssl/engine.h>
+
+#define IBMCA_PATH "/usr/lib64/openssl/engines/libibmca.so"
+
+extern ENGINE *eng;
+
+/*
+ * Loads the engine at id into eng, through the dynamic engine, and
+ * points it at libica if that is not NULL. Returns 0 on success.
+ */
+int init_engine(const char *id, const char *libica);
+
+uint64_t now_ns(void);
+uint64_t xorshift(uint64_t *s);
+
+/* Geometric steps from 1 up to and including max */
+unsigned long next_step(unsigned long cur, unsigned long max,
+			unsigned int factor);
+
+/*
+ * The threads of a measurement wait here until all of them are set up.
+ * Unlike a barrier, the gate can also be opened when not every thread
+ * could be started; the threads then give up.
+ */
+struct start_gate {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int ready;
+	int state;		/* 0 closed, 1 open, -1 aborted */
+};
+
+struct thread_result {
+	uint64_t ops;
+	uint64_t *samples;
+	size_t nsamples;
+	size_t max_samples;
+	int failed;
+};
+
+/* What bench_run() passes to each of its threads */
+struct thread_arg {
+	const void *pt;
+	struct thread_result *res;
+	struct start_gate *gate;
+	uint64_t seed;
+};
+
+/* Called by every thread, returns 0 if the measurement was aborted */
+int gate_wait(struct start_gate *gate);
+
+/*
+ * Counts an operation of lat ns. Up to max_samples latencies are kept
+ * per thread; once the buffer is full, reservoir sampling keeps the
+ * distribution unbiased.
+ */
+void record(struct thread_arg *arg, uint64_t lat);
+
+struct bench_result {
+	uint64_t ops;
+	double secs;
+	uint64_t p50, p99, p999, max;	/* latencies in ns */
+	int failed;
+};
+
+/*
+ * Runs fn in threads threads, each with a struct thread_arg that carries
+ * pt and room for max_samples latencies. fn calls gate_wait() once it is
+ * set up, and record() for each operation. Returns 0 if the measurement
+ * could not be run at all.
+ */
+int bench_run(void *(*fn)(void *), const void *pt, int threads,
+	      size_t max_samples, struct bench_result *out);
+
+#endif
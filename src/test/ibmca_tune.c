@@ -0,0 +1,114 @@
+/*
+ * Copyright [2026] International Business Machines Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * ibmca_tune runs the CALIBRATE control command of the ibmca engine and
+ * prints the tuning file it wrote. Point the engine's TUNING_FILE command
+ * at that file to use the measured crossovers.
+ */
+
+#include <openssl/engine.h>
+#include <openssl/err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include "ibmca_test_common.h"
+
+#define TUNE_PATH "ibmca.tune"
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	       "  -f, --file PATH       ibmca engine (default %s)\n"
+	       "  -l, --libica PATH     libica to load via SO_PATH\n"
+	       "  -t, --threads N       largest thread count (default 1)\n"
+	       "  -o, --output FILE     tuning file (default %s)\n"
+	       "  -h, --help            this text\n",
+	       prog, IBMCA_PATH, TUNE_PATH);
+}
+
+int main(int argc, char *argv[])
+{
+	char *engine_id = IBMCA_PATH, *libica = NULL, *output = TUNE_PATH;
+	char line[256];
+	long threads = 1;
+	int opt, option_index = 0;
+	FILE *fp;
+	struct option long_options[] = {
+		{"file", required_argument, 0, 'f'},
+		{"libica", required_argument, 0, 'l'},
+		{"threads", required_argument, 0, 't'},
+		{"output", required_argument, 0, 'o'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while ((opt = getopt_long(argc, argv, "f:l:t:o:h",
+				  long_options, &option_index)) != -1) {
+		switch (opt) {
+		case 'f':
+			engine_id = optarg;
+			break;
+		case 'l':
+			libica = optarg;
+			break;
+		case 't':
+			threads = atol(optarg);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (threads < 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (init_engine(engine_id, libica)) {
+		fprintf(stderr, "Could not initialize Ibmca engine\n");
+		ERR_print_errors_fp(stderr);
+		return EXIT_FAILURE;
+	}
+	fprintf(stderr, "calibrating with up to %ld threads\n", threads);
+	if (!ENGINE_ctrl_cmd(eng, "CALIBRATE_THREADS", threads, NULL, NULL, 0)
+	    || !ENGINE_ctrl_cmd_string(eng, "CALIBRATE", output, 0)) {
+		fprintf(stderr, "Calibration failed\n");
+		ERR_print_errors_fp(stderr);
+		ENGINE_finish(eng);
+		ENGINE_free(eng);
+		return EXIT_FAILURE;
+	}
+
+	if ((fp = fopen(output, "r")) == NULL) {
+		perror(output);
+		return EXIT_FAILURE;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL)
+		fputs(line, stdout);
+	fclose(fp);
+
+	ENGINE_finish(eng);
+	ENGINE_free(eng);
+	return EXIT_SUCCESS;
+}
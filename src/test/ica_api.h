@@ -0,0 +1,288 @@
+/*
+ * Copyright [2026] International Business Machines Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * The part of libica's ica_api.h that the engine and libica_sw.c use, for
+ * hosts without libica-devel (configure --enable-libica-sw).
+ *
+ * Types and prototypes follow libica, but the mechanism numbers are only
+ * known to agree between an engine and a libica_sw.so that were both
+ * built against this header. Do not load real libica into an engine
+ * built this way.
+ */
+
+#ifndef __ICA_API_H__
+#define __ICA_API_H__
+
+#include <stdint.h>
+
+typedef int ica_adapter_handle_t;
+
+#define ICA_ENCRYPT		1
+#define ICA_DECRYPT		0
+
+/* libica_func_list_element.flags */
+#define ICA_FLAG_SW		0x01	/* software implementation */
+#define ICA_FLAG_SHW		0x02	/* CPACF */
+#define ICA_FLAG_DHW		0x04	/* crypto card */
+
+/* libica_func_list_element.mech_mode_id */
+#define SHA1			1
+#define SHA256			3
+#define SHA512			5
+#define RSA_ME			8
+#define RSA_CRT			9
+#define DES_ECB			20
+#define DES_CBC			21
+#define DES_OFB			23
+#define DES_CFB			24
+#define DES3_ECB		41
+#define DES3_CBC		42
+#define DES3_OFB		44
+#define DES3_CFB		45
+#define DES3_CTR		46
+#define DES3_CMAC		49
+#define AES_ECB			60
+#define AES_CBC			61
+#define AES_OFB			63
+#define AES_CFB			64
+#define AES_CTR			65
+#define AES_CMAC		68
+#define AES_CCM			69
+#define AES_XTS			71
+#define AES_GCM_KMA		72
+#define P_RNG			80
+
+typedef struct {
+	unsigned int mech_mode_id;
+	unsigned int flags;
+	unsigned int property;
+} libica_func_list_element;
+
+#define SHA_HASH_LENGTH		20
+#define SHA256_HASH_LENGTH	32
+#define SHA512_HASH_LENGTH	64
+#define LENGTH_SHA_HASH		SHA_HASH_LENGTH
+#define LENGTH_SHA256_HASH	SHA256_HASH_LENGTH
+#define LENGTH_SHA512_HASH	SHA512_HASH_LENGTH
+
+#define SHA_MSG_PART_ONLY	0
+#define SHA_MSG_PART_FIRST	1
+#define SHA_MSG_PART_MIDDLE	2
+#define SHA_MSG_PART_FINAL	3
+
+typedef struct {
+	uint64_t runningLength;
+	unsigned char shaHash[LENGTH_SHA_HASH];
+} sha_context_t;
+
+typedef struct {
+	uint64_t runningLength;
+	unsigned char sha256Hash[LENGTH_SHA256_HASH];
+} sha256_context_t;
+
+typedef struct {
+	uint64_t runningLengthHigh;
+	uint64_t runningLengthLow;
+	unsigned char sha512Hash[LENGTH_SHA512_HASH];
+} sha512_context_t;
+
+typedef struct {
+	unsigned int key_length;
+	unsigned char *modulus;
+	unsigned char *exponent;
+} ica_rsa_key_mod_expo_t;
+
+typedef struct {
+	unsigned int key_length;
+	unsigned char *p;
+	unsigned char *q;
+	unsigned char *dp;
+	unsigned char *dq;
+	unsigned char *qInverse;
+} ica_rsa_key_crt_t;
+
+#define MODE_ECB		1
+#define MODE_CBC		2
+
+typedef unsigned char ica_des_vector_t[8];
+typedef unsigned char ica_des_key_single_t[8];
+typedef struct {
+	ica_des_key_single_t key1;
+	ica_des_key_single_t key2;
+	ica_des_key_single_t key3;
+} ica_des_key_triple_t;
+
+#define AES_KEY_LEN128		16
+#define AES_KEY_LEN192		24
+#define AES_KEY_LEN256		32
+
+typedef unsigned char ica_aes_vector_t[16];
+typedef unsigned char ica_aes_key_len_128_t[AES_KEY_LEN128];
+typedef unsigned char ica_aes_key_len_192_t[AES_KEY_LEN192];
+typedef unsigned char ica_aes_key_len_256_t[AES_KEY_LEN256];
+
+unsigned int ica_open_adapter(ica_adapter_handle_t *adapter_handle);
+unsigned int ica_close_adapter(ica_adapter_handle_t adapter_handle);
+unsigned int ica_get_functionlist(libica_func_list_element *pmech_list,
+				  unsigned int *pmech_list_len);
+unsigned int ica_random_number_generate(unsigned int output_length,
+					unsigned char *output_data);
+
+unsigned int ica_rsa_mod_expo(ica_adapter_handle_t adapter_handle,
+			      unsigned char *input_data,
+			      ica_rsa_key_mod_expo_t *rsa_key,
+			      unsigned char *output_data);
+unsigned int ica_rsa_crt(ica_adapter_handle_t adapter_handle,
+			 unsigned char *input_data,
+			 ica_rsa_key_crt_t *rsa_key,
+			 unsigned char *output_data);
+
+unsigned int ica_sha1(unsigned int message_part, unsigned int input_length,
+		      unsigned char *input_data, sha_context_t *sha_context,
+		      unsigned char *output_data);
+unsigned int ica_sha256(unsigned int message_part, unsigned int input_length,
+			unsigned char *input_data,
+			sha256_context_t *sha256_context,
+			unsigned char *output_data);
+unsigned int ica_sha512(unsigned int message_part, uint64_t input_length,
+			unsigned char *input_data,
+			sha512_context_t *sha512_context,
+			unsigned char *output_data);
+
+unsigned int ica_des_encrypt(unsigned int mode, unsigned int data_length,
+			     unsigned char *input_data, ica_des_vector_t *iv,
+			     ica_des_key_single_t *des_key,
+			     unsigned char *output_data);
+unsigned int ica_des_decrypt(unsigned int mode, unsigned int data_length,
+			     unsigned char *input_data, ica_des_vector_t *iv,
+			     ica_des_key_single_t *des_key,
+			     unsigned char *output_data);
+unsigned int ica_des_ofb(const unsigned char *in_data,
+			 unsigned char *out_data, unsigned long data_length,
+			 const unsigned char *key, unsigned char *iv,
+			 unsigned int direction);
+unsigned int ica_des_cfb(const unsigned char *in_data,
+			 unsigned char *out_data, unsigned long data_length,
+			 const unsigned char *key, unsigned char *iv,
+			 unsigned int lcfb, unsigned int direction);
+
+unsigned int ica_3des_encrypt(unsigned int mode, unsigned int data_length,
+			      unsigned char *input_data, ica_des_vector_t *iv,
+			      ica_des_key_triple_t *des_key,
+			      unsigned char *output_data);
+unsigned int ica_3des_decrypt(unsigned int mode, unsigned int data_length,
+			      unsigned char *input_data, ica_des_vector_t *iv,
+			      ica_des_key_triple_t *des_key,
+			      unsigned char *output_data);
+unsigned int ica_3des_ofb(const unsigned char *in_data,
+			  unsigned char *out_data, unsigned long data_length,
+			  const unsigned char *key, unsigned char *iv,
+			  unsigned int direction);
+unsigned int ica_3des_cfb(const unsigned char *in_data,
+			  unsigned char *out_data, unsigned long data_length,
+			  const unsigned char *key, unsigned char *iv,
+			  unsigned int lcfb, unsigned int direction);
+unsigned int ica_3des_ctr(const unsigned char *in_data,
+			  unsigned char *out_data, unsigned long data_length,
+			  const unsigned char *key, unsigned char *ctr,
+			  unsigned int ctr_width, unsigned int direction);
+unsigned int ica_3des_cmac_intermediate(const unsigned char *message,
+					unsigned long message_length,
+					const unsigned char *key,
+					unsigned char *iv);
+unsigned int ica_3des_cmac_last(const unsigned char *message,
+				unsigned long message_length,
+				unsigned char *mac, unsigned int mac_length,
+				const unsigned char *key, unsigned char *iv,
+				unsigned int direction);
+
+unsigned int ica_aes_encrypt(unsigned int mode, unsigned int data_length,
+			     unsigned char *input_data, ica_aes_vector_t *iv,
+			     unsigned int key_length, unsigned char *aes_key,
+			     unsigned char *output_data);
+unsigned int ica_aes_decrypt(unsigned int mode, unsigned int data_length,
+			     unsigned char *input_data, ica_aes_vector_t *iv,
+			     unsigned int key_length, unsigned char *aes_key,
+			     unsigned char *output_data);
+unsigned int ica_aes_ofb(const unsigned char *in_data,
+			 unsigned char *out_data, unsigned long data_length,
+			 const unsigned char *key, unsigned int key_length,
+			 unsigned char *iv, unsigned int direction);
+unsigned int ica_aes_cfb(const unsigned char *in_data,
+			 unsigned char *out_data, unsigned long data_length,
+			 const unsigned char *key, unsigned int key_length,
+			 unsigned char *iv, unsigned int lcfb,
+			 unsigned int direction);
+unsigned int ica_aes_ctr(const unsigned char *in_data,
+			 unsigned char *out_data, unsigned long data_length,
+			 const unsigned char *key, unsigned int key_length,
+			 unsigned char *ctr, unsigned int ctr_width,
+			 unsigned int direction);
+unsigned int ica_aes_xts(const unsigned char *in_data,
+			 unsigned char *out_data, unsigned long data_length,
+			 unsigned char *key1, unsigned char *key2,
+			 unsigned int key_length, unsigned char *tweak,
+			 unsigned int direction);
+unsigned int ica_aes_ccm(unsigned char *payload,
+			 unsigned long payload_length,
+			 unsigned char *ciphertext_n_mac,
+			 unsigned int mac_length,
+			 const unsigned char *assoc_data,
+			 unsigned long assoc_data_length,
+			 const unsigned char *nonce, unsigned int nonce_length,
+			 const unsigned char *key, unsigned int key_length,
+			 unsigned int direction);
+unsigned int ica_aes_cmac_intermediate(const unsigned char *message,
+				       unsigned long message_length,
+				       const unsigned char *key,
+				       unsigned int key_length,
+				       unsigned char *iv);
+unsigned int ica_aes_cmac_last(const unsigned char *message,
+			       unsigned long message_length,
+			       unsigned char *mac, unsigned int mac_length,
+			       const unsigned char *key,
+			       unsigned int key_length, unsigned char *iv,
+			       unsigned int direction);
+unsigned int ica_aes_gcm_initialize(const unsigned char *iv,
+				    unsigned int iv_length,
+				    unsigned char *key,
+				    unsigned int key_length,
+				    unsigned char *icb, unsigned char *ucb,
+				    unsigned char *subkey,
+				    unsigned int direction);
+unsigned int ica_aes_gcm_intermediate(unsigned char *plaintext,
+				      unsigned long plaintext_length,
+				      unsigned char *ciphertext,
+				      unsigned char *ucb,
+				      unsigned char *aad,
+				      unsigned long aad_length,
+				      unsigned char *tag,
+				      unsigned int tag_length,
+				      unsigned char *key,
+				      unsigned int key_length,
+				      unsigned char *subkey,
+				      unsigned int direction);
+unsigned int ica_aes_gcm_last(unsigned char *icb,
+			      unsigned long aad_length,
+			      unsigned long ciph_length,
+			      unsigned char *tag, unsigned char *final_tag,
+			      unsigned int final_tag_length,
+			      unsigned char *key, unsigned int key_length,
+			      unsigned char *subkey, unsigned int direction);
+
+#endif
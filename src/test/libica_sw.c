@@ -0,0 +1,1453 @@
+/*
+ * Copyright [2026] International Business Machines Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Software stand-in for libica.
+ *
+ * This shared object exports every libica entry point the ibmca engine
+ * binds and implements them with the low level libcrypto primitives, so
+ * the engine can be loaded, exercised and profiled on hosts without
+ * CPACF or crypto cards. Select it with the engine's SO_PATH control
+ * command.
+ *
+ * The EVP layer is deliberately not used here: with the engine set as
+ * default, EVP calls would be routed back into the engine.
+ *
+ * Per-call latency can be injected through the environment:
+ *
+ *   LIBICA_SW_LATENCY     nanoseconds busy-waited per symmetric cipher,
+ *                         digest and random call (CPACF is synchronous)
+ *   LIBICA_SW_PK_LATENCY  nanoseconds slept per RSA call (crypto card
+ *                         requests release the CPU while they wait)
+ *
+ * With LIBICA_SW_RSA_DHW=1, RSA is reported as needing a crypto card, like
+ * real libica does, so the engine's card detection can be tested against
+ * a fake AP bus directory (AP_PATH control command).
+ *
+ * Without libica-devel, it is built against the ica_api.h next to it; the
+ * engine then has to be built against the same header (configure
+ * --enable-libica-sw).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/aes.h>
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/des.h>
+#include <openssl/sha.h>
+#include <ica_api.h>
+
+static unsigned long sw_latency;
+static unsigned long sw_pk_latency;
+static unsigned long sw_rsa_dhw;
+
+static unsigned long env_ulong(const char *name)
+{
+	const char *val = getenv(name);
+
+	return val ? strtoul(val, NULL, 0) : 0;
+}
+
+static void __attribute__((constructor)) libica_sw_init(void)
+{
+	sw_latency = env_ulong("LIBICA_SW_LATENCY");
+	sw_pk_latency = env_ulong("LIBICA_SW_PK_LATENCY");
+	sw_rsa_dhw = env_ulong("LIBICA_SW_RSA_DHW");
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sw_spin(void)
+{
+	uint64_t end;
+
+	if (!sw_latency)
+		return;
+	end = now_ns() + sw_latency;
+	while (now_ns() < end)
+		;
+}
+
+static void sw_sleep(void)
+{
+	struct timespec ts;
+
+	if (!sw_pk_latency)
+		return;
+	ts.tv_sec = sw_pk_latency / 1000000000UL;
+	ts.tv_nsec = sw_pk_latency % 1000000000UL;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+}
+
+static uint32_t load_be32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	       (uint32_t)p[2] << 8 | p[3];
+}
+
+static void store_be32(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint64_t load_be64(const unsigned char *p)
+{
+	return (uint64_t)load_be32(p) << 32 | load_be32(p + 4);
+}
+
+static void store_be64(unsigned char *p, uint64_t v)
+{
+	store_be32(p, v >> 32);
+	store_be32(p + 4, v);
+}
+
+/*
+ * Mechanism list
+ */
+static const libica_func_list_element sw_mech_list[] = {
+	{SHA1,		ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{SHA256,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{SHA512,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{P_RNG,		ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	/*
+	 * Real libica reports RSA as ICA_FLAG_DHW, which makes the engine
+	 * look for an online crypto card. There is no card behind this
+	 * library, so the RSA paths are announced as always available
+	 * unless LIBICA_SW_RSA_DHW is set.
+	 */
+	{RSA_ME,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{RSA_CRT,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{DES_ECB,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{DES_CBC,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{DES_OFB,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{DES_CFB,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{DES3_ECB,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{DES3_CBC,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{DES3_OFB,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{DES3_CFB,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{DES3_CTR,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{AES_ECB,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{AES_CBC,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{AES_OFB,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{AES_CFB,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{AES_CTR,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{AES_XTS,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{AES_CCM,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{AES_CMAC,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{DES3_CMAC,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+	{AES_GCM_KMA,	ICA_FLAG_SW | ICA_FLAG_SHW, 0},
+};
+
+#define SW_MECH_LIST_LEN (sizeof(sw_mech_list) / sizeof(sw_mech_list[0]))
+
+unsigned int ica_get_functionlist(libica_func_list_element *pmech_list,
+				  unsigned int *pmech_list_len)
+{
+	unsigned int i;
+
+	if (pmech_list_len == NULL)
+		return EINVAL;
+
+	if (pmech_list == NULL) {
+		*pmech_list_len = SW_MECH_LIST_LEN;
+		return 0;
+	}
+	if (*pmech_list_len < SW_MECH_LIST_LEN)
+		return EINVAL;
+
+	memcpy(pmech_list, sw_mech_list, sizeof(sw_mech_list));
+	*pmech_list_len = SW_MECH_LIST_LEN;
+	if (sw_rsa_dhw) {
+		for (i = 0; i < SW_MECH_LIST_LEN; i++) {
+			if (pmech_list[i].mech_mode_id == RSA_ME
+			    || pmech_list[i].mech_mode_id == RSA_CRT)
+				pmech_list[i].flags = ICA_FLAG_SW
+						      | ICA_FLAG_DHW;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Adapter handling
+ */
+unsigned int ica_open_adapter(ica_adapter_handle_t *adapter_handle)
+{
+	if (adapter_handle == NULL)
+		return EINVAL;
+
+	/* Hand out a real descriptor, like libica does for /dev/z90crypt */
+	*adapter_handle = open("/dev/null", O_RDWR);
+	if (*adapter_handle < 0)
+		return errno;
+	return 0;
+}
+
+unsigned int ica_close_adapter(ica_adapter_handle_t adapter_handle)
+{
+	if (adapter_handle >= 0)
+		close(adapter_handle);
+	return 0;
+}
+
+/*
+ * Random numbers
+ */
+unsigned int ica_random_number_generate(unsigned int output_length,
+					unsigned char *output_data)
+{
+	static int fd = -1;
+	ssize_t rc;
+	int tmp;
+
+	sw_spin();
+
+	if (fd < 0) {
+		tmp = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+		if (tmp < 0)
+			return EIO;
+		if (!__sync_bool_compare_and_swap(&fd, -1, tmp))
+			close(tmp);
+	}
+
+	while (output_length) {
+		rc = read(fd, output_data, output_length);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			return EIO;
+		output_data += rc;
+		output_length -= rc;
+	}
+	return 0;
+}
+
+/*
+ * RSA
+ */
+unsigned int ica_rsa_mod_expo(ica_adapter_handle_t adapter_handle,
+			      unsigned char *input_data,
+			      ica_rsa_key_mod_expo_t *rsa_key,
+			      unsigned char *output_data)
+{
+	BN_CTX *ctx;
+	BIGNUM *in, *n, *e, *out;
+	unsigned int rc = EIO;
+	int len;
+
+	if (input_data == NULL || rsa_key == NULL || output_data == NULL)
+		return EINVAL;
+
+	sw_sleep();
+
+	ctx = BN_CTX_new();
+	if (ctx == NULL)
+		return ENOMEM;
+	BN_CTX_start(ctx);
+	in = BN_CTX_get(ctx);
+	n = BN_CTX_get(ctx);
+	e = BN_CTX_get(ctx);
+	out = BN_CTX_get(ctx);
+	if (out == NULL)
+		goto end;
+
+	if (!BN_bin2bn(input_data, rsa_key->key_length, in)
+	    || !BN_bin2bn(rsa_key->modulus, rsa_key->key_length, n)
+	    || !BN_bin2bn(rsa_key->exponent, rsa_key->key_length, e))
+		goto end;
+
+	if (BN_cmp(in, n) >= 0) {
+		rc = EINVAL;
+		goto end;
+	}
+	if (!BN_mod_exp(out, in, e, n, ctx))
+		goto end;
+
+	len = BN_num_bytes(out);
+	if (len > rsa_key->key_length) {
+		rc = EINVAL;
+		goto end;
+	}
+	memset(output_data, 0, rsa_key->key_length - len);
+	BN_bn2bin(out, output_data + rsa_key->key_length - len);
+	rc = 0;
+end:
+	BN_CTX_end(ctx);
+	BN_CTX_free(ctx);
+	return rc;
+}
+
+unsigned int ica_rsa_crt(ica_adapter_handle_t adapter_handle,
+			 unsigned char *input_data,
+			 ica_rsa_key_crt_t *rsa_key,
+			 unsigned char *output_data)
+{
+	BN_CTX *ctx;
+	BIGNUM *in, *p, *q, *dp, *dq, *qinv, *m1, *m2, *h;
+	unsigned int half;
+	unsigned int rc = EIO;
+	int len;
+
+	if (input_data == NULL || rsa_key == NULL || output_data == NULL)
+		return EINVAL;
+
+	sw_sleep();
+
+	ctx = BN_CTX_new();
+	if (ctx == NULL)
+		return ENOMEM;
+	BN_CTX_start(ctx);
+	in = BN_CTX_get(ctx);
+	p = BN_CTX_get(ctx);
+	q = BN_CTX_get(ctx);
+	dp = BN_CTX_get(ctx);
+	dq = BN_CTX_get(ctx);
+	qinv = BN_CTX_get(ctx);
+	m1 = BN_CTX_get(ctx);
+	m2 = BN_CTX_get(ctx);
+	h = BN_CTX_get(ctx);
+	if (h == NULL)
+		goto end;
+
+	/* p, dp and qInverse carry an additional 8 byte padding */
+	half = rsa_key->key_length / 2;
+	if (!BN_bin2bn(input_data, rsa_key->key_length, in)
+	    || !BN_bin2bn(rsa_key->p, half + 8, p)
+	    || !BN_bin2bn(rsa_key->q, half, q)
+	    || !BN_bin2bn(rsa_key->dp, half + 8, dp)
+	    || !BN_bin2bn(rsa_key->dq, half, dq)
+	    || !BN_bin2bn(rsa_key->qInverse, half + 8, qinv))
+		goto end;
+
+	/* m1 = c^dp mod p, m2 = c^dq mod q, m = m2 + q * (qinv (m1 - m2) mod p) */
+	if (!BN_mod(m1, in, p, ctx)
+	    || !BN_mod_exp(m1, m1, dp, p, ctx)
+	    || !BN_mod(m2, in, q, ctx)
+	    || !BN_mod_exp(m2, m2, dq, q, ctx)
+	    || !BN_mod_sub(h, m1, m2, p, ctx)
+	    || !BN_mod_mul(h, h, qinv, p, ctx)
+	    || !BN_mul(h, h, q, ctx)
+	    || !BN_add(h, h, m2))
+		goto end;
+
+	len = BN_num_bytes(h);
+	if (len > rsa_key->key_length) {
+		rc = EINVAL;
+		goto end;
+	}
+	memset(output_data, 0, rsa_key->key_length - len);
+	BN_bn2bin(h, output_data + rsa_key->key_length - len);
+	rc = 0;
+end:
+	BN_CTX_end(ctx);
+	BN_CTX_free(ctx);
+	return rc;
+}
+
+/*
+ * SHA
+ *
+ * libica keeps the running hash in big endian byte order together with
+ * the number of bytes processed so far. Intermediate parts have to be a
+ * multiple of the block size.
+ */
+unsigned int ica_sha1(unsigned int message_part, unsigned int input_length,
+		      unsigned char *input_data, sha_context_t *sha_context,
+		      unsigned char *output_data)
+{
+	SHA_CTX c;
+
+	if (sha_context == NULL || output_data == NULL
+	    || (input_length && input_data == NULL))
+		return EINVAL;
+	if ((message_part == SHA_MSG_PART_FIRST
+	     || message_part == SHA_MSG_PART_MIDDLE)
+	    && (input_length % SHA_CBLOCK))
+		return EINVAL;
+
+	sw_spin();
+
+	SHA1_Init(&c);
+	if (message_part == SHA_MSG_PART_MIDDLE
+	    || message_part == SHA_MSG_PART_FINAL) {
+		c.h0 = load_be32(sha_context->shaHash);
+		c.h1 = load_be32(sha_context->shaHash + 4);
+		c.h2 = load_be32(sha_context->shaHash + 8);
+		c.h3 = load_be32(sha_context->shaHash + 12);
+		c.h4 = load_be32(sha_context->shaHash + 16);
+		c.Nl = (uint32_t)(sha_context->runningLength << 3);
+		c.Nh = (uint32_t)(sha_context->runningLength >> 29);
+	} else {
+		sha_context->runningLength = 0;
+	}
+
+	SHA1_Update(&c, input_data, input_length);
+	sha_context->runningLength += input_length;
+
+	if (message_part == SHA_MSG_PART_FIRST
+	    || message_part == SHA_MSG_PART_MIDDLE) {
+		store_be32(sha_context->shaHash, c.h0);
+		store_be32(sha_context->shaHash + 4, c.h1);
+		store_be32(sha_context->shaHash + 8, c.h2);
+		store_be32(sha_context->shaHash + 12, c.h3);
+		store_be32(sha_context->shaHash + 16, c.h4);
+		memcpy(output_data, sha_context->shaHash, SHA_HASH_LENGTH);
+	} else {
+		SHA1_Final(output_data, &c);
+		memcpy(sha_context->shaHash, output_data, SHA_HASH_LENGTH);
+	}
+
+	OPENSSL_cleanse(&c, sizeof(c));
+	return 0;
+}
+
+unsigned int ica_sha256(unsigned int message_part, unsigned int input_length,
+			unsigned char *input_data,
+			sha256_context_t *sha256_context,
+			unsigned char *output_data)
+{
+	SHA256_CTX c;
+	int i;
+
+	if (sha256_context == NULL || output_data == NULL
+	    || (input_length && input_data == NULL))
+		return EINVAL;
+	if ((message_part == SHA_MSG_PART_FIRST
+	     || message_part == SHA_MSG_PART_MIDDLE)
+	    && (input_length % SHA256_CBLOCK))
+		return EINVAL;
+
+	sw_spin();
+
+	SHA256_Init(&c);
+	if (message_part == SHA_MSG_PART_MIDDLE
+	    || message_part == SHA_MSG_PART_FINAL) {
+		for (i = 0; i < 8; i++)
+			c.h[i] = load_be32(sha256_context->sha256Hash + 4 * i);
+		c.Nl = (uint32_t)(sha256_context->runningLength << 3);
+		c.Nh = (uint32_t)(sha256_context->runningLength >> 29);
+	} else {
+		sha256_context->runningLength = 0;
+	}
+
+	SHA256_Update(&c, input_data, input_length);
+	sha256_context->runningLength += input_length;
+
+	if (message_part == SHA_MSG_PART_FIRST
+	    || message_part == SHA_MSG_PART_MIDDLE) {
+		for (i = 0; i < 8; i++)
+			store_be32(sha256_context->sha256Hash + 4 * i, c.h[i]);
+		memcpy(output_data, sha256_context->sha256Hash,
+		       SHA256_HASH_LENGTH);
+	} else {
+		SHA256_Final(output_data, &c);
+		memcpy(sha256_context->sha256Hash, output_data,
+		       SHA256_HASH_LENGTH);
+	}
+
+	OPENSSL_cleanse(&c, sizeof(c));
+	return 0;
+}
+
+unsigned int ica_sha512(unsigned int message_part, uint64_t input_length,
+			unsigned char *input_data,
+			sha512_context_t *sha512_context,
+			unsigned char *output_data)
+{
+	SHA512_CTX c;
+	uint64_t low;
+	int i;
+
+	if (sha512_context == NULL || output_data == NULL
+	    || (input_length && input_data == NULL))
+		return EINVAL;
+	if ((message_part == SHA_MSG_PART_FIRST
+	     || message_part == SHA_MSG_PART_MIDDLE)
+	    && (input_length % SHA512_CBLOCK))
+		return EINVAL;
+
+	sw_spin();
+
+	SHA512_Init(&c);
+	if (message_part == SHA_MSG_PART_MIDDLE
+	    || message_part == SHA_MSG_PART_FINAL) {
+		for (i = 0; i < 8; i++)
+			c.h[i] = load_be64(sha512_context->sha512Hash + 8 * i);
+		c.Nl = sha512_context->runningLengthLow << 3;
+		c.Nh = sha512_context->runningLengthHigh << 3
+		       | sha512_context->runningLengthLow >> 61;
+	} else {
+		sha512_context->runningLengthLow = 0;
+		sha512_context->runningLengthHigh = 0;
+	}
+
+	SHA512_Update(&c, input_data, input_length);
+	low = sha512_context->runningLengthLow + input_length;
+	if (low < sha512_context->runningLengthLow)
+		sha512_context->runningLengthHigh++;
+	sha512_context->runningLengthLow = low;
+
+	if (message_part == SHA_MSG_PART_FIRST
+	    || message_part == SHA_MSG_PART_MIDDLE) {
+		for (i = 0; i < 8; i++)
+			store_be64(sha512_context->sha512Hash + 8 * i, c.h[i]);
+		memcpy(output_data, sha512_context->sha512Hash,
+		       SHA512_HASH_LENGTH);
+	} else {
+		SHA512_Final(output_data, &c);
+		memcpy(sha512_context->sha512Hash, output_data,
+		       SHA512_HASH_LENGTH);
+	}
+
+	OPENSSL_cleanse(&c, sizeof(c));
+	return 0;
+}
+
+/*
+ * CTR
+ */
+
+/*
+ * Counts the rightmost width bits of the block cb of blklen bytes up by
+ * one. width is a multiple of 8.
+ */
+static void ctr_inc(unsigned char *cb, unsigned int blklen,
+		    unsigned int width)
+{
+	unsigned int i;
+
+	for (i = blklen; i > blklen - width / 8; i--)
+		if (++cb[i - 1])
+			break;
+}
+
+static unsigned int ctr_modes(const unsigned char *in, unsigned char *out,
+			      unsigned long len, unsigned char *ctr,
+			      unsigned int ctr_width, unsigned int blklen,
+			      void (*block)(const unsigned char *,
+					    unsigned char *, const void *),
+			      const void *ks)
+{
+	unsigned char ksb[AES_BLOCK_SIZE];
+	unsigned long i, n;
+
+	if (ctr_width % 8 || ctr_width < 8 || ctr_width > blklen * 8)
+		return EINVAL;
+
+	while (len) {
+		n = len < blklen ? len : blklen;
+		block(ctr, ksb, ks);
+		for (i = 0; i < n; i++)
+			out[i] = in[i] ^ ksb[i];
+		ctr_inc(ctr, blklen, ctr_width);
+		in += n;
+		out += n;
+		len -= n;
+	}
+	OPENSSL_cleanse(ksb, sizeof(ksb));
+	return 0;
+}
+
+/*
+ * DES and TDES
+ */
+static void des_schedule(DES_key_schedule *ks, const unsigned char *key,
+			 int nkeys)
+{
+	int i;
+
+	for (i = 0; i < nkeys; i++)
+		DES_set_key_unchecked((const_DES_cblock *)(key + 8 * i),
+				      &ks[i]);
+}
+
+static unsigned int des_modes(unsigned int mode, unsigned int data_length,
+			      const unsigned char *in, unsigned char *iv,
+			      const unsigned char *key, int nkeys,
+			      unsigned char *out, int enc)
+{
+	DES_key_schedule ks[3];
+	unsigned int i;
+
+	if (in == NULL || out == NULL || key == NULL
+	    || (data_length % sizeof(ica_des_vector_t)))
+		return EINVAL;
+	if (mode != MODE_ECB && (mode != MODE_CBC || iv == NULL))
+		return EINVAL;
+
+	sw_spin();
+
+	des_schedule(ks, key, nkeys);
+	if (mode == MODE_ECB) {
+		for (i = 0; i < data_length; i += 8) {
+			if (nkeys == 1)
+				DES_ecb_encrypt((const_DES_cblock *)(in + i),
+						(DES_cblock *)(out + i),
+						&ks[0], enc);
+			else
+				DES_ecb3_encrypt((const_DES_cblock *)(in + i),
+						 (DES_cblock *)(out + i),
+						 &ks[0], &ks[1], &ks[2], enc);
+		}
+	} else if (nkeys == 1) {
+		DES_ncbc_encrypt(in, out, data_length, &ks[0],
+				 (DES_cblock *)iv, enc);
+	} else {
+		DES_ede3_cbc_encrypt(in, out, data_length, &ks[0], &ks[1],
+				     &ks[2], (DES_cblock *)iv, enc);
+	}
+
+	OPENSSL_cleanse(ks, sizeof(ks));
+	return 0;
+}
+
+unsigned int ica_des_encrypt(unsigned int mode, unsigned int data_length,
+			     unsigned char *input_data, ica_des_vector_t *iv,
+			     ica_des_key_single_t *des_key,
+			     unsigned char *output_data)
+{
+	return des_modes(mode, data_length, input_data, (unsigned char *)iv,
+			 (unsigned char *)des_key, 1, output_data, DES_ENCRYPT);
+}
+
+unsigned int ica_des_decrypt(unsigned int mode, unsigned int data_length,
+			     unsigned char *input_data, ica_des_vector_t *iv,
+			     ica_des_key_single_t *des_key,
+			     unsigned char *output_data)
+{
+	return des_modes(mode, data_length, input_data, (unsigned char *)iv,
+			 (unsigned char *)des_key, 1, output_data, DES_DECRYPT);
+}
+
+unsigned int ica_3des_encrypt(unsigned int mode, unsigned int data_length,
+			      unsigned char *input_data, ica_des_vector_t *iv,
+			      ica_des_key_triple_t *des_key,
+			      unsigned char *output_data)
+{
+	return des_modes(mode, data_length, input_data, (unsigned char *)iv,
+			 (unsigned char *)des_key, 3, output_data, DES_ENCRYPT);
+}
+
+unsigned int ica_3des_decrypt(unsigned int mode, unsigned int data_length,
+			      unsigned char *input_data, ica_des_vector_t *iv,
+			      ica_des_key_triple_t *des_key,
+			      unsigned char *output_data)
+{
+	return des_modes(mode, data_length, input_data, (unsigned char *)iv,
+			 (unsigned char *)des_key, 3, output_data, DES_DECRYPT);
+}
+
+static unsigned int des_stream(const unsigned char *in, unsigned char *out,
+			       unsigned long len, const unsigned char *key,
+			       int nkeys, unsigned char *iv, int cfb, int enc)
+{
+	DES_key_schedule ks[3];
+	int num = 0;
+
+	if (in == NULL || out == NULL || key == NULL || iv == NULL)
+		return EINVAL;
+
+	sw_spin();
+
+	des_schedule(ks, key, nkeys);
+	if (cfb && nkeys == 1)
+		DES_cfb64_encrypt(in, out, len, &ks[0], (DES_cblock *)iv,
+				  &num, enc);
+	else if (cfb)
+		DES_ede3_cfb64_encrypt(in, out, len, &ks[0], &ks[1], &ks[2],
+				       (DES_cblock *)iv, &num, enc);
+	else if (nkeys == 1)
+		DES_ofb64_encrypt(in, out, len, &ks[0], (DES_cblock *)iv,
+				  &num);
+	else
+		DES_ede3_ofb64_encrypt(in, out, len, &ks[0], &ks[1], &ks[2],
+				       (DES_cblock *)iv, &num);
+
+	OPENSSL_cleanse(ks, sizeof(ks));
+	return 0;
+}
+
+unsigned int ica_des_ofb(const unsigned char *in_data, unsigned char *out_data,
+			 unsigned long data_length, const unsigned char *key,
+			 unsigned char *iv, unsigned int direction)
+{
+	return des_stream(in_data, out_data, data_length, key, 1, iv, 0,
+			  direction == ICA_ENCRYPT);
+}
+
+unsigned int ica_des_cfb(const unsigned char *in_data, unsigned char *out_data,
+			 unsigned long data_length, const unsigned char *key,
+			 unsigned char *iv, unsigned int lcfb,
+			 unsigned int direction)
+{
+	if (lcfb != sizeof(ica_des_vector_t))
+		return EINVAL;
+	return des_stream(in_data, out_data, data_length, key, 1, iv, 1,
+			  direction == ICA_ENCRYPT);
+}
+
+unsigned int ica_3des_ofb(const unsigned char *in_data,
+			  unsigned char *out_data, unsigned long data_length,
+			  const unsigned char *key, unsigned char *iv,
+			  unsigned int direction)
+{
+	return des_stream(in_data, out_data, data_length, key, 3, iv, 0,
+			  direction == ICA_ENCRYPT);
+}
+
+unsigned int ica_3des_cfb(const unsigned char *in_data,
+			  unsigned char *out_data, unsigned long data_length,
+			  const unsigned char *key, unsigned char *iv,
+			  unsigned int lcfb, unsigned int direction)
+{
+	if (lcfb != sizeof(ica_des_vector_t))
+		return EINVAL;
+	return des_stream(in_data, out_data, data_length, key, 3, iv, 1,
+			  direction == ICA_ENCRYPT);
+}
+
+static void tdes_block(const unsigned char *in, unsigned char *out,
+		       const void *ks)
+{
+	DES_key_schedule *k = (DES_key_schedule *)ks;
+
+	DES_ecb3_encrypt((const_DES_cblock *)in, (DES_cblock *)out, &k[0],
+			 &k[1], &k[2], DES_ENCRYPT);
+}
+
+unsigned int ica_3des_ctr(const unsigned char *in_data,
+			  unsigned char *out_data, unsigned long data_length,
+			  const unsigned char *key, unsigned char *ctr,
+			  unsigned int ctr_width, unsigned int direction)
+{
+	DES_key_schedule ks[3];
+	unsigned int rc;
+
+	if (in_data == NULL || out_data == NULL || key == NULL || ctr == NULL)
+		return EINVAL;
+
+	sw_spin();
+
+	des_schedule(ks, key, 3);
+	rc = ctr_modes(in_data, out_data, data_length, ctr, ctr_width,
+		       sizeof(ica_des_vector_t), tdes_block, ks);
+	OPENSSL_cleanse(ks, sizeof(ks));
+	return rc;
+}
+
+/*
+ * AES
+ */
+static int aes_key_ok(unsigned int key_length)
+{
+	return key_length == AES_KEY_LEN128 || key_length == AES_KEY_LEN192
+	       || key_length == AES_KEY_LEN256;
+}
+
+static unsigned int aes_modes(unsigned int mode, unsigned int data_length,
+			      const unsigned char *in, unsigned char *iv,
+			      unsigned int key_length, const unsigned char *key,
+			      unsigned char *out, int enc)
+{
+	AES_KEY ks;
+	unsigned int i;
+
+	if (in == NULL || out == NULL || key == NULL || !aes_key_ok(key_length)
+	    || (data_length % AES_BLOCK_SIZE))
+		return EINVAL;
+	if (mode != MODE_ECB && (mode != MODE_CBC || iv == NULL))
+		return EINVAL;
+
+	sw_spin();
+
+	if (enc)
+		AES_set_encrypt_key(key, key_length * 8, &ks);
+	else
+		AES_set_decrypt_key(key, key_length * 8, &ks);
+
+	if (mode == MODE_ECB) {
+		for (i = 0; i < data_length; i += AES_BLOCK_SIZE)
+			AES_ecb_encrypt(in + i, out + i, &ks, enc);
+	} else {
+		AES_cbc_encrypt(in, out, data_length, &ks, iv, enc);
+	}
+
+	OPENSSL_cleanse(&ks, sizeof(ks));
+	return 0;
+}
+
+unsigned int ica_aes_encrypt(unsigned int mode, unsigned int data_length,
+			     unsigned char *input_data, ica_aes_vector_t *iv,
+			     unsigned int key_length, unsigned char *aes_key,
+			     unsigned char *output_data)
+{
+	return aes_modes(mode, data_length, input_data, (unsigned char *)iv,
+			 key_length, aes_key, output_data, AES_ENCRYPT);
+}
+
+unsigned int ica_aes_decrypt(unsigned int mode, unsigned int data_length,
+			     unsigned char *input_data, ica_aes_vector_t *iv,
+			     unsigned int key_length, unsigned char *aes_key,
+			     unsigned char *output_data)
+{
+	return aes_modes(mode, data_length, input_data, (unsigned char *)iv,
+			 key_length, aes_key, output_data, AES_DECRYPT);
+}
+
+unsigned int ica_aes_ofb(const unsigned char *in_data, unsigned char *out_data,
+			 unsigned long data_length, const unsigned char *key,
+			 unsigned int key_length, unsigned char *iv,
+			 unsigned int direction)
+{
+	AES_KEY ks;
+	int num = 0;
+
+	if (in_data == NULL || out_data == NULL || key == NULL || iv == NULL
+	    || !aes_key_ok(key_length))
+		return EINVAL;
+
+	sw_spin();
+
+	AES_set_encrypt_key(key, key_length * 8, &ks);
+	AES_ofb128_encrypt(in_data, out_data, data_length, &ks, iv, &num);
+	OPENSSL_cleanse(&ks, sizeof(ks));
+	return 0;
+}
+
+unsigned int ica_aes_cfb(const unsigned char *in_data, unsigned char *out_data,
+			 unsigned long data_length, const unsigned char *key,
+			 unsigned int key_length, unsigned char *iv,
+			 unsigned int lcfb, unsigned int direction)
+{
+	AES_KEY ks;
+	int num = 0;
+
+	if (in_data == NULL || out_data == NULL || key == NULL || iv == NULL
+	    || !aes_key_ok(key_length) || lcfb != AES_BLOCK_SIZE)
+		return EINVAL;
+
+	sw_spin();
+
+	AES_set_encrypt_key(key, key_length * 8, &ks);
+	AES_cfb128_encrypt(in_data, out_data, data_length, &ks, iv, &num,
+			   direction == ICA_ENCRYPT);
+	OPENSSL_cleanse(&ks, sizeof(ks));
+	return 0;
+}
+
+static void aes_block(const unsigned char *in, unsigned char *out,
+		      const void *ks)
+{
+	AES_encrypt(in, out, ks);
+}
+
+unsigned int ica_aes_ctr(const unsigned char *in_data, unsigned char *out_data,
+			 unsigned long data_length, const unsigned char *key,
+			 unsigned int key_length, unsigned char *ctr,
+			 unsigned int ctr_width, unsigned int direction)
+{
+	AES_KEY ks;
+	unsigned int rc;
+
+	if (in_data == NULL || out_data == NULL || key == NULL || ctr == NULL
+	    || !aes_key_ok(key_length))
+		return EINVAL;
+
+	sw_spin();
+
+	AES_set_encrypt_key(key, key_length * 8, &ks);
+	rc = ctr_modes(in_data, out_data, data_length, ctr, ctr_width,
+		       AES_BLOCK_SIZE, aes_block, &ks);
+	OPENSSL_cleanse(&ks, sizeof(ks));
+	return rc;
+}
+
+/*
+ * AES-XTS, with ciphertext stealing for a partial last block
+ */
+static void xts_mul_alpha(unsigned char *t)
+{
+	unsigned char carry = t[AES_BLOCK_SIZE - 1] >> 7;
+	int i;
+
+	for (i = AES_BLOCK_SIZE - 1; i > 0; i--)
+		t[i] = t[i] << 1 | t[i - 1] >> 7;
+	t[0] = t[0] << 1 ^ (carry ? 0x87 : 0);
+}
+
+static void xts_block(const unsigned char *in, unsigned char *out,
+		      const unsigned char *t, const AES_KEY *ks, int enc)
+{
+	unsigned char b[AES_BLOCK_SIZE];
+	int i;
+
+	for (i = 0; i < AES_BLOCK_SIZE; i++)
+		b[i] = in[i] ^ t[i];
+	if (enc)
+		AES_encrypt(b, b, ks);
+	else
+		AES_decrypt(b, b, ks);
+	for (i = 0; i < AES_BLOCK_SIZE; i++)
+		out[i] = b[i] ^ t[i];
+}
+
+unsigned int ica_aes_xts(const unsigned char *in_data, unsigned char *out_data,
+			 unsigned long data_length, unsigned char *key1,
+			 unsigned char *key2, unsigned int key_length,
+			 unsigned char *tweak, unsigned int direction)
+{
+	unsigned char pp[AES_BLOCK_SIZE], cc[AES_BLOCK_SIZE];
+	unsigned char t[AES_BLOCK_SIZE], tn[AES_BLOCK_SIZE];
+	unsigned long rem = data_length % AES_BLOCK_SIZE;
+	unsigned long full = data_length - rem;
+	int enc = direction == ICA_ENCRYPT;
+	AES_KEY ks;
+
+	if (in_data == NULL || out_data == NULL || key1 == NULL || key2 == NULL
+	    || tweak == NULL || data_length < AES_BLOCK_SIZE
+	    || (key_length != AES_KEY_LEN128 && key_length != AES_KEY_LEN256))
+		return EINVAL;
+
+	sw_spin();
+
+	AES_set_encrypt_key(key2, key_length * 8, &ks);
+	AES_encrypt(tweak, t, &ks);
+	if (enc)
+		AES_set_encrypt_key(key1, key_length * 8, &ks);
+	else
+		AES_set_decrypt_key(key1, key_length * 8, &ks);
+
+	/* the last full block takes part in the stealing */
+	if (rem)
+		full -= AES_BLOCK_SIZE;
+	for (; full; full -= AES_BLOCK_SIZE) {
+		xts_block(in_data, out_data, t, &ks, enc);
+		xts_mul_alpha(t);
+		in_data += AES_BLOCK_SIZE;
+		out_data += AES_BLOCK_SIZE;
+	}
+	if (rem) {
+		memcpy(tn, t, sizeof(tn));
+		xts_mul_alpha(tn);
+		/* decryption takes the tweaks of the two blocks in turn */
+		xts_block(in_data, cc, enc ? t : tn, &ks, enc);
+		memcpy(pp, in_data + AES_BLOCK_SIZE, rem);
+		memcpy(pp + rem, cc + rem, AES_BLOCK_SIZE - rem);
+		memcpy(out_data + AES_BLOCK_SIZE, cc, rem);
+		xts_block(pp, out_data, enc ? tn : t, &ks, enc);
+		memcpy(t, tn, sizeof(t));
+	}
+
+	memcpy(tweak, t, sizeof(t));
+	OPENSSL_cleanse(&ks, sizeof(ks));
+	return 0;
+}
+
+/*
+ * AES-CCM (NIST SP 800-38C): CBC-MAC over B0, the AAD and the payload,
+ * then CTR with counter blocks A0 (for the tag) and A1... (payload).
+ */
+struct ccm_mac {
+	unsigned char x[AES_BLOCK_SIZE];
+	unsigned int pos;
+	const AES_KEY *ks;
+};
+
+static void ccm_mac_update(struct ccm_mac *m, const unsigned char *data,
+			   unsigned long len)
+{
+	while (len--) {
+		m->x[m->pos++] ^= *data++;
+		if (m->pos == AES_BLOCK_SIZE) {
+			AES_encrypt(m->x, m->x, m->ks);
+			m->pos = 0;
+		}
+	}
+}
+
+static void ccm_mac_pad(struct ccm_mac *m)
+{
+	if (m->pos) {
+		AES_encrypt(m->x, m->x, m->ks);
+		m->pos = 0;
+	}
+}
+
+static void ccm_ctr_block(unsigned char *a, const unsigned char *nonce,
+			  unsigned int nlen, uint64_t i)
+{
+	unsigned int L = 15 - nlen, k;
+
+	a[0] = L - 1;
+	memcpy(a + 1, nonce, nlen);
+	for (k = 0; k < L; k++, i >>= 8)
+		a[15 - k] = i & 0xff;
+}
+
+unsigned int ica_aes_ccm(unsigned char *payload, unsigned long payload_length,
+			 unsigned char *ciphertext_n_mac,
+			 unsigned int mac_length,
+			 const unsigned char *assoc_data,
+			 unsigned long assoc_data_length,
+			 const unsigned char *nonce, unsigned int nonce_length,
+			 const unsigned char *key, unsigned int key_length,
+			 unsigned int direction)
+{
+	unsigned char b[AES_BLOCK_SIZE], s[AES_BLOCK_SIZE], tag[16], hdr[10];
+	unsigned int L = 15 - nonce_length, hlen, k;
+	unsigned long i, n;
+	int enc = direction == ICA_ENCRYPT;
+	struct ccm_mac m;
+	AES_KEY ks;
+	unsigned int rc = 0;
+
+	if (key == NULL || nonce == NULL || !aes_key_ok(key_length)
+	    || nonce_length < 7 || nonce_length > 13
+	    || mac_length < 4 || mac_length > 16 || (mac_length & 1)
+	    || (payload_length && (payload == NULL
+				   || ciphertext_n_mac == NULL))
+	    || (assoc_data_length && assoc_data == NULL)
+	    || (L < 8 && (payload_length >> (8 * L))))
+		return EINVAL;
+
+	sw_spin();
+
+	AES_set_encrypt_key(key, key_length * 8, &ks);
+	memset(&m, 0, sizeof(m));
+	m.ks = &ks;
+
+	/* decrypt first, the MAC is over the plaintext */
+	if (!enc) {
+		memcpy(tag, ciphertext_n_mac + payload_length, mac_length);
+		for (i = 0; i < payload_length; i += n) {
+			n = payload_length - i < AES_BLOCK_SIZE ?
+			    payload_length - i : AES_BLOCK_SIZE;
+			ccm_ctr_block(b, nonce, nonce_length,
+				      i / AES_BLOCK_SIZE + 1);
+			AES_encrypt(b, s, &ks);
+			for (k = 0; k < n; k++)
+				payload[i + k] = ciphertext_n_mac[i + k] ^ s[k];
+		}
+	}
+
+	b[0] = (assoc_data_length ? 0x40 : 0) | ((mac_length - 2) / 2) << 3
+	       | (L - 1);
+	memcpy(b + 1, nonce, nonce_length);
+	for (k = 0, n = payload_length; k < L; k++, n >>= 8)
+		b[15 - k] = n & 0xff;
+	ccm_mac_update(&m, b, AES_BLOCK_SIZE);
+
+	if (assoc_data_length) {
+		if (assoc_data_length < 0xff00) {
+			hlen = 2;
+		} else if (assoc_data_length <= 0xffffffffUL) {
+			hdr[0] = 0xff;
+			hdr[1] = 0xfe;
+			hlen = 6;
+		} else {
+			hdr[0] = 0xff;
+			hdr[1] = 0xff;
+			hlen = 10;
+		}
+		for (k = 0, n = assoc_data_length; k < hlen - (hlen > 2 ? 2 : 0);
+		     k++, n >>= 8)
+			hdr[hlen - 1 - k] = n & 0xff;
+		ccm_mac_update(&m, hdr, hlen);
+		ccm_mac_update(&m, assoc_data, assoc_data_length);
+		ccm_mac_pad(&m);
+	}
+	ccm_mac_update(&m, payload, payload_length);
+	ccm_mac_pad(&m);
+
+	ccm_ctr_block(b, nonce, nonce_length, 0);
+	AES_encrypt(b, s, &ks);
+	for (k = 0; k < mac_length; k++)
+		m.x[k] ^= s[k];
+
+	if (enc) {
+		for (i = 0; i < payload_length; i += n) {
+			n = payload_length - i < AES_BLOCK_SIZE ?
+			    payload_length - i : AES_BLOCK_SIZE;
+			ccm_ctr_block(b, nonce, nonce_length,
+				      i / AES_BLOCK_SIZE + 1);
+			AES_encrypt(b, s, &ks);
+			for (k = 0; k < n; k++)
+				ciphertext_n_mac[i + k] = payload[i + k] ^ s[k];
+		}
+		memcpy(ciphertext_n_mac + payload_length, m.x, mac_length);
+	} else if (CRYPTO_memcmp(tag, m.x, mac_length)) {
+		rc = EFAULT;
+	}
+
+	OPENSSL_cleanse(&ks, sizeof(ks));
+	OPENSSL_cleanse(&m, sizeof(m));
+	return rc;
+}
+
+/*
+ * CMAC (NIST SP 800-38B) over AES and TDES. iv is the CBC-MAC chaining
+ * value of the blocks done so far; the last call gets the rest of the
+ * message, whose last (partial) block is masked with K1 or K2.
+ */
+static void cmac_chain(const unsigned char *msg, unsigned long len,
+		       unsigned char *iv, unsigned int blklen,
+		       void (*block)(const unsigned char *, unsigned char *,
+				     const void *), const void *ks)
+{
+	unsigned int i;
+
+	for (; len; len -= blklen, msg += blklen) {
+		for (i = 0; i < blklen; i++)
+			iv[i] ^= msg[i];
+		block(iv, iv, ks);
+	}
+}
+
+static void cmac_dbl(unsigned char *k, unsigned int blklen)
+{
+	unsigned char carry = k[0] >> 7;
+	unsigned int i;
+
+	for (i = 0; i < blklen - 1; i++)
+		k[i] = k[i] << 1 | k[i + 1] >> 7;
+	k[blklen - 1] = k[blklen - 1] << 1
+			^ (carry ? (blklen == AES_BLOCK_SIZE ? 0x87 : 0x1b) : 0);
+}
+
+static unsigned int cmac_last(const unsigned char *msg, unsigned long len,
+			      unsigned char *mac, unsigned int mac_length,
+			      unsigned char *iv, unsigned int blklen,
+			      void (*block)(const unsigned char *,
+					    unsigned char *, const void *),
+			      const void *ks, unsigned int direction)
+{
+	unsigned char k[AES_BLOCK_SIZE] = { 0 }, last[AES_BLOCK_SIZE];
+	unsigned long n = len ? (len - 1) / blklen * blklen : 0;
+	unsigned int i, r = len - n;
+	unsigned int rc = 0;
+
+	if (mac == NULL || mac_length == 0 || mac_length > blklen)
+		return EINVAL;
+
+	cmac_chain(msg, n, iv, blklen, block, ks);
+	block(k, k, ks);
+	cmac_dbl(k, blklen);
+	memset(last, 0, sizeof(last));
+	memcpy(last, msg + n, r);
+	if (r < blklen) {
+		last[r] = 0x80;
+		cmac_dbl(k, blklen);
+	}
+	for (i = 0; i < blklen; i++)
+		iv[i] ^= last[i] ^ k[i];
+	block(iv, iv, ks);
+
+	if (direction == ICA_ENCRYPT)
+		memcpy(mac, iv, mac_length);
+	else if (CRYPTO_memcmp(mac, iv, mac_length))
+		rc = EFAULT;
+	OPENSSL_cleanse(k, sizeof(k));
+	return rc;
+}
+
+unsigned int ica_aes_cmac_intermediate(const unsigned char *message,
+				       unsigned long message_length,
+				       const unsigned char *key,
+				       unsigned int key_length,
+				       unsigned char *iv)
+{
+	AES_KEY ks;
+
+	if (message == NULL || key == NULL || iv == NULL
+	    || !aes_key_ok(key_length) || message_length % AES_BLOCK_SIZE)
+		return EINVAL;
+
+	sw_spin();
+
+	AES_set_encrypt_key(key, key_length * 8, &ks);
+	cmac_chain(message, message_length, iv, AES_BLOCK_SIZE, aes_block,
+		   &ks);
+	OPENSSL_cleanse(&ks, sizeof(ks));
+	return 0;
+}
+
+unsigned int ica_aes_cmac_last(const unsigned char *message,
+			       unsigned long message_length,
+			       unsigned char *mac, unsigned int mac_length,
+			       const unsigned char *key,
+			       unsigned int key_length, unsigned char *iv,
+			       unsigned int direction)
+{
+	AES_KEY ks;
+	unsigned int rc;
+
+	if ((message == NULL && message_length) || key == NULL || iv == NULL
+	    || !aes_key_ok(key_length))
+		return EINVAL;
+
+	sw_spin();
+
+	AES_set_encrypt_key(key, key_length * 8, &ks);
+	rc = cmac_last(message, message_length, mac, mac_length, iv,
+		       AES_BLOCK_SIZE, aes_block, &ks, direction);
+	OPENSSL_cleanse(&ks, sizeof(ks));
+	return rc;
+}
+
+unsigned int ica_3des_cmac_intermediate(const unsigned char *message,
+					unsigned long message_length,
+					const unsigned char *key,
+					unsigned char *iv)
+{
+	DES_key_schedule ks[3];
+
+	if (message == NULL || key == NULL || iv == NULL
+	    || message_length % sizeof(ica_des_vector_t))
+		return EINVAL;
+
+	sw_spin();
+
+	des_schedule(ks, key, 3);
+	cmac_chain(message, message_length, iv, sizeof(ica_des_vector_t),
+		   tdes_block, ks);
+	OPENSSL_cleanse(ks, sizeof(ks));
+	return 0;
+}
+
+unsigned int ica_3des_cmac_last(const unsigned char *message,
+				unsigned long message_length,
+				unsigned char *mac, unsigned int mac_length,
+				const unsigned char *key, unsigned char *iv,
+				unsigned int direction)
+{
+	DES_key_schedule ks[3];
+	unsigned int rc;
+
+	if ((message == NULL && message_length) || key == NULL || iv == NULL)
+		return EINVAL;
+
+	sw_spin();
+
+	des_schedule(ks, key, 3);
+	rc = cmac_last(message, message_length, mac, mac_length, iv,
+		       sizeof(ica_des_vector_t), tdes_block, ks, direction);
+	OPENSSL_cleanse(ks, sizeof(ks));
+	return rc;
+}
+
+/*
+ * AES-GCM
+ *
+ * icb holds J0, ucb the last counter block used and tag the running
+ * GHASH value. Partial blocks are zero padded, so only the last chunk
+ * of AAD and of the message may have a length that is not a multiple
+ * of the block size - the same restriction libica has.
+ */
+static void gf128_mul(unsigned char *x, const unsigned char *h)
+{
+	uint64_t zh = 0, zl = 0;
+	uint64_t vh = load_be64(h), vl = load_be64(h + 8);
+	uint64_t carry;
+	int i;
+
+	for (i = 0; i < 128; i++) {
+		if (x[i / 8] & (0x80 >> (i % 8))) {
+			zh ^= vh;
+			zl ^= vl;
+		}
+		carry = vl & 1;
+		vl = vl >> 1 | vh << 63;
+		vh >>= 1;
+		if (carry)
+			vh ^= 0xe100000000000000ULL;
+	}
+	store_be64(x, zh);
+	store_be64(x + 8, zl);
+}
+
+static void ghash(unsigned char *y, const unsigned char *h,
+		  const unsigned char *data, unsigned long len)
+{
+	unsigned long i, n;
+
+	while (len) {
+		n = len < AES_BLOCK_SIZE ? len : AES_BLOCK_SIZE;
+		for (i = 0; i < n; i++)
+			y[i] ^= data[i];
+		gf128_mul(y, h);
+		data += n;
+		len -= n;
+	}
+}
+
+static void ctr_inc32(unsigned char *cb)
+{
+	store_be32(cb + 12, load_be32(cb + 12) + 1);
+}
+
+unsigned int ica_aes_gcm_initialize(const unsigned char *iv,
+				    unsigned int iv_length,
+				    unsigned char *key,
+				    unsigned int key_length,
+				    unsigned char *icb,
+				    unsigned char *ucb,
+				    unsigned char *subkey,
+				    unsigned int direction)
+{
+	AES_KEY ks;
+	unsigned char lenblk[AES_BLOCK_SIZE];
+
+	if (iv == NULL || iv_length == 0 || key == NULL || icb == NULL
+	    || ucb == NULL || subkey == NULL || !aes_key_ok(key_length))
+		return EINVAL;
+
+	sw_spin();
+
+	AES_set_encrypt_key(key, key_length * 8, &ks);
+	memset(subkey, 0, AES_BLOCK_SIZE);
+	AES_encrypt(subkey, subkey, &ks);
+
+	memset(icb, 0, AES_BLOCK_SIZE);
+	if (iv_length == 12) {
+		memcpy(icb, iv, iv_length);
+		icb[15] = 1;
+	} else {
+		ghash(icb, subkey, iv, iv_length);
+		memset(lenblk, 0, sizeof(lenblk));
+		store_be64(lenblk + 8, (uint64_t)iv_length * 8);
+		ghash(icb, subkey, lenblk, sizeof(lenblk));
+	}
+	memcpy(ucb, icb, AES_BLOCK_SIZE);
+
+	OPENSSL_cleanse(&ks, sizeof(ks));
+	return 0;
+}
+
+unsigned int ica_aes_gcm_intermediate(unsigned char *plaintext,
+				      unsigned long plaintext_length,
+				      unsigned char *ciphertext,
+				      unsigned char *ucb,
+				      unsigned char *aad,
+				      unsigned long aad_length,
+				      unsigned char *tag,
+				      unsigned int tag_length,
+				      unsigned char *key,
+				      unsigned int key_length,
+				      unsigned char *subkey,
+				      unsigned int direction)
+{
+	AES_KEY ks;
+	unsigned char ks_blk[AES_BLOCK_SIZE];
+	unsigned long i, j, n;
+
+	if (ucb == NULL || tag == NULL || key == NULL || subkey == NULL
+	    || !aes_key_ok(key_length) || tag_length > AES_BLOCK_SIZE
+	    || (aad_length && aad == NULL)
+	    || (plaintext_length && (plaintext == NULL || ciphertext == NULL)))
+		return EINVAL;
+
+	sw_spin();
+
+	if (aad_length)
+		ghash(tag, subkey, aad, aad_length);
+
+	if (!plaintext_length)
+		return 0;
+
+	if (direction != ICA_ENCRYPT)
+		ghash(tag, subkey, ciphertext, plaintext_length);
+
+	AES_set_encrypt_key(key, key_length * 8, &ks);
+	for (i = 0; i < plaintext_length; i += n) {
+		n = plaintext_length - i;
+		if (n > AES_BLOCK_SIZE)
+			n = AES_BLOCK_SIZE;
+		ctr_inc32(ucb);
+		AES_encrypt(ucb, ks_blk, &ks);
+		if (direction == ICA_ENCRYPT) {
+			for (j = 0; j < n; j++)
+				ciphertext[i + j] = plaintext[i + j] ^ ks_blk[j];
+		} else {
+			for (j = 0; j < n; j++)
+				plaintext[i + j] = ciphertext[i + j] ^ ks_blk[j];
+		}
+	}
+
+	if (direction == ICA_ENCRYPT)
+		ghash(tag, subkey, ciphertext, plaintext_length);
+
+	OPENSSL_cleanse(&ks, sizeof(ks));
+	OPENSSL_cleanse(ks_blk, sizeof(ks_blk));
+	return 0;
+}
+
+unsigned int ica_aes_gcm_last(unsigned char *icb,
+			      unsigned long aad_length,
+			      unsigned long ciph_length,
+			      unsigned char *tag,
+			      unsigned char *final_tag,
+			      unsigned int final_tag_length,
+			      unsigned char *key,
+			      unsigned int key_length,
+			      unsigned char *subkey,
+			      unsigned int direction)
+{
+	AES_KEY ks;
+	unsigned char lenblk[AES_BLOCK_SIZE];
+	unsigned char ek0[AES_BLOCK_SIZE];
+	int i;
+
+	if (icb == NULL || tag == NULL || key == NULL || subkey == NULL
+	    || !aes_key_ok(key_length) || final_tag_length > AES_BLOCK_SIZE
+	    || (direction != ICA_ENCRYPT && final_tag == NULL))
+		return EINVAL;
+
+	sw_spin();
+
+	store_be64(lenblk, (uint64_t)aad_length * 8);
+	store_be64(lenblk + 8, (uint64_t)ciph_length * 8);
+	ghash(tag, subkey, lenblk, sizeof(lenblk));
+
+	AES_set_encrypt_key(key, key_length * 8, &ks);
+	AES_encrypt(icb, ek0, &ks);
+	for (i = 0; i < AES_BLOCK_SIZE; i++)
+		tag[i] ^= ek0[i];
+
+	OPENSSL_cleanse(&ks, sizeof(ks));
+	OPENSSL_cleanse(ek0, sizeof(ek0));
+
+	if (direction != ICA_ENCRYPT
+	    && CRYPTO_memcmp(tag, final_tag, final_tag_length))
+		return EFAULT;
+	return 0;
+}